@@ -854,6 +854,79 @@ enum aome_enc_control_id {
   /*!\brief Codec control function to set the path to the film grain parameters
    */
   AV1E_SET_FILM_GRAIN_TABLE,
+
+  /*!\brief Codec control function to set the directory holding the CNN
+   * restoration model files.
+   *
+   * Every *.bin model file in the directory is loaded, and for each frame the
+   * model trained for the nearest QP and the same frame type is used. By
+   * default the built-in qp52 checkpoints are used if they can be found.
+   */
+  AV1E_SET_CNN_MODEL_DIR,
+
+  /*!\brief Codec control function to get how much of the last frame the
+   * CNN restoration ran on, see aom_cnn_mask_stats_t.
+   *
+   * The CNN skips superblocks made only of inter blocks without residual. All
+   * counts are 0 if the last frame was not restored by the CNN.
+   */
+  AV1E_GET_CNN_MASK_STATS,
+
+  /*!\brief Codec control function to get the time spent in each stage of
+   * the CNN restoration, see aom_cnn_stage_times_t.
+   *
+   * The times are summed over all frames encoded so far, so the cost of a
+   * frame is the difference between two calls.
+   */
+  AV1E_GET_CNN_STAGE_TIMES,
+
+  /*!\brief Codec control function to set the time the CNN restoration of a
+   * frame may take, in microseconds.
+   *
+   * Frames the CNN is expected to take longer on, going by the time it took
+   * per restored pixel on the frames before, get the regular in-loop filters
+   * instead. The choice is signalled in the frame header. 0 (the default)
+   * sets no limit.
+   */
+  AV1E_SET_CNN_TIME_BUDGET,
+
+  /*!\brief Codec control function to set the number of layers of the CNN
+   * restoration network to prefer, 0..32.
+   *
+   * Of the models trained for the QP of a frame, the one with the nearest
+   * depth is used. Deeper networks restore better and take longer. The
+   * default, 0, picks the depth by the speed setting: 30 layers for speeds 0
+   * and 1, 25 for 2 and 3, 20 for 4 and 5, and 15 above. The depth is
+   * signalled in the sequence header.
+   */
+  AV1E_SET_CNN_DEPTH,
+
+  /*!\brief Codec control function to set the Unix domain socket of a CNN
+   * inference server (tools/cnn_inference_server) to restore frames with.
+   *
+   * The server restores the frames of all encoders connected to it with one
+   * pool of threads and the models it loaded, in place of those of the
+   * encoder. The decoder still needs the same models. Only available in
+   * builds with CONFIG_CNN_REMOTE. NULL (the default) restores in process.
+   */
+  AV1E_SET_CNN_SERVER,
+
+  /*!\brief Codec control function to set the backend the CNN restoration
+   * runs on, see aom_cnn_backend_t.
+   *
+   * Lets the backends be compared on the same build. Backends the build
+   * lacks are rejected with AOM_CODEC_INCAPABLE.
+   */
+  AV1E_SET_CNN_BACKEND,
+
+  /*!\brief Codec control function to store the activations the CNN
+   * restoration network passes between its hidden layers as bfloat16, 0 or 1.
+   *
+   * bfloat16 halves the memory traffic of the network at a small cost in
+   * quality. As it changes the restored frames, the choice is signalled in
+   * the sequence header. The default is 0.
+   */
+  AV1E_SET_CNN_BF16,
 };
 
 /*!\brief aom 1-D scaling mode
@@ -917,6 +990,31 @@ typedef struct aom_scaling_mode {
   AOM_SCALING_MODE v_scaling_mode; /**< vertical scaling mode   */
 } aom_scaling_mode_t;
 
+/*!\brief  aom CNN restoration mask statistics
+ *
+ * These describe the share of a frame the CNN restoration ran on.
+ *
+ */
+typedef struct aom_cnn_mask_stats {
+  int sb_count;          /**< number of superblocks in the frame */
+  int active_sb_count;   /**< number of superblocks the CNN ran on */
+  int64_t active_pixels; /**< luma pixels of the active superblocks */
+  int64_t pixels;        /**< luma pixels of the frame */
+} aom_cnn_mask_stats_t;
+
+/*!\brief  aom CNN restoration stage times
+ *
+ * Microseconds of wall time spent in each stage of the CNN restoration.
+ *
+ */
+typedef struct aom_cnn_stage_times {
+  int64_t load_us;    /**< loading the models */
+  int64_t prepare_us; /**< copying the input and building the mask */
+  /*! running the network, including writing the restored pixels back */
+  int64_t inference_us;
+  int64_t write_back_us; /**< keeping the output for the next frame */
+} aom_cnn_stage_times_t;
+
 /*!brief AV1 encoder content type */
 typedef enum {
   AOM_CONTENT_DEFAULT,
@@ -931,6 +1029,19 @@ typedef enum {
   AOM_TIMING_DEC_MODEL
 } aom_timing_info_type_t;
 
+/*!brief AV1 encoder CNN restoration backend */
+typedef enum {
+  /*! the server of AV1E_SET_CNN_SERVER if one is set, else the native
+   * backend */
+  AOM_CNN_BACKEND_DEFAULT,
+  AOM_CNN_BACKEND_NATIVE,    /**< the optimized kernels of the decoder */
+  AOM_CNN_BACKEND_REFERENCE, /**< the plain C kernels, for comparison */
+  AOM_CNN_BACKEND_REMOTE,    /**< the server of AV1E_SET_CNN_SERVER */
+  /*! the embedded Python interpreter, which does not match the decoder: the
+   * stream does not use the CNN, the frames are only restored for timing */
+  AOM_CNN_BACKEND_TENSORFLOW
+} aom_cnn_backend_t;
+
 /*!\brief Model tuning parameters
  *
  * Changes the encoder to tune for certain types of input material.
@@ -1162,6 +1273,30 @@ AOM_CTRL_USE_TYPE(AV1E_SET_FILM_GRAIN_TEST_VECTOR, unsigned int)
 AOM_CTRL_USE_TYPE(AV1E_SET_FILM_GRAIN_TABLE, const char *)
 #define AOM_CTRL_AV1E_SET_FILM_GRAIN_TABLE
 
+AOM_CTRL_USE_TYPE(AV1E_SET_CNN_MODEL_DIR, const char *)
+#define AOM_CTRL_AV1E_SET_CNN_MODEL_DIR
+
+AOM_CTRL_USE_TYPE(AV1E_GET_CNN_MASK_STATS, aom_cnn_mask_stats_t *)
+#define AOM_CTRL_AV1E_GET_CNN_MASK_STATS
+
+AOM_CTRL_USE_TYPE(AV1E_GET_CNN_STAGE_TIMES, aom_cnn_stage_times_t *)
+#define AOM_CTRL_AV1E_GET_CNN_STAGE_TIMES
+
+AOM_CTRL_USE_TYPE(AV1E_SET_CNN_TIME_BUDGET, unsigned int)
+#define AOM_CTRL_AV1E_SET_CNN_TIME_BUDGET
+
+AOM_CTRL_USE_TYPE(AV1E_SET_CNN_DEPTH, unsigned int)
+#define AOM_CTRL_AV1E_SET_CNN_DEPTH
+
+AOM_CTRL_USE_TYPE(AV1E_SET_CNN_SERVER, const char *)
+#define AOM_CTRL_AV1E_SET_CNN_SERVER
+
+AOM_CTRL_USE_TYPE(AV1E_SET_CNN_BACKEND, aom_cnn_backend_t)
+#define AOM_CTRL_AV1E_SET_CNN_BACKEND
+
+AOM_CTRL_USE_TYPE(AV1E_SET_CNN_BF16, unsigned int)
+#define AOM_CTRL_AV1E_SET_CNN_BF16
+
 AOM_CTRL_USE_TYPE(AV1E_SET_CDF_UPDATE_MODE, int)
 #define AOM_CTRL_AV1E_SET_CDF_UPDATE_MODE
 
@@ -227,6 +227,13 @@ enum aom_dec_control_id {
    */
   AV1_SET_INSPECTION_CALLBACK,
 
+  /** control function to set the directory the CNN restoration models are
+   * loaded from. The models must be the ones the stream was encoded with
+   * (see AV1E_SET_CNN_MODEL_DIR). By default the built-in model paths are
+   * used.
+   */
+  AV1D_SET_CNN_MODEL_DIR,
+
   AOM_DECODER_CTRL_ID_MAX,
 };
 
@@ -284,6 +291,8 @@ AOM_CTRL_USE_TYPE(AV1D_SET_OUTPUT_ALL_LAYERS, int)
 #define AOM_CTRL_AV1D_SET_OUTPUT_ALL_LAYERS
 AOM_CTRL_USE_TYPE(AV1_SET_INSPECTION_CALLBACK, aom_inspect_init *)
 #define AOM_CTRL_AV1_SET_INSPECTION_CALLBACK
+AOM_CTRL_USE_TYPE(AV1D_SET_CNN_MODEL_DIR, const char *)
+#define AOM_CTRL_AV1D_SET_CNN_MODEL_DIR
 /*!\endcond */
 /*! @} - end defgroup aom_decoder */
 
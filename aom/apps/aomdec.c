@@ -114,6 +114,9 @@ static const arg_def_t oppointarg = ARG_DEF(
     NULL, "oppoint", 1, "Select an operating point of a scalable bitstream");
 static const arg_def_t outallarg = ARG_DEF(
     NULL, "all-layers", 0, "Output all decoded frames of a scalable bitstream");
+static const arg_def_t cnnmodeldirarg =
+    ARG_DEF(NULL, "cnn-model-dir", 1,
+            "Directory containing the CNN restoration model files");
 
 static const arg_def_t *all_args[] = {
   &help,        &codecarg,       &use_yv12,    &use_i420,   &flipuvarg,
@@ -121,7 +124,8 @@ static const arg_def_t *all_args[] = {
   &postprocarg, &summaryarg,     &outputfile,  &threadsarg, &rowmtarg,
   &verbosearg,  &scalearg,       &fb_arg,      &md5arg,     &framestatsarg,
   &continuearg, &outbitdeptharg, &tilem,       &tiler,      &tilec,
-  &isannexb,    &oppointarg,     &outallarg,   NULL
+  &isannexb,    &oppointarg,     &outallarg,   &cnnmodeldirarg,
+  NULL
 };
 
 #if CONFIG_LIBYUV
@@ -515,6 +519,7 @@ static int main_loop(int argc, const char **argv_) {
   int operating_point = 0;
   int output_all_layers = 0;
   unsigned int row_mt = 0;
+  const char *cnn_model_dir = NULL;
   aom_image_t *scaled_img = NULL;
   aom_image_t *img_shifted = NULL;
   int frame_avail, got_data, flush_decoder = 0;
@@ -629,6 +634,8 @@ static int main_loop(int argc, const char **argv_) {
       operating_point = arg_parse_int(&arg);
     } else if (arg_match(&arg, &outallarg, argi)) {
       output_all_layers = 1;
+    } else if (arg_match(&arg, &cnnmodeldirarg, argi)) {
+      cnn_model_dir = arg.val;
     } else {
       argj++;
     }
@@ -773,6 +780,13 @@ static int main_loop(int argc, const char **argv_) {
     fprintf(stderr, "Failed to set row_mt: %s\n", aom_codec_error(&decoder));
     goto fail;
   }
+
+  if (cnn_model_dir &&
+      aom_codec_control(&decoder, AV1D_SET_CNN_MODEL_DIR, cnn_model_dir)) {
+    fprintf(stderr, "Failed to set cnn_model_dir: %s\n",
+            aom_codec_error(&decoder));
+    goto fail;
+  }
 #endif
 
   if (arg_skip) fprintf(stderr, "Skipping first %d frames.\n", arg_skip);
@@ -158,7 +158,8 @@ static const arg_def_t good_dl =
 static const arg_def_t quietarg =
     ARG_DEF("q", "quiet", 0, "Do not print encode progress");
 static const arg_def_t verbosearg =
-    ARG_DEF("v", "verbose", 0, "Show encoder parameters");
+    ARG_DEF("v", "verbose", 0,
+            "Show encoder parameters and per-frame CNN restoration times");
 static const arg_def_t psnrarg =
     ARG_DEF(NULL, "psnr", 0, "Show PSNR in status line");
 #if CONFIG_FILEOPTIONS
@@ -476,6 +477,35 @@ static const arg_def_t film_grain_test =
 static const arg_def_t film_grain_table =
     ARG_DEF(NULL, "film-grain-table", 1,
             "Path to file containing film grain parameters");
+static const arg_def_t cnn_model_dir =
+    ARG_DEF(NULL, "cnn-model-dir", 1,
+            "Directory containing the CNN restoration model files");
+static const arg_def_t cnn_time_budget =
+    ARG_DEF(NULL, "cnn-time-budget", 1,
+            "Microseconds the CNN restoration of a frame may take before the "
+            "regular loop filters are used instead (0: no limit (default))");
+static const arg_def_t cnn_depth =
+    ARG_DEF(NULL, "cnn-depth", 1,
+            "Number of CNN restoration layers to prefer (0: by --cpu-used "
+            "(default), 15, 20, 25, 30)");
+static const arg_def_t cnn_bf16 =
+    ARG_DEF(NULL, "cnn-bf16", 1,
+            "Store the CNN restoration activations as bfloat16 (0: float "
+            "(default), 1: bfloat16)");
+static const arg_def_t cnn_server =
+    ARG_DEF(NULL, "cnn-server", 1,
+            "Socket of a cnn_inference_server to run the CNN restoration on");
+static const struct arg_enum_list cnn_backend_enum[] = {
+  { "default", AOM_CNN_BACKEND_DEFAULT },
+  { "native", AOM_CNN_BACKEND_NATIVE },
+  { "reference", AOM_CNN_BACKEND_REFERENCE },
+  { "remote", AOM_CNN_BACKEND_REMOTE },
+  { "tensorflow", AOM_CNN_BACKEND_TENSORFLOW },
+  { NULL, 0 }
+};
+static const arg_def_t cnn_backend =
+    ARG_DEF_ENUM(NULL, "cnn-backend", 1,
+                 "Backend to run the CNN restoration on:", cnn_backend_enum);
 static const arg_def_t enable_ref_frame_mvs =
     ARG_DEF(NULL, "enable-ref-frame-mvs", 1,
             "Enable temporal mv prediction (default is 1)");
@@ -657,6 +687,12 @@ static const arg_def_t *av1_args[] = { &cpu_used_av1,
                                        &timing_info,
                                        &film_grain_test,
                                        &film_grain_table,
+                                       &cnn_model_dir,
+                                       &cnn_time_budget,
+                                       &cnn_depth,
+                                       &cnn_bf16,
+                                       &cnn_server,
+                                       &cnn_backend,
                                        &enable_ref_frame_mvs,
                                        &bitdeptharg,
                                        &inbitdeptharg,
@@ -709,6 +745,12 @@ static const int av1_arg_ctrl_map[] = { AOME_SET_CPUUSED,
                                         AV1E_SET_TIMING_INFO_TYPE,
                                         AV1E_SET_FILM_GRAIN_TEST_VECTOR,
                                         AV1E_SET_FILM_GRAIN_TABLE,
+                                        AV1E_SET_CNN_MODEL_DIR,
+                                        AV1E_SET_CNN_TIME_BUDGET,
+                                        AV1E_SET_CNN_DEPTH,
+                                        AV1E_SET_CNN_BF16,
+                                        AV1E_SET_CNN_SERVER,
+                                        AV1E_SET_CNN_BACKEND,
                                         AV1E_SET_ENABLE_REF_FRAME_MVS,
                                         AV1E_SET_ENABLE_DF,
                                         AV1E_SET_ENABLE_ORDER_HINT,
@@ -788,6 +830,9 @@ struct stream_config {
   int arg_ctrl_cnt;
   int write_webm;
   const char *film_grain_filename;
+  const char *cnn_model_dir;
+  const char *cnn_server;
+  int cnn_backend;
   int write_ivf;
   // whether to use 16bit internal buffers
   int use_16bit_internal;
@@ -816,6 +861,7 @@ struct stream_state {
   struct aom_image *img;
   aom_codec_ctx_t decoder;
   int mismatch_seen;
+  aom_cnn_stage_times_t cnn_times;
 };
 
 static void validate_positive_rational(const char *msg,
@@ -1062,6 +1108,19 @@ static void set_config_arg_ctrls(struct stream_config *config, int key,
     config->film_grain_filename = arg->val;
     return;
   }
+  if (key == AV1E_SET_CNN_MODEL_DIR) {
+    config->cnn_model_dir = arg->val;
+    return;
+  }
+  if (key == AV1E_SET_CNN_SERVER) {
+    config->cnn_server = arg->val;
+    return;
+  }
+  if (key == AV1E_SET_CNN_BACKEND) {
+    // Set after the server, which the remote backend needs.
+    config->cnn_backend = arg_parse_enum_or_int(arg);
+    return;
+  }
 
   /* Point either to the next free element or the first instance of this
    * control.
@@ -1541,6 +1600,22 @@ static void initialize_encoder(struct stream_state *stream,
     aom_codec_control_(&stream->encoder, AV1E_SET_FILM_GRAIN_TABLE,
                        stream->config.film_grain_filename);
   }
+  if (stream->config.cnn_model_dir) {
+    aom_codec_control_(&stream->encoder, AV1E_SET_CNN_MODEL_DIR,
+                       stream->config.cnn_model_dir);
+    ctx_exit_on_error(&stream->encoder, "Failed to load CNN models");
+  }
+  if (stream->config.cnn_server) {
+    aom_codec_control_(&stream->encoder, AV1E_SET_CNN_SERVER,
+                       stream->config.cnn_server);
+    ctx_exit_on_error(&stream->encoder,
+                      "Failed to connect to the CNN inference server");
+  }
+  if (stream->config.cnn_backend != AOM_CNN_BACKEND_DEFAULT) {
+    aom_codec_control_(&stream->encoder, AV1E_SET_CNN_BACKEND,
+                       stream->config.cnn_backend);
+    ctx_exit_on_error(&stream->encoder, "Failed to set the CNN backend");
+  }
 
 #if CONFIG_AV1_DECODER
   if (global->test_decode != TEST_DECODE_OFF) {
@@ -1562,6 +1637,12 @@ static void initialize_encoder(struct stream_state *stream,
 
       aom_codec_control(&stream->decoder, AV1_SET_DECODE_TILE_COL, -1);
       ctx_exit_on_error(&stream->decoder, "Failed to set decode_tile_col");
+
+      if (stream->config.cnn_model_dir) {
+        aom_codec_control(&stream->decoder, AV1D_SET_CNN_MODEL_DIR,
+                          stream->config.cnn_model_dir);
+        ctx_exit_on_error(&stream->decoder, "Failed to set cnn_model_dir");
+      }
     }
   }
 #endif
@@ -1665,6 +1746,22 @@ static void update_quantizer_histogram(struct stream_state *stream) {
   }
 }
 
+// Prints the time the CNN restoration stages took since the last call.
+static void show_cnn_stage_times(struct stream_state *stream) {
+  aom_cnn_stage_times_t times;
+  if (aom_codec_control(&stream->encoder, AV1E_GET_CNN_STAGE_TIMES, &times) !=
+      AOM_CODEC_OK)
+    return;
+  const aom_cnn_stage_times_t *const last = &stream->cnn_times;
+  // Stages: model load, pre-processing, inference and write-back.
+  fprintf(stderr, " cnn load/prep/net/wb %.1f/%.1f/%.1f/%.1fms",
+          (times.load_us - last->load_us) / 1000.0,
+          (times.prepare_us - last->prepare_us) / 1000.0,
+          (times.inference_us - last->inference_us) / 1000.0,
+          (times.write_back_us - last->write_back_us) / 1000.0);
+  stream->cnn_times = times;
+}
+
 static void get_cx_data(struct stream_state *stream,
                         struct AvxEncoderConfig *global, int *got_data) {
   const aom_codec_cx_pkt_t *pkt;
@@ -1681,8 +1778,10 @@ static void get_cx_data(struct stream_state *stream,
         if (!(pkt->data.frame.flags & AOM_FRAME_IS_FRAGMENT)) {
           stream->frames_out++;
         }
-        if (!global->quiet)
+        if (!global->quiet) {
           fprintf(stderr, " %6luF", (unsigned long)pkt->data.frame.sz);
+          if (global->verbose) show_cnn_stage_times(stream);
+        }
 
         update_rate_histogram(stream->rate_hist, cfg, pkt);
 #if CONFIG_WEBM_IO
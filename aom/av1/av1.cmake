@@ -105,8 +105,6 @@ list(APPEND AOM_AV1_DECODER_SOURCES
             "${AOM_ROOT}/av1/decoder/obu.c")
 
 list(APPEND AOM_AV1_ENCODER_SOURCES
-            "${AOM_ROOT}/av1/encoder/addition_handle_frame.cpp"
-            "${AOM_ROOT}/av1/encoder/addition_handle_frame.h"
             "${AOM_ROOT}/av1/av1_cx_iface.c"
             "${AOM_ROOT}/av1/encoder/aq_complexity.c"
             "${AOM_ROOT}/av1/encoder/aq_complexity.h"
@@ -123,7 +121,6 @@ list(APPEND AOM_AV1_ENCODER_SOURCES
             "${AOM_ROOT}/av1/encoder/bitstream.c"
             "${AOM_ROOT}/av1/encoder/bitstream.h"
             "${AOM_ROOT}/av1/encoder/block.h"
-            "${AOM_ROOT}/av1/encoder/call_tensorflow.cpp"
             "${AOM_ROOT}/av1/encoder/context_tree.c"
             "${AOM_ROOT}/av1/encoder/context_tree.h"
             "${AOM_ROOT}/av1/encoder/corner_detect.c"
@@ -319,6 +316,44 @@ if(CONFIG_INSPECTION)
               "${AOM_ROOT}/av1/decoder/inspection.h")
 endif()
 
+if(CONFIG_CNN_RESTORATION)
+  list(APPEND AOM_AV1_COMMON_SOURCES "${AOM_ROOT}/av1/common/cnn_restoration.c"
+              "${AOM_ROOT}/av1/common/cnn_restoration.h")
+
+  list(APPEND AOM_AV1_COMMON_INTRIN_AVX2
+              "${AOM_ROOT}/av1/common/x86/cnn_restoration_avx2.c")
+
+  list(APPEND AOM_AV1_ENCODER_SOURCES
+              "${AOM_ROOT}/av1/encoder/addition_handle_frame.cpp"
+              "${AOM_ROOT}/av1/encoder/addition_handle_frame.h")
+
+  if(CONFIG_CNN_TENSORFLOW)
+    list(APPEND AOM_AV1_ENCODER_SOURCES
+                "${AOM_ROOT}/av1/encoder/call_tensorflow.cpp"
+                "${AOM_ROOT}/av1/encoder/call_tensorflow.h")
+  endif()
+
+  if(CONFIG_CNN_REMOTE)
+    list(APPEND AOM_AV1_ENCODER_SOURCES "${AOM_ROOT}/av1/encoder/cnn_remote.c"
+                "${AOM_ROOT}/av1/encoder/cnn_remote.h"
+                "${AOM_ROOT}/av1/encoder/cnn_server.c")
+  endif()
+
+  # The CNN output is normative and the C and SIMD kernels must round every
+  # operation alike, so the compiler may neither fuse multiplies into adds nor
+  # keep intermediates in x87 registers.
+  if(NOT MSVC)
+    set(cnn_fp_flags " -ffp-contract=off")
+    if("${AOM_TARGET_CPU}" STREQUAL "x86")
+      set(cnn_fp_flags "${cnn_fp_flags} -msse2 -mfpmath=sse")
+    endif()
+    set_property(SOURCE "${AOM_ROOT}/av1/common/cnn_restoration.c"
+                        "${AOM_ROOT}/av1/common/x86/cnn_restoration_avx2.c"
+                 APPEND_STRING
+                 PROPERTY COMPILE_FLAGS "${cnn_fp_flags}")
+  endif()
+endif()
+
 if(CONFIG_INTERNAL_STATS)
   list(APPEND AOM_AV1_ENCODER_SOURCES "${AOM_ROOT}/av1/encoder/blockiness.c")
 endif()
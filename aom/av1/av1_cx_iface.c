@@ -24,6 +24,9 @@
 #include "av1/av1_iface_common.h"
 #include "av1/encoder/bitstream.h"
 #include "aom_ports/mem_ops.h"
+#if CONFIG_CNN_RESTORATION
+#include "av1/encoder/addition_handle_frame.h"
+#endif  // CONFIG_CNN_RESTORATION
 
 #define MAG_SIZE (4)
 #define MAX_NUM_ENHANCEMENT_LAYERS 3
@@ -85,6 +88,12 @@ struct av1_extracfg {
 
   int film_grain_test_vector;
   const char *film_grain_table_filename;
+  const char *cnn_model_dir;
+  unsigned int cnn_time_budget;
+  unsigned int cnn_depth;
+  unsigned int cnn_bf16;
+  const char *cnn_server;
+  aom_cnn_backend_t cnn_backend;
   unsigned int motion_vector_unit_test;
   unsigned int cdf_update_mode;
   int enable_order_hint;
@@ -151,6 +160,12 @@ static struct av1_extracfg default_extra_cfg = {
   0,                            // s_frame_mode off by default.
   0,                            // film_grain_test_vector
   0,                            // film_grain_table_filename
+  0,                            // cnn_model_dir
+  0,                            // cnn_time_budget
+  0,                            // cnn_depth
+  0,                            // cnn_bf16
+  0,                            // cnn_server
+  AOM_CNN_BACKEND_DEFAULT,      // cnn_backend
   0,                            // motion_vector_unit_test
   1,                            // CDF update mode
   1,                            // frame order hint
@@ -273,6 +288,9 @@ static aom_codec_err_t validate_config(aom_codec_alg_priv_t *ctx,
         "or kf_max_dist instead.");
 
   RANGE_CHECK_HI(extra_cfg, motion_vector_unit_test, 2);
+  RANGE_CHECK_HI(extra_cfg, cnn_depth, 32);
+  RANGE_CHECK_HI(extra_cfg, cnn_bf16, 1);
+  RANGE_CHECK_HI(extra_cfg, cnn_backend, AOM_CNN_BACKEND_TENSORFLOW);
   RANGE_CHECK_HI(extra_cfg, enable_auto_alt_ref, 2);
   RANGE_CHECK_HI(extra_cfg, enable_auto_bwd_ref, 2);
   RANGE_CHECK(extra_cfg, cpu_used, 0, 8);
@@ -612,6 +630,12 @@ static aom_codec_err_t set_encoder_config(
     oxcf->film_grain_test_vector = extra_cfg->film_grain_test_vector;
     oxcf->film_grain_table_filename = extra_cfg->film_grain_table_filename;
   }
+  oxcf->cnn_model_dir = extra_cfg->cnn_model_dir;
+  oxcf->cnn_time_budget = extra_cfg->cnn_time_budget;
+  oxcf->cnn_depth = extra_cfg->cnn_depth;
+  oxcf->cnn_bf16 = extra_cfg->cnn_bf16;
+  oxcf->cnn_server = extra_cfg->cnn_server;
+  oxcf->cnn_backend = extra_cfg->cnn_backend;
   oxcf->large_scale_tile = cfg->large_scale_tile;
   oxcf->single_tile_decoding =
       (oxcf->large_scale_tile) ? extra_cfg->single_tile_decoding : 0;
@@ -735,6 +759,40 @@ static aom_codec_err_t ctrl_get_quantizer64(aom_codec_alg_priv_t *ctx,
   return AOM_CODEC_OK;
 }
 
+static aom_codec_err_t ctrl_get_cnn_mask_stats(aom_codec_alg_priv_t *ctx,
+                                               va_list args) {
+  aom_cnn_mask_stats_t *const arg = va_arg(args, aom_cnn_mask_stats_t *);
+  if (arg == NULL) return AOM_CODEC_INVALID_PARAM;
+#if CONFIG_CNN_RESTORATION
+  const AV1CnnMaskStats *const stats = &ctx->cpi->cnn_mask_stats;
+  arg->sb_count = stats->sb_count;
+  arg->active_sb_count = stats->active_sb_count;
+  arg->active_pixels = stats->active_pixels;
+  arg->pixels = stats->pixels;
+  return AOM_CODEC_OK;
+#else
+  (void)ctx;
+  return AOM_CODEC_INCAPABLE;
+#endif  // CONFIG_CNN_RESTORATION
+}
+
+static aom_codec_err_t ctrl_get_cnn_stage_times(aom_codec_alg_priv_t *ctx,
+                                                va_list args) {
+  aom_cnn_stage_times_t *const arg = va_arg(args, aom_cnn_stage_times_t *);
+  if (arg == NULL) return AOM_CODEC_INVALID_PARAM;
+#if CONFIG_CNN_RESTORATION
+  const AV1_COMP *const cpi = ctx->cpi;
+  arg->load_us = (int64_t)cpi->time_cnn_load;
+  arg->prepare_us = (int64_t)cpi->cnn_sync.time_prepare;
+  arg->inference_us = (int64_t)cpi->cnn_sync.time_inference;
+  arg->write_back_us = (int64_t)cpi->cnn_sync.time_write_back;
+  return AOM_CODEC_OK;
+#else
+  (void)ctx;
+  return AOM_CODEC_INCAPABLE;
+#endif  // CONFIG_CNN_RESTORATION
+}
+
 static aom_codec_err_t update_extra_cfg(aom_codec_alg_priv_t *ctx,
                                         const struct av1_extracfg *extra_cfg) {
   const aom_codec_err_t res = validate_config(ctx, &ctx->cfg, extra_cfg);
@@ -1055,6 +1113,75 @@ static aom_codec_err_t ctrl_set_film_grain_table(aom_codec_alg_priv_t *ctx,
   return update_extra_cfg(ctx, &extra_cfg);
 }
 
+static aom_codec_err_t ctrl_set_cnn_model_dir(aom_codec_alg_priv_t *ctx,
+                                              va_list args) {
+  struct av1_extracfg extra_cfg = ctx->extra_cfg;
+  extra_cfg.cnn_model_dir = CAST(AV1E_SET_CNN_MODEL_DIR, args);
+  const aom_codec_err_t res = update_extra_cfg(ctx, &extra_cfg);
+#if CONFIG_CNN_RESTORATION
+  if (res == AOM_CODEC_OK && addition_num_models(ctx->cpi) == 0)
+    ERROR("No CNN models could be loaded from the model directory");
+#endif  // CONFIG_CNN_RESTORATION
+  return res;
+}
+
+static aom_codec_err_t ctrl_set_cnn_time_budget(aom_codec_alg_priv_t *ctx,
+                                                va_list args) {
+  struct av1_extracfg extra_cfg = ctx->extra_cfg;
+  extra_cfg.cnn_time_budget = CAST(AV1E_SET_CNN_TIME_BUDGET, args);
+  return update_extra_cfg(ctx, &extra_cfg);
+}
+
+static aom_codec_err_t ctrl_set_cnn_depth(aom_codec_alg_priv_t *ctx,
+                                          va_list args) {
+  struct av1_extracfg extra_cfg = ctx->extra_cfg;
+  extra_cfg.cnn_depth = CAST(AV1E_SET_CNN_DEPTH, args);
+  return update_extra_cfg(ctx, &extra_cfg);
+}
+
+static aom_codec_err_t ctrl_set_cnn_bf16(aom_codec_alg_priv_t *ctx,
+                                         va_list args) {
+  struct av1_extracfg extra_cfg = ctx->extra_cfg;
+  extra_cfg.cnn_bf16 = CAST(AV1E_SET_CNN_BF16, args);
+  return update_extra_cfg(ctx, &extra_cfg);
+}
+
+static aom_codec_err_t ctrl_set_cnn_server(aom_codec_alg_priv_t *ctx,
+                                           va_list args) {
+#if CONFIG_CNN_REMOTE
+  struct av1_extracfg extra_cfg = ctx->extra_cfg;
+  extra_cfg.cnn_server = CAST(AV1E_SET_CNN_SERVER, args);
+  const aom_codec_err_t res = update_extra_cfg(ctx, &extra_cfg);
+  if (res == AOM_CODEC_OK && extra_cfg.cnn_server != NULL &&
+      ctx->cpi->cnn_remote == NULL)
+    ERROR("Failed to connect to the CNN inference server");
+  return res;
+#else
+  (void)ctx;
+  (void)args;
+  return AOM_CODEC_INCAPABLE;
+#endif  // CONFIG_CNN_REMOTE
+}
+
+static aom_codec_err_t ctrl_set_cnn_backend(aom_codec_alg_priv_t *ctx,
+                                            va_list args) {
+#if CONFIG_CNN_RESTORATION
+  struct av1_extracfg extra_cfg = ctx->extra_cfg;
+  extra_cfg.cnn_backend = CAST(AV1E_SET_CNN_BACKEND, args);
+  if (extra_cfg.cnn_backend != AOM_CNN_BACKEND_DEFAULT &&
+      addition_get_backend(extra_cfg.cnn_backend) == NULL)
+    return AOM_CODEC_INCAPABLE;
+  const aom_codec_err_t res = update_extra_cfg(ctx, &extra_cfg);
+  if (res == AOM_CODEC_OK && addition_num_models(ctx->cpi) == 0)
+    ERROR("The CNN backend has no models or server to restore with");
+  return res;
+#else
+  (void)ctx;
+  (void)args;
+  return AOM_CODEC_INCAPABLE;
+#endif  // CONFIG_CNN_RESTORATION
+}
+
 static aom_codec_err_t ctrl_set_deltaq_mode(aom_codec_alg_priv_t *ctx,
                                             va_list args) {
   struct av1_extracfg extra_cfg = ctx->extra_cfg;
@@ -1710,6 +1837,12 @@ static aom_codec_ctrl_fn_map_t encoder_ctrl_maps[] = {
   { AV1E_SET_SINGLE_TILE_DECODING, ctrl_set_single_tile_decoding },
   { AV1E_SET_FILM_GRAIN_TEST_VECTOR, ctrl_set_film_grain_test_vector },
   { AV1E_SET_FILM_GRAIN_TABLE, ctrl_set_film_grain_table },
+  { AV1E_SET_CNN_MODEL_DIR, ctrl_set_cnn_model_dir },
+  { AV1E_SET_CNN_TIME_BUDGET, ctrl_set_cnn_time_budget },
+  { AV1E_SET_CNN_DEPTH, ctrl_set_cnn_depth },
+  { AV1E_SET_CNN_BF16, ctrl_set_cnn_bf16 },
+  { AV1E_SET_CNN_SERVER, ctrl_set_cnn_server },
+  { AV1E_SET_CNN_BACKEND, ctrl_set_cnn_backend },
   { AV1E_ENABLE_MOTION_VECTOR_UNIT_TEST, ctrl_enable_motion_vector_unit_test },
 
   // Getters
@@ -1717,6 +1850,8 @@ static aom_codec_ctrl_fn_map_t encoder_ctrl_maps[] = {
   { AOME_GET_LAST_QUANTIZER_64, ctrl_get_quantizer64 },
   { AV1_GET_REFERENCE, ctrl_get_reference },
   { AV1E_GET_ACTIVEMAP, ctrl_get_active_map },
+  { AV1E_GET_CNN_MASK_STATS, ctrl_get_cnn_mask_stats },
+  { AV1E_GET_CNN_STAGE_TIMES, ctrl_get_cnn_stage_times },
   { AV1_GET_NEW_FRAME_IMAGE, ctrl_get_new_frame_image },
   { AV1_COPY_NEW_FRAME_IMAGE, ctrl_copy_new_frame_image },
 
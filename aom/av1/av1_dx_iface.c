@@ -51,6 +51,7 @@ struct aom_codec_alg_priv {
   unsigned int tile_mode;
   unsigned int ext_tile_debug;
   unsigned int row_mt;
+  const char *cnn_model_dir;
   EXTERNAL_REFERENCES ext_refs;
   unsigned int is_annexb;
   int operating_point;
@@ -433,6 +434,9 @@ static aom_codec_err_t init_decoder(aom_codec_alg_priv_t *ctx) {
     frame_worker_data->pbi->output_all_layers = ctx->output_all_layers;
     frame_worker_data->pbi->ext_tile_debug = ctx->ext_tile_debug;
     frame_worker_data->pbi->row_mt = ctx->row_mt;
+#if CONFIG_CNN_RESTORATION
+    frame_worker_data->pbi->cnn_model_dir = ctx->cnn_model_dir;
+#endif  // CONFIG_CNN_RESTORATION
 
     worker->hook = (AVxWorkerHook)frame_worker_hook;
     if (!winterface->reset(worker)) {
@@ -495,6 +499,13 @@ static aom_codec_err_t decode_one(aom_codec_alg_priv_t *ctx,
   frame_worker_data->pbi->ext_tile_debug = ctx->ext_tile_debug;
   frame_worker_data->pbi->row_mt = ctx->row_mt;
   frame_worker_data->pbi->ext_refs = ctx->ext_refs;
+#if CONFIG_CNN_RESTORATION
+  if (frame_worker_data->pbi->cnn_model_dir != ctx->cnn_model_dir) {
+    // Reload the models before the next frame that needs them.
+    frame_worker_data->pbi->cnn_model_dir = ctx->cnn_model_dir;
+    frame_worker_data->pbi->cnn_models_loaded = 0;
+  }
+#endif  // CONFIG_CNN_RESTORATION
 
   frame_worker_data->pbi->common.is_annexb = ctx->is_annexb;
 
@@ -1207,6 +1218,18 @@ static aom_codec_err_t ctrl_set_row_mt(aom_codec_alg_priv_t *ctx,
   return AOM_CODEC_OK;
 }
 
+static aom_codec_err_t ctrl_set_cnn_model_dir(aom_codec_alg_priv_t *ctx,
+                                              va_list args) {
+#if CONFIG_CNN_RESTORATION
+  ctx->cnn_model_dir = va_arg(args, const char *);
+  return AOM_CODEC_OK;
+#else
+  (void)ctx;
+  (void)args;
+  return AOM_CODEC_INCAPABLE;
+#endif  // CONFIG_CNN_RESTORATION
+}
+
 static aom_codec_ctrl_fn_map_t decoder_ctrl_maps[] = {
   { AV1_COPY_REFERENCE, ctrl_copy_reference },
 
@@ -1230,6 +1253,7 @@ static aom_codec_ctrl_fn_map_t decoder_ctrl_maps[] = {
   { AV1D_EXT_TILE_DEBUG, ctrl_ext_tile_debug },
   { AV1D_SET_ROW_MT, ctrl_set_row_mt },
   { AV1D_SET_EXT_REF_PTR, ctrl_set_ext_ref_ptr },
+  { AV1D_SET_CNN_MODEL_DIR, ctrl_set_cnn_model_dir },
 
   // Getters
   { AOMD_GET_FRAME_CORRUPTED, ctrl_get_frame_corrupted },
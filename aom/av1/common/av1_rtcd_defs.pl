@@ -295,6 +295,20 @@ add_proto qw/void av1_selfguided_restoration/, "const uint8_t *dgd8, int width,
                                   int sgr_params_idx, int bit_depth, int highbd";
 specialize qw/av1_selfguided_restoration sse4_1 avx2 neon/;
 
+# CNN_RESTORATION functions
+if (aom_config("CONFIG_CNN_RESTORATION") eq "yes") {
+  add_proto qw/void av1_cnn_convolve_3x3/, "const float *input, int in_stride, int in_channels, float *output, int out_stride, int out_channels, int width, int height, const float *weights, const float *bias, int relu";
+  specialize qw/av1_cnn_convolve_3x3 avx2/;
+  add_proto qw/void av1_cnn_convolve_3x3_int8/, "const uint8_t *input, int in_stride, int in_channels, uint8_t *output, int out_stride, int out_channels, int width, int height, const int8_t *weights, const int32_t *bias, const float *scale";
+  specialize qw/av1_cnn_convolve_3x3_int8 avx2/;
+  add_proto qw/void av1_cnn_winograd_3x3/, "const float *input, int in_stride, int in_channels, float *output, int out_stride, int out_channels, int width, int height, const float *weights, const float *bias, int relu, float *scratch";
+  specialize qw/av1_cnn_winograd_3x3 avx2/;
+  add_proto qw/void av1_cnn_load_bf16/, "const uint16_t *src, float *dst, int n";
+  specialize qw/av1_cnn_load_bf16 avx2/;
+  add_proto qw/void av1_cnn_store_bf16/, "const float *src, uint16_t *dst, int n";
+  specialize qw/av1_cnn_store_bf16 avx2/;
+}
+
 # CONVOLVE_ROUND/COMPOUND_ROUND functions
 
 add_proto qw/void av1_convolve_2d_sr/, "const uint8_t *src, int src_stride, uint8_t *dst, int dst_stride, int w, int h, InterpFilterParams *filter_params_x, InterpFilterParams *filter_params_y, const int subpel_x_q4, const int subpel_y_q4, ConvolveParams *conv_params";
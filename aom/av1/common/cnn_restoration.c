@@ -0,0 +1,1586 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config/aom_config.h"
+#include "config/av1_rtcd.h"
+
+#include "aom_dsp/aom_dsp_common.h"
+#include "aom_mem/aom_mem.h"
+#include "aom_ports/mem.h"
+#include "av1/common/cnn_restoration.h"
+#include "av1/common/onyxc_int.h"
+#include "av1/common/resize.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif  // defined(_WIN32)
+#if HAVE_UNISTD_H
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // HAVE_UNISTD_H
+
+// Models used for intra and inter frames when no model directory is given,
+// relative to the working directory.
+#ifndef CNN_I_MODEL_PATH
+#define CNN_I_MODEL_PATH                         \
+  "MODELS/qp52/VDSR25_qp52_I_set2K+2299_true/" \
+  "VDSR25_qp52_I_set2K+2299_true_364.ckpt.data-00000-of-00001"
+#endif
+#ifndef CNN_B_MODEL_PATH
+#define CNN_B_MODEL_PATH                        \
+  "MODELS/qp52/VDSR25_qp52_B_set2299_noclip/" \
+  "VDSR25_qp52_B_set2299_noclip_252.ckpt.data-00000-of-00001"
+#endif
+
+// QP bucket the default models were trained for.
+#define CNN_DEFAULT_MODEL_QP 52
+
+static int layer_in_channels(int layer, int num_layers) {
+  (void)num_layers;
+  return layer == 0 ? 1 : CNN_CHANNELS;
+}
+
+static int layer_out_channels(int layer, int num_layers) {
+  return layer == num_layers - 1 ? 1 : CNN_CHANNELS;
+}
+
+size_t av1_cnn_model_param_count(int num_layers) {
+  if (num_layers < 2 || num_layers > CNN_MAX_LAYERS) return 0;
+  size_t count = 0;
+  for (int l = 0; l < num_layers; ++l) {
+    const size_t in_ch = layer_in_channels(l, num_layers);
+    const size_t out_ch = layer_out_channels(l, num_layers);
+    count += out_ch + CNN_KERNEL_TAPS * in_ch * out_ch;
+  }
+  return count;
+}
+
+void av1_cnn_model_setup_layers(CnnModel *model, int num_layers) {
+  const float *p = model->params;
+  model->num_layers = num_layers;
+  for (int l = 0; l < num_layers; ++l) {
+    CnnLayer *const layer = &model->layers[l];
+    layer->in_channels = layer_in_channels(l, num_layers);
+    layer->out_channels = layer_out_channels(l, num_layers);
+    // Checkpoint variables are sorted by name, so "conv_NN_b" precedes
+    // "conv_NN_w".
+    layer->bias = p;
+    p += layer->out_channels;
+    layer->weights = p;
+    p += CNN_KERNEL_TAPS * layer->in_channels * layer->out_channels;
+  }
+}
+
+// Reorders the HWIO weights of a layer into the blocked layout.
+static void pack_layer_weights(const float *hwio, float *dst, int in_channels,
+                               int out_channels) {
+  for (int tap = 0; tap < CNN_KERNEL_TAPS; ++tap) {
+    for (int i = 0; i < in_channels; ++i) {
+      for (int o = 0; o < out_channels; ++o) {
+        dst[av1_cnn_weight_index(tap, i, o, in_channels, out_channels)] =
+            hwio[(tap * in_channels + i) * out_channels + o];
+      }
+    }
+  }
+}
+
+int av1_cnn_model_load_ckpt(CnnModel *model, const char *path) {
+  memset(model, 0, sizeof(*model));
+  model->qp = -1;
+
+  FILE *const f = fopen(path, "rb");
+  if (f == NULL) return -1;
+  if (fseek(f, 0, SEEK_END) != 0) {
+    fclose(f);
+    return -1;
+  }
+  const long size = ftell(f);
+  rewind(f);
+  if (size <= 0 || size % sizeof(float) != 0) {
+    fclose(f);
+    return -1;
+  }
+
+  const size_t count = (size_t)size / sizeof(float);
+  int num_layers = 0;
+  for (int l = 2; l <= CNN_MAX_LAYERS; ++l) {
+    if (av1_cnn_model_param_count(l) == count) {
+      num_layers = l;
+      break;
+    }
+  }
+  if (num_layers == 0) {
+    fclose(f);
+    return -1;
+  }
+
+  float *const raw = (float *)aom_malloc(count * sizeof(*raw));
+  model->params = (float *)aom_memalign(32, count * sizeof(float));
+  if (raw == NULL || model->params == NULL ||
+      fread(raw, sizeof(*raw), count, f) != count) {
+    fclose(f);
+    aom_free(raw);
+    av1_cnn_model_free(model);
+    return -1;
+  }
+  fclose(f);
+
+  av1_cnn_model_setup_layers(model, num_layers);
+  const float *src = raw;
+  for (int l = 0; l < num_layers; ++l) {
+    const CnnLayer *const layer = &model->layers[l];
+    const size_t num_weights =
+        (size_t)CNN_KERNEL_TAPS * layer->in_channels * layer->out_channels;
+    memcpy((float *)layer->bias, src, layer->out_channels * sizeof(*src));
+    src += layer->out_channels;
+    pack_layer_weights(src, (float *)layer->weights, layer->in_channels,
+                       layer->out_channels);
+    src += num_weights;
+  }
+  aom_free(raw);
+  return 0;
+}
+
+// Checks that the header describes a supported network whose parameters lie
+// within the file.
+static int check_model_header(const CnnModelFileHeader *hdr, size_t size) {
+  if (hdr->magic != CNN_MODEL_MAGIC || hdr->version < 1 ||
+      hdr->version > CNN_MODEL_VERSION ||
+      hdr->file_size != size || hdr->kernel_size != CNN_KERNEL_SIZE ||
+      hdr->out_block != CNN_OUT_BLOCK || hdr->num_layers < 2 ||
+      hdr->num_layers > CNN_MAX_LAYERS ||
+      hdr->role > CNN_ROLE_CHROMA_INTER) {
+    return -1;
+  }
+  for (uint32_t l = 0; l < hdr->num_layers; ++l) {
+    const CnnModelFileLayer *const layer = &hdr->layers[l];
+    if ((int)layer->in_channels != layer_in_channels(l, hdr->num_layers) ||
+        (int)layer->out_channels != layer_out_channels(l, hdr->num_layers)) {
+      return -1;
+    }
+    const uint64_t weights_size = (uint64_t)CNN_KERNEL_TAPS *
+                                  layer->in_channels * layer->out_channels *
+                                  sizeof(float);
+    const uint64_t bias_size = (uint64_t)layer->out_channels * sizeof(float);
+    if (layer->weights_offset % CNN_MODEL_ALIGN ||
+        layer->bias_offset % CNN_MODEL_ALIGN ||
+        layer->weights_offset + weights_size > size ||
+        layer->bias_offset + bias_size > size) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Returns the table of int8 layer parameters of a checked model file, or NULL
+// for a float model.
+static const CnnModelFileQuantLayer *get_quant_layers(
+    const CnnModelFileHeader *hdr, const uint8_t *data) {
+  if (hdr->version < 2 || hdr->quant_offset == 0) return NULL;
+  return (const CnnModelFileQuantLayer *)(data + hdr->quant_offset);
+}
+
+// Checks that the int8 parameters of a version 2 model file lie within it.
+static int check_quant_layers(const CnnModelFileHeader *hdr, size_t size,
+                              const CnnModelFileQuantLayer *qlayers) {
+  for (uint32_t l = 0; l < hdr->num_layers; ++l) {
+    const CnnModelFileQuantLayer *const qlayer = &qlayers[l];
+    const int in_ch = hdr->layers[l].in_channels;
+    const int out_ch = hdr->layers[l].out_channels;
+    const uint64_t weights_size = av1_cnn_int8_weight_count(in_ch, out_ch);
+    const uint64_t channels_size = (uint64_t)out_ch * sizeof(int32_t);
+    if (qlayer->weights_offset % CNN_MODEL_ALIGN ||
+        qlayer->bias_offset % CNN_MODEL_ALIGN ||
+        qlayer->scale_offset % CNN_MODEL_ALIGN ||
+        qlayer->weights_offset + weights_size > size ||
+        qlayer->bias_offset + channels_size > size ||
+        qlayer->scale_offset + channels_size > size) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Checks that the int8 weights of a quantized model are within
+// +/-CNN_INT8_WEIGHT_MAX. The optimized kernels saturate on larger ones where
+// the C kernels do not, so restoring with them would depend on the CPU.
+static int check_quant_weights(const CnnModel *model) {
+  if (!model->quantized) return 0;
+  for (int l = 0; l < model->num_layers; ++l) {
+    const CnnLayer *const layer = &model->layers[l];
+    const size_t count =
+        av1_cnn_int8_weight_count(layer->in_channels, layer->out_channels);
+    for (size_t i = 0; i < count; ++i) {
+      if (abs(layer->qweights[i]) > CNN_INT8_WEIGHT_MAX) return -1;
+    }
+  }
+  return 0;
+}
+
+static void setup_layers_from_file(CnnModel *model, const uint8_t *data) {
+  const CnnModelFileHeader *const hdr = (const CnnModelFileHeader *)data;
+  model->num_layers = hdr->num_layers;
+  model->qp = hdr->qp;
+  model->role = (CNN_MODEL_ROLE)hdr->role;
+  for (int l = 0; l < model->num_layers; ++l) {
+    const CnnModelFileLayer *const src = &hdr->layers[l];
+    CnnLayer *const layer = &model->layers[l];
+    layer->in_channels = src->in_channels;
+    layer->out_channels = src->out_channels;
+    layer->weights = (const float *)(data + src->weights_offset);
+    layer->bias = (const float *)(data + src->bias_offset);
+  }
+  const CnnModelFileQuantLayer *const qlayers = get_quant_layers(hdr, data);
+  if (qlayers == NULL) return;
+  model->quantized = 1;
+  for (int l = 0; l < model->num_layers; ++l) {
+    CnnLayer *const layer = &model->layers[l];
+    layer->qweights = (const int8_t *)(data + qlayers[l].weights_offset);
+    layer->qbias = (const int32_t *)(data + qlayers[l].bias_offset);
+    layer->qscale = (const float *)(data + qlayers[l].scale_offset);
+  }
+}
+
+int av1_cnn_model_load(CnnModel *model, const char *path) {
+  memset(model, 0, sizeof(*model));
+
+  FILE *const f = fopen(path, "rb");
+  if (f == NULL) return -1;
+  CnnModelFileHeader hdr;
+  const int is_model_file = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+                            hdr.magic == CNN_MODEL_MAGIC;
+  if (!is_model_file) {
+    fclose(f);
+    return av1_cnn_model_load_ckpt(model, path);
+  }
+  if (fseek(f, 0, SEEK_END) != 0) {
+    fclose(f);
+    return -1;
+  }
+  const long size = ftell(f);
+  if (size <= 0 || check_model_header(&hdr, (size_t)size)) {
+    fclose(f);
+    return -1;
+  }
+  if (hdr.version >= 2 && hdr.quant_offset != 0) {
+    CnnModelFileQuantLayer qlayers[CNN_MAX_LAYERS];
+    if (hdr.quant_offset % CNN_MODEL_ALIGN ||
+        hdr.quant_offset + (uint64_t)hdr.num_layers * sizeof(*qlayers) >
+            (uint64_t)size ||
+        fseek(f, hdr.quant_offset, SEEK_SET) != 0 ||
+        fread(qlayers, sizeof(*qlayers), hdr.num_layers, f) !=
+            hdr.num_layers ||
+        check_quant_layers(&hdr, (size_t)size, qlayers)) {
+      fclose(f);
+      return -1;
+    }
+  }
+
+#if HAVE_UNISTD_H
+  fclose(f);
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+  void *const data = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return -1;
+  model->mapping = data;
+  model->mapping_size = (size_t)size;
+  setup_layers_from_file(model, (const uint8_t *)data);
+#else
+  model->params = (float *)aom_memalign(CNN_MODEL_ALIGN, (size_t)size);
+  rewind(f);
+  if (model->params == NULL ||
+      fread(model->params, 1, (size_t)size, f) != (size_t)size) {
+    fclose(f);
+    av1_cnn_model_free(model);
+    return -1;
+  }
+  fclose(f);
+  setup_layers_from_file(model, (const uint8_t *)model->params);
+#endif  // HAVE_UNISTD_H
+  if (check_quant_weights(model)) {
+    av1_cnn_model_free(model);
+    return -1;
+  }
+  return 0;
+}
+
+void av1_cnn_model_free(CnnModel *model) {
+#if HAVE_UNISTD_H
+  if (model->mapping) munmap(model->mapping, model->mapping_size);
+#endif  // HAVE_UNISTD_H
+  aom_free(model->params);
+  aom_free(model->qparams);
+  aom_free(model->wino_params);
+  memset(model, 0, sizeof(*model));
+}
+
+int av1_cnn_registry_add(CnnModelRegistry *registry, const char *path, int qp,
+                         CNN_MODEL_ROLE role) {
+  if (registry->num_models >= CNN_MAX_MODELS) return -1;
+  CnnModel *const model = &registry->models[registry->num_models];
+  if (av1_cnn_model_load(model, path)) return -1;
+  if (av1_cnn_model_set_conv_algo(model, CNN_CONV_WINOGRAD)) {
+    av1_cnn_model_free(model);
+    return -1;
+  }
+  if (qp >= 0) {
+    model->qp = qp;
+    model->role = role;
+  }
+  ++registry->num_models;
+  return 0;
+}
+
+void av1_cnn_registry_set_act_format(CnnModelRegistry *registry,
+                                     CNN_ACT_FORMAT act_format) {
+  for (int i = 0; i < registry->num_models; ++i)
+    registry->models[i].act_format = act_format;
+}
+
+static int has_model_suffix(const char *name) {
+  static const char suffix[] = ".bin";
+  const size_t len = strlen(name);
+  return len >= sizeof(suffix) - 1 &&
+         !strcmp(name + len - (sizeof(suffix) - 1), suffix);
+}
+
+static int add_dir_entry(CnnModelRegistry *registry, const char *dir,
+                         const char *name) {
+  char path[1024];
+  if (!has_model_suffix(name)) return 0;
+  if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+    return -1;
+  return av1_cnn_registry_add(registry, path, -1, CNN_ROLE_INTRA) ? -1 : 1;
+}
+
+int av1_cnn_registry_load_dir(CnnModelRegistry *registry, const char *dir) {
+  const int num_models = registry->num_models;
+  int ret = 0;
+#if defined(_WIN32)
+  char pattern[1024];
+  WIN32_FIND_DATAA data;
+  snprintf(pattern, sizeof(pattern), "%s\\*.bin", dir);
+  const HANDLE find = FindFirstFileA(pattern, &data);
+  if (find == INVALID_HANDLE_VALUE) return 0;
+  do {
+    ret = add_dir_entry(registry, dir, data.cFileName);
+  } while (ret >= 0 && FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR *const d = opendir(dir);
+  if (d == NULL) return -1;
+  const struct dirent *entry;
+  while (ret >= 0 && (entry = readdir(d)) != NULL)
+    ret = add_dir_entry(registry, dir, entry->d_name);
+  closedir(d);
+#endif  // defined(_WIN32)
+  return ret < 0 ? -1 : registry->num_models - num_models;
+}
+
+const CnnModel *av1_cnn_registry_select(const CnnModelRegistry *registry,
+                                        int qp, CNN_MODEL_ROLE role,
+                                        int depth) {
+  const CnnModel *best = NULL;
+  int best_cost = INT_MAX;
+  for (int i = 0; i < registry->num_models; ++i) {
+    const CnnModel *const model = &registry->models[i];
+    if ((model->role ^ role) >> 1) continue;
+    // A model of the other frame type is only used if there is no other
+    // choice, so the penalty exceeds any distance between two quantizers. The
+    // depth only decides between the models of the nearest QP bucket.
+    const int role_cost = ((model->role ^ role) & 1) * 64;
+    const int depth_cost = depth > 0 ? abs(model->num_layers - depth)
+                                     : CNN_MAX_LAYERS - model->num_layers;
+    const int cost =
+        (abs(model->qp - qp) + role_cost) * (CNN_MAX_LAYERS + 1) + depth_cost;
+    if (cost < best_cost) {
+      best = model;
+      best_cost = cost;
+    }
+  }
+  return best;
+}
+
+int av1_cnn_depth_for_speed(int speed) {
+  if (speed <= 1) return 30;
+  if (speed <= 3) return 25;
+  if (speed <= 5) return 20;
+  return 15;
+}
+
+void av1_cnn_registry_free(CnnModelRegistry *registry) {
+  for (int i = 0; i < registry->num_models; ++i)
+    av1_cnn_model_free(&registry->models[i]);
+  registry->num_models = 0;
+}
+
+int av1_cnn_registry_load(CnnModelRegistry *registry, const char *dir) {
+  av1_cnn_registry_free(registry);
+  if (dir != NULL) {
+    if (av1_cnn_registry_load_dir(registry, dir) > 0) return 0;
+  } else if (!av1_cnn_registry_add(registry, CNN_I_MODEL_PATH,
+                                   CNN_DEFAULT_MODEL_QP, CNN_ROLE_INTRA) &&
+             !av1_cnn_registry_add(registry, CNN_B_MODEL_PATH,
+                                   CNN_DEFAULT_MODEL_QP, CNN_ROLE_INTER)) {
+    return 0;
+  }
+  av1_cnn_registry_free(registry);
+  return -1;
+}
+
+int av1_cnn_frame_allowed(const AV1_COMMON *cm, int refresh_frame_flags) {
+  // The CNN stands in for the whole in-loop filter chain, so it is off
+  // wherever the chain is: lossless frames, intra block copy and the large
+  // scale tile mode. It also knows nothing about superres upscaling.
+  // Frames no later frame predicts from are only displayed, and get the much
+  // cheaper regular filters instead.
+  return cm->seq_params.enable_cnn_restoration && refresh_frame_flags != 0 &&
+         !cm->coded_lossless && !cm->allow_intrabc && !cm->large_scale_tile &&
+         !av1_superres_scaled(cm);
+}
+
+int av1_cnn_frame_enabled(const AV1_COMMON *cm, int refresh_frame_flags) {
+  return av1_cnn_frame_allowed(cm, refresh_frame_flags) &&
+         cm->use_cnn_restoration;
+}
+
+int av1_cnn_frame_luma_only(const AV1_COMMON *cm, int refresh_frame_flags) {
+  return av1_cnn_frame_enabled(cm, refresh_frame_flags) &&
+         av1_num_planes(cm) > 1 && !cm->cnn_restore_chroma;
+}
+
+// Maps a qindex to the 0..63 quantizer scale the models are labelled with,
+// like the encoder's av1_qindex_to_quantizer(). The quantizers are 4 qindex
+// steps apart, except the last two, which map to 249 and 255.
+static int qindex_to_qp(int qindex) {
+  if (qindex <= 244) return (qindex + 3) / 4;
+  return qindex <= 249 ? 62 : 63;
+}
+
+int av1_cnn_frame_qp(const AV1_COMMON *cm) {
+  return qindex_to_qp(cm->base_qindex);
+}
+
+const CnnModel *av1_cnn_select_frame_model(const CnnModelRegistry *registry,
+                                           const AV1_COMMON *cm, int plane) {
+  const FRAME_TYPE frame_type = cm->cur_frame->frame_type;
+  const int intra = frame_type == KEY_FRAME || frame_type == INTRA_ONLY_FRAME;
+  const CNN_MODEL_ROLE role =
+      plane > 0 ? (intra ? CNN_ROLE_CHROMA_INTRA : CNN_ROLE_CHROMA_INTER)
+                : (intra ? CNN_ROLE_INTRA : CNN_ROLE_INTER);
+  return av1_cnn_registry_select(registry, av1_cnn_frame_qp(cm), role,
+                                 cm->seq_params.cnn_depth);
+}
+
+// Returns 1 if the prediction of the block copies the pixels of its reference
+// frame unchanged, and there is no residual on top: a single reference at
+// its own size, translated by whole pixels in every plane.
+static int is_copy_block(const AV1_COMMON *cm, const MB_MODE_INFO *mbmi) {
+  if (!is_inter_block(mbmi) || !mbmi->skip || is_intrabc_block(mbmi) ||
+      has_second_ref(mbmi) || is_interintra_mode(mbmi) ||
+      mbmi->motion_mode != SIMPLE_TRANSLATION)
+    return 0;
+  const MV_REFERENCE_FRAME ref = mbmi->ref_frame[0];
+  if (is_global_mv_block(mbmi, cm->global_motion[ref].wmtype) ||
+      av1_is_scaled(&cm->frame_refs[ref - LAST_FRAME].sf))
+    return 0;
+  // The chroma planes move by half the luma vector, in 1/16 pixel units.
+  const int ss = av1_num_planes(cm) > 1
+                     ? AOMMAX(cm->subsampling_x, cm->subsampling_y)
+                     : 0;
+  const int subpel_mask = (8 << ss) - 1;
+  return !(mbmi->mv[0].as_mv.row & subpel_mask) &&
+         !(mbmi->mv[0].as_mv.col & subpel_mask);
+}
+
+int av1_cnn_sb_active(const AV1_COMMON *cm, int mi_row, int mi_col) {
+  const int mi_row_end = AOMMIN(mi_row + cm->seq_params.mib_size, cm->mi_rows);
+  const int mi_col_end = AOMMIN(mi_col + cm->seq_params.mib_size, cm->mi_cols);
+
+  for (int r = mi_row; r < mi_row_end; ++r) {
+    MB_MODE_INFO **const mi_row_grid = cm->mi_grid_visible + r * cm->mi_stride;
+    // The blocks of a row tile it from the superblock edge on, so stepping by
+    // their widths visits each of them once.
+    for (int c = mi_col; c < mi_col_end;) {
+      const MB_MODE_INFO *const mbmi = mi_row_grid[c];
+      if (!is_copy_block(cm, mbmi)) return 1;
+      c += mi_size_wide[mbmi->sb_type];
+    }
+  }
+  return 0;
+}
+
+void av1_cnn_convolve_3x3_c(const float *input, int in_stride, int in_channels,
+                            float *output, int out_stride, int out_channels,
+                            int width, int height, const float *weights,
+                            const float *bias, int relu) {
+  const int block = av1_cnn_out_block(out_channels);
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      float *const out = output + r * out_stride + c * out_channels;
+      for (int o = 0; o < out_channels; ++o) out[o] = bias[o];
+
+      for (int ob = 0; ob < out_channels; ob += block) {
+        const float *w = weights + (size_t)ob * CNN_KERNEL_TAPS * in_channels;
+        for (int ky = 0; ky < CNN_KERNEL_SIZE; ++ky) {
+          for (int kx = 0; kx < CNN_KERNEL_SIZE; ++kx) {
+            const float *const in =
+                input + (r + ky - 1) * in_stride + (c + kx - 1) * in_channels;
+            for (int i = 0; i < in_channels; ++i, w += block) {
+              const float v = in[i];
+              for (int o = 0; o < block; ++o) out[ob + o] += v * w[o];
+            }
+          }
+        }
+      }
+
+      if (relu) {
+        for (int o = 0; o < out_channels; ++o) out[o] = AOMMAX(out[o], 0.0f);
+      }
+    }
+  }
+}
+
+// Winograd F(4x4, 3x3) transforms of one dimension. The input transform
+// (B^T) maps 6 inputs to 6 points and the output transform (A^T) 6 points to
+// 4 outputs. The SIMD versions evaluate every expression in the same order.
+static INLINE void winograd_input_1d(const float *x, int xs, float *y,
+                                     int ys) {
+  const float x0 = x[0], x1 = x[1 * xs], x2 = x[2 * xs];
+  const float x3 = x[3 * xs], x4 = x[4 * xs], x5 = x[5 * xs];
+  const float x34 = x3 + x4, x4m3 = x4 - x3, x4m2 = x4 - x2;
+  y[0 * ys] = (4.0f * x0 - 5.0f * x2) + x4;
+  y[1 * ys] = x34 - 4.0f * (x1 + x2);
+  y[2 * ys] = x4m3 + 4.0f * (x1 - x2);
+  y[3 * ys] = x4m2 + 2.0f * (x3 - x1);
+  y[4 * ys] = x4m2 + 2.0f * (x1 - x3);
+  y[5 * ys] = (4.0f * x1 - 5.0f * x3) + x5;
+}
+
+static INLINE void winograd_output_1d(const float *m, int ms, float *y,
+                                      int ys) {
+  const float a = m[1 * ms] + m[2 * ms], b = m[1 * ms] - m[2 * ms];
+  const float c = m[3 * ms] + m[4 * ms], d = m[3 * ms] - m[4 * ms];
+  y[0 * ys] = m[0] + a + c;
+  y[1 * ys] = b + 2.0f * d;
+  y[2 * ys] = a + 4.0f * c;
+  y[3 * ys] = b + 8.0f * d + m[5 * ms];
+}
+
+// Filter transform (G) of one dimension, mapping 3 taps to 6 points.
+static void winograd_filter_1d(const float *g, int gs, float *y, int ys) {
+  y[0 * ys] = g[0] / 4.0f;
+  y[1 * ys] = -(g[0] + g[gs] + g[2 * gs]) / 6.0f;
+  y[2 * ys] = -(g[0] - g[gs] + g[2 * gs]) / 6.0f;
+  y[3 * ys] = g[0] / 24.0f + g[gs] / 12.0f + g[2 * gs] / 6.0f;
+  y[4 * ys] = g[0] / 24.0f - g[gs] / 12.0f + g[2 * gs] / 6.0f;
+  y[5 * ys] = g[2 * gs];
+}
+
+// Transforms the 6x6 block of inputs around the 4x4 block of outputs at
+// (x, y) into v[point * v_stride + i]. Inputs beyond the row and column past
+// the region, which a direct convolution would not read, count as zero.
+static void winograd_input_tile_c(const float *input, int in_stride,
+                                  int in_channels, int x, int y, int width,
+                                  int height, float *v, int v_stride) {
+  for (int i = 0; i < in_channels; ++i) {
+    float d[6 * 6], t[6 * 6];
+    for (int r = 0; r < 6; ++r) {
+      for (int c = 0; c < 6; ++c) {
+        const int in_y = y + r - 1, in_x = x + c - 1;
+        d[r * 6 + c] = in_y <= height && in_x <= width
+                           ? input[in_y * in_stride + in_x * in_channels + i]
+                           : 0.0f;
+      }
+    }
+    for (int c = 0; c < 6; ++c) winograd_input_1d(d + c, 6, t + c, 6);
+    for (int r = 0; r < 6; ++r) {
+      winograd_input_1d(t + r * 6, 1, v + r * 6 * v_stride + i, v_stride);
+    }
+  }
+}
+
+void av1_cnn_winograd_3x3_c(const float *input, int in_stride,
+                            int in_channels, float *output, int out_stride,
+                            int out_channels, int width, int height,
+                            const float *weights, const float *bias, int relu,
+                            float *scratch) {
+  const int tiles = CNN_WINOGRAD_TILES;
+  const int v_stride = tiles * in_channels;
+  const int m_stride = tiles * out_channels;
+  float *const v = scratch;
+  float *const m = scratch + CNN_WINOGRAD_POINTS * v_stride;
+  assert(in_channels <= CNN_CHANNELS && out_channels <= CNN_CHANNELS);
+
+  for (int y = 0; y < height; y += CNN_WINOGRAD_BLOCK) {
+    for (int x0 = 0; x0 < width; x0 += tiles * CNN_WINOGRAD_BLOCK) {
+      const int n = AOMMIN(tiles, (width - x0 + CNN_WINOGRAD_BLOCK - 1) /
+                                      CNN_WINOGRAD_BLOCK);
+      for (int t = 0; t < n; ++t) {
+        winograd_input_tile_c(input, in_stride, in_channels,
+                              x0 + t * CNN_WINOGRAD_BLOCK, y, width, height,
+                              v + t * in_channels, v_stride);
+      }
+
+      // One small matrix product per point.
+      for (int p = 0; p < CNN_WINOGRAD_POINTS; ++p) {
+        const float *const u = weights + p * in_channels * out_channels;
+        for (int t = 0; t < n; ++t) {
+          const float *const vt = v + p * v_stride + t * in_channels;
+          float *const mt = m + p * m_stride + t * out_channels;
+          for (int o = 0; o < out_channels; ++o) mt[o] = 0.0f;
+          for (int i = 0; i < in_channels; ++i) {
+            const float *const ui = u + i * out_channels;
+            for (int o = 0; o < out_channels; ++o) mt[o] += vt[i] * ui[o];
+          }
+        }
+      }
+
+      for (int t = 0; t < n; ++t) {
+        const int x = x0 + t * CNN_WINOGRAD_BLOCK;
+        const int w = AOMMIN(CNN_WINOGRAD_BLOCK, width - x);
+        const int h = AOMMIN(CNN_WINOGRAD_BLOCK, height - y);
+        for (int o = 0; o < out_channels; ++o) {
+          const float *const mt = m + t * out_channels + o;
+          float s[6 * 4], out[4 * 4];
+          for (int c = 0; c < 6; ++c) {
+            winograd_output_1d(mt + c * m_stride, 6 * m_stride, s + c, 6);
+          }
+          for (int r = 0; r < 4; ++r)
+            winograd_output_1d(s + r * 6, 1, out + r * 4, 1);
+          for (int r = 0; r < h; ++r) {
+            float *const dst =
+                output + (y + r) * out_stride + x * out_channels + o;
+            for (int c = 0; c < w; ++c) {
+              const float val = out[r * 4 + c] + bias[o];
+              dst[c * out_channels] = relu ? AOMMAX(val, 0.0f) : val;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void av1_cnn_load_bf16_c(const uint16_t *src, float *dst, int n) {
+  for (int i = 0; i < n; ++i) {
+    const uint32_t bits = (uint32_t)src[i] << 16;
+    memcpy(&dst[i], &bits, sizeof(bits));
+  }
+}
+
+void av1_cnn_store_bf16_c(const float *src, uint16_t *dst, int n) {
+  for (int i = 0; i < n; ++i) {
+    uint32_t bits;
+    memcpy(&bits, &src[i], sizeof(bits));
+    // Round to nearest even. The activations are never NaN.
+    bits += 0x7fff + ((bits >> 16) & 1);
+    dst[i] = (uint16_t)(bits >> 16);
+  }
+}
+
+// Largest sample value of bit_depth bits. The models see the samples
+// normalized to [0, 1] by it, whatever the bit depth.
+static INLINE int sample_peak(int bit_depth) { return (1 << bit_depth) - 1; }
+
+// Requantizes an int32 accumulator to a uint8 activation.
+static INLINE uint8_t requantize(int32_t acc, float scale) {
+  const float v = (float)acc * scale;
+  if (v <= 0.0f) return 0;
+  if (v >= 255.0f) return 255;
+  return (uint8_t)lrintf(v);
+}
+
+void av1_cnn_convolve_3x3_int8_c(const uint8_t *input, int in_stride,
+                                 int in_channels, uint8_t *output,
+                                 int out_stride, int out_channels, int width,
+                                 int height, const int8_t *weights,
+                                 const int32_t *bias, const float *scale) {
+  const int block = av1_cnn_int8_out_block(out_channels);
+  const int in_ch = (in_channels + 3) & ~3;
+  assert(block <= CNN_CHANNELS);
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      uint8_t *const out = output + r * out_stride + c * out_channels;
+      for (int ob = 0; ob < out_channels; ob += block) {
+        int32_t acc[CNN_CHANNELS];
+        for (int o = 0; o < block; ++o) acc[o] = bias[ob + o];
+        // The weights of the padding channels are zero, so the 4 channels of
+        // a group can be read even past in_channels.
+        const int8_t *w = weights + (size_t)ob * CNN_KERNEL_TAPS * in_ch;
+        for (int ky = 0; ky < CNN_KERNEL_SIZE; ++ky) {
+          for (int kx = 0; kx < CNN_KERNEL_SIZE; ++kx) {
+            const uint8_t *in =
+                input + (r + ky - 1) * in_stride + (c + kx - 1) * in_ch;
+            for (int g = 0; g < in_ch; g += 4, in += 4) {
+              for (int o = 0; o < block; ++o, w += 4) {
+                acc[o] += in[0] * w[0] + in[1] * w[1] + in[2] * w[2] +
+                          in[3] * w[3];
+              }
+            }
+          }
+        }
+        for (int o = 0; o < block; ++o)
+          out[ob + o] = requantize(acc[o], scale[ob + o]);
+      }
+    }
+  }
+}
+
+// Raises act_max to the largest value of the width x height x channels
+// activations at buf.
+static void update_act_max(const float *buf, int stride, int width,
+                           int height, int channels, float *act_max) {
+  float m = *act_max;
+  for (int r = 0; r < height; ++r) {
+    const float *const row = buf + r * stride;
+    for (int i = 0; i < width * channels; ++i) m = AOMMAX(m, row[i]);
+  }
+  *act_max = m;
+}
+
+// Makes *buf hold at least size bytes, keeping it if it already does.
+static int reserve_buf(void **buf, size_t *buf_size, size_t size) {
+  if (size <= *buf_size) return 0;
+  aom_free(*buf);
+  *buf = aom_memalign(32, size);
+  *buf_size = *buf ? size : 0;
+  return *buf ? 0 : -1;
+}
+
+void av1_cnn_workspace_free(CnnWorkspace *ws) {
+  aom_free(ws->in_buf);
+  aom_free(ws->act_buf);
+  aom_free(ws->scratch);
+  aom_free(ws->stage_buf);
+  aom_free(ws->plans);
+  memset(ws, 0, sizeof(*ws));
+}
+
+// The float layers are evaluated depth first: each layer computes
+// CNN_FUSED_ROWS rows at a time, as soon as the rows of the layer before that
+// they read are ready, and only keeps the CNN_WINDOW_ROWS rows the next layer
+// still reads. The activations of a tile thus take a few rows per layer
+// instead of the whole tile per layer, and stay in cache between layers.
+// Winograd layers compute whole blocks, up to CNN_WINOGRAD_BLOCK - 1 rows
+// past those asked for, and keep CNN_WINO_WINDOW_ROWS rows.
+#define CNN_FUSED_ROWS CNN_WINOGRAD_BLOCK
+#define CNN_WINDOW_ROWS (CNN_FUSED_ROWS + 2)
+#define CNN_WINO_WINDOW_ROWS (2 * CNN_WINOGRAD_BLOCK + 1)
+// The windows of a layer only span the columns it is evaluated over, which
+// the halo still widens by a block per Winograd layer. Regions are thus
+// restored in column strips of at most CNN_STRIP_WIDTH pixels, each over its
+// own context, which bounds the windows by the strip rather than the tile.
+// Narrower strips take less memory but compute more of the halo again.
+#define CNN_STRIP_WIDTH 256
+
+static INLINE int align_block(int pos) {
+  return (pos + CNN_WINOGRAD_BLOCK - 1) & ~(CNN_WINOGRAD_BLOCK - 1);
+}
+
+static INLINE int floor_block(int pos) {
+  return pos & ~(CNN_WINOGRAD_BLOCK - 1);
+}
+
+// Width of the row windows and of the input of a ctx_width wide context: the
+// Winograd layers may compute up to the next whole block, and every layer
+// has a zero column on each side.
+static INLINE int padded_width(int ctx_width) {
+  return align_block(ctx_width) + 2;
+}
+
+static INLINE int window_rows(const CnnLayer *layer) {
+  return layer->wino_weights ? CNN_WINO_WINDOW_ROWS : CNN_WINDOW_ROWS;
+}
+
+// Width of the row window of a layer evaluated over columns x0 to x1 of a
+// ctx_width wide context: a zero column left of x0, and the columns up to the
+// end of the last block the next layer may read, which stay zero past x1.
+static INLINE int window_width(int x0, int x1, int ctx_width) {
+  return AOMMIN(x1 + CNN_WINOGRAD_BLOCK - 1, align_block(ctx_width)) - x0 + 2;
+}
+
+// Bytes of the row windows restore_region() keeps for the layers of model,
+// for any region of up to CNN_STRIP_WIDTH columns of a ctx_width wide
+// context.
+static size_t windows_size(const CnnModel *model, int ctx_width) {
+  // The output of the last layer is the residual, which stays float.
+  const int bf16 = model->act_format == CNN_ACT_BF16;
+  const int strip_width = AOMMIN(CNN_STRIP_WIDTH, ctx_width);
+  // Context the layers after the current one read on each side of the strip.
+  int halo = 0;
+  size_t size = 0;
+  for (int l = model->num_layers - 1; l >= 0; --l) {
+    const CnnLayer *const layer = &model->layers[l];
+    const int act_size =
+        bf16 && l < model->num_layers - 1 ? sizeof(uint16_t) : sizeof(float);
+    // build_plan() rounds each side out by up to a block, see window_width().
+    const int width =
+        AOMMIN(padded_width(ctx_width),
+               strip_width + 2 * (halo + CNN_WINOGRAD_BLOCK) + 3);
+    size += (size_t)window_rows(layer) * width * layer->out_channels *
+            act_size;
+    halo += layer->wino_weights ? CNN_WINOGRAD_BLOCK : CNN_KERNEL_SIZE / 2;
+  }
+  return size;
+}
+
+// Number of tile geometries a workspace keeps the plans of. A frame split
+// into tiles has up to 9 geometries per plane size and model depth, for the
+// tiles at its corners, its edges and its inside.
+#define CNN_PLAN_CACHE_SIZE 32
+
+// Part of the context a layer is evaluated over, and the size and place of
+// its row window in the activation buffer of the float models.
+typedef struct CnnPlanLayer {
+  int x0, x1, y0, y1;
+  int stride;
+  int rows;
+  int bf16;
+  size_t offset;
+} CnnPlanLayer;
+
+// What restore_region() works out from the geometry of a tile and the shape
+// of the model before it runs the layers. The weights need no such work:
+// they are packed for the kernels once, when the model is loaded. Models of
+// the same depth and format share their plans.
+typedef struct CnnPlan {
+  // The key of the plan, which last_used sets apart from unused slots.
+  int num_layers;
+  int act_format;
+  int int8;
+  int winograd;
+  int ctx_width, ctx_height;
+  int tile_x, tile_y, width, height;
+  uint64_t last_used;
+  // Bytes of the row windows of the float models.
+  size_t windows_size;
+  CnnPlanLayer layers[CNN_MAX_LAYERS];
+} CnnPlan;
+
+static void build_plan(CnnPlan *plan, const CnnModel *model) {
+  const int last = model->num_layers - 1;
+  // Part of the context the layers after the current one read from it, from
+  // the tile backwards. The context starts at a multiple of
+  // CNN_WINOGRAD_BLOCK of the plane, so the Winograd layers round their part
+  // out to whole blocks of the context, which may end past it.
+  int x0 = plan->tile_x, x1 = plan->tile_x + plan->width;
+  int y0 = plan->tile_y, y1 = plan->tile_y + plan->height;
+  for (int l = last; l >= 0; --l) {
+    CnnPlanLayer *const layer = &plan->layers[l];
+    const int winograd = plan->winograd && model->layers[l].wino_weights;
+    layer->x0 = winograd ? floor_block(x0) : x0;
+    layer->y0 = winograd ? floor_block(y0) : y0;
+    layer->x1 = winograd ? align_block(x1) : x1;
+    layer->y1 = winograd ? align_block(y1) : y1;
+    layer->rows = window_rows(&model->layers[l]);
+    x0 = AOMMAX(layer->x0 - CNN_KERNEL_SIZE / 2, 0);
+    y0 = AOMMAX(layer->y0 - CNN_KERNEL_SIZE / 2, 0);
+    x1 = AOMMIN(layer->x1 + CNN_KERNEL_SIZE / 2, plan->ctx_width);
+    y1 = AOMMIN(layer->y1 + CNN_KERNEL_SIZE / 2, plan->ctx_height);
+  }
+
+  size_t offset = 0;
+  for (int l = 0; l <= last; ++l) {
+    CnnPlanLayer *const layer = &plan->layers[l];
+    layer->stride = window_width(layer->x0, layer->x1, plan->ctx_width) *
+                    model->layers[l].out_channels;
+    // The output of the last layer is the residual, which stays float.
+    layer->bf16 = plan->act_format == CNN_ACT_BF16 && l < last;
+    layer->offset = offset;
+    offset += (size_t)layer->rows * layer->stride *
+              (layer->bf16 ? sizeof(uint16_t) : sizeof(float));
+  }
+  plan->windows_size = plan->int8 ? 0 : offset;
+}
+
+// Returns the plan of restoring the width x height tile at (tile_x, tile_y)
+// of a ctx_width x ctx_height context with model, building it in place of
+// the least recently used one if ws has none. ws->plans must be allocated.
+static const CnnPlan *get_plan(CnnWorkspace *ws, const CnnModel *model,
+                               int int8, int ctx_width, int ctx_height,
+                               int tile_x, int tile_y, int width,
+                               int height) {
+  const int act_format = int8 ? CNN_ACT_FLOAT : model->act_format;
+  const int winograd = !int8 && model->wino_params != NULL;
+  CnnPlan *lru = &ws->plans[0];
+  for (int i = 0; i < CNN_PLAN_CACHE_SIZE; ++i) {
+    CnnPlan *const plan = &ws->plans[i];
+    if (plan->last_used && plan->num_layers == model->num_layers &&
+        plan->act_format == act_format && plan->int8 == int8 &&
+        plan->winograd == winograd &&
+        plan->ctx_width == ctx_width && plan->ctx_height == ctx_height &&
+        plan->tile_x == tile_x && plan->tile_y == tile_y &&
+        plan->width == width && plan->height == height) {
+      plan->last_used = ++ws->plan_clock;
+      return plan;
+    }
+    if (plan->last_used < lru->last_used) lru = plan;
+  }
+  lru->num_layers = model->num_layers;
+  lru->act_format = act_format;
+  lru->int8 = int8;
+  lru->winograd = winograd;
+  lru->ctx_width = ctx_width;
+  lru->ctx_height = ctx_height;
+  lru->tile_x = tile_x;
+  lru->tile_y = tile_y;
+  lru->width = width;
+  lru->height = height;
+  build_plan(lru, model);
+  lru->last_used = ++ws->plan_clock;
+  ws->plans_built++;
+  return lru;
+}
+
+// Makes ws hold the buffers of the int8 or the float version of
+// restore_region() over a ctx_width x ctx_height context.
+static int reserve_workspace(CnnWorkspace *ws, const CnnModel *model,
+                             int ctx_width, int ctx_height, int int8) {
+  const int padded_w = padded_width(ctx_width);
+  const size_t padded_size = (size_t)padded_w * padded_width(ctx_height);
+  if (ws->plans == NULL) {
+    ws->plans =
+        (CnnPlan *)aom_calloc(CNN_PLAN_CACHE_SIZE, sizeof(*ws->plans));
+    if (ws->plans == NULL) return -1;
+  }
+  if (int8) {
+    return reserve_buf(&ws->in_buf, &ws->in_size, padded_size * 4) ||
+                   reserve_buf(&ws->act_buf, &ws->act_size,
+                               2 * padded_size * CNN_CHANNELS)
+               ? -1
+               : 0;
+  }
+  if (reserve_buf(&ws->in_buf, &ws->in_size, padded_size * sizeof(float)) ||
+      reserve_buf(&ws->act_buf, &ws->act_size, windows_size(model, ctx_width)))
+    return -1;
+  if (model->wino_params && ws->scratch == NULL) {
+    ws->scratch =
+        (float *)aom_memalign(32, CNN_WINOGRAD_SCRATCH_SIZE * sizeof(float));
+    if (ws->scratch == NULL) return -1;
+  }
+  if (model->act_format == CNN_ACT_BF16) {
+    const size_t stage_size = (CNN_WINDOW_ROWS + CNN_FUSED_ROWS) *
+                              (size_t)padded_w * CNN_CHANNELS * sizeof(float);
+    if (reserve_buf((void **)&ws->stage_buf, &ws->stage_size, stage_size))
+      return -1;
+  }
+  return 0;
+}
+
+int av1_cnn_workspace_reserve(CnnWorkspace *ws, const CnnModel *model,
+                              int ctx_width, int ctx_height) {
+  // The regions are restored in strips, see CNN_STRIP_WIDTH.
+  ctx_width = av1_cnn_context_size(model, CNN_STRIP_WIDTH, ctx_width);
+  return reserve_workspace(ws, model, ctx_width, ctx_height, model->quantized);
+}
+
+// Int8 version of restore_region() for quantized models. The activations are
+// stored as uint8 with (in_channels + 3) & ~3 channels per pixel.
+static int restore_region_int8(const CnnModel *model, const uint8_t *src,
+                               int src_stride, uint8_t *dst, int dst_stride,
+                               int ctx_width, int ctx_height, int tile_x,
+                               int tile_y, int width, int height, int highbd,
+                               int bit_depth, CnnWorkspace *ws) {
+  const int padded_w = ctx_width + 2;
+  const size_t padded_size = (size_t)padded_w * (ctx_height + 2);
+  const size_t act_size = padded_size * CNN_CHANNELS;
+  if (reserve_workspace(ws, model, ctx_width, ctx_height, 1)) return -1;
+  const CnnPlan *const plan = get_plan(ws, model, 1, ctx_width, ctx_height,
+                                       tile_x, tile_y, width, height);
+  // Whatever no layer writes reads as zero.
+  uint8_t *const in_buf = (uint8_t *)ws->in_buf;
+  uint8_t *act[2];
+  act[0] = (uint8_t *)ws->act_buf;
+  act[1] = act[0] + act_size;
+  memset(in_buf, 0, padded_size * 4);
+  memset(act[0], 0, 2 * act_size);
+
+  // The input layer sees the pixels scaled to 8 bits, padded to 4 channels.
+  const int peak = sample_peak(bit_depth);
+  for (int r = 0; r < ctx_height; ++r) {
+    uint8_t *const d = in_buf + ((r + 1) * padded_w + 1) * 4;
+    if (highbd) {
+      const uint16_t *const s = CONVERT_TO_SHORTPTR(src) + r * src_stride;
+      for (int c = 0; c < ctx_width; ++c)
+        d[4 * c] = (s[c] * 255 + (peak >> 1)) / peak;
+    } else {
+      const uint8_t *const s = src + r * src_stride;
+      for (int c = 0; c < ctx_width; ++c) d[4 * c] = s[c];
+    }
+  }
+
+  const int last = model->num_layers - 1;
+  const uint8_t *in = in_buf + (padded_w + 1) * 4;
+  int in_stride = padded_w * 4;
+  for (int l = 0; l < last; ++l) {
+    const CnnLayer *const layer = &model->layers[l];
+    const int in_ch = (layer->in_channels + 3) & ~3;
+    const int x0 = plan->layers[l].x0;
+    const int y0 = plan->layers[l].y0;
+    const int x1 = plan->layers[l].x1;
+    const int y1 = plan->layers[l].y1;
+    const int out_stride = padded_w * layer->out_channels;
+    uint8_t *const out = act[l & 1] + out_stride + layer->out_channels;
+    (model->reference ? av1_cnn_convolve_3x3_int8_c
+                      : av1_cnn_convolve_3x3_int8)(
+        in + y0 * in_stride + x0 * in_ch, in_stride, layer->in_channels,
+        out + y0 * out_stride + x0 * layer->out_channels, out_stride,
+        layer->out_channels, x1 - x0, y1 - y0, layer->qweights, layer->qbias,
+        layer->qscale);
+    in = out;
+    in_stride = out_stride;
+  }
+
+  // The reconstruction layer scales its single output channel to the
+  // residual in pixels, which is added to the samples at full precision.
+  const CnnLayer *const layer = &model->layers[last];
+  const int in_ch = (layer->in_channels + 3) & ~3;
+  const float res_scale = layer->qscale[0] * ((float)peak / 255.0f);
+  for (int r = 0; r < height; ++r) {
+    const uint8_t *const s =
+        in_buf + ((tile_y + r + 1) * padded_w + tile_x + 1) * 4;
+    const uint16_t *const s16 =
+        highbd ? CONVERT_TO_SHORTPTR(src) + (tile_y + r) * src_stride + tile_x
+               : NULL;
+    for (int c = 0; c < width; ++c) {
+      int32_t acc = layer->qbias[0];
+      for (int tap = 0; tap < CNN_KERNEL_TAPS; ++tap) {
+        const int ky = tap / CNN_KERNEL_SIZE;
+        const int kx = tap % CNN_KERNEL_SIZE;
+        const uint8_t *const a = in + (tile_y + r + ky - 1) * in_stride +
+                                 (tile_x + c + kx - 1) * in_ch;
+        const int8_t *const w = layer->qweights + tap * in_ch;
+        for (int i = 0; i < layer->in_channels; ++i) acc += a[i] * w[i];
+      }
+      const int res = (int)lrintf((float)acc * res_scale);
+      if (highbd) {
+        const int v = clamp(s16[c] + res, 0, peak);
+        CONVERT_TO_SHORTPTR(dst)[r * dst_stride + c] = v;
+      } else {
+        dst[r * dst_stride + c] = clamp(s[4 * c] + res, 0, 255);
+      }
+    }
+  }
+  return 0;
+}
+
+// Output rows of one layer. Rows and columns are relative to the context.
+typedef struct CnnRowWindow {
+  // rows rows of the columns window_width() gives, from column x0 - 1 on.
+  // Rows and columns never computed stay zero. The activations are floats, or
+  // bfloat16 for the hidden layers of CNN_ACT_BF16 models.
+  void *buf;
+  // Distance between rows, in activations.
+  int stride;
+  int rows;
+  int bf16;
+  // Row held in the first buffer row.
+  int first;
+  // Next row to compute.
+  int next;
+  // Part of the context the layer is evaluated over.
+  int x0, x1, y0, y1;
+} CnnRowWindow;
+
+typedef struct CnnFusedContext {
+  const CnnModel *model;
+  // Size of the context. What the Winograd layers compute past it is reset
+  // to zero, as if the context were the whole plane.
+  int width;
+  int height;
+  // Normalized input, with a one pixel border of zeros.
+  const float *in_buf;
+  int in_stride;
+  CnnRowWindow windows[CNN_MAX_LAYERS];
+  float *scratch;
+  // Float copies of the input and output rows of a chunk of a layer whose
+  // windows hold bfloat16, with the strides of the windows.
+  float *stage_in;
+  float *stage_out;
+  float *act_max;
+} CnnFusedContext;
+
+// Returns the activation at offset in row of the window.
+static INLINE void *window_at(const CnnRowWindow *window, int row,
+                              int offset) {
+  const size_t index = (size_t)(row - window->first) * window->stride + offset;
+  return window->bf16 ? (void *)((uint16_t *)window->buf + index)
+                      : (void *)((float *)window->buf + index);
+}
+
+// Drops the rows of the window above row first, keeping the others.
+static void slide_window(CnnRowWindow *window, int first) {
+  const int shift = first - window->first;
+  assert(shift >= 0);
+  if (shift == 0) return;
+  const int keep = AOMMAX(window->rows - shift, 0);
+  const size_t row_size =
+      window->stride * (window->bf16 ? sizeof(uint16_t) : sizeof(float));
+  uint8_t *const buf = (uint8_t *)window->buf;
+  memmove(buf, buf + (window->rows - keep) * row_size, keep * row_size);
+  memset(buf + keep * row_size, 0, (window->rows - keep) * row_size);
+  window->first = first;
+}
+
+// Zeroes the outputs of rows y to y_end of a window that lie past the
+// context, starting at out, the output at (x0, y).
+static void clear_past_context(const CnnFusedContext *ctx,
+                               const CnnRowWindow *window, float *out, int y,
+                               int y_end, int channels) {
+  const int x0 = window->x0, x1 = window->x1;
+  for (int r = y; r < y_end; ++r) {
+    float *const row = out + (r - y) * window->stride;
+    if (r >= ctx->height) {
+      memset(row, 0, (x1 - x0) * channels * sizeof(*row));
+    } else if (x1 > ctx->width) {
+      memset(row + (ctx->width - x0) * channels, 0,
+             (x1 - ctx->width) * channels * sizeof(*row));
+    }
+  }
+}
+
+// Computes layer l up to row end, first computing the rows of the layers
+// before it that each chunk of CNN_FUSED_ROWS rows reads.
+static void compute_layer_rows(CnnFusedContext *ctx, int l, int end) {
+  const CnnModel *const model = ctx->model;
+  const CnnLayer *const layer = &model->layers[l];
+  CnnRowWindow *const window = &ctx->windows[l];
+  const int last = l == model->num_layers - 1;
+  const int width = window->x1 - window->x0;
+  // Winograd layers only compute whole blocks.
+  if (layer->wino_weights) end = align_block(end);
+  end = AOMMIN(end, window->y1);
+  while (window->next < end) {
+    const int y = window->next;
+    const int chunk_end = AOMMIN(y + CNN_FUSED_ROWS, end);
+    const float *in;
+    int in_stride;
+    if (l == 0) {
+      in_stride = ctx->in_stride;
+      in = ctx->in_buf + (y + 1) * in_stride + window->x0 + 1;
+    } else {
+      // The chunk reads one more row of the layer before on each side, and
+      // no row above that any more. The rows above may have to be computed
+      // first all the same, when they share a block with the first row read.
+      CnnRowWindow *const prev = &ctx->windows[l - 1];
+      compute_layer_rows(ctx, l - 1, y);
+      slide_window(prev, y - 1);
+      compute_layer_rows(ctx, l - 1, chunk_end + 1);
+      in_stride = prev->stride;
+      const int offset = (window->x0 - prev->x0 + 1) * layer->in_channels;
+      if (prev->bf16) {
+        // The rows the chunk reads, from one column left of it to one column
+        // right of it.
+        const int left = offset - layer->in_channels;
+        for (int r = y - 1; r <= chunk_end; ++r) {
+          (model->reference ? av1_cnn_load_bf16_c : av1_cnn_load_bf16)(
+              (const uint16_t *)window_at(prev, r, left),
+              ctx->stage_in + (r - y + 1) * in_stride + left,
+              (width + 2) * layer->in_channels);
+        }
+        in = ctx->stage_in + in_stride + offset;
+      } else {
+        in = (const float *)window_at(prev, y, offset);
+      }
+    }
+
+    assert(chunk_end - window->first <= window->rows);
+    const int offset = layer->out_channels;
+    float *const out = window->bf16 ? ctx->stage_out + offset
+                                    : (float *)window_at(window, y, offset);
+    if (layer->wino_weights) {
+      assert(y % CNN_WINOGRAD_BLOCK == 0 && chunk_end - y == CNN_FUSED_ROWS);
+      (model->reference ? av1_cnn_winograd_3x3_c : av1_cnn_winograd_3x3)(
+          in, in_stride, layer->in_channels, out, window->stride,
+          layer->out_channels, width, chunk_end - y, layer->wino_weights,
+          layer->bias, !last, ctx->scratch);
+      clear_past_context(ctx, window, out, y, chunk_end, layer->out_channels);
+    } else {
+      (model->reference ? av1_cnn_convolve_3x3_c : av1_cnn_convolve_3x3)(
+          in, in_stride, layer->in_channels, out, window->stride,
+          layer->out_channels, width, chunk_end - y, layer->weights,
+          layer->bias, !last);
+    }
+    if (ctx->act_max != NULL && !last) {
+      update_act_max(out, window->stride, width, chunk_end - y,
+                     layer->out_channels, &ctx->act_max[l]);
+    }
+    if (window->bf16) {
+      for (int r = y; r < chunk_end; ++r) {
+        (model->reference ? av1_cnn_store_bf16_c : av1_cnn_store_bf16)(
+            out + (r - y) * window->stride,
+            (uint16_t *)window_at(window, r, offset),
+            width * layer->out_channels);
+      }
+    }
+    window->next = chunk_end;
+  }
+}
+
+// Runs the model over the ctx_width x ctx_height region at src, which starts
+// at a multiple of CNN_WINOGRAD_BLOCK of the plane, and writes the restored
+// width x height tile found at (tile_x, tile_y) inside it to dst. Each layer
+// is only evaluated where the following layers still need it, so the context
+// costs less and less work per layer. Quantized models run
+// restore_region_int8() unless act_max is given, in which case the float
+// model runs and the largest output of each hidden layer l is kept in
+// act_max[l]. The buffers are taken from ws.
+static int restore_region(const CnnModel *model, const uint8_t *src,
+                          int src_stride, uint8_t *dst, int dst_stride,
+                          int ctx_width, int ctx_height, int tile_x,
+                          int tile_y, int width, int height, int highbd,
+                          int bit_depth, float *act_max, CnnWorkspace *ws) {
+  assert(model->num_layers >= 2);
+  assert(highbd || bit_depth == 8);
+  if (model->quantized && act_max == NULL) {
+    return restore_region_int8(model, src, src_stride, dst, dst_stride,
+                               ctx_width, ctx_height, tile_x, tile_y, width,
+                               height, highbd, bit_depth, ws);
+  }
+  // The input and every window carry a one pixel border of zeros, which
+  // gives the "SAME" padding of each layer at the borders of the context for
+  // free.
+  const int padded_w = padded_width(ctx_width);
+  const size_t padded_size = (size_t)padded_w * padded_width(ctx_height);
+  const int bf16 = model->act_format == CNN_ACT_BF16;
+  const size_t stage_stride = (size_t)padded_w * CNN_CHANNELS;
+  if (reserve_workspace(ws, model, ctx_width, ctx_height, 0)) return -1;
+  const CnnPlan *const plan = get_plan(ws, model, 0, ctx_width, ctx_height,
+                                       tile_x, tile_y, width, height);
+  // Wider regions than the strips windows_size() allows for take more.
+  if (reserve_buf(&ws->act_buf, &ws->act_size, plan->windows_size)) return -1;
+  float *const in_buf = (float *)ws->in_buf;
+  uint8_t *const windows_buf = (uint8_t *)ws->act_buf;
+  float *const scratch = ws->scratch;
+  float *const stage_buf = ws->stage_buf;
+  memset(in_buf, 0, padded_size * sizeof(*in_buf));
+  memset(windows_buf, 0, plan->windows_size);
+
+  const float peak = (float)sample_peak(bit_depth);
+  const float scale = 1.0f / peak;
+  if (highbd) {
+    const uint16_t *s = CONVERT_TO_SHORTPTR(src);
+    for (int r = 0; r < ctx_height; ++r, s += src_stride) {
+      float *const d = in_buf + (r + 1) * padded_w + 1;
+      for (int c = 0; c < ctx_width; ++c) d[c] = s[c] * scale;
+    }
+  } else {
+    const uint8_t *s = src;
+    for (int r = 0; r < ctx_height; ++r, s += src_stride) {
+      float *const d = in_buf + (r + 1) * padded_w + 1;
+      for (int c = 0; c < ctx_width; ++c) d[c] = s[c] * scale;
+    }
+  }
+
+  CnnFusedContext ctx;
+  ctx.model = model;
+  ctx.width = ctx_width;
+  ctx.height = ctx_height;
+  ctx.in_buf = in_buf;
+  ctx.in_stride = padded_w;
+  ctx.scratch = scratch;
+  ctx.stage_in = stage_buf;
+  ctx.stage_out = bf16 ? stage_buf + CNN_WINDOW_ROWS * stage_stride : NULL;
+  ctx.act_max = act_max;
+  for (int l = 0; l < model->num_layers; ++l) {
+    const CnnPlanLayer *const layer = &plan->layers[l];
+    CnnRowWindow *const window = &ctx.windows[l];
+    assert(model->layers[l].out_channels <= CNN_CHANNELS);
+    window->x0 = layer->x0;
+    window->y0 = layer->y0;
+    window->x1 = layer->x1;
+    window->y1 = layer->y1;
+    window->buf = windows_buf + layer->offset;
+    window->stride = layer->stride;
+    window->rows = layer->rows;
+    window->bf16 = layer->bf16;
+    window->first = window->y0 - 1;
+    window->next = window->y0;
+  }
+
+  // The last layer predicts the residual of the normalized input.
+  CnnRowWindow *const res_window = &ctx.windows[model->num_layers - 1];
+  for (int r = 0; r < height; ++r) {
+    const int y = tile_y + r;
+    if (y >= res_window->next) {
+      slide_window(res_window, y);
+      compute_layer_rows(&ctx, model->num_layers - 1, y + CNN_FUSED_ROWS);
+    }
+    const float *const res =
+        (const float *)window_at(res_window, y, tile_x - res_window->x0 + 1);
+    const float *const s = in_buf + (y + 1) * padded_w + tile_x + 1;
+    if (highbd) {
+      uint16_t *const d = CONVERT_TO_SHORTPTR(dst) + r * dst_stride;
+      for (int c = 0; c < width; ++c) {
+        const float v = AOMMIN(AOMMAX(res[c] + s[c], 0.0f), 1.0f);
+        d[c] = (uint16_t)(v * peak + 0.5f);
+      }
+    } else {
+      uint8_t *const d = dst + r * dst_stride;
+      for (int c = 0; c < width; ++c) {
+        const float v = AOMMIN(AOMMAX(res[c] + s[c], 0.0f), 1.0f);
+        d[c] = (uint8_t)(v * peak + 0.5f);
+      }
+    }
+  }
+  return 0;
+}
+
+int av1_cnn_restore_plane(const CnnModel *model, uint8_t *buf, int width,
+                          int height, int stride, int highbd, int bit_depth) {
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  // The whole region is converted to floats before anything is written, so
+  // it can be restored in place.
+  const int ret = restore_region(model, buf, stride, buf, stride, width,
+                                 height, 0, 0, width, height, highbd,
+                                 bit_depth, NULL, &ws);
+  av1_cnn_workspace_free(&ws);
+  return ret;
+}
+
+// Sets *ctx to the context restore_region() takes for region of a
+// plane_width x plane_height plane: the region and av1_cnn_model_halo()
+// pixels around it, from a multiple of CNN_WINOGRAD_BLOCK on.
+static void region_context(const CnnModel *model, const CnnRegion *region,
+                           int plane_width, int plane_height, CnnRegion *ctx) {
+  const int halo = av1_cnn_model_halo(model);
+  ctx->x = floor_block(AOMMAX(region->x - halo, 0));
+  ctx->y = floor_block(AOMMAX(region->y - halo, 0));
+  ctx->width = AOMMIN(region->x + region->width + halo, plane_width) - ctx->x;
+  ctx->height =
+      AOMMIN(region->y + region->height + halo, plane_height) - ctx->y;
+}
+
+// Sets *strip to the column strip of region that starts at column x, see
+// CNN_STRIP_WIDTH.
+static void region_strip(const CnnRegion *region, int x, CnnRegion *strip) {
+  strip->x = x;
+  strip->y = region->y;
+  strip->width = AOMMIN(CNN_STRIP_WIDTH, region->x + region->width - x);
+  strip->height = region->height;
+}
+
+int64_t av1_cnn_regions_context_area(const CnnModel *model,
+                                     const CnnRegion *regions, int num_regions,
+                                     int plane_width, int plane_height) {
+  int64_t area = 0;
+  for (int i = 0; i < num_regions; ++i) {
+    const CnnRegion *const region = &regions[i];
+    for (int x = region->x; x < region->x + region->width;
+         x += CNN_STRIP_WIDTH) {
+      CnnRegion strip, ctx;
+      region_strip(region, x, &strip);
+      region_context(model, &strip, plane_width, plane_height, &ctx);
+      area += (int64_t)ctx.width * ctx.height;
+    }
+  }
+  return area;
+}
+
+int av1_cnn_restore_regions(const CnnModel *model, const uint8_t *src,
+                            int src_stride, uint8_t *dst, int dst_stride,
+                            int plane_width, int plane_height,
+                            const CnnRegion *regions, int num_regions,
+                            int highbd, int bit_depth, CnnWorkspace *ws) {
+  for (int i = 0; i < num_regions; ++i) {
+    const CnnRegion *const region = &regions[i];
+    for (int x = region->x; x < region->x + region->width;
+         x += CNN_STRIP_WIDTH) {
+      CnnRegion strip, ctx;
+      region_strip(region, x, &strip);
+      region_context(model, &strip, plane_width, plane_height, &ctx);
+      ws->context_area += (int64_t)ctx.width * ctx.height;
+      // For 16-bit planes src and dst are CONVERT_TO_BYTEPTR() aliases, so
+      // the sample offsets can be applied to them directly.
+      if (restore_region(model, src + ctx.y * src_stride + ctx.x, src_stride,
+                         dst + strip.y * dst_stride + strip.x, dst_stride,
+                         ctx.width, ctx.height, strip.x - ctx.x,
+                         strip.y - ctx.y, strip.width, strip.height, highbd,
+                         bit_depth, NULL, ws))
+        return -1;
+    }
+  }
+  return 0;
+}
+
+int av1_cnn_restore_region(const CnnModel *model, const uint8_t *src,
+                           int src_stride, uint8_t *dst, int dst_stride,
+                           int plane_width, int plane_height, int x, int y,
+                           int width, int height, int highbd,
+                           int bit_depth) {
+  const CnnRegion region = { x, y, width, height };
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  const int ret = av1_cnn_restore_regions(model, src, src_stride, dst,
+                                          dst_stride, plane_width,
+                                          plane_height, &region, 1, highbd,
+                                          bit_depth, &ws);
+  av1_cnn_workspace_free(&ws);
+  return ret;
+}
+
+// Size of the tiles av1_cnn_model_calibrate() splits the plane into, which
+// bounds the size of the float activation buffers.
+#define CNN_CALIBRATE_TILE_SIZE 256
+
+int av1_cnn_model_calibrate(const CnnModel *model, const uint8_t *buf,
+                            int width, int height, int stride, float *act_max) {
+  const int tile_size = CNN_CALIBRATE_TILE_SIZE;
+  uint8_t *const dst = (uint8_t *)aom_malloc(tile_size * tile_size);
+  if (dst == NULL) return -1;
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  int ret = 0;
+  for (int y = 0; y < height; y += tile_size) {
+    for (int x = 0; x < width; x += tile_size) {
+      const CnnRegion tile = { x, y, AOMMIN(tile_size, width - x),
+                               AOMMIN(tile_size, height - y) };
+      CnnRegion ctx;
+      region_context(model, &tile, width, height, &ctx);
+      ret = restore_region(model, buf + ctx.y * stride + ctx.x, stride, dst,
+                           tile_size, ctx.width, ctx.height, x - ctx.x,
+                           y - ctx.y, tile.width, tile.height, 0, 8, act_max,
+                           &ws);
+      if (ret) break;
+    }
+    if (ret) break;
+  }
+  av1_cnn_workspace_free(&ws);
+  aom_free(dst);
+  return ret;
+}
+
+static size_t align_size(size_t size) {
+  return (size + CNN_MODEL_ALIGN - 1) & ~(size_t)(CNN_MODEL_ALIGN - 1);
+}
+
+int av1_cnn_model_quantize(CnnModel *model, const float *act_max) {
+  size_t size = 0;
+  for (int l = 0; l < model->num_layers; ++l) {
+    const CnnLayer *const layer = &model->layers[l];
+    size += align_size(
+        av1_cnn_int8_weight_count(layer->in_channels, layer->out_channels));
+    size += 2 * align_size(layer->out_channels * sizeof(int32_t));
+  }
+  uint8_t *const qparams = (uint8_t *)aom_memalign(CNN_MODEL_ALIGN, size);
+  if (qparams == NULL) return -1;
+  memset(qparams, 0, size);
+
+  uint8_t *p = qparams;
+  // Scale of the input activations of the current layer.
+  float in_scale = 1.0f / 255.0f;
+  for (int l = 0; l < model->num_layers; ++l) {
+    CnnLayer *const layer = &model->layers[l];
+    const int in_ch = layer->in_channels;
+    const int out_ch = layer->out_channels;
+    int8_t *const qweights = (int8_t *)p;
+    p += align_size(av1_cnn_int8_weight_count(in_ch, out_ch));
+    int32_t *const qbias = (int32_t *)p;
+    p += align_size(out_ch * sizeof(int32_t));
+    float *const qscale = (float *)p;
+    p += align_size(out_ch * sizeof(float));
+
+    // The outputs of the hidden layers are mapped from [0, act_max] to
+    // [0, 255], the output of the last layer to pixels.
+    const int is_last = l == model->num_layers - 1;
+    const float out_scale =
+        is_last ? 1.0f / 255.0f : AOMMAX(act_max[l], 1e-6f) / 255.0f;
+    for (int o = 0; o < out_ch; ++o) {
+      float w_max = 0.0f;
+      for (int tap = 0; tap < CNN_KERNEL_TAPS; ++tap) {
+        for (int i = 0; i < in_ch; ++i) {
+          const float w = layer->weights[av1_cnn_weight_index(tap, i, o, in_ch,
+                                                              out_ch)];
+          w_max = AOMMAX(w_max, fabsf(w));
+        }
+      }
+      const float w_scale =
+          w_max > 0.0f ? w_max / CNN_INT8_WEIGHT_MAX : 1.0f;
+      for (int tap = 0; tap < CNN_KERNEL_TAPS; ++tap) {
+        for (int i = 0; i < in_ch; ++i) {
+          const float w = layer->weights[av1_cnn_weight_index(tap, i, o, in_ch,
+                                                              out_ch)];
+          qweights[av1_cnn_int8_weight_index(tap, i, o, in_ch, out_ch)] =
+              (int8_t)clamp((int)lrintf(w / w_scale), -CNN_INT8_WEIGHT_MAX,
+                            CNN_INT8_WEIGHT_MAX);
+        }
+      }
+      const float acc_scale = in_scale * w_scale;
+      const float b = layer->bias[o] / acc_scale;
+      qbias[o] = (int32_t)lrintf(AOMMIN(AOMMAX(b, -(float)(1 << 30)),
+                                        (float)(1 << 30)));
+      qscale[o] = acc_scale / out_scale;
+    }
+    layer->qweights = qweights;
+    layer->qbias = qbias;
+    layer->qscale = qscale;
+    in_scale = out_scale;
+  }
+
+  aom_free(model->qparams);
+  model->qparams = qparams;
+  model->quantized = 1;
+  return 0;
+}
+
+int av1_cnn_model_set_conv_algo(CnnModel *model, CNN_CONV_ALGO algo) {
+  for (int l = 0; l < model->num_layers; ++l)
+    model->layers[l].wino_weights = NULL;
+  aom_free(model->wino_params);
+  model->wino_params = NULL;
+  if (algo == CNN_CONV_DIRECT) return 0;
+
+  // Only the hidden layers have enough channels to gain from the transforms.
+  const size_t layer_size =
+      (size_t)CNN_WINOGRAD_POINTS * CNN_CHANNELS * CNN_CHANNELS;
+  const int num_wino_layers = model->num_layers - 2;
+  if (num_wino_layers <= 0) return 0;
+  model->wino_params = (float *)aom_memalign(
+      32, layer_size * num_wino_layers * sizeof(*model->wino_params));
+  if (model->wino_params == NULL) return -1;
+  for (int l = 1; l < model->num_layers - 1; ++l) {
+    CnnLayer *const layer = &model->layers[l];
+    const int in_ch = layer->in_channels;
+    const int out_ch = layer->out_channels;
+    assert(in_ch == CNN_CHANNELS && out_ch == CNN_CHANNELS);
+    float *const u = model->wino_params + (l - 1) * layer_size;
+    for (int i = 0; i < in_ch; ++i) {
+      for (int o = 0; o < out_ch; ++o) {
+        float g[CNN_KERNEL_TAPS], t[6 * 3], ut[6 * 6];
+        for (int tap = 0; tap < CNN_KERNEL_TAPS; ++tap)
+          g[tap] = layer->weights[av1_cnn_weight_index(tap, i, o, in_ch,
+                                                       out_ch)];
+        // G g G^T, along ky and then along kx.
+        for (int kx = 0; kx < 3; ++kx)
+          winograd_filter_1d(g + kx, 3, t + kx, 3);
+        for (int r = 0; r < 6; ++r)
+          winograd_filter_1d(t + r * 3, 1, ut + r * 6, 1);
+        for (int p = 0; p < CNN_WINOGRAD_POINTS; ++p)
+          u[(p * in_ch + i) * out_ch + o] = ut[p];
+      }
+    }
+    layer->wino_weights = u;
+  }
+  return 0;
+}
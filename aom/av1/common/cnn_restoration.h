@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#ifndef AV1_COMMON_CNN_RESTORATION_H_
+#define AV1_COMMON_CNN_RESTORATION_H_
+
+#include "config/aom_config.h"
+
+#include "aom/aom_integer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Native inference engine for the VDSR-style in-loop restoration networks
+// (VDSR15/20/25/30). Every network is a chain of 3x3 "SAME" convolutions:
+//   1 -> CNN_CHANNELS (ReLU), (num_layers - 2) x
+//   CNN_CHANNELS -> CNN_CHANNELS (ReLU), CNN_CHANNELS -> 1,
+// followed by a residual add of the normalized input and a clip to [0, 1].
+
+#define CNN_CHANNELS 64
+#define CNN_MAX_LAYERS 32
+// Bits of the preferred depth in the sequence header, enough for 0 to
+// CNN_MAX_LAYERS.
+#define CNN_DEPTH_BITS 6
+#define CNN_KERNEL_SIZE 3
+#define CNN_KERNEL_TAPS (CNN_KERNEL_SIZE * CNN_KERNEL_SIZE)
+// Layers with a multiple of CNN_OUT_BLOCK output channels store their weights
+// as [out_channels / CNN_OUT_BLOCK][ky][kx][in_channels][CNN_OUT_BLOCK], so
+// the SIMD kernels stream through one block of output channels at a time.
+// Other layers form a single block, i.e. keep the TensorFlow HWIO order
+// [ky][kx][in_channels][out_channels].
+#define CNN_OUT_BLOCK 16
+
+// Quantized models run the layers on uint8 activations and int8 weights with
+// int32 accumulators. Their weights are stored as
+// [out_channels / CNN_INT8_OUT_BLOCK][ky][kx][in_channels / 4]
+// [CNN_INT8_OUT_BLOCK][4], with in_channels rounded up to a multiple of 4
+// by zero weights, so that a 32-bit lane holds the weights of 4 input
+// channels for one output channel. Layers with other output channel counts
+// form a single block. The weights are limited to +/-CNN_INT8_WEIGHT_MAX, so
+// that the sum of two uint8 x int8 products never saturates 16 bits.
+#define CNN_INT8_OUT_BLOCK 8
+#define CNN_INT8_WEIGHT_MAX 63
+
+// The CNN_CHANNELS -> CNN_CHANNELS layers of float models can run as
+// Winograd F(4x4, 3x3) convolutions, which compute each 4x4 block of outputs
+// from the 6x6 block of inputs around it with 36 instead of 144 multiplies
+// per pair of input and output channels. Their transformed weights are
+// stored as [CNN_WINOGRAD_POINTS][in_channels][out_channels]. The rounding of
+// each output depends on the whole block it is computed with, so the blocks
+// are anchored at multiples of CNN_WINOGRAD_BLOCK in the plane, wherever the
+// region being restored starts.
+#define CNN_WINOGRAD_BLOCK 4
+#define CNN_WINOGRAD_POINTS 36
+// Number of blocks transformed and multiplied together.
+#define CNN_WINOGRAD_TILES 6
+// Number of floats of the scratch buffer av1_cnn_winograd_3x3() needs.
+#define CNN_WINOGRAD_SCRATCH_SIZE \
+  (2 * CNN_WINOGRAD_POINTS * CNN_WINOGRAD_TILES * CNN_CHANNELS)
+
+typedef enum {
+  CNN_CONV_DIRECT,
+  CNN_CONV_WINOGRAD,
+} CNN_CONV_ALGO;
+
+// Storage of the CNN_CHANNELS-wide activations float models pass from one
+// layer to the next. CNN_ACT_BF16 keeps the upper half of each float32,
+// rounded to nearest even, which halves the memory traffic of the hidden
+// layers. The layers still read and accumulate float32.
+typedef enum {
+  CNN_ACT_FLOAT,
+  CNN_ACT_BF16,
+} CNN_ACT_FORMAT;
+
+// Flat binary model file written by tools/cnn_model_converter. All fields
+// are little-endian and every parameter array starts on a CNN_MODEL_ALIGN
+// byte boundary, so the file can be mapped and used in place.
+#define CNN_MODEL_MAGIC 0x4e4e4356  // "VCNN"
+// Version 2 adds the optional int8 parameters of quantized models.
+#define CNN_MODEL_VERSION 2
+#define CNN_MODEL_ALIGN 64
+
+// Bit 0 of the role tells inter from intra frames, bit 1 chroma from luma.
+typedef enum {
+  CNN_ROLE_INTRA = 0,        // Trained on the luma of intra (I) frames.
+  CNN_ROLE_INTER = 1,        // Trained on the luma of inter (B) frames.
+  CNN_ROLE_CHROMA_INTRA = 2,  // Trained on the chroma of intra frames.
+  CNN_ROLE_CHROMA_INTER = 3,  // Trained on the chroma of inter frames.
+} CNN_MODEL_ROLE;
+
+typedef struct CnnModelFileLayer {
+  uint32_t in_channels;
+  uint32_t out_channels;
+  // Byte offsets from the start of the file.
+  uint32_t weights_offset;
+  uint32_t bias_offset;
+} CnnModelFileLayer;
+
+// Parameters of a layer of a quantized model, see CNN_INT8_OUT_BLOCK. The
+// int32 biases are in units of the accumulator. The float scales map the
+// accumulator of each output channel to the uint8 activations of the next
+// layer, or for the last layer to the residual in pixels.
+typedef struct CnnModelFileQuantLayer {
+  uint32_t weights_offset;
+  uint32_t bias_offset;
+  uint32_t scale_offset;
+  uint32_t reserved;
+} CnnModelFileQuantLayer;
+
+typedef struct CnnModelFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t file_size;
+  uint32_t num_layers;
+  uint32_t kernel_size;
+  uint32_t out_block;
+  // QP bucket the model was trained for, or -1 if unknown.
+  int32_t qp;
+  uint32_t role;
+  CnnModelFileLayer layers[CNN_MAX_LAYERS];
+  // Version 2: byte offset of num_layers CnnModelFileQuantLayer entries, or
+  // 0 for a float model. Quantized models only run the int8 parameters.
+  uint32_t quant_offset;
+} CnnModelFileHeader;
+
+// A borrowed, strided view of a plane region handed to a restoration backend,
+// which reads its input from and writes its output to the same samples.
+typedef struct CnnPlaneView {
+  // First sample of the region. For high bitdepth planes this is a
+  // CONVERT_TO_BYTEPTR() alias of the 16-bit samples.
+  uint8_t *data;
+  int width;
+  int height;
+  // Distance between rows, in samples.
+  int stride;
+  int highbd;
+  // Number of bits of the samples, 8 unless highbd is set.
+  int bit_depth;
+} CnnPlaneView;
+
+typedef struct CnnLayer {
+  int in_channels;
+  int out_channels;
+  // Weights in the layout described at CNN_OUT_BLOCK.
+  const float *weights;
+  const float *bias;
+  // Parameters of quantized models, see CnnModelFileQuantLayer.
+  const int8_t *qweights;
+  const int32_t *qbias;
+  const float *qscale;
+  // Winograd-domain weights, see CNN_WINOGRAD_BLOCK, or NULL if the layer
+  // runs as a direct convolution.
+  const float *wino_weights;
+} CnnLayer;
+
+typedef struct CnnModel {
+  int num_layers;
+  CnnLayer layers[CNN_MAX_LAYERS];
+  int qp;
+  CNN_MODEL_ROLE role;
+  // Whether the model runs on its int8 parameters.
+  int quantized;
+  // Storage of the activations of the float model. As it changes the output
+  // slightly, encoder and decoder have to use the same: the one the sequence
+  // header signals, see av1_cnn_registry_set_act_format().
+  CNN_ACT_FORMAT act_format;
+  // Whether the model runs the C kernels instead of the optimized ones. Both
+  // evaluate every operation in the same order and give identical output;
+  // the C ones are only slower.
+  int reference;
+  // Backing storage for all layer parameters, owned by the model. It is
+  // either a heap buffer (params, and qparams for models quantized after
+  // loading) or a read-only file mapping (mapping).
+  float *params;
+  void *qparams;
+  // Transformed weights of the Winograd layers, owned by the model.
+  float *wino_params;
+  void *mapping;
+  size_t mapping_size;
+} CnnModel;
+
+// Number of output channels stored together in the weights of a layer.
+static INLINE int av1_cnn_out_block(int out_channels) {
+  return out_channels % CNN_OUT_BLOCK ? out_channels : CNN_OUT_BLOCK;
+}
+
+// Index of the weight connecting input channel i to output channel o at
+// kernel tap (ky * CNN_KERNEL_SIZE + kx).
+static INLINE size_t av1_cnn_weight_index(int tap, int i, int o,
+                                          int in_channels, int out_channels) {
+  const int block = av1_cnn_out_block(out_channels);
+  return (((size_t)(o / block) * CNN_KERNEL_TAPS + tap) * in_channels + i) *
+             block +
+         o % block;
+}
+
+// Number of output channels stored together in the int8 weights of a layer.
+static INLINE int av1_cnn_int8_out_block(int out_channels) {
+  return out_channels % CNN_INT8_OUT_BLOCK ? out_channels : CNN_INT8_OUT_BLOCK;
+}
+
+// Number of int8 weights of a layer, including the padding input channels.
+static INLINE size_t av1_cnn_int8_weight_count(int in_channels,
+                                               int out_channels) {
+  return (size_t)CNN_KERNEL_TAPS * ((in_channels + 3) & ~3) * out_channels;
+}
+
+// Index of the int8 weight connecting input channel i to output channel o at
+// kernel tap (ky * CNN_KERNEL_SIZE + kx).
+static INLINE size_t av1_cnn_int8_weight_index(int tap, int i, int o,
+                                               int in_channels,
+                                               int out_channels) {
+  const int block = av1_cnn_int8_out_block(out_channels);
+  const int in_groups = (in_channels + 3) >> 2;
+  return ((((size_t)(o / block) * CNN_KERNEL_TAPS + tap) * in_groups +
+           (i >> 2)) *
+              block +
+          o % block) *
+             4 +
+         (i & 3);
+}
+
+// Number of pixels around an output pixel that affect its value, i.e. the
+// context a tile needs on each side to be restored exactly as it would be as
+// part of the whole plane. An output of a Winograd layer depends on the input
+// block around its whole output block, up to CNN_WINOGRAD_BLOCK pixels away.
+static INLINE int av1_cnn_model_halo(const CnnModel *model) {
+  int halo = 0;
+  for (int l = 0; l < model->num_layers; ++l) {
+    halo += model->layers[l].wino_weights ? CNN_WINOGRAD_BLOCK
+                                          : CNN_KERNEL_SIZE / 2;
+  }
+  return halo;
+}
+
+// Largest width (or height) of the context of a tile of up to size pixels of
+// a plane of plane_size pixels, for av1_cnn_workspace_reserve(). The context
+// starts at a multiple of CNN_WINOGRAD_BLOCK, so it may reach up to
+// CNN_WINOGRAD_BLOCK - 1 pixels further than the halo to the top and left.
+static INLINE int av1_cnn_context_size(const CnnModel *model, int size,
+                                       int plane_size) {
+  const int ctx_size =
+      size + 2 * av1_cnn_model_halo(model) + CNN_WINOGRAD_BLOCK - 1;
+  return ctx_size < plane_size ? ctx_size : plane_size;
+}
+
+// Returns the number of floats a model of the given depth needs for all of
+// its weights and biases, or 0 if the depth is not supported.
+size_t av1_cnn_model_param_count(int num_layers);
+
+// Sets up the layer table of a model whose parameters are stored back to back
+// in checkpoint order (bias then weights for each layer) in model->params.
+void av1_cnn_model_setup_layers(CnnModel *model, int num_layers);
+
+// Loads a model from the data shard of a TensorFlow checkpoint
+// (*.ckpt.data-00000-of-00001). The shard holds the float32 variables in
+// sorted-name order, so the depth of the network follows from its size.
+// The weights are reordered into the blocked layout. Returns 0 on success.
+int av1_cnn_model_load_ckpt(CnnModel *model, const char *path);
+
+// Loads a model file written by tools/cnn_model_converter, mapping it
+// read-only where the platform allows so that all processes using the same
+// file share its pages. Files without the CNN_MODEL_MAGIC header are loaded
+// with av1_cnn_model_load_ckpt(). Returns 0 on success.
+int av1_cnn_model_load(CnnModel *model, const char *path);
+
+void av1_cnn_model_free(CnnModel *model);
+
+// Runs the float model over an 8-bit plane and raises act_max[l] to the
+// largest activation seen at the output of every layer l but the last.
+// Returns 0 on success.
+int av1_cnn_model_calibrate(const CnnModel *model, const uint8_t *buf,
+                            int width, int height, int stride, float *act_max);
+
+// Quantizes the float parameters of the model to int8, with a scale per
+// output channel for the weights and the activations of layer l mapped from
+// [0, act_max[l]] to [0, 255]. The model runs on the int8 parameters from
+// then on. Returns 0 on success.
+int av1_cnn_model_quantize(CnnModel *model, const float *act_max);
+
+// Selects how the CNN_CHANNELS -> CNN_CHANNELS layers of the float model are
+// computed. CNN_CONV_WINOGRAD transforms their weights once here. Models are
+// loaded into a registry with CNN_CONV_WINOGRAD. Returns 0 on success.
+int av1_cnn_model_set_conv_algo(CnnModel *model, CNN_CONV_ALGO algo);
+
+// Set of models covering several QP buckets and frame roles. All models stay
+// loaded for the lifetime of the registry, so switching between them costs
+// nothing.
+#define CNN_MAX_MODELS 64
+
+typedef struct CnnModelRegistry {
+  int num_models;
+  CnnModel models[CNN_MAX_MODELS];
+} CnnModelRegistry;
+
+// Adds every model file (*.bin) found in dir to the registry. Returns the
+// number of models added, or -1 if the directory cannot be read or a model
+// file fails to load.
+int av1_cnn_registry_load_dir(CnnModelRegistry *registry, const char *dir);
+
+// Adds a single model to the registry. If qp is not negative, qp and role
+// replace the values recorded in the file, which is needed for checkpoints as
+// they carry no metadata. Returns 0 on success.
+int av1_cnn_registry_add(CnnModelRegistry *registry, const char *path, int qp,
+                         CNN_MODEL_ROLE role);
+
+// Sets the activation storage of every model in the registry. Models are
+// added with CNN_ACT_FLOAT; encoder and decoder set the format of the
+// sequence header (seq_params.cnn_bf16) before they restore a frame.
+void av1_cnn_registry_set_act_format(CnnModelRegistry *registry,
+                                     CNN_ACT_FORMAT act_format);
+
+// Returns the model of the given role whose QP bucket is nearest to qp (in
+// the 0..63 quantizer scale). Falls back to the other frame type of the same
+// planes if the registry has no model of the requested role, and returns NULL
+// if it has no model of those planes: the luma models were not trained on
+// chroma, and the chroma ones not on luma. Of the models of that bucket, the
+// one with the number of layers nearest to depth is taken, or the deepest if
+// depth is 0.
+const CnnModel *av1_cnn_registry_select(const CnnModelRegistry *registry,
+                                        int qp, CNN_MODEL_ROLE role,
+                                        int depth);
+
+// Returns the network depth (VDSR15 to VDSR30) the encoder asks for at the
+// given speed setting: deeper networks restore better and run slower.
+int av1_cnn_depth_for_speed(int speed);
+
+void av1_cnn_registry_free(CnnModelRegistry *registry);
+
+// Replaces the models in the registry with those found in dir, or with the
+// default models (see CNN_I_MODEL_PATH) if dir is NULL. Returns 0 on success
+// and leaves the registry empty on failure.
+int av1_cnn_registry_load(CnnModelRegistry *registry, const char *dir);
+
+struct AV1Common;
+
+// Returns 1 if the CNN may replace the normative in-loop filters for the
+// current frame of cm, which refreshes the reference slots in
+// refresh_frame_flags. The frame header then signals whether it does
+// (cm->use_cnn_restoration), and av1_cnn_frame_enabled() tells the outcome.
+// Both only depend on what the bitstream signals, so that encoder and decoder
+// agree.
+int av1_cnn_frame_allowed(const struct AV1Common *cm, int refresh_frame_flags);
+int av1_cnn_frame_enabled(const struct AV1Common *cm, int refresh_frame_flags);
+
+// Returns 1 if the CNN restores the luma plane of the current frame of cm but
+// not its chroma planes. These then go through the regular in-loop filters,
+// and the frame header codes their loop filter levels even though the luma
+// ones are 0.
+int av1_cnn_frame_luma_only(const struct AV1Common *cm,
+                            int refresh_frame_flags);
+
+// Returns the base_qindex of the current frame of cm on the 0..63 quantizer
+// scale the models are selected by.
+int av1_cnn_frame_qp(const struct AV1Common *cm);
+
+// Returns the model of the registry meant for the given plane and the
+// base_qindex and frame type of the current frame of cm, with the depth the
+// sequence header asks for, or NULL if the registry has no model of the
+// plane.
+const CnnModel *av1_cnn_select_frame_model(const CnnModelRegistry *registry,
+                                           const struct AV1Common *cm,
+                                           int plane);
+
+// Returns 1 if the CNN runs on the superblock at (mi_row, mi_col) of the
+// current frame of cm. Superblocks are left as they are only if every block
+// copies pixels the CNN has already restored: inter blocks without residual
+// predicting from a single unscaled reference by whole-pel translation.
+// Sub-pel, compound, OBMC, warped and inter-intra predictions interpolate or
+// blend the reference into values the CNN has not seen, so they are
+// restored.
+int av1_cnn_sb_active(const struct AV1Common *cm, int mi_row, int mi_col);
+
+// Runs the model over a width x height region of an 8-bit plane, or of a
+// 16-bit plane holding bit_depth-bit samples when highbd is set, and writes
+// the result back in place. The samples are normalized by the largest value
+// of their bit depth, so the same models serve every bit depth. The region is
+// treated as a standalone image, i.e. it is zero-padded at its borders before
+// every layer. Returns 0 on success.
+int av1_cnn_restore_plane(const CnnModel *model, uint8_t *buf, int width,
+                          int height, int stride, int highbd, int bit_depth);
+
+// Execution plan of a tile, see the definition in cnn_restoration.c.
+struct CnnPlan;
+
+// Buffers the restoration of a region needs, kept from one region to the
+// next so that they are only allocated once for a batch of regions, or for
+// all the batches a thread restores. Zero-initialize before first use.
+typedef struct CnnWorkspace {
+  void *in_buf;
+  size_t in_size;
+  void *act_buf;
+  size_t act_size;
+  float *scratch;
+  float *stage_buf;
+  size_t stage_size;
+  // The plans of the tile geometries restored last, least recently used
+  // first out. The tiles of a frame come in a handful of geometries, so
+  // after the first frame every tile finds its plan here.
+  struct CnnPlan *plans;
+  uint64_t plan_clock;
+  // Number of plans built so far.
+  int plans_built;
+  // Context samples restored so far, see av1_cnn_regions_context_area().
+  int64_t context_area;
+} CnnWorkspace;
+
+// Grows the buffers of ws to what restoring regions with a context of up to
+// ctx_width x ctx_height pixels (see av1_cnn_context_size()) with model
+// takes, so that such restorations allocate nothing. Returns 0 on success.
+int av1_cnn_workspace_reserve(CnnWorkspace *ws, const CnnModel *model,
+                              int ctx_width, int ctx_height);
+
+void av1_cnn_workspace_free(CnnWorkspace *ws);
+
+typedef struct CnnRegion {
+  int x;
+  int y;
+  int width;
+  int height;
+} CnnRegion;
+
+// Returns the number of context samples av1_cnn_restore_regions() runs the
+// model on to restore the regions, which the time it takes goes by.
+int64_t av1_cnn_regions_context_area(const CnnModel *model,
+                                     const CnnRegion *regions, int num_regions,
+                                     int plane_width, int plane_height);
+
+// Restores a batch of regions of a plane_width x plane_height plane, each as
+// av1_cnn_restore_region() does, with the buffers of ws. The regions must
+// not overlap, and are restored in column strips, each from its own context,
+// so none may be restored in place. Returns 0 on success.
+int av1_cnn_restore_regions(const CnnModel *model, const uint8_t *src,
+                            int src_stride, uint8_t *dst, int dst_stride,
+                            int plane_width, int plane_height,
+                            const CnnRegion *regions, int num_regions,
+                            int highbd, int bit_depth, CnnWorkspace *ws);
+
+// Restores the width x height tile at (x, y) of a plane_width x
+// plane_height plane. The result only depends on the tile and the
+// av1_cnn_model_halo() pixels of context around it, which are read from src,
+// and only the tile is written to dst, so the result matches
+// av1_cnn_restore_plane() on the whole plane bit for bit and tiles can be
+// processed in any order as long as src is not modified. src and dst
+// point to the top left of the plane and may be CONVERT_TO_BYTEPTR() aliases
+// of 16-bit planes of bit_depth-bit samples when highbd is set. Returns 0 on
+// success.
+int av1_cnn_restore_region(const CnnModel *model, const uint8_t *src,
+                           int src_stride, uint8_t *dst, int dst_stride,
+                           int plane_width, int plane_height, int x, int y,
+                           int width, int height, int highbd, int bit_depth);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // AV1_COMMON_CNN_RESTORATION_H_
@@ -229,6 +229,11 @@ typedef struct SequenceHeader {
                            //     enabled for that frame.
   int enable_cdef;         // To turn on/off CDEF
   int enable_restoration;  // To turn on/off loop restoration
+#if CONFIG_CNN_RESTORATION
+  int enable_cnn_restoration;  // The CNN may replace the in-loop filters
+  int cnn_depth;  // Preferred number of CNN layers, 0 for the deepest
+  int cnn_bf16;   // The CNN stores its activations as bfloat16
+#endif  // CONFIG_CNN_RESTORATION
   int operating_points_cnt_minus_1;
   int operating_point_idc[MAX_NUM_OPERATING_POINTS];
   int display_model_info_present_flag;
@@ -429,6 +434,15 @@ typedef struct AV1Common {
   struct segmentation seg;
   int coded_lossless;  // frame is fully lossless at the coded resolution.
   int all_lossless;    // frame is fully lossless at the upscaled resolution.
+#if CONFIG_CNN_RESTORATION
+  // Signalled for frames av1_cnn_frame_allowed() holds for: the CNN replaces
+  // the in-loop filters, rather than only being allowed to.
+  int use_cnn_restoration;
+  // Whether the CNN also restores the chroma planes, signalled along with
+  // use_cnn_restoration for frames that have them. They go through the
+  // regular in-loop filters otherwise.
+  int cnn_restore_chroma;
+#endif  // CONFIG_CNN_RESTORATION
 
   int reduced_tx_set_used;
 
@@ -9,11 +9,14 @@
  * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
  */
 
+#include <assert.h>
+
 #include "config/aom_config.h"
 #include "config/aom_scale_rtcd.h"
 
 #include "aom_dsp/aom_dsp_common.h"
 #include "aom_mem/aom_mem.h"
+#include "aom_ports/aom_timer.h"
 #include "av1/common/av1_loopfilter.h"
 #include "av1/common/entropymode.h"
 #include "av1/common/thread_common.h"
@@ -780,3 +783,642 @@ void av1_loop_restoration_filter_frame_mt(YV12_BUFFER_CONFIG *frame,
   foreach_rest_unit_in_planes_mt(loop_rest_ctxt, workers, num_workers, lr_sync,
                                  cm);
 }
+
+#if CONFIG_CNN_RESTORATION
+// Target tile size for CNN restoration. Larger tiles waste less work on the
+// context around them, smaller ones need less memory per worker and balance
+// better across them. The float models keep a window of a few rows per layer
+// (see restore_region()) over strips of CNN_STRIP_WIDTH columns of the tile,
+// so a 25-layer bfloat16 model takes about 12 MB per worker whatever the tile
+// width, 9.8 MB of which are windows. This still misses the few MB per thread
+// the fused layers were meant to reach: strips of 128 would take about 8 MB,
+// but compute so much more of the halo of 94 pixels that restoration takes
+// about 30% longer than with strips of 256.
+#define CNN_TILE_SIZE 512
+
+static void forget_prev_frame(AV1CnnSync *cnn_sync) {
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane)
+    cnn_sync->planes[plane].prev_model = NULL;
+}
+
+// Returns the samples of the copies of all planes of a frame of width x
+// height luma samples.
+static size_t cnn_frame_size(int width, int height, int ss_x, int ss_y,
+                             int num_planes) {
+  const size_t uv_size =
+      (size_t)((width + ss_x) >> ss_x) * ((height + ss_y) >> ss_y);
+  return (size_t)width * height + (num_planes - 1) * uv_size;
+}
+
+// Returns 0 on success. On failure the buffers that could not be grown are
+// left empty, and are grown again on the next call.
+static int cnn_restore_alloc(AV1CnnSync *cnn_sync, int num_jobs,
+                             size_t src_buf_size, int sb_mask_size) {
+#if CONFIG_MULTITHREAD
+  if (cnn_sync->job_mutex == NULL) {
+    cnn_sync->job_mutex =
+        (pthread_mutex_t *)aom_malloc(sizeof(*(cnn_sync->job_mutex)));
+    if (cnn_sync->job_mutex == NULL) return 1;
+    pthread_mutex_init(cnn_sync->job_mutex, NULL);
+  }
+#endif  // CONFIG_MULTITHREAD
+  if (num_jobs > cnn_sync->max_jobs) {
+    aom_free(cnn_sync->job_queue);
+    cnn_sync->max_jobs = 0;
+    cnn_sync->job_queue = (AV1CnnMTInfo *)aom_malloc(
+        sizeof(*(cnn_sync->job_queue)) * num_jobs);
+    if (cnn_sync->job_queue == NULL) return 1;
+    cnn_sync->max_jobs = num_jobs;
+  }
+  if (src_buf_size > cnn_sync->src_buf_size) {
+    aom_free(cnn_sync->src_buf);
+    aom_free(cnn_sync->prev_src);
+    aom_free(cnn_sync->prev_dst);
+    cnn_sync->src_buf_size = 0;
+    forget_prev_frame(cnn_sync);
+    cnn_sync->src_buf = (uint8_t *)aom_memalign(32, src_buf_size);
+    cnn_sync->prev_src = (uint8_t *)aom_memalign(32, src_buf_size);
+    cnn_sync->prev_dst = (uint8_t *)aom_memalign(32, src_buf_size);
+    if (cnn_sync->src_buf == NULL || cnn_sync->prev_src == NULL ||
+        cnn_sync->prev_dst == NULL)
+      return 1;
+    cnn_sync->src_buf_size = src_buf_size;
+  }
+  if (sb_mask_size > cnn_sync->sb_mask_size) {
+    aom_free(cnn_sync->sb_mask);
+    aom_free(cnn_sync->prev_sb_mask);
+    cnn_sync->sb_mask_size = 0;
+    forget_prev_frame(cnn_sync);
+    cnn_sync->sb_mask = (uint8_t *)aom_malloc(sb_mask_size);
+    cnn_sync->prev_sb_mask = (uint8_t *)aom_malloc(sb_mask_size);
+    if (cnn_sync->sb_mask == NULL || cnn_sync->prev_sb_mask == NULL) return 1;
+    cnn_sync->sb_mask_size = sb_mask_size;
+  }
+  return 0;
+}
+
+void av1_cnn_restore_alloc_workspaces(AV1CnnSync *cnn_sync, AV1_COMMON *cm,
+                                      int num_workers) {
+  if (num_workers <= cnn_sync->num_workspaces) return;
+  CnnWorkspace *workspaces;
+  CHECK_MEM_ERROR(cm, workspaces,
+                  aom_calloc(num_workers, sizeof(*workspaces)));
+  if (cnn_sync->num_workspaces > 0) {
+    memcpy(workspaces, cnn_sync->workspaces,
+           cnn_sync->num_workspaces * sizeof(*workspaces));
+  }
+  aom_free(cnn_sync->workspaces);
+  cnn_sync->workspaces = workspaces;
+  cnn_sync->num_workspaces = num_workers;
+}
+
+void av1_cnn_restore_reserve(AV1CnnSync *cnn_sync, AV1_COMMON *cm,
+                             const CnnModelRegistry *models, int width,
+                             int height, int highbd, int num_workers) {
+  const int num_planes = av1_num_planes(cm);
+  const int tile_cols = (width + CNN_TILE_SIZE - 1) / CNN_TILE_SIZE;
+  const int tile_rows = (height + CNN_TILE_SIZE - 1) / CNN_TILE_SIZE;
+  // The superblock size may still change, so count the smallest one.
+  const int sb_cols = (width + (1 << MIN_SB_SIZE_LOG2) - 1) >> MIN_SB_SIZE_LOG2;
+  const int sb_rows =
+      (height + (1 << MIN_SB_SIZE_LOG2) - 1) >> MIN_SB_SIZE_LOG2;
+  if (cnn_restore_alloc(cnn_sync, tile_cols * tile_rows * num_planes,
+                        cnn_frame_size(width, height, cm->subsampling_x,
+                                       cm->subsampling_y, num_planes) *
+                            (highbd ? 2 : 1),
+                        sb_cols * sb_rows)) {
+    aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
+                       "Failed to allocate CNN restoration buffers");
+  }
+  av1_cnn_restore_alloc_workspaces(cnn_sync, cm, num_workers);
+
+  // No smaller frame has larger tiles than min(size, CNN_TILE_SIZE), and the
+  // chroma tiles are no larger than the luma ones. Workers beyond the number
+  // of tiles usually find no tile left, and only allocate if they do.
+  const int num_workspaces =
+      AOMMIN(num_workers, tile_cols * tile_rows * num_planes);
+  for (int m = 0; m < models->num_models; ++m) {
+    const CnnModel *const model = &models->models[m];
+    const int ctx_w = av1_cnn_context_size(model, CNN_TILE_SIZE, width);
+    const int ctx_h = av1_cnn_context_size(model, CNN_TILE_SIZE, height);
+    for (int i = 0; i < num_workspaces; ++i) {
+      if (av1_cnn_workspace_reserve(&cnn_sync->workspaces[i], model, ctx_w,
+                                    ctx_h)) {
+        aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
+                           "Failed to allocate CNN restoration buffers");
+      }
+    }
+  }
+}
+
+void av1_cnn_restore_dealloc(AV1CnnSync *cnn_sync) {
+  if (cnn_sync != NULL) {
+#if CONFIG_MULTITHREAD
+    if (cnn_sync->job_mutex != NULL) {
+      pthread_mutex_destroy(cnn_sync->job_mutex);
+      aom_free(cnn_sync->job_mutex);
+    }
+#endif  // CONFIG_MULTITHREAD
+    aom_free(cnn_sync->job_queue);
+    aom_free(cnn_sync->src_buf);
+    aom_free(cnn_sync->sb_mask);
+    aom_free(cnn_sync->prev_src);
+    aom_free(cnn_sync->prev_dst);
+    aom_free(cnn_sync->prev_sb_mask);
+    for (int i = 0; i < cnn_sync->num_workspaces; ++i)
+      av1_cnn_workspace_free(&cnn_sync->workspaces[i]);
+    aom_free(cnn_sync->workspaces);
+    av1_zero(*cnn_sync);
+  }
+}
+
+// Maps a row or column pos of the luma plane, of luma_size samples, to a
+// plane subsampled by ss, of size samples. The end of the luma plane maps to
+// the end of the other one.
+static INLINE int luma_to_plane_pos(int pos, int luma_size, int ss, int size) {
+  return pos >= luma_size ? size : pos >> ss;
+}
+
+// Splits the luma plane into tiles of at most CNN_TILE_SIZE, evening out
+// their sizes so that the last row and column are not left with slivers. The
+// chroma planes are split along the same lines.
+static void enqueue_cnn_jobs(AV1CnnSync *cnn_sync, int tile_cols,
+                             int tile_rows) {
+  AV1CnnMTInfo *cnn_job_queue = cnn_sync->job_queue;
+  const AV1CnnPlane *const luma = &cnn_sync->planes[0];
+  const int tile_w = (luma->width + tile_cols - 1) / tile_cols;
+  const int tile_h = (luma->height + tile_rows - 1) / tile_rows;
+  cnn_sync->jobs_enqueued = 0;
+  cnn_sync->jobs_dequeued = 0;
+
+  for (int y = 0; y < luma->height; y += tile_h) {
+    for (int plane = 0; plane < cnn_sync->num_planes; ++plane) {
+      const AV1CnnPlane *const p = &cnn_sync->planes[plane];
+      if (p->model == NULL) continue;
+      const int y0 = luma_to_plane_pos(y, luma->height, p->ss_y, p->height);
+      const int y1 =
+          luma_to_plane_pos(y + tile_h, luma->height, p->ss_y, p->height);
+      for (int x = 0; x < luma->width; x += tile_w) {
+        const int x0 = luma_to_plane_pos(x, luma->width, p->ss_x, p->width);
+        const int x1 =
+            luma_to_plane_pos(x + tile_w, luma->width, p->ss_x, p->width);
+        if (x1 <= x0 || y1 <= y0) continue;
+        cnn_job_queue->x = x0;
+        cnn_job_queue->y = y0;
+        cnn_job_queue->width = x1 - x0;
+        cnn_job_queue->height = y1 - y0;
+        cnn_job_queue->plane = plane;
+        cnn_job_queue++;
+        cnn_sync->jobs_enqueued++;
+      }
+    }
+  }
+}
+
+static AV1CnnMTInfo *get_cnn_job_info(AV1CnnSync *cnn_sync) {
+  AV1CnnMTInfo *cur_job_info = NULL;
+
+#if CONFIG_MULTITHREAD
+  pthread_mutex_lock(cnn_sync->job_mutex);
+#endif
+  if (cnn_sync->jobs_dequeued < cnn_sync->jobs_enqueued) {
+    cur_job_info = cnn_sync->job_queue + cnn_sync->jobs_dequeued;
+    cnn_sync->jobs_dequeued++;
+  }
+#if CONFIG_MULTITHREAD
+  pthread_mutex_unlock(cnn_sync->job_mutex);
+#endif
+
+  return cur_job_info;
+}
+
+int av1_cnn_restore_init_planes(AV1CnnSync *cnn_sync,
+                                const AV1CnnPlane *planes, int num_planes,
+                                int highbd, int bit_depth, int sb_size_log2) {
+  const int width = planes[0].width;
+  const int height = planes[0].height;
+  const int tile_cols = (width + CNN_TILE_SIZE - 1) / CNN_TILE_SIZE;
+  const int tile_rows = (height + CNN_TILE_SIZE - 1) / CNN_TILE_SIZE;
+  const int sb_cols = (width + (1 << sb_size_log2) - 1) >> sb_size_log2;
+  const int sb_rows = (height + (1 << sb_size_log2) - 1) >> sb_size_log2;
+  size_t buf_size = 0;
+  for (int plane = 0; plane < num_planes; ++plane)
+    buf_size += (size_t)planes[plane].width * planes[plane].height;
+
+  if (cnn_restore_alloc(cnn_sync, tile_cols * tile_rows * num_planes,
+                        buf_size * (highbd ? 2 : 1), sb_cols * sb_rows))
+    return 1;
+
+  size_t buf_offset = 0;
+  for (int plane = 0; plane < num_planes; ++plane) {
+    AV1CnnPlane *const p = &cnn_sync->planes[plane];
+    // What the last frame left in the plane stays for its reuse.
+    p->model = planes[plane].model;
+    p->dst = planes[plane].dst;
+    p->dst_stride = planes[plane].dst_stride;
+    p->width = planes[plane].width;
+    p->height = planes[plane].height;
+    p->ss_x = planes[plane].ss_x;
+    p->ss_y = planes[plane].ss_y;
+    p->buf_offset = buf_offset;
+    buf_offset += (size_t)p->width * p->height * (highbd ? 2 : 1);
+  }
+  cnn_sync->num_planes = num_planes;
+  cnn_sync->highbd = highbd;
+  cnn_sync->bit_depth = highbd ? bit_depth : 8;
+  cnn_sync->sb_size_log2 = sb_size_log2;
+  cnn_sync->sb_cols = sb_cols;
+  cnn_sync->sb_rows = sb_rows;
+
+  enqueue_cnn_jobs(cnn_sync, tile_cols, tile_rows);
+  return 0;
+}
+
+void av1_cnn_restore_init(AV1CnnSync *cnn_sync, YV12_BUFFER_CONFIG *frame,
+                          AV1_COMMON *cm, const CnnModel *const *models) {
+  const int num_planes = av1_num_planes(cm);
+  AV1CnnPlane planes[MAX_MB_PLANE];
+  memset(planes, 0, sizeof(planes));
+  for (int plane = 0; plane < num_planes; ++plane) {
+    AV1CnnPlane *const p = &planes[plane];
+    const int is_uv = plane > 0;
+    p->model = models[plane];
+    p->dst = frame->buffers[plane];
+    p->dst_stride = frame->strides[is_uv];
+    p->width = frame->crop_widths[is_uv];
+    p->height = frame->crop_heights[is_uv];
+    p->ss_x = is_uv ? frame->subsampling_x : 0;
+    p->ss_y = is_uv ? frame->subsampling_y : 0;
+  }
+  if (av1_cnn_restore_init_planes(
+          cnn_sync, planes, num_planes,
+          (frame->flags & YV12_FLAG_HIGHBITDEPTH) != 0, (int)cm->bit_depth,
+          cm->seq_params.mib_size_log2 + MI_SIZE_LOG2)) {
+    aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
+                       "Failed to allocate CNN restoration buffers");
+  }
+}
+
+void av1_cnn_restore_copy_rows(AV1CnnSync *cnn_sync, int row_start,
+                               int row_end) {
+  const int bytes_per_sample = cnn_sync->highbd ? 2 : 1;
+  const int luma_height = cnn_sync->planes[0].height;
+  for (int plane = 0; plane < cnn_sync->num_planes; ++plane) {
+    const AV1CnnPlane *const p = &cnn_sync->planes[plane];
+    if (p->model == NULL) continue;
+    const int start =
+        luma_to_plane_pos(row_start, luma_height, p->ss_y, p->height);
+    const int end = luma_to_plane_pos(row_end, luma_height, p->ss_y, p->height);
+    const uint8_t *s = cnn_sync->highbd
+                           ? (const uint8_t *)CONVERT_TO_SHORTPTR(p->dst)
+                           : p->dst;
+    uint8_t *d = cnn_sync->src_buf + p->buf_offset;
+    s += (size_t)start * p->dst_stride * bytes_per_sample;
+    d += (size_t)start * p->width * bytes_per_sample;
+    for (int r = start; r < end; ++r) {
+      memcpy(d, s, p->width * bytes_per_sample);
+      s += p->dst_stride * bytes_per_sample;
+      d += p->width * bytes_per_sample;
+    }
+  }
+}
+
+void av1_cnn_restore_update_mask(AV1CnnSync *cnn_sync, const AV1_COMMON *cm,
+                                 int sb_row_start, int sb_row_end) {
+  const int mib_size_log2 = cm->seq_params.mib_size_log2;
+  for (int sb_row = sb_row_start; sb_row < sb_row_end; ++sb_row) {
+    uint8_t *const mask = cnn_sync->sb_mask + sb_row * cnn_sync->sb_cols;
+    for (int sb_col = 0; sb_col < cnn_sync->sb_cols; ++sb_col) {
+      mask[sb_col] = av1_cnn_sb_active(cm, sb_row << mib_size_log2,
+                                       sb_col << mib_size_log2);
+    }
+  }
+}
+
+// Superblocks are at least 64 pixels wide.
+#define CNN_TILE_MAX_SBS (CNN_TILE_SIZE / 64 + 1)
+// Each superblock row of a tile adds at most one region per run of active
+// superblocks, which are at least every other one.
+#define CNN_TILE_MAX_REGIONS \
+  (CNN_TILE_MAX_SBS * ((CNN_TILE_MAX_SBS + 1) / 2))
+
+// How av1_cnn_restore_tile() treats a superblock.
+enum { CNN_SB_SKIP, CNN_SB_RUN, CNN_SB_REUSE };
+
+// Adds the run of superblocks at (x, y) to the regions, extending the region
+// of the same columns that ends right above it if there is one.
+static void add_region(CnnRegion *regions, int *num_regions, int x, int y,
+                       int width, int height) {
+  for (int i = 0; i < *num_regions; ++i) {
+    CnnRegion *const region = &regions[i];
+    if (region->x == x && region->width == width &&
+        region->y + region->height == y) {
+      region->height += height;
+      return;
+    }
+  }
+  CnnRegion *const region = &regions[(*num_regions)++];
+  assert(*num_regions <= CNN_TILE_MAX_REGIONS);
+  region->x = x;
+  region->y = y;
+  region->width = width;
+  region->height = height;
+}
+
+// Copies the width x height region at (x, y) of buf, which holds the samples
+// of plane p with a stride of its width, to the frame.
+static void copy_region_to_frame(const AV1CnnSync *cnn_sync,
+                                 const AV1CnnPlane *p, const uint8_t *buf,
+                                 int x, int y, int width, int height) {
+  const int bytes_per_sample = cnn_sync->highbd ? 2 : 1;
+  const int stride = p->width * bytes_per_sample;
+  const uint8_t *s =
+      buf + p->buf_offset + (size_t)y * stride + x * bytes_per_sample;
+  uint8_t *d =
+      cnn_sync->highbd ? (uint8_t *)CONVERT_TO_SHORTPTR(p->dst) : p->dst;
+  d += ((size_t)y * p->dst_stride + x) * bytes_per_sample;
+  for (int r = 0; r < height; ++r) {
+    memcpy(d, s, width * bytes_per_sample);
+    s += stride;
+    d += p->dst_stride * bytes_per_sample;
+  }
+}
+
+// Returns 1 if the width x height region at (x, y) of plane p was restored
+// by the last frame from the same input as far as the model sees, and copies
+// the output of then to it.
+static int reuse_prev_region(const AV1CnnSync *cnn_sync, const AV1CnnPlane *p,
+                             int x, int y, int width, int height) {
+  const int bytes_per_sample = cnn_sync->highbd ? 2 : 1;
+  const int halo = av1_cnn_model_halo(p->model);
+  const int ctx_x = AOMMAX(x - halo, 0);
+  const int ctx_y = AOMMAX(y - halo, 0);
+  const int ctx_w = AOMMIN(x + width + halo, p->width) - ctx_x;
+  const int ctx_h = AOMMIN(y + height + halo, p->height) - ctx_y;
+  const int stride = p->width * bytes_per_sample;
+  const uint8_t *const src = cnn_sync->src_buf + p->buf_offset;
+  const uint8_t *const prev_src = cnn_sync->prev_src + p->buf_offset;
+
+  for (int r = ctx_y; r < ctx_y + ctx_h; ++r) {
+    const size_t offset = (size_t)r * stride + ctx_x * bytes_per_sample;
+    if (memcmp(src + offset, prev_src + offset, ctx_w * bytes_per_sample))
+      return 0;
+  }
+
+  copy_region_to_frame(cnn_sync, p, cnn_sync->prev_dst, x, y, width, height);
+  return 1;
+}
+
+// Restores the active superblocks of the tile, unless the output of the last
+// frame can be reused. Runs of adjacent superblocks are restored as regions,
+// merged with the runs of the same columns in the rows above, and gathered
+// into one batch. Every region pays for its halo though, so when the context
+// of the regions adds up to more than that of the tile, the tile is restored
+// whole instead and the superblocks to skip are put back.
+int av1_cnn_restore_tile(AV1CnnSync *cnn_sync, const AV1CnnMTInfo *job,
+                         CnnWorkspace *ws) {
+  const AV1CnnPlane *const p = &cnn_sync->planes[job->plane];
+  // Superblock size in the samples of the plane.
+  const int sb_w_log2 = cnn_sync->sb_size_log2 - p->ss_x;
+  const int sb_h_log2 = cnn_sync->sb_size_log2 - p->ss_y;
+  const int x_end = job->x + job->width;
+  const int y_end = job->y + job->height;
+  const int sb_col_start = job->x >> sb_w_log2;
+  const int sb_col_end = ((x_end - 1) >> sb_w_log2) + 1;
+  const int sb_row_start = job->y >> sb_h_log2;
+  const int sb_row_end = ((y_end - 1) >> sb_h_log2) + 1;
+  const int can_reuse =
+      p->prev_model == p->model &&
+      p->prev_act_format == p->model->act_format &&
+      p->prev_width == p->width &&
+      p->prev_height == p->height &&
+      cnn_sync->prev_highbd == cnn_sync->highbd &&
+      cnn_sync->prev_bit_depth == cnn_sync->bit_depth &&
+      cnn_sync->prev_sb_size_log2 == cnn_sync->sb_size_log2;
+  uint8_t sb_state[CNN_TILE_MAX_SBS][CNN_TILE_MAX_SBS];
+  CnnRegion regions[CNN_TILE_MAX_REGIONS];
+  int num_regions = 0;
+
+  assert(sb_col_end - sb_col_start <= CNN_TILE_MAX_SBS);
+  assert(sb_row_end - sb_row_start <= CNN_TILE_MAX_SBS);
+  for (int sb_row = sb_row_start; sb_row < sb_row_end; ++sb_row) {
+    const int sb_offset = sb_row * cnn_sync->sb_cols;
+    const int y = AOMMAX(sb_row << sb_h_log2, job->y);
+    const int height = AOMMIN((sb_row + 1) << sb_h_log2, y_end) - y;
+    uint8_t *const state = sb_state[sb_row - sb_row_start];
+    for (int sb_col = sb_col_start; sb_col < sb_col_end; ++sb_col) {
+      const int x = AOMMAX(sb_col << sb_w_log2, job->x);
+      const int width = AOMMIN((sb_col + 1) << sb_w_log2, x_end) - x;
+      if (!cnn_sync->sb_mask[sb_offset + sb_col]) {
+        state[sb_col - sb_col_start] = CNN_SB_SKIP;
+      } else if (can_reuse && cnn_sync->prev_sb_mask[sb_offset + sb_col] &&
+                 reuse_prev_region(cnn_sync, p, x, y, width, height)) {
+        state[sb_col - sb_col_start] = CNN_SB_REUSE;
+      } else {
+        state[sb_col - sb_col_start] = CNN_SB_RUN;
+      }
+    }
+
+    for (int sb_col = sb_col_start; sb_col < sb_col_end;) {
+      if (state[sb_col - sb_col_start] != CNN_SB_RUN) {
+        ++sb_col;
+        continue;
+      }
+      const int run_start = sb_col;
+      while (sb_col < sb_col_end && state[sb_col - sb_col_start] == CNN_SB_RUN)
+        ++sb_col;
+      const int x = AOMMAX(run_start << sb_w_log2, job->x);
+      add_region(regions, &num_regions, x, y,
+                 AOMMIN(sb_col << sb_w_log2, x_end) - x, height);
+    }
+  }
+
+  uint8_t *const src_buf = cnn_sync->src_buf + p->buf_offset;
+  const uint8_t *const src =
+      cnn_sync->highbd ? CONVERT_TO_BYTEPTR(src_buf) : src_buf;
+  const CnnRegion tile = { job->x, job->y, job->width, job->height };
+  if (num_regions <= 1 ||
+      av1_cnn_regions_context_area(p->model, regions, num_regions, p->width,
+                                   p->height) <
+          av1_cnn_regions_context_area(p->model, &tile, 1, p->width,
+                                       p->height)) {
+    return av1_cnn_restore_regions(p->model, src, p->width, p->dst,
+                                   p->dst_stride, p->width, p->height,
+                                   regions, num_regions, cnn_sync->highbd,
+                                   cnn_sync->bit_depth, ws);
+  }
+
+  // The reused superblocks restore to the output they already hold.
+  if (av1_cnn_restore_regions(p->model, src, p->width, p->dst, p->dst_stride,
+                              p->width, p->height, &tile, 1, cnn_sync->highbd,
+                              cnn_sync->bit_depth, ws))
+    return -1;
+  for (int sb_row = sb_row_start; sb_row < sb_row_end; ++sb_row) {
+    const int y = AOMMAX(sb_row << sb_h_log2, job->y);
+    const int height = AOMMIN((sb_row + 1) << sb_h_log2, y_end) - y;
+    for (int sb_col = sb_col_start; sb_col < sb_col_end; ++sb_col) {
+      if (sb_state[sb_row - sb_row_start][sb_col - sb_col_start] !=
+          CNN_SB_SKIP)
+        continue;
+      const int x = AOMMAX(sb_col << sb_w_log2, job->x);
+      copy_region_to_frame(cnn_sync, p, cnn_sync->src_buf, x, y,
+                           AOMMIN((sb_col + 1) << sb_w_log2, x_end) - x,
+                           height);
+    }
+  }
+  return 0;
+}
+
+int av1_cnn_restore_rows_needed(const AV1CnnSync *cnn_sync,
+                                const AV1CnnMTInfo *job) {
+  const AV1CnnPlane *const p = &cnn_sync->planes[job->plane];
+  const int rows =
+      AOMMIN(job->y + job->height + av1_cnn_model_halo(p->model), p->height);
+  // The last rows of a subsampled plane may cover one luma row only.
+  return rows == p->height ? cnn_sync->planes[0].height : rows << p->ss_y;
+}
+
+// Copies a plane between the frame and a buffer of the plane with a stride
+// of width samples, in the direction to_frame says.
+static void copy_cnn_plane(const AV1CnnSync *cnn_sync, const AV1CnnPlane *p,
+                           uint8_t *buf, int to_frame) {
+  const int bytes_per_sample = cnn_sync->highbd ? 2 : 1;
+  uint8_t *frame =
+      cnn_sync->highbd ? (uint8_t *)CONVERT_TO_SHORTPTR(p->dst) : p->dst;
+  buf += p->buf_offset;
+  for (int r = 0; r < p->height; ++r) {
+    if (to_frame) {
+      memcpy(frame, buf, p->width * bytes_per_sample);
+    } else {
+      memcpy(buf, frame, p->width * bytes_per_sample);
+    }
+    frame += p->dst_stride * bytes_per_sample;
+    buf += p->width * bytes_per_sample;
+  }
+}
+
+void av1_cnn_restore_finish(AV1CnnSync *cnn_sync) {
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    AV1CnnPlane *const p = &cnn_sync->planes[plane];
+    p->prev_model = plane < cnn_sync->num_planes ? p->model : NULL;
+    if (p->prev_model == NULL) continue;
+    p->prev_act_format = p->model->act_format;
+    copy_cnn_plane(cnn_sync, p, cnn_sync->prev_dst, 0);
+    p->prev_width = p->width;
+    p->prev_height = p->height;
+  }
+
+  uint8_t *const src_buf = cnn_sync->src_buf;
+  cnn_sync->src_buf = cnn_sync->prev_src;
+  cnn_sync->prev_src = src_buf;
+  memcpy(cnn_sync->prev_sb_mask, cnn_sync->sb_mask,
+         cnn_sync->sb_rows * cnn_sync->sb_cols);
+  cnn_sync->prev_highbd = cnn_sync->highbd;
+  cnn_sync->prev_bit_depth = cnn_sync->bit_depth;
+  cnn_sync->prev_sb_size_log2 = cnn_sync->sb_size_log2;
+}
+
+void av1_cnn_restore_undo_plane(AV1CnnSync *cnn_sync, int plane) {
+  AV1CnnPlane *const p = &cnn_sync->planes[plane];
+  if (p->prev_model == NULL) return;
+  // av1_cnn_restore_finish() has swapped the input into prev_src.
+  copy_cnn_plane(cnn_sync, p, cnn_sync->prev_src, 1);
+  p->prev_model = NULL;
+}
+
+void av1_cnn_restore_get_stats(const AV1CnnSync *cnn_sync,
+                               AV1CnnMaskStats *stats) {
+  const AV1CnnPlane *const luma = &cnn_sync->planes[0];
+  const int sb_size = 1 << cnn_sync->sb_size_log2;
+  av1_zero(*stats);
+  stats->pixels = (int64_t)luma->width * luma->height;
+  for (int sb_row = 0; sb_row < cnn_sync->sb_rows; ++sb_row) {
+    const int h = AOMMIN(sb_size, luma->height - sb_row * sb_size);
+    for (int sb_col = 0; sb_col < cnn_sync->sb_cols; ++sb_col) {
+      if (!cnn_sync->sb_mask[sb_row * cnn_sync->sb_cols + sb_col]) continue;
+      const int w = AOMMIN(sb_size, luma->width - sb_col * sb_size);
+      stats->active_sb_count++;
+      stats->active_pixels += w * h;
+    }
+  }
+  stats->sb_count = cnn_sync->sb_rows * cnn_sync->sb_cols;
+}
+
+// Tile-based multi-threaded CNN restoration hook. Returns 0 if a tile could
+// not be restored.
+static int cnn_restore_worker(AV1CnnSync *const cnn_sync, CnnWorkspace *ws) {
+  AV1CnnMTInfo *cur_job_info;
+
+  while ((cur_job_info = get_cnn_job_info(cnn_sync)) != NULL) {
+    if (av1_cnn_restore_tile(cnn_sync, cur_job_info, ws)) return 0;
+  }
+  return 1;
+}
+
+void av1_cnn_restore_frame_launch(YV12_BUFFER_CONFIG *frame, AV1_COMMON *cm,
+                                  const CnnModel *const *models,
+                                  AVxWorker *workers, int num_workers,
+                                  AV1CnnSync *cnn_sync) {
+  const AVxWorkerInterface *const winterface = aom_get_worker_interface();
+  struct aom_usec_timer timer;
+
+  aom_usec_timer_start(&timer);
+  av1_cnn_restore_init(cnn_sync, frame, cm, models);
+  // The calling thread takes the workspace after those of the workers.
+  av1_cnn_restore_alloc_workspaces(cnn_sync, cm, num_workers + 1);
+  // Every tile reads context from its neighbours, so they all have to see
+  // the plane as it was before restoration.
+  av1_cnn_restore_copy_rows(cnn_sync, 0, cnn_sync->planes[0].height);
+  av1_cnn_restore_update_mask(cnn_sync, cm, 0, cnn_sync->sb_rows);
+  aom_usec_timer_mark(&timer);
+  cnn_sync->time_prepare += aom_usec_timer_elapsed(&timer);
+
+  aom_usec_timer_start(&cnn_sync->inference_timer);
+  for (int i = 0; i < num_workers; ++i) {
+    AVxWorker *const worker = &workers[i];
+
+    worker->hook = (AVxWorkerHook)cnn_restore_worker;
+    worker->data1 = cnn_sync;
+    worker->data2 = &cnn_sync->workspaces[i];
+
+    // Start CNN restoration
+    winterface->launch(worker);
+  }
+}
+
+void av1_cnn_restore_frame_sync(AV1_COMMON *cm, AVxWorker *workers,
+                                int num_workers, AV1CnnSync *cnn_sync) {
+  const AVxWorkerInterface *const winterface = aom_get_worker_interface();
+  struct aom_usec_timer timer;
+  int had_error =
+      !cnn_restore_worker(cnn_sync, &cnn_sync->workspaces[num_workers]);
+
+  // Wait till all tiles are finished
+  for (int i = 0; i < num_workers; ++i) {
+    had_error |= !winterface->sync(&workers[i]);
+  }
+  aom_usec_timer_mark(&cnn_sync->inference_timer);
+  cnn_sync->time_inference +=
+      aom_usec_timer_elapsed(&cnn_sync->inference_timer);
+
+  if (had_error)
+    aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
+                       "Failed to allocate CNN restoration buffers");
+
+  aom_usec_timer_start(&timer);
+  av1_cnn_restore_finish(cnn_sync);
+  aom_usec_timer_mark(&timer);
+  cnn_sync->time_write_back += aom_usec_timer_elapsed(&timer);
+}
+
+void av1_cnn_restore_frame_mt(YV12_BUFFER_CONFIG *frame, AV1_COMMON *cm,
+                              const CnnModel *const *models,
+                              AVxWorker *workers, int num_workers,
+                              AV1CnnSync *cnn_sync) {
+  // The last worker is the calling thread.
+  num_workers = AOMMAX(num_workers, 1) - 1;
+  av1_cnn_restore_frame_launch(frame, cm, models, workers, num_workers,
+                               cnn_sync);
+  av1_cnn_restore_frame_sync(cm, workers, num_workers, cnn_sync);
+}
+#endif  // CONFIG_CNN_RESTORATION
@@ -15,6 +15,10 @@
 #include "config/aom_config.h"
 
 #include "av1/common/av1_loopfilter.h"
+#if CONFIG_CNN_RESTORATION
+#include "av1/common/cnn_restoration.h"
+#include "aom_ports/aom_timer.h"
+#endif  // CONFIG_CNN_RESTORATION
 #include "aom_util/aom_thread.h"
 
 #ifdef __cplusplus
@@ -97,6 +101,104 @@ typedef struct AV1LrSyncData {
   int jobs_dequeued;
 } AV1LrSync;
 
+#if CONFIG_CNN_RESTORATION
+// A tile of a plane, in the samples of that plane.
+typedef struct AV1CnnMTInfo {
+  int x;
+  int y;
+  int width;
+  int height;
+  int plane;
+} AV1CnnMTInfo;
+
+// A plane of the frame being restored.
+typedef struct AV1CnnPlane {
+  // NULL if the plane is left as it is.
+  const CnnModel *model;
+  uint8_t *dst;
+  int dst_stride;
+  int width;
+  int height;
+  int ss_x;
+  int ss_y;
+  // Byte offset of the plane in src_buf, prev_src and prev_dst, which hold
+  // it with a stride of width samples.
+  size_t buf_offset;
+
+  // Model, activation storage and size of the plane in the last frame, the
+  // model being NULL if the plane was not restored.
+  const CnnModel *prev_model;
+  CNN_ACT_FORMAT prev_act_format;
+  int prev_width;
+  int prev_height;
+} AV1CnnPlane;
+
+// CNN restoration tile scheduling. The tiles of all planes are independent
+// of each other and share one job queue, so only the queue needs to be
+// synchronized.
+typedef struct AV1CnnSyncData {
+#if CONFIG_MULTITHREAD
+  pthread_mutex_t *job_mutex;
+#endif
+  AV1CnnMTInfo *job_queue;
+  int max_jobs;
+  int jobs_enqueued;
+  int jobs_dequeued;
+
+  // Copy of the planes taken before any tile is written back, which the
+  // tiles read their context from.
+  uint8_t *src_buf;
+  size_t src_buf_size;
+
+  // Planes of the frame being restored. Luma comes first and sets the
+  // superblock grid.
+  AV1CnnPlane planes[MAX_MB_PLANE];
+  int num_planes;
+  int highbd;
+  int bit_depth;
+
+  // Whether each superblock of the frame is restored, in raster order (see
+  // av1_cnn_sb_active()). The tiles of every plane skip the others.
+  uint8_t *sb_mask;
+  int sb_mask_size;
+  int sb_size_log2;
+  int sb_cols;
+  int sb_rows;
+
+  // Input, output and mask of the last frame restored. The output of an
+  // active superblock of a plane is taken from there if the input around it,
+  // as far as the model sees, and the model are the same as then.
+  uint8_t *prev_src;
+  uint8_t *prev_dst;
+  uint8_t *prev_sb_mask;
+  int prev_highbd;
+  int prev_bit_depth;
+  int prev_sb_size_log2;
+
+  // Restoration buffers of each worker, kept across tiles and frames.
+  CnnWorkspace *workspaces;
+  int num_workspaces;
+
+  // Microseconds spent in each stage of av1_cnn_restore_frame_mt(), summed
+  // over all frames: taking the input copy and the superblock mask, running
+  // the tiles (which write their restored pixels to the frame as they go),
+  // and keeping the restored plane for the next frame.
+  uint64_t time_prepare;
+  uint64_t time_inference;
+  uint64_t time_write_back;
+  // Times the tiles from av1_cnn_restore_frame_launch() on.
+  struct aom_usec_timer inference_timer;
+} AV1CnnSync;
+
+typedef struct AV1CnnMaskStats {
+  int sb_count;
+  int active_sb_count;
+  // Luma pixels of the active superblocks, out of width * height.
+  int64_t active_pixels;
+  int64_t pixels;
+} AV1CnnMaskStats;
+#endif  // CONFIG_CNN_RESTORATION
+
 // Deallocate loopfilter synchronization related mutex and data.
 void av1_loop_filter_dealloc(AV1LfSync *lf_sync);
 
@@ -112,6 +214,88 @@ void av1_loop_restoration_filter_frame_mt(YV12_BUFFER_CONFIG *frame,
                                           void *lr_ctxt);
 void av1_loop_restoration_dealloc(AV1LrSync *lr_sync, int num_workers);
 
+#if CONFIG_CNN_RESTORATION
+// Restores the planes of frame with the CNN, models holding the model of
+// each plane, or NULL for the planes to leave as they are. The planes are
+// split into tiles that carry av1_cnn_model_halo() samples of context, so
+// the result is bit for bit that of restoring each plane whole, whatever the
+// tiling and the number of workers. The
+// tiles of all planes are queued together, a band of luma tiles being
+// followed by the chroma tiles of the same rows. With num_workers <= 1 the
+// calling thread restores all tiles itself and workers may be NULL.
+void av1_cnn_restore_frame_mt(YV12_BUFFER_CONFIG *frame, struct AV1Common *cm,
+                              const CnnModel *const *models,
+                              AVxWorker *workers, int num_workers,
+                              AV1CnnSync *cnn_sync);
+// av1_cnn_restore_frame_mt() in two halves, for callers with other work to do
+// while the frame is restored. av1_cnn_restore_frame_launch() prepares the
+// frame and starts the num_workers workers on the tiles in the background.
+// av1_cnn_restore_frame_sync() restores the tiles still left on the calling
+// thread, waits for the workers and keeps the planes for the next frame.
+// Nothing may touch the frame in between, and the same workers must be
+// passed to both.
+void av1_cnn_restore_frame_launch(YV12_BUFFER_CONFIG *frame,
+                                  struct AV1Common *cm,
+                                  const CnnModel *const *models,
+                                  AVxWorker *workers, int num_workers,
+                                  AV1CnnSync *cnn_sync);
+void av1_cnn_restore_frame_sync(struct AV1Common *cm, AVxWorker *workers,
+                                int num_workers, AV1CnnSync *cnn_sync);
+void av1_cnn_restore_dealloc(AV1CnnSync *cnn_sync);
+
+// Allocates up front everything restoring all planes of frames of up to
+// width x height pixels with any of models on num_workers workers takes, so
+// that the frames themselves allocate nothing.
+void av1_cnn_restore_reserve(AV1CnnSync *cnn_sync, struct AV1Common *cm,
+                             const CnnModelRegistry *models, int width,
+                             int height, int highbd, int num_workers);
+
+// Building blocks of av1_cnn_restore_frame_mt() for callers that schedule the
+// tiles themselves. av1_cnn_restore_init() sets up the job queue with the
+// tiles in the order av1_cnn_restore_frame_mt() describes,
+// av1_cnn_restore_copy_rows() takes the copy of a band of luma rows, and of
+// the chroma rows they cover, the tiles read their context from, and
+// av1_cnn_restore_tile() restores one tile with the buffers of a worker,
+// returning 0 on success. av1_cnn_restore_update_mask() marks which
+// superblocks in a band of superblock rows are restored. A tile may only be
+// restored once the first av1_cnn_restore_rows_needed() luma rows have been
+// copied and the mask of the superblock rows it covers is set.
+// av1_cnn_restore_alloc_workspaces() makes cnn_sync->workspaces hold at least
+// one workspace per worker.
+void av1_cnn_restore_init(AV1CnnSync *cnn_sync, YV12_BUFFER_CONFIG *frame,
+                          struct AV1Common *cm, const CnnModel *const *models);
+// av1_cnn_restore_init() for planes that are not part of a frame of the codec.
+// Takes the model, dst, dst_stride, size and subsampling of each plane from
+// planes, and the superblock size, which is 1 << sb_size_log2 luma samples.
+// The superblock mask is left to the caller. Returns 0 on success.
+int av1_cnn_restore_init_planes(AV1CnnSync *cnn_sync,
+                                const AV1CnnPlane *planes, int num_planes,
+                                int highbd, int bit_depth, int sb_size_log2);
+void av1_cnn_restore_alloc_workspaces(AV1CnnSync *cnn_sync,
+                                      struct AV1Common *cm, int num_workers);
+void av1_cnn_restore_copy_rows(AV1CnnSync *cnn_sync, int row_start,
+                               int row_end);
+void av1_cnn_restore_update_mask(AV1CnnSync *cnn_sync,
+                                 const struct AV1Common *cm, int sb_row_start,
+                                 int sb_row_end);
+int av1_cnn_restore_rows_needed(const AV1CnnSync *cnn_sync,
+                                const AV1CnnMTInfo *job);
+int av1_cnn_restore_tile(AV1CnnSync *cnn_sync, const AV1CnnMTInfo *job,
+                         CnnWorkspace *ws);
+// Keeps the restored planes for the next frame to reuse. Must only be called
+// once all tiles are restored.
+void av1_cnn_restore_finish(AV1CnnSync *cnn_sync);
+
+// Puts the input of a plane of the last restored frame back in place of its
+// output, and keeps the next frame from reusing that output. Must only be
+// called after av1_cnn_restore_finish().
+void av1_cnn_restore_undo_plane(AV1CnnSync *cnn_sync, int plane);
+
+// Counts the superblocks the last restored frame ran the CNN on.
+void av1_cnn_restore_get_stats(const AV1CnnSync *cnn_sync,
+                               AV1CnnMaskStats *stats);
+#endif  // CONFIG_CNN_RESTORATION
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#include <immintrin.h>
+
+#include "config/aom_config.h"
+#include "config/av1_rtcd.h"
+
+#include "aom_dsp/x86/synonyms.h"
+#include "av1/common/cnn_restoration.h"
+
+// Number of horizontally adjacent output pixels computed together. Each
+// broadcast input sample is reused for 16 output channels and each pair of
+// weight vectors for CNN_PIXELS pixels, which keeps 12 accumulators live.
+#define CNN_PIXELS 6
+
+// Computes n (<= CNN_PIXELS) output pixels for the CNN_OUT_BLOCK (16) output
+// channels starting at channel ob.
+static INLINE void conv_pixels_16(const float *input, int in_stride,
+                                  int in_channels, float *output,
+                                  int out_channels, const float *weights,
+                                  const float *bias, int relu, int ob,
+                                  const int n) {
+  __m256 acc[CNN_PIXELS][2];
+  const __m256 b0 = _mm256_loadu_ps(bias + ob);
+  const __m256 b1 = _mm256_loadu_ps(bias + ob + 8);
+  for (int p = 0; p < n; ++p) {
+    acc[p][0] = b0;
+    acc[p][1] = b1;
+  }
+
+  for (int ky = 0; ky < CNN_KERNEL_SIZE; ++ky) {
+    for (int kx = 0; kx < CNN_KERNEL_SIZE; ++kx) {
+      const float *const in =
+          input + (ky - 1) * in_stride + (kx - 1) * in_channels;
+      const float *w =
+          weights + ((ob / CNN_OUT_BLOCK) * CNN_KERNEL_TAPS +
+                     ky * CNN_KERNEL_SIZE + kx) *
+                        in_channels * CNN_OUT_BLOCK;
+      for (int i = 0; i < in_channels; ++i, w += CNN_OUT_BLOCK) {
+        const __m256 w0 = _mm256_loadu_ps(w);
+        const __m256 w1 = _mm256_loadu_ps(w + 8);
+        for (int p = 0; p < n; ++p) {
+          const __m256 v = _mm256_broadcast_ss(in + p * in_channels + i);
+          acc[p][0] = _mm256_add_ps(acc[p][0], _mm256_mul_ps(v, w0));
+          acc[p][1] = _mm256_add_ps(acc[p][1], _mm256_mul_ps(v, w1));
+        }
+      }
+    }
+  }
+
+  const __m256 zero = _mm256_setzero_ps();
+  for (int p = 0; p < n; ++p) {
+    float *const out = output + p * out_channels + ob;
+    if (relu) {
+      acc[p][0] = _mm256_max_ps(acc[p][0], zero);
+      acc[p][1] = _mm256_max_ps(acc[p][1], zero);
+    }
+    _mm256_storeu_ps(out, acc[p][0]);
+    _mm256_storeu_ps(out + 8, acc[p][1]);
+  }
+}
+
+// Single output channel (the reconstruction layer): vectorize along 8
+// horizontally adjacent output pixels instead, gathering their inputs, so that
+// each pixel sums its products in the same order as the C version.
+static void conv_single_output(const float *input, int in_stride,
+                               int in_channels, float *output, int out_stride,
+                               int width, int height, const float *weights,
+                               const float *bias, int relu) {
+  const __m256i idx =
+      _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                         _mm256_set1_epi32(in_channels));
+  const __m256 b = _mm256_set1_ps(bias[0]);
+  const __m256 zero = _mm256_setzero_ps();
+  for (int r = 0; r < height; ++r) {
+    const float *const in_row = input + r * in_stride;
+    float *const out_row = output + r * out_stride;
+    int c = 0;
+    for (; c + 8 <= width; c += 8) {
+      __m256 acc = b;
+      for (int ky = 0; ky < CNN_KERNEL_SIZE; ++ky) {
+        for (int kx = 0; kx < CNN_KERNEL_SIZE; ++kx) {
+          const float *const in =
+              in_row + (ky - 1) * in_stride + (c + kx - 1) * in_channels;
+          const float *const w =
+              weights + (ky * CNN_KERNEL_SIZE + kx) * in_channels;
+          for (int i = 0; i < in_channels; ++i) {
+            const __m256 v = _mm256_i32gather_ps(in + i, idx, 4);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(v, _mm256_set1_ps(w[i])));
+          }
+        }
+      }
+      if (relu) acc = _mm256_max_ps(acc, zero);
+      _mm256_storeu_ps(out_row + c, acc);
+    }
+    if (c < width) {
+      av1_cnn_convolve_3x3_c(in_row + c * in_channels, in_stride, in_channels,
+                             out_row + c, out_stride, 1, width - c, 1,
+                             weights, bias, relu);
+    }
+  }
+}
+
+void av1_cnn_convolve_3x3_avx2(const float *input, int in_stride,
+                               int in_channels, float *output, int out_stride,
+                               int out_channels, int width, int height,
+                               const float *weights, const float *bias,
+                               int relu) {
+  if (out_channels == 1) {
+    conv_single_output(input, in_stride, in_channels, output, out_stride, width,
+                       height, weights, bias, relu);
+    return;
+  }
+  if (out_channels % CNN_OUT_BLOCK) {
+    av1_cnn_convolve_3x3_c(input, in_stride, in_channels, output, out_stride,
+                           out_channels, width, height, weights, bias, relu);
+    return;
+  }
+
+  for (int r = 0; r < height; ++r) {
+    const float *const in_row = input + r * in_stride;
+    float *const out_row = output + r * out_stride;
+    int c = 0;
+    for (; c + CNN_PIXELS <= width; c += CNN_PIXELS) {
+      for (int ob = 0; ob < out_channels; ob += CNN_OUT_BLOCK) {
+        conv_pixels_16(in_row + c * in_channels, in_stride, in_channels,
+                       out_row + c * out_channels, out_channels, weights, bias,
+                       relu, ob, CNN_PIXELS);
+      }
+    }
+    for (; c < width; ++c) {
+      for (int ob = 0; ob < out_channels; ob += CNN_OUT_BLOCK) {
+        conv_pixels_16(in_row + c * in_channels, in_stride, in_channels,
+                       out_row + c * out_channels, out_channels, weights, bias,
+                       relu, ob, 1);
+      }
+    }
+  }
+}
+
+// Number of horizontally adjacent output pixels computed together by the int8
+// kernel. Each vector of weights, 4 input channels for CNN_INT8_OUT_BLOCK (8)
+// output channels, is reused for all of them.
+#define CNN_INT8_PIXELS 8
+
+// Computes n (<= CNN_INT8_PIXELS) output pixels for the CNN_INT8_OUT_BLOCK
+// output channels starting at channel ob.
+static INLINE void conv_pixels_int8(const uint8_t *input, int in_stride,
+                                    int in_channels, uint8_t *output,
+                                    int out_channels, const int8_t *weights,
+                                    const int32_t *bias, const float *scale,
+                                    int ob, const int n) {
+  const int in_groups = in_channels >> 2;
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i acc[CNN_INT8_PIXELS];
+  const __m256i b = _mm256_loadu_si256((const __m256i *)(bias + ob));
+  for (int p = 0; p < n; ++p) acc[p] = b;
+
+  for (int ky = 0; ky < CNN_KERNEL_SIZE; ++ky) {
+    for (int kx = 0; kx < CNN_KERNEL_SIZE; ++kx) {
+      const uint8_t *const in =
+          input + (ky - 1) * in_stride + (kx - 1) * in_channels;
+      const int8_t *w =
+          weights + ((ob / CNN_INT8_OUT_BLOCK) * CNN_KERNEL_TAPS +
+                     ky * CNN_KERNEL_SIZE + kx) *
+                        in_groups * CNN_INT8_OUT_BLOCK * 4;
+      for (int g = 0; g < in_groups; ++g, w += CNN_INT8_OUT_BLOCK * 4) {
+        const __m256i wv = _mm256_loadu_si256((const __m256i *)w);
+        for (int p = 0; p < n; ++p) {
+          // The same 4 input channels for every output channel. The weights
+          // are small enough for the pair sums not to saturate.
+          const uint8_t *const a = in + p * in_channels + 4 * g;
+          const __m256i v = _mm256_broadcastd_epi32(xx_loadl_32(a));
+          const __m256i prod =
+              _mm256_madd_epi16(_mm256_maddubs_epi16(v, wv), ones);
+          acc[p] = _mm256_add_epi32(acc[p], prod);
+        }
+      }
+    }
+  }
+
+  const __m256 s = _mm256_loadu_ps(scale + ob);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 max = _mm256_set1_ps(255.0f);
+  for (int p = 0; p < n; ++p) {
+    const __m256 v = _mm256_min_ps(
+        _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(acc[p]), s), zero),
+        max);
+    const __m256i q = _mm256_cvtps_epi32(v);
+    const __m128i q16 = _mm_packs_epi32(_mm256_castsi256_si128(q),
+                                        _mm256_extracti128_si256(q, 1));
+    _mm_storel_epi64((__m128i *)(output + p * out_channels + ob),
+                     _mm_packus_epi16(q16, q16));
+  }
+}
+
+void av1_cnn_convolve_3x3_int8_avx2(const uint8_t *input, int in_stride,
+                                    int in_channels, uint8_t *output,
+                                    int out_stride, int out_channels,
+                                    int width, int height,
+                                    const int8_t *weights, const int32_t *bias,
+                                    const float *scale) {
+  if ((in_channels & 3) || out_channels % CNN_INT8_OUT_BLOCK) {
+    av1_cnn_convolve_3x3_int8_c(input, in_stride, in_channels, output,
+                                out_stride, out_channels, width, height,
+                                weights, bias, scale);
+    return;
+  }
+
+  for (int r = 0; r < height; ++r) {
+    const uint8_t *const in_row = input + r * in_stride;
+    uint8_t *const out_row = output + r * out_stride;
+    int c = 0;
+    for (; c + CNN_INT8_PIXELS <= width; c += CNN_INT8_PIXELS) {
+      for (int ob = 0; ob < out_channels; ob += CNN_INT8_OUT_BLOCK) {
+        conv_pixels_int8(in_row + c * in_channels, in_stride, in_channels,
+                         out_row + c * out_channels, out_channels, weights,
+                         bias, scale, ob, CNN_INT8_PIXELS);
+      }
+    }
+    for (; c < width; ++c) {
+      for (int ob = 0; ob < out_channels; ob += CNN_INT8_OUT_BLOCK) {
+        conv_pixels_int8(in_row + c * in_channels, in_stride, in_channels,
+                         out_row + c * out_channels, out_channels, weights,
+                         bias, scale, ob, 1);
+      }
+    }
+  }
+}
+
+// Winograd F(4x4, 3x3) transforms of one dimension for 8 channels at a time,
+// see winograd_input_1d() and winograd_output_1d() in cnn_restoration.c.
+static INLINE void winograd_input_1d_avx2(const __m256 *x, int xs, __m256 *y,
+                                          int ys) {
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 four = _mm256_set1_ps(4.0f);
+  const __m256 five = _mm256_set1_ps(5.0f);
+  const __m256 x0 = x[0], x1 = x[xs], x2 = x[2 * xs];
+  const __m256 x3 = x[3 * xs], x4 = x[4 * xs], x5 = x[5 * xs];
+  const __m256 x34 = _mm256_add_ps(x3, x4);
+  const __m256 x4m3 = _mm256_sub_ps(x4, x3);
+  const __m256 x4m2 = _mm256_sub_ps(x4, x2);
+  y[0] = _mm256_add_ps(
+      _mm256_sub_ps(_mm256_mul_ps(four, x0), _mm256_mul_ps(five, x2)), x4);
+  y[ys] = _mm256_sub_ps(x34, _mm256_mul_ps(four, _mm256_add_ps(x1, x2)));
+  y[2 * ys] = _mm256_add_ps(x4m3, _mm256_mul_ps(four, _mm256_sub_ps(x1, x2)));
+  y[3 * ys] = _mm256_add_ps(x4m2, _mm256_mul_ps(two, _mm256_sub_ps(x3, x1)));
+  y[4 * ys] = _mm256_add_ps(x4m2, _mm256_mul_ps(two, _mm256_sub_ps(x1, x3)));
+  y[5 * ys] = _mm256_add_ps(
+      _mm256_sub_ps(_mm256_mul_ps(four, x1), _mm256_mul_ps(five, x3)), x5);
+}
+
+static INLINE void winograd_output_1d_avx2(const __m256 *m, int ms, __m256 *y,
+                                           int ys) {
+  const __m256 a = _mm256_add_ps(m[ms], m[2 * ms]);
+  const __m256 b = _mm256_sub_ps(m[ms], m[2 * ms]);
+  const __m256 c = _mm256_add_ps(m[3 * ms], m[4 * ms]);
+  const __m256 d = _mm256_sub_ps(m[3 * ms], m[4 * ms]);
+  y[0] = _mm256_add_ps(_mm256_add_ps(m[0], a), c);
+  y[ys] = _mm256_add_ps(b, _mm256_mul_ps(_mm256_set1_ps(2.0f), d));
+  y[2 * ys] = _mm256_add_ps(a, _mm256_mul_ps(_mm256_set1_ps(4.0f), c));
+  y[3 * ys] = _mm256_add_ps(
+      _mm256_add_ps(b, _mm256_mul_ps(_mm256_set1_ps(8.0f), d)), m[5 * ms]);
+}
+
+// Transforms the 6x6 block of inputs around the 4x4 block of outputs at
+// (x, y) into v[point * v_stride + i], 8 input channels at a time.
+static void winograd_input_tile_avx2(const float *input, int in_stride,
+                                     int in_channels, int x, int y, int width,
+                                     int height, float *v, int v_stride) {
+  for (int i = 0; i < in_channels; i += 8) {
+    __m256 d[6 * 6], t[6 * 6], u[6 * 6];
+    for (int r = 0; r < 6; ++r) {
+      const int in_y = y + r - 1;
+      for (int c = 0; c < 6; ++c) {
+        const int in_x = x + c - 1;
+        d[r * 6 + c] = in_y <= height && in_x <= width
+                           ? _mm256_loadu_ps(input + in_y * in_stride +
+                                             in_x * in_channels + i)
+                           : _mm256_setzero_ps();
+      }
+    }
+    for (int c = 0; c < 6; ++c) winograd_input_1d_avx2(d + c, 6, t + c, 6);
+    for (int r = 0; r < 6; ++r)
+      winograd_input_1d_avx2(t + r * 6, 1, u + r * 6, 1);
+    for (int p = 0; p < CNN_WINOGRAD_POINTS; ++p)
+      _mm256_storeu_ps(v + p * v_stride + i, u[p]);
+  }
+}
+
+// Multiplies the transformed inputs of n (<= CNN_WINOGRAD_TILES) blocks by
+// the transformed weights of one point, for the 16 output channels starting
+// at channel ob.
+static INLINE void winograd_multiply_16(const float *v, int in_channels,
+                                        const float *u, float *m,
+                                        int out_channels, int ob, const int n) {
+  __m256 acc[CNN_WINOGRAD_TILES][2];
+  for (int t = 0; t < n; ++t) {
+    acc[t][0] = _mm256_setzero_ps();
+    acc[t][1] = _mm256_setzero_ps();
+  }
+  for (int i = 0; i < in_channels; ++i) {
+    const __m256 w0 = _mm256_loadu_ps(u + i * out_channels + ob);
+    const __m256 w1 = _mm256_loadu_ps(u + i * out_channels + ob + 8);
+    for (int t = 0; t < n; ++t) {
+      const __m256 a = _mm256_broadcast_ss(v + t * in_channels + i);
+      acc[t][0] = _mm256_add_ps(acc[t][0], _mm256_mul_ps(a, w0));
+      acc[t][1] = _mm256_add_ps(acc[t][1], _mm256_mul_ps(a, w1));
+    }
+  }
+  for (int t = 0; t < n; ++t) {
+    _mm256_storeu_ps(m + t * out_channels + ob, acc[t][0]);
+    _mm256_storeu_ps(m + t * out_channels + ob + 8, acc[t][1]);
+  }
+}
+
+void av1_cnn_winograd_3x3_avx2(const float *input, int in_stride,
+                               int in_channels, float *output, int out_stride,
+                               int out_channels, int width, int height,
+                               const float *weights, const float *bias,
+                               int relu, float *scratch) {
+  if ((in_channels & 7) || out_channels % CNN_OUT_BLOCK) {
+    av1_cnn_winograd_3x3_c(input, in_stride, in_channels, output, out_stride,
+                           out_channels, width, height, weights, bias, relu,
+                           scratch);
+    return;
+  }
+
+  const int tiles = CNN_WINOGRAD_TILES;
+  const int v_stride = tiles * in_channels;
+  const int m_stride = tiles * out_channels;
+  float *const v = scratch;
+  float *const m = scratch + CNN_WINOGRAD_POINTS * v_stride;
+  const __m256 zero = _mm256_setzero_ps();
+
+  for (int y = 0; y < height; y += CNN_WINOGRAD_BLOCK) {
+    const int h = AOMMIN(CNN_WINOGRAD_BLOCK, height - y);
+    for (int x0 = 0; x0 < width; x0 += tiles * CNN_WINOGRAD_BLOCK) {
+      const int n = AOMMIN(tiles, (width - x0 + CNN_WINOGRAD_BLOCK - 1) /
+                                      CNN_WINOGRAD_BLOCK);
+      for (int t = 0; t < n; ++t) {
+        winograd_input_tile_avx2(input, in_stride, in_channels,
+                                 x0 + t * CNN_WINOGRAD_BLOCK, y, width, height,
+                                 v + t * in_channels, v_stride);
+      }
+
+      for (int p = 0; p < CNN_WINOGRAD_POINTS; ++p) {
+        for (int ob = 0; ob < out_channels; ob += CNN_OUT_BLOCK) {
+          winograd_multiply_16(v + p * v_stride, in_channels,
+                               weights + p * in_channels * out_channels,
+                               m + p * m_stride, out_channels, ob, n);
+        }
+      }
+
+      for (int t = 0; t < n; ++t) {
+        const int x = x0 + t * CNN_WINOGRAD_BLOCK;
+        const int w = AOMMIN(CNN_WINOGRAD_BLOCK, width - x);
+        for (int o = 0; o < out_channels; o += 8) {
+          __m256 mt[6 * 6], s[4 * 6], out[4 * 4];
+          for (int p = 0; p < CNN_WINOGRAD_POINTS; ++p)
+            mt[p] = _mm256_loadu_ps(m + p * m_stride + t * out_channels + o);
+          for (int c = 0; c < 6; ++c)
+            winograd_output_1d_avx2(mt + c, 6, s + c, 6);
+          for (int r = 0; r < 4; ++r)
+            winograd_output_1d_avx2(s + r * 6, 1, out + r * 4, 1);
+          const __m256 b = _mm256_loadu_ps(bias + o);
+          for (int r = 0; r < h; ++r) {
+            float *const dst =
+                output + (y + r) * out_stride + x * out_channels + o;
+            for (int c = 0; c < w; ++c) {
+              __m256 val = _mm256_add_ps(out[r * 4 + c], b);
+              if (relu) val = _mm256_max_ps(val, zero);
+              _mm256_storeu_ps(dst + c * out_channels, val);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void av1_cnn_load_bf16_avx2(const uint16_t *src, float *dst, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i v =
+        _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(v, 16)));
+  }
+  av1_cnn_load_bf16_c(src + i, dst + i, n - i);
+}
+
+// Rounds 8 floats to nearest even bfloat16, returned in the low halves of
+// the 32-bit lanes, see av1_cnn_store_bf16_c().
+static INLINE __m256i round_bf16(const float *src) {
+  const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(src));
+  const __m256i lsb =
+      _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+  const __m256i bias = _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff));
+  return _mm256_srli_epi32(_mm256_add_epi32(bits, bias), 16);
+}
+
+void av1_cnn_store_bf16_avx2(const float *src, uint16_t *dst, int n) {
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    // The packing interleaves the 128-bit lanes of the two inputs.
+    const __m256i v = _mm256_packus_epi32(round_bf16(src + i),
+                                          round_bf16(src + i + 8));
+    _mm256_storeu_si256((__m256i *)(dst + i),
+                        _mm256_permute4x64_epi64(v, 0xd8));
+  }
+  av1_cnn_store_bf16_c(src + i, dst + i, n - i);
+}
@@ -1863,7 +1863,8 @@ static void loop_restoration_read_sb_coeffs(const AV1_COMMON *const cm,
   }
 }
 
-static void setup_loopfilter(AV1_COMMON *cm, struct aom_read_bit_buffer *rb) {
+static void setup_loopfilter(AV1Decoder *pbi, struct aom_read_bit_buffer *rb) {
+  AV1_COMMON *const cm = &pbi->common;
   const int num_planes = av1_num_planes(cm);
   struct loopfilter *lf = &cm->lf;
   if (cm->allow_intrabc || cm->coded_lossless) {
@@ -1883,8 +1884,12 @@ static void setup_loopfilter(AV1_COMMON *cm, struct aom_read_bit_buffer *rb) {
   }
   lf->filter_level[0] = aom_rb_read_literal(rb, 6);
   lf->filter_level[1] = aom_rb_read_literal(rb, 6);
+  int chroma_levels = lf->filter_level[0] || lf->filter_level[1];
+#if CONFIG_CNN_RESTORATION
+  chroma_levels |= av1_cnn_frame_luma_only(cm, pbi->refresh_frame_flags);
+#endif  // CONFIG_CNN_RESTORATION
   if (num_planes > 1) {
-    if (lf->filter_level[0] || lf->filter_level[1]) {
+    if (chroma_levels) {
       lf->filter_level_u = aom_rb_read_literal(rb, 6);
       lf->filter_level_v = aom_rb_read_literal(rb, 6);
     }
@@ -3094,6 +3099,27 @@ static int tile_worker_hook(void *arg1, void *arg2) {
   return !td->xd.corrupted;
 }
 
+#if CONFIG_CNN_RESTORATION
+// Returns the next CNN tile if the rows it reads have been reconstructed and
+// copied, or NULL. Tiles are queued top to bottom, so the first one is the
+// least demanding. As the halo is at least one row, the superblock row below a
+// tile is decoded before the tile overwrites the pixels it predicts from.
+static const AV1CnnMTInfo *get_ready_cnn_job(AV1Decoder *const pbi) {
+  AV1DecRowMTInfo *frame_row_mt_info = &pbi->frame_row_mt_info;
+  AV1CnnSync *const cnn_sync = &pbi->cnn_sync;
+  const AV1CnnMTInfo *const job = cnn_sync->job_queue + cnn_sync->jobs_dequeued;
+  const int sb_size_log2 = pbi->common.seq_params.mib_size_log2 + MI_SIZE_LOG2;
+  const int rows_ready =
+      AOMMIN(frame_row_mt_info->cnn_sb_rows_ready << sb_size_log2,
+             cnn_sync->planes[0].height);
+  const int rows_needed = av1_cnn_restore_rows_needed(cnn_sync, job);
+
+  if (rows_needed > rows_ready) return NULL;
+  cnn_sync->jobs_dequeued++;
+  return job;
+}
+#endif  // CONFIG_CNN_RESTORATION
+
 static int get_next_job_info(AV1Decoder *const pbi,
                              AV1DecRowMTJobInfo *next_job_info,
                              int *end_of_frame) {
@@ -3118,6 +3144,26 @@ static int get_next_job_info(AV1Decoder *const pbi,
 
   memset(next_job_info, 0, sizeof(*next_job_info));
 
+#if CONFIG_CNN_RESTORATION
+  // CNN tiles are restored whenever there is no superblock row to decode, and
+  // the frame is only done once all of them are.
+  if (frame_row_mt_info->cnn_enabled && frame_row_mt_info->row_mt_exit != 1 &&
+      pbi->cnn_sync.jobs_dequeued < pbi->cnn_sync.jobs_enqueued) {
+    const int decode_done = frame_row_mt_info->mi_rows_decode_started ==
+                            frame_row_mt_info->mi_rows_to_decode;
+    if (decode_done || frame_row_mt_info->mi_rows_parse_done ==
+                           frame_row_mt_info->mi_rows_decode_started) {
+      next_job_info->cnn_job = get_ready_cnn_job(pbi);
+      if (next_job_info->cnn_job != NULL) {
+        next_job_info->job_available = 1;
+        return 1;
+      }
+      // Wait for the rows the next tile reads.
+      if (decode_done) return 0;
+    }
+  }
+#endif  // CONFIG_CNN_RESTORATION
+
   // Frame decode is completed or error is encountered.
   *end_of_frame = (frame_row_mt_info->mi_rows_decode_started ==
                    frame_row_mt_info->mi_rows_to_decode) ||
@@ -3196,6 +3242,39 @@ static INLINE void signal_parse_sb_row_done(AV1Decoder *const pbi,
 #endif
 }
 
+#if CONFIG_CNN_RESTORATION
+// Called once all tile columns have reconstructed the superblock row. Copies
+// it for the CNN and makes the CNN tiles that only read it and the rows above
+// available.
+static void signal_cnn_sb_row_done(AV1Decoder *const pbi, int sb_row) {
+  AV1DecRowMTInfo *frame_row_mt_info = &pbi->frame_row_mt_info;
+  AV1CnnSync *const cnn_sync = &pbi->cnn_sync;
+  const int sb_size_log2 = pbi->common.seq_params.mib_size_log2 + MI_SIZE_LOG2;
+
+  // No other thread accesses the copy of these rows or their mask before they
+  // are ready.
+  av1_cnn_restore_update_mask(cnn_sync, &pbi->common, sb_row, sb_row + 1);
+  av1_cnn_restore_copy_rows(
+      cnn_sync, AOMMIN(sb_row << sb_size_log2, cnn_sync->planes[0].height),
+      AOMMIN((sb_row + 1) << sb_size_log2, cnn_sync->planes[0].height));
+
+#if CONFIG_MULTITHREAD
+  pthread_mutex_lock(pbi->row_mt_mutex_);
+#endif
+  int *const sb_row_state = frame_row_mt_info->cnn_sb_row_state;
+  int *const sb_rows_ready = &frame_row_mt_info->cnn_sb_rows_ready;
+  sb_row_state[sb_row] = CNN_SB_ROW_COPIED;
+  while (*sb_rows_ready < frame_row_mt_info->cnn_sb_rows &&
+         sb_row_state[*sb_rows_ready] == CNN_SB_ROW_COPIED) {
+    ++*sb_rows_ready;
+  }
+#if CONFIG_MULTITHREAD
+  pthread_cond_broadcast(pbi->row_mt_cond_);
+  pthread_mutex_unlock(pbi->row_mt_mutex_);
+#endif
+}
+#endif  // CONFIG_CNN_RESTORATION
+
 static int row_mt_worker_hook(void *arg1, void *arg2) {
   DecWorkerData *const thread_data = (DecWorkerData *)arg1;
   AV1Decoder *const pbi = (AV1Decoder *)arg2;
@@ -3212,6 +3291,8 @@ static int row_mt_worker_hook(void *arg1, void *arg2) {
 #endif
     frame_row_mt_info->row_mt_exit = 1;
 #if CONFIG_MULTITHREAD
+    // Wake up the workers waiting for rows this one will not decode.
+    pthread_cond_broadcast(pbi->row_mt_cond_);
     pthread_mutex_unlock(pbi->row_mt_mutex_);
 #endif
     return 0;
@@ -3286,6 +3367,18 @@ static int row_mt_worker_hook(void *arg1, void *arg2) {
 
     if (end_of_frame) break;
 
+#if CONFIG_CNN_RESTORATION
+    if (next_job_info.cnn_job != NULL) {
+      CnnWorkspace *const ws =
+          &pbi->cnn_sync.workspaces[thread_data - pbi->thread_data];
+      if (av1_cnn_restore_tile(&pbi->cnn_sync, next_job_info.cnn_job, ws)) {
+        aom_internal_error(&thread_data->error_info, AOM_CODEC_MEM_ERROR,
+                           "Failed to allocate CNN restoration buffers");
+      }
+      continue;
+    }
+#endif  // CONFIG_CNN_RESTORATION
+
     int tile_row = next_job_info.tile_row;
     int tile_col = next_job_info.tile_col;
     int mi_row = next_job_info.mi_row;
@@ -3301,13 +3394,26 @@ static int row_mt_worker_hook(void *arg1, void *arg2) {
 
     decode_tile_sb_row(pbi, td, tile_info, mi_row);
 
+#if CONFIG_CNN_RESTORATION
+    const int sb_row = mi_row >> cm->seq_params.mib_size_log2;
+    int sb_row_done = 0;
+#endif  // CONFIG_CNN_RESTORATION
 #if CONFIG_MULTITHREAD
     pthread_mutex_lock(pbi->row_mt_mutex_);
 #endif
     dec_row_mt_sync->num_threads_working--;
+#if CONFIG_CNN_RESTORATION
+    if (frame_row_mt_info->cnn_enabled) {
+      sb_row_done =
+          ++frame_row_mt_info->cnn_sb_row_state[sb_row] == cm->tile_cols;
+    }
+#endif  // CONFIG_CNN_RESTORATION
 #if CONFIG_MULTITHREAD
     pthread_mutex_unlock(pbi->row_mt_mutex_);
 #endif
+#if CONFIG_CNN_RESTORATION
+    if (sb_row_done) signal_cnn_sb_row_done(pbi, sb_row);
+#endif  // CONFIG_CNN_RESTORATION
   }
   thread_data->error_info.setjmp = 0;
   return !td->xd.corrupted;
@@ -3680,6 +3786,79 @@ static void row_mt_frame_init(AV1Decoder *pbi, int tile_rows_start,
 #endif
 }
 
+#if CONFIG_CNN_RESTORATION
+// Loads the models on first use, so that decoding streams without the CNN
+// does not need them. Fills the model of each plane, NULL for the chroma
+// planes unless the frame header asks to restore them.
+static const CnnModel *const *get_cnn_models(
+    AV1Decoder *pbi, const CnnModel *models[MAX_MB_PLANE]) {
+  AV1_COMMON *const cm = &pbi->common;
+  if (!pbi->cnn_models_loaded) {
+    av1_cnn_registry_load(&pbi->cnn_models, pbi->cnn_model_dir);
+    pbi->cnn_models_loaded = 1;
+  }
+  av1_cnn_registry_set_act_format(
+      &pbi->cnn_models,
+      cm->seq_params.cnn_bf16 ? CNN_ACT_BF16 : CNN_ACT_FLOAT);
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    models[plane] = plane == 0 || cm->cnn_restore_chroma
+                        ? av1_cnn_select_frame_model(&pbi->cnn_models, cm,
+                                                     plane)
+                        : NULL;
+  }
+  if (models[0] == NULL || (cm->cnn_restore_chroma && models[1] == NULL)) {
+    aom_internal_error(&cm->error, AOM_CODEC_UNSUP_BITSTREAM,
+                       "CNN restoration models are not available");
+  }
+  return models;
+}
+
+// The filters of the chroma planes the CNN leaves run after it, once the
+// frame is decoded, whichever way it is restored.
+static int luma_filters_off(const AV1_COMMON *cm) {
+  for (int i = 0; i < 1 << cm->cdef_bits; ++i)
+    if (cm->cdef_strengths[i]) return 0;
+  return !cm->lf.filter_level[0] && !cm->lf.filter_level[1] &&
+         cm->rst_info[0].frame_restoration_type == RESTORE_NONE;
+}
+
+// Lets the row-mt workers restore the CNN tiles as soon as the superblock
+// rows they read are reconstructed, instead of in a pass after the whole frame
+// is decoded. Only done when the tile group covers the frame and no other
+// in-loop filter touches the luma plane.
+static void row_mt_cnn_init(AV1Decoder *pbi, int start_tile, int end_tile) {
+  AV1_COMMON *const cm = &pbi->common;
+  AV1DecRowMTInfo *frame_row_mt_info = &pbi->frame_row_mt_info;
+
+  frame_row_mt_info->cnn_enabled = 0;
+  if (!av1_cnn_frame_enabled(cm, pbi->refresh_frame_flags) || start_tile != 0 ||
+      end_tile != cm->tile_rows * cm->tile_cols - 1 || !luma_filters_off(cm))
+    return;
+
+  const CnnModel *models[MAX_MB_PLANE];
+  av1_cnn_restore_init(&pbi->cnn_sync, get_frame_new_buffer(cm), cm,
+                       get_cnn_models(pbi, models));
+  // One workspace per entry of pbi->thread_data.
+  av1_cnn_restore_alloc_workspaces(&pbi->cnn_sync, cm, pbi->max_threads);
+
+  const int sb_rows = (cm->mi_rows + cm->seq_params.mib_size - 1) >>
+                      cm->seq_params.mib_size_log2;
+  if (frame_row_mt_info->cnn_sb_rows_alloc < sb_rows) {
+    aom_free(frame_row_mt_info->cnn_sb_row_state);
+    frame_row_mt_info->cnn_sb_rows_alloc = 0;
+    CHECK_MEM_ERROR(cm, frame_row_mt_info->cnn_sb_row_state,
+                    aom_malloc(sizeof(*frame_row_mt_info->cnn_sb_row_state) *
+                               sb_rows));
+    frame_row_mt_info->cnn_sb_rows_alloc = sb_rows;
+  }
+  memset(frame_row_mt_info->cnn_sb_row_state, 0,
+         sizeof(*frame_row_mt_info->cnn_sb_row_state) * sb_rows);
+  frame_row_mt_info->cnn_sb_rows = sb_rows;
+  frame_row_mt_info->cnn_sb_rows_ready = 0;
+  frame_row_mt_info->cnn_enabled = 1;
+}
+#endif  // CONFIG_CNN_RESTORATION
+
 static const uint8_t *decode_tiles_row_mt(AV1Decoder *pbi, const uint8_t *data,
                                           const uint8_t *data_end,
                                           int start_tile, int end_tile) {
@@ -3777,6 +3956,9 @@ static const uint8_t *decode_tiles_row_mt(AV1Decoder *pbi, const uint8_t *data,
 
   row_mt_frame_init(pbi, tile_rows_start, tile_rows_end, tile_cols_start,
                     tile_cols_end, start_tile, end_tile, max_sb_rows);
+#if CONFIG_CNN_RESTORATION
+  row_mt_cnn_init(pbi, start_tile, end_tile);
+#endif  // CONFIG_CNN_RESTORATION
 
   reset_dec_workers(pbi, row_mt_worker_hook, num_workers);
   launch_dec_workers(pbi, data_end, num_workers);
@@ -3785,6 +3967,10 @@ static const uint8_t *decode_tiles_row_mt(AV1Decoder *pbi, const uint8_t *data,
   if (pbi->mb.corrupted)
     aom_internal_error(&cm->error, AOM_CODEC_CORRUPT_FRAME,
                        "Failed to decode tile data");
+#if CONFIG_CNN_RESTORATION
+  if (pbi->frame_row_mt_info.cnn_enabled)
+    av1_cnn_restore_finish(&pbi->cnn_sync);
+#endif  // CONFIG_CNN_RESTORATION
 
   if (cm->large_scale_tile) {
     if (n_tiles == 1) {
@@ -4190,6 +4376,14 @@ void av1_read_sequence_header(AV1_COMMON *cm, struct aom_read_bit_buffer *rb,
   seq_params->enable_superres = aom_rb_read_bit(rb);
   seq_params->enable_cdef = aom_rb_read_bit(rb);
   seq_params->enable_restoration = aom_rb_read_bit(rb);
+#if CONFIG_CNN_RESTORATION
+  seq_params->enable_cnn_restoration = aom_rb_read_bit(rb);
+  seq_params->cnn_depth = seq_params->enable_cnn_restoration
+                              ? aom_rb_read_literal(rb, CNN_DEPTH_BITS)
+                              : 0;
+  seq_params->cnn_bf16 =
+      seq_params->enable_cnn_restoration ? aom_rb_read_bit(rb) : 0;
+#endif  // CONFIG_CNN_RESTORATION
 }
 
 static int read_global_motion_params(WarpedMotionParams *params,
@@ -4930,6 +5124,13 @@ static int read_uncompressed_header(AV1Decoder *pbi,
   }
   cm->coded_lossless = is_coded_lossless(cm, xd);
   cm->all_lossless = cm->coded_lossless && !av1_superres_scaled(cm);
+#if CONFIG_CNN_RESTORATION
+  cm->use_cnn_restoration =
+      av1_cnn_frame_allowed(cm, pbi->refresh_frame_flags) &&
+      aom_rb_read_bit(rb);
+  cm->cnn_restore_chroma =
+      cm->use_cnn_restoration && av1_num_planes(cm) > 1 && aom_rb_read_bit(rb);
+#endif  // CONFIG_CNN_RESTORATION
   setup_segmentation_dequant(cm);
   if (cm->coded_lossless) {
     cm->lf.filter_level[0] = 0;
@@ -4945,7 +5146,7 @@ static int read_uncompressed_header(AV1Decoder *pbi,
     cm->rst_info[1].frame_restoration_type = RESTORE_NONE;
     cm->rst_info[2].frame_restoration_type = RESTORE_NONE;
   }
-  setup_loopfilter(cm, rb);
+  setup_loopfilter(pbi, rb);
 
   if (!cm->coded_lossless && cm->seq_params.enable_cdef) {
     setup_cdef(cm, rb);
@@ -5125,6 +5326,9 @@ void av1_decode_tg_tiles_and_wrapup(AV1Decoder *pbi, const uint8_t *data,
   const int tile_count_tg = end_tile - start_tile + 1;
 
   if (initialize_flag) setup_frame_info(pbi);
+#if CONFIG_CNN_RESTORATION
+  pbi->frame_row_mt_info.cnn_enabled = 0;
+#endif  // CONFIG_CNN_RESTORATION
 
   if (pbi->max_threads > 1 && !(cm->large_scale_tile && !pbi->ext_tile_debug) &&
       pbi->row_mt)
@@ -5145,18 +5349,38 @@ void av1_decode_tg_tiles_and_wrapup(AV1Decoder *pbi, const uint8_t *data,
   }
 
   if (!cm->allow_intrabc && !cm->single_tile_decoding) {
-    if (cm->lf.filter_level[0] || cm->lf.filter_level[1]) {
+#if CONFIG_CNN_RESTORATION
+    // Unless the row-mt workers already restored the frame while decoding it.
+    if (av1_cnn_frame_enabled(cm, pbi->refresh_frame_flags) &&
+        !pbi->frame_row_mt_info.cnn_enabled) {
+      const CnnModel *models[MAX_MB_PLANE];
+      av1_cnn_restore_frame_mt(get_frame_new_buffer(cm), cm,
+                               get_cnn_models(pbi, models), pbi->tile_workers,
+                               pbi->num_workers, &pbi->cnn_sync);
+    }
+#endif  // CONFIG_CNN_RESTORATION
+    int lf_plane_start = AOM_PLANE_Y;
+    int do_loop_filter = cm->lf.filter_level[0] || cm->lf.filter_level[1];
+#if CONFIG_CNN_RESTORATION
+    // The CNN has taken the place of the luma loop filter.
+    if (av1_cnn_frame_luma_only(cm, pbi->refresh_frame_flags)) {
+      lf_plane_start = AOM_PLANE_U;
+      do_loop_filter = cm->lf.filter_level_u || cm->lf.filter_level_v;
+    }
+#endif  // CONFIG_CNN_RESTORATION
+    if (do_loop_filter) {
 #if LOOP_FILTER_BITMASK
-      av1_loop_filter_frame(get_frame_new_buffer(cm), cm, &pbi->mb, 0,
-                            num_planes, 0);
+      av1_loop_filter_frame(get_frame_new_buffer(cm), cm, &pbi->mb,
+                            lf_plane_start, num_planes, 0);
 #else
       if (pbi->num_workers > 1) {
-        av1_loop_filter_frame_mt(get_frame_new_buffer(cm), cm, &pbi->mb, 0,
-                                 num_planes, 0, pbi->tile_workers,
-                                 pbi->num_workers, &pbi->lf_row_sync);
+        av1_loop_filter_frame_mt(get_frame_new_buffer(cm), cm, &pbi->mb,
+                                 lf_plane_start, num_planes, 0,
+                                 pbi->tile_workers, pbi->num_workers,
+                                 &pbi->lf_row_sync);
       } else {
-        av1_loop_filter_frame(get_frame_new_buffer(cm), cm, &pbi->mb, 0,
-                              num_planes, 0);
+        av1_loop_filter_frame(get_frame_new_buffer(cm), cm, &pbi->mb,
+                              lf_plane_start, num_planes, 0);
       }
 #endif
     }
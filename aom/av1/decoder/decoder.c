@@ -203,6 +203,11 @@ void av1_decoder_remove(AV1Decoder *pbi) {
   }
 
   av1_dec_free_cb_buf(pbi);
+#if CONFIG_CNN_RESTORATION
+  aom_free(pbi->frame_row_mt_info.cnn_sb_row_state);
+  av1_cnn_restore_dealloc(&pbi->cnn_sync);
+  av1_cnn_registry_free(&pbi->cnn_models);
+#endif  // CONFIG_CNN_RESTORATION
 #if CONFIG_ACCOUNTING
   aom_accounting_clear(&pbi->accounting);
 #endif
@@ -69,6 +69,10 @@ typedef struct AV1DecRowMTJobInfo {
   int tile_col;
   int mi_row;
   int job_available;
+#if CONFIG_CNN_RESTORATION
+  // Set instead of the tile position for CNN restoration jobs.
+  const AV1CnnMTInfo *cnn_job;
+#endif  // CONFIG_CNN_RESTORATION
 } AV1DecRowMTJobInfo;
 
 typedef struct AV1DecRowMTSyncData {
@@ -86,6 +90,10 @@ typedef struct AV1DecRowMTSyncData {
   int num_threads_working;
 } AV1DecRowMTSync;
 
+#if CONFIG_CNN_RESTORATION
+#define CNN_SB_ROW_COPIED -1
+#endif  // CONFIG_CNN_RESTORATION
+
 typedef struct AV1DecRowMTInfo {
   int tile_rows_start;
   int tile_rows_end;
@@ -97,6 +105,18 @@ typedef struct AV1DecRowMTInfo {
   int mi_rows_decode_started;
   int mi_rows_to_decode;
   int row_mt_exit;
+#if CONFIG_CNN_RESTORATION
+  // CNN restoration run by the row-MT workers as soon as the rows a CNN tile
+  // reads are reconstructed. For every superblock row of the frame,
+  // cnn_sb_row_state counts the tile columns that have reconstructed it, and
+  // is set to CNN_SB_ROW_COPIED once the row has been copied for the CNN.
+  // The first cnn_sb_rows_ready superblock rows are copied.
+  int cnn_enabled;
+  int *cnn_sb_row_state;
+  int cnn_sb_rows_alloc;
+  int cnn_sb_rows;
+  int cnn_sb_rows_ready;
+#endif  // CONFIG_CNN_RESTORATION
 } AV1DecRowMTInfo;
 
 typedef struct TileDataDec {
@@ -235,6 +255,15 @@ typedef struct AV1Decoder {
 #endif
 
   AV1DecRowMTInfo frame_row_mt_info;
+
+#if CONFIG_CNN_RESTORATION
+  // Directory the CNN models are loaded from, or NULL for the default models.
+  // They are loaded when the first frame restored with them is decoded.
+  const char *cnn_model_dir;
+  int cnn_models_loaded;
+  CnnModelRegistry cnn_models;
+  AV1CnnSync cnn_sync;
+#endif  // CONFIG_CNN_RESTORATION
 } AV1Decoder;
 
 // Returns 0 on success. Sets pbi->common.error.error_code to a nonzero error
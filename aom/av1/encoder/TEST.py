@@ -33,20 +33,20 @@ I_MODEL_PATH = r"/home/chenjs/a5/aom_cnn_7/MODELS/qp52/VDSR25_qp52_I_set2K+2299_
 B_MODEL_PATH = r"/home/chenjs/a5/aom_cnn_7/MODELS/qp52/VDSR25_qp52_B_set2299_noclip"  #252
 
 
-def prepare_test_data(fileOrDir):
+def prepare_test_data(fileOrDir, peak):
     original_ycbcr = []
     gt_y = []
     fileName_list = []
     imgCbCr = 0
     fileName_list.append(fileOrDir)
     imgY = np.reshape(fileOrDir,(1, len(fileOrDir), len(fileOrDir[0]), 1))
-    imgY = normalize(imgY)
+    imgY = truncate(imgY / float(peak), 0., 1.)
     #print(imgY)
     
     original_ycbcr.append([imgY, imgCbCr])
     return original_ycbcr, gt_y, fileName_list
 
-def test_all_ckpt(modelPath, fileOrDir, flags):
+def test_all_ckpt(modelPath, fileOrDir, flags, peak=255):
     tf.reset_default_graph()
     tf.logging.warning(modelPath)
     #tf.logging.warning(os.getcwd())
@@ -66,11 +66,11 @@ def test_all_ckpt(modelPath, fileOrDir, flags):
         #shared_model = tf.make_template('shared_model', model)
         output_tensor, weights = shared_model(input_tensor)
         output_tensor = tf.clip_by_value(output_tensor, 0., 1.)
-        output_tensor = output_tensor * 255
+        output_tensor = output_tensor * peak
 
         sess.run(tf.global_variables_initializer())
 
-        original_ycbcr, gt_y, fileName_list = prepare_test_data(fileOrDir)
+        original_ycbcr, gt_y, fileName_list = prepare_test_data(fileOrDir, peak)
 		
         for ckpt in ckptFiles:
             epoch = int(ckpt.split('_')[-1].split('.')[0])
@@ -92,19 +92,22 @@ def test_all_ckpt(modelPath, fileOrDir, flags):
                 out = sess.run(output_tensor, feed_dict={input_tensor: imgY})
                 out = np.reshape(out, (out.shape[1], out.shape[2]))
                 out = np.around(out)
-                out = out.astype('int')
-                out = out.tolist()
 
                 return out
                 
 
-def entranceI(inp):
+# The encoder passes the plane region as a writable 2-D memoryview over the
+# frame buffer (uint8, or uint16 for high bitdepth frames). np.asarray() wraps
+# it without a copy and the result is written back through it in place. The
+# view is only valid for the duration of the call, so no reference to it may
+# be kept. The samples have bit_depth bits and are normalized by the largest
+# value of that depth, as the native backend does.
+def entranceI(plane, bit_depth=8):
     tf.logging.warning("python, in I")
-    #print(inp)
-    i = test_all_ckpt(I_MODEL_PATH, inp, 0)
-    return i
+    view = np.asarray(plane)
+    view[...] = test_all_ckpt(I_MODEL_PATH, view, 0, (1 << bit_depth) - 1)
 
-def entranceB(inp):
+def entranceB(plane, bit_depth=8):
     tf.logging.warning("python, in B")
-    b = test_all_ckpt(B_MODEL_PATH, inp, 1)
-    return b
+    view = np.asarray(plane)
+    view[...] = test_all_ckpt(B_MODEL_PATH, view, 1, (1 << bit_depth) - 1)
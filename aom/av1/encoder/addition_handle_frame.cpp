@@ -1,255 +1,473 @@
-/*
- * Copyright (c) 2019, Alliance for Open Media. All rights reserved
- *
- * This source code is subject to the terms of the BSD 2 Clause License and
- * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
- * was not distributed with this source code in the LICENSE file, you can
- * obtain it at www.aomedia.org/license/software. If the Alliance for Open
- * Media Patent License 1.0 was not distributed with this source code in the
- * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
- */
-
-#include "additionHandle_Frame.h"
-
-extern uint8_t **call_tensorflow(uint8_t *ppp, int height, int width,
-                                 int stride, FRAME_TYPE frame_type);
-extern uint8_t **block_call_tensorflow(uint8_t *ppp, int cur_buf_height,
-                                       int cur_buf_width, int stride,
-                                       FRAME_TYPE frame_type);
-extern uint16_t **call_tensorflow_hbd(uint16_t *ppp, int height, int width,
-                                      int stride, FRAME_TYPE frame_type);
-extern uint16_t **block_call_tensorflow_hbd(uint16_t *ppp, int cur_buf_height,
-                                            int cur_buf_width, int stride,
-                                            FRAME_TYPE frame_type);
-
-/*Feed the whole frame image into the neural network.*/
-void addition_handle_frame(AV1_COMMON *cm, FRAME_TYPE frame_type) {
-	YV12_BUFFER_CONFIG* pcPicYuvRec = cm->frame_to_show;
-
-	if(!cm->use_highbitdepth) {
-		uint8_t* py = pcPicYuvRec->y_buffer;
-		uint8_t* bkuPy = py;
-
-		int height = pcPicYuvRec->y_height;
-		int width = pcPicYuvRec->y_width;
-		int stride = pcPicYuvRec->y_stride;
-
-
-		uint8_t **buf = new uint8_t*[height];
-		for (int i = 0; i < height; i++) {
-			buf[i] = new uint8_t[width];
-		}
-
-		buf = callTensorflow(py, height, width, stride, frame_type);
-
-		//FILE *ff = fopen("end.yuv", "wb");
-		for (int i = 0; i < height; i++) {
-			for (int j = 0; j < width; j++) {
-				*(bkuPy + j) = buf[i][j]; //Fill in the luma buffer again
-				//fwrite(bkuPy + j, 1, 1, ff);
-			}
-			bkuPy += stride;
-		}
-		//fclose(ff);
-	}
-	else {
-		uint16_t* py = CONVERT_TO_SHORTPTR(pcPicYuvRec->y_buffer);
-		uint16_t* bkuPy = py;
-
-		int height = pcPicYuvRec->y_height;
-		int width = pcPicYuvRec->y_width;
-		int stride = pcPicYuvRec->y_stride;
-
-		uint16_t **buf = new uint16_t*[height];
-		for (int i = 0; i < height; i++) {
-			buf[i] = new uint16_t[width];
-		}
-
-		buf = callTensorflow_hbd(py, height, width, stride, frame_type);
-
-		//FILE *ff = fopen("end.yuv", "wb");
-		for (int i = 0; i < height; i++) {
-			for (int j = 0; j < width; j++) {
-				*(bkuPy + j) = buf[i][j]; //Fill in the luma buffer again
-				//fwrite(bkuPy + j, 1, 1, ff);
-			}
-			bkuPy += stride;
-		}
-	}
-
-}
-
-/*Split into 1000x1000 blocks and feed them into the neural network separately*/
-void addition_handle_blocks(AV1_COMP *cpi, AV1_COMMON *cm, FRAME_TYPE frame_type) {
-	YV12_BUFFER_CONFIG* pcPicYuvRec = cm->frame_to_show;
-	
-	int height = pcPicYuvRec->y_height;
-	int width = pcPicYuvRec->y_width;
-	int buf_width = 1000;
-	int buf_height = 1000;
-	int bufx_count = width / buf_width;
-	int bufy_count = height / buf_height;
-	int stride = pcPicYuvRec->y_stride;
-	int cur_buf_width;
-	int cur_buf_height;
-
-    if(!cm->use_highbitdepth) {
-		uint8_t* py = pcPicYuvRec->y_buffer;
-		uint8_t* bkuPy = py;
-		uint8_t* bkuPyTemp = bkuPy;
-
-
-		for (int y = 0; y < bufy_count+1; y++) {
-			for (int x = 0; x < bufx_count+1; x++) {
-
-				if (x == bufx_count)
-					cur_buf_width = width - buf_width * bufx_count;
-				else
-					cur_buf_width = buf_width;
-				if (y == bufy_count)
-					cur_buf_height = height - buf_height* bufy_count;
-				else
-					cur_buf_height = buf_height;
-
-
-				if (cur_buf_width != 0 && cur_buf_height != 0) {
-
-					uint8_t **buf = new uint8_t*[cur_buf_height];
-					for (int i = 0; i < cur_buf_height; i++) {
-						buf[i] = new uint8_t[cur_buf_width];
-					}
-
-					buf = blockCallTensorflow(py + x*buf_width + stride*buf_height*y, cur_buf_height, cur_buf_width, stride, frame_type);
-
-					bkuPy = bkuPyTemp;
-					for (int i = 0; i < cur_buf_height; i++) {
-						for (int j = 0; j < cur_buf_width; j++) {
-							*(bkuPy + j + x * buf_width + y * buf_height * stride) = buf[i][j]; //Fill in the luma buffer
-						}
-						bkuPy += stride;
-					}
-				}
-			}
-		}
-	}
-	else {
-		uint16_t* py = CONVERT_TO_SHORTPTR(pcPicYuvRec->y_buffer);
-		uint16_t* bkuPy = py;
-		uint16_t* bkuPyTemp = bkuPy;
-
-		for (int y = 0; y < bufy_count+1; y++) {
-			for (int x = 0; x < bufx_count+1; x++) {
-				if (x == bufx_count)
-					cur_buf_width = width - buf_width * bufx_count;
-				else
-					cur_buf_width = buf_width;
-				if (y == bufy_count)
-					cur_buf_height = height - buf_height* bufy_count;
-				else
-					cur_buf_height = buf_height;
-
-
-				if (cur_buf_width != 0 && cur_buf_height != 0) {
-
-					uint16_t **buf = new uint16_t*[cur_buf_height];
-					for (int i = 0; i < cur_buf_height; i++) {
-						buf[i] = new uint16_t[cur_buf_width];
-					}
-
-					buf = blockCallTensorflow_hbd(py + x*buf_width + stride*buf_height*y, cur_buf_height, cur_buf_width, stride, frame_type);
-
-					bkuPy = bkuPyTemp;
-					//FILE *ff = fopen("end.yuv", "wb");
-					for (int i = 0; i < cur_buf_height; i++) {
-						for (int j = 0; j < cur_buf_width; j++) {
-							*(bkuPy + j + x * buf_width + y * buf_height * stride) = buf[i][j]; 
-							//fwrite(bkuPy + j, 1, 1, ff);
-						}
-						bkuPy += stride;
-					}
-					//fclose(ff);
-				}
-			}
-	    }
-	}
-
-}
-
-
-/*
- *frame_type determines what kind of network blocks need to be fed into,
- *not exactly equivalent to what frame the current frame is.
- */
-/*Low bitdepth*/
-uint8_t **blocks_to_cnn_secondly(uint8_t *pBuffer_y, int height, int width, int stride, FRAME_TYPE frame_type) {
-
-	uint8_t **dst = new uint8_t *[height];
-	for (int i = 0; i < height; i++) {
-		dst[i] = new uint8_t[width];
-	}
-
-	if (frame_type == FRAME_TYPES) {
-		for (int r = 0; r < height; ++r) {
-			for (int c = 0; c < width; ++c) {
-				dst[r][c] = (uint8_t)(*(pBuffer_y + c));
-			}
-			pBuffer_y += stride;
-		}
-		return dst;
-	}
-	else if (frame_type != FRAME_TYPES) {
-		int buf_width = 1000;
-		int buf_height = 1000;
-		int bufx_count = width / buf_width;
-		int bufy_count = height / buf_height; /**/
-		int cur_buf_width;
-		int cur_buf_height;
-
-		
-		for (int y = 0; y < bufy_count + 1; y++) {
-			for (int x = 0; x < bufx_count + 1; x++) {
-				if (x == bufx_count)
-					cur_buf_width = width - buf_width * bufx_count;
-				else
-					cur_buf_width = buf_width;
-				if (y == bufy_count)
-					cur_buf_height = height - buf_height* bufy_count;
-				else
-					cur_buf_height = buf_height;
-
-
-				if (cur_buf_width != 0 && cur_buf_height != 0) {
-
-					uint8_t **buf = new uint8_t*[cur_buf_height];
-					for (int i = 0; i < cur_buf_height; i++) {
-						buf[i] = new uint8_t[cur_buf_width];
-					}
-					buf = blockCallTensorflow(pBuffer_y + x*buf_width + stride*buf_height*y, cur_buf_height, cur_buf_width, stride, frame_type);
-
-					for (int i = 0; i < cur_buf_height; i++) {
-						for (int j = 0; j < cur_buf_width; j++) {
-							dst[y * buf_height + i][x * buf_width + j] = buf[i][j]; 
-						}
-					}
-
-					for (int i = 0; i < cur_buf_height; i++) {
-						delete[] buf[i];
-					}
-					delete buf;
-				}
-			}
-		}
-
-	}
-	/*
-	FILE *ff = fopen("end.yuv", "wb");
-	for (int i = 0; i < height; i++) {
-		for (int j = 0; j < width; j++) {
-			fwrite(*(dst+i)+j, 1, 1, ff);
-		}
-	}
-	fclose(ff);
-	*/
-	return dst;
-
-}
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#include "av1/encoder/addition_handle_frame.h"
+
+#include "aom_dsp/aom_dsp_common.h"
+#include "aom_ports/aom_timer.h"
+#include "aom_ports/mem.h"
+#include "av1/common/cnn_restoration.h"
+
+#if CONFIG_CNN_TENSORFLOW
+#include "av1/encoder/call_tensorflow.h"
+#endif  // CONFIG_CNN_TENSORFLOW
+#if CONFIG_CNN_REMOTE
+#include "av1/encoder/cnn_remote.h"
+#endif  // CONFIG_CNN_REMOTE
+
+#if CONFIG_CNN_TENSORFLOW
+// Size of the blocks the luma plane is split into by the TensorFlow backend.
+#define CNN_BLOCK_SIZE 1000
+
+static int is_intra_frame_type(FRAME_TYPE frame_type) {
+  return frame_type == KEY_FRAME || frame_type == INTRA_ONLY_FRAME;
+}
+#endif  // CONFIG_CNN_TENSORFLOW
+
+// Picks the model trained for the quantizer, frame type and plane nearest to
+// the current frame, the same way the decoder does. Returns NULL for the
+// chroma planes if there are no chroma models, which leaves them as they are.
+static const CnnModel *get_cnn_model(AV1_COMP *cpi, int plane) {
+  av1_cnn_registry_set_act_format(
+      &cpi->cnn_models,
+      cpi->common.seq_params.cnn_bf16 ? CNN_ACT_BF16 : CNN_ACT_FLOAT);
+  const CnnModel *const model =
+      av1_cnn_select_frame_model(&cpi->cnn_models, &cpi->common, plane);
+  if (model == NULL && plane == 0) {
+    aom_internal_error(&cpi->common.error, AOM_CODEC_ERROR,
+                       "No CNN model loaded");
+  }
+  return model;
+}
+
+// Creates the threads that restore the tiles along with the main thread on
+// first use, one less than the encoder may use.
+static void alloc_cnn_workers(AV1_COMP *cpi) {
+  AV1_COMMON *const cm = &cpi->common;
+  const AVxWorkerInterface *const winterface = aom_get_worker_interface();
+  const int num_workers = AOMMAX(cpi->oxcf.max_threads, 1) - 1;
+  if (cpi->cnn_workers != NULL || num_workers == 0) return;
+
+  CHECK_MEM_ERROR(
+      cm, cpi->cnn_workers,
+      (AVxWorker *)aom_malloc(num_workers * sizeof(*cpi->cnn_workers)));
+  for (int i = 0; i < num_workers; ++i) {
+    AVxWorker *const worker = &cpi->cnn_workers[i];
+    ++cpi->num_cnn_workers;
+    winterface->init(worker);
+    if (!winterface->reset(worker))
+      aom_internal_error(&cm->error, AOM_CODEC_ERROR,
+                         "CNN restoration thread creation failed");
+  }
+}
+
+// The native backend, which restores the frames with the kernels the decoder
+// runs, and the reference backend, which runs the C versions of them.
+
+static void local_load(AV1_COMP *cpi, int reference) {
+  const char *const dir = cpi->oxcf.cnn_model_dir;
+  // Without the default models the encoder falls back to the normative loop
+  // filters.
+  if (av1_cnn_registry_load(&cpi->cnn_models, dir) && dir != NULL) {
+    aom_internal_error(&cpi->common.error, AOM_CODEC_ERROR,
+                       "Failed to load CNN models from %s", dir);
+  }
+  for (int i = 0; i < cpi->cnn_models.num_models; ++i)
+    cpi->cnn_models.models[i].reference = reference;
+}
+
+static void native_init(AV1_COMP *cpi) { local_load(cpi, 0); }
+
+static void reference_init(AV1_COMP *cpi) { local_load(cpi, 1); }
+
+static void local_destroy(AV1_COMP *cpi) {
+  av1_cnn_registry_free(&cpi->cnn_models);
+}
+
+static int local_num_models(const AV1_COMP *cpi) {
+  return cpi->cnn_models.num_models;
+}
+
+static void local_reserve(AV1_COMP *cpi) {
+  AV1_COMMON *const cm = &cpi->common;
+  const int width = cpi->oxcf.forced_max_frame_width
+                        ? cpi->oxcf.forced_max_frame_width
+                        : cm->width;
+  const int height = cpi->oxcf.forced_max_frame_height
+                         ? cpi->oxcf.forced_max_frame_height
+                         : cm->height;
+  av1_cnn_restore_reserve(&cpi->cnn_sync, cm, &cpi->cnn_models,
+                          AOMMAX(width, cm->width), AOMMAX(height, cm->height),
+                          cm->use_highbitdepth,
+                          AOMMAX(cpi->oxcf.max_threads, 1));
+}
+
+static void local_restore_join(AV1_COMP *cpi, AV1_COMMON *cm) {
+  av1_cnn_restore_frame_sync(cm, cpi->cnn_workers, cpi->num_cnn_workers,
+                             &cpi->cnn_sync);
+  av1_cnn_restore_get_stats(&cpi->cnn_sync, &cpi->cnn_mask_stats);
+}
+
+static int local_restore_launch(AV1_COMP *cpi, AV1_COMMON *cm,
+                                FRAME_TYPE frame_type) {
+  (void)frame_type;
+  // The chroma planes share the job queue of the luma plane.
+  const CnnModel *models[MAX_MB_PLANE] = { NULL, NULL, NULL };
+  for (int plane = 0; plane < av1_num_planes(cm); ++plane)
+    models[plane] = get_cnn_model(cpi, plane);
+  alloc_cnn_workers(cpi);
+  av1_cnn_restore_frame_launch(cm->frame_to_show, cm, models,
+                               cpi->cnn_workers, cpi->num_cnn_workers,
+                               &cpi->cnn_sync);
+  if (cpi->num_cnn_workers > 0) return 1;
+  local_restore_join(cpi, cm);
+  return 0;
+}
+
+static void local_undo_plane(AV1_COMP *cpi, AV1_COMMON *cm, int plane) {
+  (void)cm;
+  av1_cnn_restore_undo_plane(&cpi->cnn_sync, plane);
+}
+
+static const CnnBackend native_backend = {
+  AOM_CNN_BACKEND_NATIVE,
+  "native",
+  CNN_BACKEND_BATCH | CNN_BACKEND_HIGHBD | CNN_BACKEND_BIT_EXACT |
+      CNN_BACKEND_CHROMA,
+  native_init,
+  local_destroy,
+  local_num_models,
+  local_reserve,
+  local_restore_launch,
+  local_restore_join,
+  local_undo_plane,
+};
+
+static const CnnBackend reference_backend = {
+  AOM_CNN_BACKEND_REFERENCE,
+  "reference",
+  CNN_BACKEND_BATCH | CNN_BACKEND_HIGHBD | CNN_BACKEND_BIT_EXACT |
+      CNN_BACKEND_CHROMA,
+  reference_init,
+  local_destroy,
+  local_num_models,
+  local_reserve,
+  local_restore_launch,
+  local_restore_join,
+  local_undo_plane,
+};
+
+#if CONFIG_CNN_REMOTE
+// The remote backend, which hands the frames to the CNN inference server at
+// cpi->oxcf.cnn_server. The server holds the models.
+
+static void remote_init(AV1_COMP *cpi) {
+  if (cpi->oxcf.cnn_server == NULL) {
+    aom_internal_error(&cpi->common.error, AOM_CODEC_INVALID_PARAM,
+                       "The remote CNN backend needs a CNN inference server");
+    return;
+  }
+  cpi->cnn_remote = av1_cnn_remote_connect(cpi->oxcf.cnn_server);
+  if (cpi->cnn_remote == NULL) {
+    aom_internal_error(&cpi->common.error, AOM_CODEC_ERROR,
+                       "Failed to connect to the CNN inference server at %s",
+                       cpi->oxcf.cnn_server);
+  }
+}
+
+static void remote_destroy(AV1_COMP *cpi) {
+  av1_cnn_remote_close(cpi->cnn_remote);
+  cpi->cnn_remote = NULL;
+}
+
+static int remote_num_models(const AV1_COMP *cpi) {
+  if (cpi->cnn_remote == NULL) return 0;
+  return av1_cnn_remote_num_models(cpi->cnn_remote);
+}
+
+// Hands the frame over to the CNN inference server along with the superblocks
+// to restore, and takes the stats av1_cnn_restore_frame_launch() would.
+static int remote_restore_launch(AV1_COMP *cpi, AV1_COMMON *cm,
+                                 FRAME_TYPE frame_type) {
+  const YV12_BUFFER_CONFIG *const frame = cm->frame_to_show;
+  AV1CnnSync *const cnn_sync = &cpi->cnn_sync;
+  AV1CnnMaskStats *const stats = &cpi->cnn_mask_stats;
+  const int mib_size = cm->seq_params.mib_size;
+  const int sb_size_log2 = cm->seq_params.mib_size_log2 + MI_SIZE_LOG2;
+  const int sb_size = 1 << sb_size_log2;
+  const int sb_cols = (frame->y_crop_width + sb_size - 1) >> sb_size_log2;
+  const int sb_rows = (frame->y_crop_height + sb_size - 1) >> sb_size_log2;
+  struct aom_usec_timer timer;
+  aom_usec_timer_start(&timer);
+
+  uint8_t *const mask =
+      av1_cnn_remote_mask_buffer(cpi->cnn_remote, sb_cols * sb_rows);
+  if (mask == NULL) {
+    aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
+                       "Failed to allocate CNN superblock mask");
+  }
+  av1_zero(*stats);
+  stats->sb_count = sb_cols * sb_rows;
+  stats->pixels = (int64_t)frame->y_crop_width * frame->y_crop_height;
+  for (int sb_row = 0; sb_row < sb_rows; ++sb_row) {
+    const int h = AOMMIN(sb_size, frame->y_crop_height - sb_row * sb_size);
+    for (int sb_col = 0; sb_col < sb_cols; ++sb_col) {
+      uint8_t *const active = &mask[sb_row * sb_cols + sb_col];
+      *active = av1_cnn_sb_active(cm, sb_row * mib_size, sb_col * mib_size);
+      if (!*active) continue;
+      const int w = AOMMIN(sb_size, frame->y_crop_width - sb_col * sb_size);
+      stats->active_sb_count++;
+      stats->active_pixels += w * h;
+    }
+  }
+
+  CnnRemoteParams params;
+  params.qp = av1_cnn_frame_qp(cm);
+  params.depth = cm->seq_params.cnn_depth;
+  params.act_format = cm->seq_params.cnn_bf16 ? CNN_ACT_BF16 : CNN_ACT_FLOAT;
+  params.intra = frame_type == KEY_FRAME || frame_type == INTRA_ONLY_FRAME;
+  params.num_planes = av1_num_planes(cm);
+  params.bit_depth = (int)cm->bit_depth;
+  params.sb_mask = mask;
+  params.sb_size_log2 = sb_size_log2;
+  // The frame buffers of the pool are in shared memory, see
+  // realloc_pool_frame_buffer(), so the server restores the frame in place.
+  const aom_codec_frame_buffer_t *const fb =
+      frame == &cm->cur_frame->buf ? &cm->cur_frame->raw_frame_buffer : NULL;
+  if (av1_cnn_remote_launch(cpi->cnn_remote, frame, fb, &params)) {
+    aom_internal_error(&cm->error, AOM_CODEC_ERROR,
+                       "Failed to send the frame to the CNN inference server");
+  }
+  aom_usec_timer_mark(&timer);
+  cnn_sync->time_prepare += aom_usec_timer_elapsed(&timer);
+  aom_usec_timer_start(&cnn_sync->inference_timer);
+  return 1;
+}
+
+static void remote_restore_join(AV1_COMP *cpi, AV1_COMMON *cm) {
+  AV1CnnSync *const cnn_sync = &cpi->cnn_sync;
+  const int failed = av1_cnn_remote_wait(cpi->cnn_remote, cm->frame_to_show);
+  aom_usec_timer_mark(&cnn_sync->inference_timer);
+  cnn_sync->time_inference +=
+      aom_usec_timer_elapsed(&cnn_sync->inference_timer);
+  if (failed) {
+    aom_internal_error(&cm->error, AOM_CODEC_ERROR,
+                       "The CNN inference server failed to restore a frame");
+  }
+}
+
+static void remote_undo_plane(AV1_COMP *cpi, AV1_COMMON *cm, int plane) {
+  if (av1_cnn_remote_undo_plane(cpi->cnn_remote, cm->frame_to_show, plane)) {
+    aom_internal_error(&cm->error, AOM_CODEC_ERROR,
+                       "The CNN inference server failed to restore a plane");
+  }
+}
+
+static const CnnBackend remote_backend = {
+  AOM_CNN_BACKEND_REMOTE,
+  "remote",
+  CNN_BACKEND_BATCH | CNN_BACKEND_HIGHBD | CNN_BACKEND_BIT_EXACT |
+      CNN_BACKEND_CHROMA,
+  remote_init,
+  remote_destroy,
+  remote_num_models,
+  NULL,
+  remote_restore_launch,
+  remote_restore_join,
+  remote_undo_plane,
+};
+#endif  // CONFIG_CNN_REMOTE
+
+#if CONFIG_CNN_TENSORFLOW
+// The TensorFlow backend, which runs the network in the embedded Python
+// interpreter. It restores the luma plane in place, in blocks without
+// context, and cannot run on several threads. Its output differs from the
+// decoder's, so it only serves to compare timings.
+
+static void tensorflow_init(AV1_COMP *cpi) { (void)cpi; }
+
+static void tensorflow_destroy(AV1_COMP *cpi) { (void)cpi; }
+
+static int tensorflow_num_models(const AV1_COMP *cpi) {
+  // The Python side holds one network for every frame.
+  (void)cpi;
+  return 1;
+}
+
+static void tensorflow_restore_luma(AV1_COMP *cpi, AV1_COMMON *cm,
+                                    FRAME_TYPE frame_type, int x, int y,
+                                    int width, int height) {
+  YV12_BUFFER_CONFIG *const frame = cm->frame_to_show;
+  // For high bitdepth frames y_buffer is a CONVERT_TO_BYTEPTR() alias, so the
+  // sample offset can be applied to it directly.
+  const CnnPlaneView view = { frame->y_buffer + y * frame->y_stride + x,
+                              width,
+                              height,
+                              frame->y_stride,
+                              cm->use_highbitdepth,
+                              (int)cm->bit_depth };
+  // The region is restored in place, all of it counts as inference.
+  struct aom_usec_timer timer;
+  aom_usec_timer_start(&timer);
+  if (call_tensorflow(&view, is_intra_frame_type(frame_type))) {
+    aom_internal_error(&cpi->common.error, AOM_CODEC_ERROR,
+                       "TensorFlow CNN restoration failed");
+  }
+  aom_usec_timer_mark(&timer);
+  cpi->cnn_sync.time_inference += aom_usec_timer_elapsed(&timer);
+}
+
+static int tensorflow_restore_launch(AV1_COMP *cpi, AV1_COMMON *cm,
+                                     FRAME_TYPE frame_type) {
+  const YV12_BUFFER_CONFIG *const frame = cm->frame_to_show;
+  const int height = frame->y_crop_height;
+  const int width = frame->y_crop_width;
+
+  for (int y = 0; y < height; y += CNN_BLOCK_SIZE) {
+    for (int x = 0; x < width; x += CNN_BLOCK_SIZE) {
+      tensorflow_restore_luma(cpi, cm, frame_type, x, y,
+                              AOMMIN(CNN_BLOCK_SIZE, width - x),
+                              AOMMIN(CNN_BLOCK_SIZE, height - y));
+    }
+  }
+  return 0;
+}
+
+static void tensorflow_restore_join(AV1_COMP *cpi, AV1_COMMON *cm) {
+  (void)cpi;
+  (void)cm;
+}
+
+static void tensorflow_undo_plane(AV1_COMP *cpi, AV1_COMMON *cm, int plane) {
+  (void)cpi;
+  (void)cm;
+  (void)plane;
+}
+
+static const CnnBackend tensorflow_backend = {
+  AOM_CNN_BACKEND_TENSORFLOW,
+  "tensorflow",
+  CNN_BACKEND_HIGHBD,
+  tensorflow_init,
+  tensorflow_destroy,
+  tensorflow_num_models,
+  NULL,
+  tensorflow_restore_launch,
+  tensorflow_restore_join,
+  tensorflow_undo_plane,
+};
+#endif  // CONFIG_CNN_TENSORFLOW
+
+static const CnnBackend *const cnn_backends[] = {
+  &native_backend,
+  &reference_backend,
+#if CONFIG_CNN_REMOTE
+  &remote_backend,
+#endif  // CONFIG_CNN_REMOTE
+#if CONFIG_CNN_TENSORFLOW
+  &tensorflow_backend,
+#endif  // CONFIG_CNN_TENSORFLOW
+};
+
+const CnnBackend *addition_get_backend(aom_cnn_backend_t id) {
+  for (size_t i = 0; i < sizeof(cnn_backends) / sizeof(cnn_backends[0]); ++i)
+    if (cnn_backends[i]->id == id) return cnn_backends[i];
+  return NULL;
+}
+
+// Resolves AOM_CNN_BACKEND_DEFAULT to a backend the decoder matches.
+static aom_cnn_backend_t default_backend(const AV1_COMP *cpi) {
+  return cpi->oxcf.cnn_server != NULL ? AOM_CNN_BACKEND_REMOTE
+                                      : AOM_CNN_BACKEND_NATIVE;
+}
+
+void addition_load_models(AV1_COMP *cpi) {
+  const aom_cnn_backend_t id = cpi->oxcf.cnn_backend == AOM_CNN_BACKEND_DEFAULT
+                                   ? default_backend(cpi)
+                                   : cpi->oxcf.cnn_backend;
+  addition_free_models(cpi);
+  cpi->cnn_backend = addition_get_backend(id);
+  if (cpi->cnn_backend == NULL) {
+    // Keeps a backend to fall back on if the error does not jump out.
+    cpi->cnn_backend = &native_backend;
+    aom_internal_error(&cpi->common.error, AOM_CODEC_INCAPABLE,
+                       "CNN backend %d is not built in", (int)id);
+  }
+  cpi->cnn_backend->init(cpi);
+}
+
+void addition_free_models(AV1_COMP *cpi) {
+  if (cpi->cnn_backend != NULL) cpi->cnn_backend->destroy(cpi);
+  cpi->cnn_backend = NULL;
+}
+
+int addition_num_models(const AV1_COMP *cpi) {
+  return cpi->cnn_backend->num_models(cpi);
+}
+
+/*Feed the whole frame image into the neural network.*/
+void addition_handle_frame(AV1_COMP *cpi, AV1_COMMON *cm,
+                           FRAME_TYPE frame_type) {
+#if CONFIG_CNN_TENSORFLOW
+  if (cpi->cnn_backend->id == AOM_CNN_BACKEND_TENSORFLOW) {
+    const YV12_BUFFER_CONFIG *const frame = cm->frame_to_show;
+    tensorflow_restore_luma(cpi, cm, frame_type, 0, 0, frame->y_crop_width,
+                            frame->y_crop_height);
+    return;
+  }
+#endif  // CONFIG_CNN_TENSORFLOW
+  const aom_cnn_backend_t id = cpi->cnn_backend->id;
+  if (id != AOM_CNN_BACKEND_NATIVE && id != AOM_CNN_BACKEND_REFERENCE) {
+    // The server only takes whole frames anyway.
+    addition_handle_blocks(cpi, cm, frame_type);
+    return;
+  }
+  YV12_BUFFER_CONFIG *const frame = cm->frame_to_show;
+  const CnnModel *const model = get_cnn_model(cpi, 0);
+  // The region is restored in place, all of it counts as inference.
+  struct aom_usec_timer timer;
+  aom_usec_timer_start(&timer);
+  // The buffers reserved for the first worker serve the whole luma plane,
+  // which is restored in place as one standalone image.
+  av1_cnn_restore_alloc_workspaces(&cpi->cnn_sync, cm, 1);
+  const CnnRegion region = { 0, 0, frame->y_crop_width, frame->y_crop_height };
+  if (av1_cnn_restore_regions(model, frame->y_buffer, frame->y_stride,
+                              frame->y_buffer, frame->y_stride,
+                              frame->y_crop_width, frame->y_crop_height,
+                              &region, 1, cm->use_highbitdepth,
+                              (int)cm->bit_depth,
+                              &cpi->cnn_sync.workspaces[0])) {
+    aom_internal_error(&cpi->common.error, AOM_CODEC_MEM_ERROR,
+                       "Failed to allocate CNN restoration buffers");
+  }
+  aom_usec_timer_mark(&timer);
+  cpi->cnn_sync.time_inference += aom_usec_timer_elapsed(&timer);
+}
+
+/*Split into tiles and feed them into the neural network separately*/
+void addition_handle_blocks(AV1_COMP *cpi, AV1_COMMON *cm,
+                            FRAME_TYPE frame_type) {
+  if (addition_handle_blocks_launch(cpi, cm, frame_type))
+    addition_handle_blocks_join(cpi, cm);
+}
+
+int addition_handle_blocks_launch(AV1_COMP *cpi, AV1_COMMON *cm,
+                                  FRAME_TYPE frame_type) {
+  return cpi->cnn_backend->restore_launch(cpi, cm, frame_type);
+}
+
+void addition_handle_blocks_join(AV1_COMP *cpi, AV1_COMMON *cm) {
+  cpi->cnn_backend->restore_join(cpi, cm);
+}
+
+void addition_undo_plane(AV1_COMP *cpi, AV1_COMMON *cm, int plane) {
+  cpi->cnn_backend->undo_plane(cpi, cm, plane);
+}
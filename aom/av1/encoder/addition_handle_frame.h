@@ -9,89 +9,89 @@
  * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
  */
 
-#pragma once
-#include <limits.h>
-#include <math.h>
-#include <stdio.h>
+#ifndef AV1_ENCODER_ADDITION_HANDLE_FRAME_H_
+#define AV1_ENCODER_ADDITION_HANDLE_FRAME_H_
 
 #include "config/aom_config.h"
-#include "config/aom_dsp_rtcd.h"
-#include "config/aom_scale_rtcd.h"
-#include "config/av1_rtcd.h"
 
-#include "aom_dsp/aom_dsp_common.h"
-#include "aom_dsp/aom_filter.h"
-#if CONFIG_DENOISE
-#include "aom_dsp/grain_table.h"
-#include "aom_dsp/noise_util.h"
-#include "aom_dsp/noise_model.h"
-#endif
-#include "aom_dsp/psnr.h"
-#if CONFIG_INTERNAL_STATS
-#include "aom_dsp/ssim.h"
-#endif
-#include "aom_ports/aom_timer.h"
-#include "aom_ports/mem.h"
-#include "aom_ports/system_state.h"
-#include "aom_scale/aom_scale.h"
-#if CONFIG_BITSTREAM_DEBUG || CONFIG_MISMATCH_DEBUG
-#include "aom_util/debug_util.h"
-#endif  // CONFIG_BITSTREAM_DEBUG || CONFIG_MISMATCH_DEBUG
-
-#include "av1/common/alloccommon.h"
-#include "av1/common/cdef.h"
-#include "av1/common/filter.h"
-#include "av1/common/idct.h"
-#include "av1/common/reconinter.h"
-#include "av1/common/reconintra.h"
-#include "av1/common/resize.h"
-#include "av1/common/tile_common.h"
 #include "av1/common/onyxc_int.h"
-
-#include "av1/encoder/aq_complexity.h"
-#include "av1/encoder/aq_cyclicrefresh.h"
-#include "av1/encoder/aq_variance.h"
-#include "av1/encoder/bitstream.h"
-#include "av1/encoder/context_tree.h"
-#include "av1/encoder/encodeframe.h"
-#include "av1/encoder/encodemv.h"
 #include "av1/encoder/encoder.h"
-#include "av1/encoder/encodetxb.h"
-#include "av1/encoder/ethread.h"
-#include "av1/encoder/firstpass.h"
-#include "av1/encoder/grain_test_vectors.h"
-#include "av1/encoder/hash_motion.h"
-#include "av1/encoder/mbgraph.h"
-#include "av1/encoder/picklpf.h"
-#include "av1/encoder/pickrst.h"
-#include "av1/encoder/random.h"
-#include "av1/encoder/ratectrl.h"
-#include "av1/encoder/rd.h"
-#include "av1/encoder/segmentation.h"
-#include "av1/encoder/speed_features.h"
-#include "av1/encoder/temporal_filter.h"
-
-#ifndef ADDITIONHANDLE_FRAME
-#define ADDITIONHANDLE_FRAME
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-//Feed the whole frame image into the neural network.
-void addition_handle_frame(AV1_COMMON *cm, FRAME_TYPE frame_type); 
-//The encoding image is divided into small blocks and fed into the neural network separately.
-void addition_handle_blocks(AV1_COMMON *cm, FRAME_TYPE frame_type); 
+// Capabilities of a CNN restoration backend.
+enum {
+  // Restores the tiles of a frame in batches on cpi->cnn_workers, in the
+  // background.
+  CNN_BACKEND_BATCH = 1 << 0,
+  // Restores high bitdepth frames at their bit depth.
+  CNN_BACKEND_HIGHBD = 1 << 1,
+  // Restores frames bit for bit as the decoder does, so that the sequence
+  // header may signal the CNN. The encoder runs other backends on a copy of
+  // the filtered frame, for their timings only.
+  CNN_BACKEND_BIT_EXACT = 1 << 2,
+  // Restores the chroma planes, and can put them back afterwards.
+  CNN_BACKEND_CHROMA = 1 << 3,
+};
 
-uint8_t **blocks_to_cnn_secondly(uint8_t *pBuffer_y, int height, int width,
-                                 int stride, FRAME_TYPE frame_type);
+// Something the encoder can restore frames with. Functions that fail raise
+// an error through cpi->common.error.
+typedef struct CnnBackend {
+  aom_cnn_backend_t id;
+  const char *name;
+  unsigned int caps;
+  // Loads the models, or whatever the backend restores with.
+  void (*init)(AV1_COMP *cpi);
+  void (*destroy)(AV1_COMP *cpi);
+  // Number of models the frames can be restored with.
+  int (*num_models)(const AV1_COMP *cpi);
+  // Sizes the buffers for the largest frames of the stream, so that
+  // restoring a frame allocates nothing. May be NULL.
+  void (*reserve)(AV1_COMP *cpi);
+  // Restores cm->frame_to_show. Returns 1 if the frame is restored in the
+  // background, in which case restore_join() has to be called before
+  // anything touches the frame again.
+  int (*restore_launch)(AV1_COMP *cpi, AV1_COMMON *cm, FRAME_TYPE frame_type);
+  void (*restore_join)(AV1_COMP *cpi, AV1_COMMON *cm);
+  // Puts a plane of the frame restored last back the way it was before.
+  void (*undo_plane)(AV1_COMP *cpi, AV1_COMMON *cm, int plane);
+} CnnBackend;
 
-#ifdef __cplusplus
-}  // extern "C"
-#endif
+// Returns the backend id stands for, or NULL if the build lacks it.
+// AOM_CNN_BACKEND_DEFAULT has no backend of its own.
+const CnnBackend *addition_get_backend(aom_cnn_backend_t id);
 
-#endif //ADDITIONHANDLE_FRAME
+// Switches to the backend of cpi->oxcf.cnn_backend and initializes it, which
+// for the local backends loads the CNN models from cpi->oxcf.cnn_model_dir,
+// or the built-in default models if it is not set. The registry is left
+// empty if the default models are missing.
+void addition_load_models(AV1_COMP *cpi);
+// Releases what the backend holds.
+void addition_free_models(AV1_COMP *cpi);
+// Number of models the frames can be restored with.
+int addition_num_models(const AV1_COMP *cpi);
 
-#pragma once
+// Feed the whole frame image into the neural network.
+void addition_handle_frame(AV1_COMP *cpi, AV1_COMMON *cm,
+                           FRAME_TYPE frame_type);
+// The encoding image is divided into small blocks and fed into the neural
+// network separately. The native backends give the blocks enough context to
+// hide their boundaries, spread them over cpi->cnn_workers and restore the
+// chroma planes as well. The TensorFlow backend only restores luma.
+void addition_handle_blocks(AV1_COMP *cpi, AV1_COMMON *cm,
+                            FRAME_TYPE frame_type);
+// addition_handle_blocks() in two halves, see CnnBackend.restore_launch().
+int addition_handle_blocks_launch(AV1_COMP *cpi, AV1_COMMON *cm,
+                                  FRAME_TYPE frame_type);
+void addition_handle_blocks_join(AV1_COMP *cpi, AV1_COMMON *cm);
+// Puts a plane of the frame addition_handle_blocks() restored last back the
+// way it was before.
+void addition_undo_plane(AV1_COMP *cpi, AV1_COMMON *cm, int plane);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
 
+#endif  // AV1_ENCODER_ADDITION_HANDLE_FRAME_H_
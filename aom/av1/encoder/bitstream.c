@@ -1924,18 +1924,23 @@ static void loop_restoration_write_sb_coeffs(const AV1_COMMON *const cm,
   }
 }
 
-static void encode_loopfilter(AV1_COMMON *cm, struct aom_write_bit_buffer *wb) {
+static void encode_loopfilter(AV1_COMP *cpi, struct aom_write_bit_buffer *wb) {
+  AV1_COMMON *const cm = &cpi->common;
   assert(!cm->coded_lossless);
   if (cm->allow_intrabc) return;
   const int num_planes = av1_num_planes(cm);
   int i;
   struct loopfilter *lf = &cm->lf;
+  int chroma_levels = lf->filter_level[0] || lf->filter_level[1];
+#if CONFIG_CNN_RESTORATION
+  chroma_levels |= av1_cnn_frame_luma_only(cm, cpi->refresh_frame_mask);
+#endif  // CONFIG_CNN_RESTORATION
 
   // Encode the loop filter level and type
   aom_wb_write_literal(wb, lf->filter_level[0], 6);
   aom_wb_write_literal(wb, lf->filter_level[1], 6);
   if (num_planes > 1) {
-    if (lf->filter_level[0] || lf->filter_level[1]) {
+    if (chroma_levels) {
       aom_wb_write_literal(wb, lf->filter_level_u, 6);
       aom_wb_write_literal(wb, lf->filter_level_v, 6);
     }
@@ -2238,7 +2243,7 @@ static int get_refresh_mask_gf16(AV1_COMP *cpi) {
 }
 #endif  // USE_GF16_MULTI_LAYER
 
-static int get_refresh_mask(AV1_COMP *cpi) {
+int av1_get_refresh_mask(AV1_COMP *cpi) {
   if ((cpi->common.frame_type == KEY_FRAME && cpi->common.show_frame) ||
       frame_is_sframe(&cpi->common))
     return 0xFF;
@@ -2764,6 +2769,13 @@ void write_sequence_header(AV1_COMP *cpi, struct aom_write_bit_buffer *wb) {
   aom_wb_write_bit(wb, seq_params->enable_superres);
   aom_wb_write_bit(wb, seq_params->enable_cdef);
   aom_wb_write_bit(wb, seq_params->enable_restoration);
+#if CONFIG_CNN_RESTORATION
+  aom_wb_write_bit(wb, seq_params->enable_cnn_restoration);
+  if (seq_params->enable_cnn_restoration) {
+    aom_wb_write_literal(wb, seq_params->cnn_depth, CNN_DEPTH_BITS);
+    aom_wb_write_bit(wb, seq_params->cnn_bf16);
+  }
+#endif  // CONFIG_CNN_RESTORATION
 }
 
 static void write_global_motion_params(const WarpedMotionParams *params,
@@ -3076,7 +3088,7 @@ static void write_uncompressed_header_obu(AV1_COMP *cpi,
       }
     }
   }
-  cpi->refresh_frame_mask = get_refresh_mask(cpi);
+  cpi->refresh_frame_mask = av1_get_refresh_mask(cpi);
   if (cm->frame_type == KEY_FRAME) {
     if (!cm->show_frame) {  // unshown keyframe (forward keyframe)
       aom_wb_write_literal(wb, cpi->refresh_frame_mask, REF_FRAMES);
@@ -3259,11 +3271,19 @@ static void write_uncompressed_header_obu(AV1_COMP *cpi,
     }
   }
 
+#if CONFIG_CNN_RESTORATION
+  if (av1_cnn_frame_allowed(cm, cpi->refresh_frame_mask)) {
+    aom_wb_write_bit(wb, cm->use_cnn_restoration);
+    if (cm->use_cnn_restoration && av1_num_planes(cm) > 1)
+      aom_wb_write_bit(wb, cm->cnn_restore_chroma);
+  }
+#endif  // CONFIG_CNN_RESTORATION
+
   if (cm->all_lossless) {
     assert(!av1_superres_scaled(cm));
   } else {
     if (!cm->coded_lossless) {
-      encode_loopfilter(cm, wb);
+      encode_loopfilter(cpi, wb);
       encode_cdef(cm, wb);
     }
     encode_restoration_mode(cm, wb);
@@ -30,6 +30,9 @@ int write_uleb_obu_size(uint32_t obu_header_size, uint32_t obu_payload_size,
 
 int av1_pack_bitstream(AV1_COMP *const cpi, uint8_t *dest, size_t *size);
 
+// Returns the reference slots the current frame is written to.
+int av1_get_refresh_mask(AV1_COMP *cpi);
+
 static INLINE int av1_preserve_existing_gf(AV1_COMP *cpi) {
   // Do not swap gf and arf indices for internal overlay frames
   return !cpi->multi_arf_allowed && cpi->rc.is_src_frame_alt_ref &&
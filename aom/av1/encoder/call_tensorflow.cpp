@@ -1,4 +1,4 @@
-﻿/*
+/*
  * Copyright (c) 2019, Alliance for Open Media. All rights reserved
  *
  * This source code is subject to the terms of the BSD 2 Clause License and
@@ -11,418 +11,86 @@
 
 #include <Python.h>
 #include <stdio.h>
-#include <sstream>
+#include <string.h>
 
-#include <limits.h>
-#include <math.h>
+#include "av1/encoder/call_tensorflow.h"
 
-#include "config/aom_config.h"
-#include "config/aom_dsp_rtcd.h"
-#include "config/aom_scale_rtcd.h"
-#include "config/av1_rtcd.h"
-
-#include "aom_dsp/aom_dsp_common.h"
-#include "aom_dsp/aom_filter.h"
-#if CONFIG_DENOISE
-#include "aom_dsp/grain_table.h"
-#include "aom_dsp/noise_util.h"
-#include "aom_dsp/noise_model.h"
-#endif
-#include "aom_dsp/psnr.h"
-#if CONFIG_INTERNAL_STATS
-#include "aom_dsp/ssim.h"
-#endif
-#include "aom_ports/aom_timer.h"
 #include "aom_ports/mem.h"
-#include "aom_ports/system_state.h"
-#include "aom_scale/aom_scale.h"
-#if CONFIG_BITSTREAM_DEBUG || CONFIG_MISMATCH_DEBUG
-#include "aom_util/debug_util.h"
-#endif  // CONFIG_BITSTREAM_DEBUG || CONFIG_MISMATCH_DEBUG
-
-#include "av1/common/alloccommon.h"
-#include "av1/common/cdef.h"
-#include "av1/common/filter.h"
-#include "av1/common/idct.h"
-#include "av1/common/reconinter.h"
-#include "av1/common/reconintra.h"
-#include "av1/common/resize.h"
-
-#include "av1/encoder/aq_complexity.h"
-#include "av1/encoder/aq_cyclicrefresh.h"
-#include "av1/encoder/aq_variance.h"
-#include "av1/encoder/bitstream.h"
-#include "av1/encoder/context_tree.h"
-#include "av1/encoder/encodeframe.h"
-#include "av1/encoder/encodemv.h"
-#include "av1/encoder/encoder.h"
-#include "av1/encoder/encodetxb.h"
-#include "av1/encoder/ethread.h"
-#include "av1/encoder/firstpass.h"
-#include "av1/encoder/grain_test_vectors.h"
-#include "av1/encoder/hash_motion.h"
-#include "av1/encoder/mbgraph.h"
-#include "av1/encoder/picklpf.h"
-#include "av1/encoder/pickrst.h"
-#include "av1/encoder/random.h"
-#include "av1/encoder/ratectrl.h"
-#include "av1/encoder/rd.h"
-#include "av1/encoder/segmentation.h"
-#include "av1/encoder/speed_features.h"
-#include "av1/encoder/temporal_filter.h"
-
-
-uint8_t **call_tensorflow(uint8_t *ppp, int height, int width, int stride,
-                          FRAME_TYPE frame_type) {
-	Py_SetPath(
-		L"/home/chenjs/a5/aom_cnn_7/aom/av1/encoder:"
-	    "/home/chenjs/.conda/envs/tf2/lib:"
-	    "/home/chenjs/.conda/envs/tf2/lib/python3.6:"
-	    "/home/chenjs/.conda/envs/tf2/lib/python3.6/site-packages:"
-	    "/home/chenjs/.conda/envs/tf2/lib/python3.6/lib-dynload");
-
-	PyObject * pModule = NULL;
-	PyObject * pFuncI = NULL;
-	PyObject * pFuncB = NULL;
-	PyObject * pArgs = NULL;
-
-	// Initialize the python environment
-	Py_Initialize();
-
-	if (!Py_IsInitialized()) {
-		printf("Python init failed!\n");
-		return NULL;
-	}
-
-	// Import a specified submodule
-	pModule = PyImport_ImportModule("TEST");
-	//pModule = PyImport_ImportModule("TEST_qp52_I");
-
-	if (!pModule) {
-		printf("don't load Pmodule\n");
-		Py_Finalize();
-		return NULL;
-	}
-	
-	pFuncI = PyObject_GetAttrString(pModule, "entranceI");
-	if (!pFuncI) {
-		printf("don't get I function!");
-		Py_Finalize();
-		return NULL;
-	}
-
-	pFuncB = PyObject_GetAttrString(pModule, "entranceB");
-	if (!pFuncB) {
-		printf("don't get B function!");
-		Py_Finalize();
-		return NULL;
-	}
-	
-	PyObject* list = PyList_New(height); 
-	pArgs = PyTuple_New(1);           
-	PyObject** lists = new PyObject*[height];
-
-	for (int i = 0; i < height; i++)
-	{
-		lists[i] = PyList_New(0);
-		for (int j = 0; j < width; j++)
-		{
-			//Convert to a Python int object
-			PyList_Append(lists[i], Py_BuildValue("i", *(ppp + j))); 
-		}
-		PyList_SetItem(list, i, lists[i]);
-		ppp += stride;
-	}
-	PyTuple_SetItem(pArgs, 0, list);    //"list" is the input image
-
-	PyObject *presult = NULL;
-	if (frame_type == KEY_FRAME){
-		presult = PyEval_CallObject(pFuncI, pArgs);
-	}
-	else{
-		presult = PyEval_CallObject(pFuncB, pArgs);
-	}
-
-	uint8_t **rePic = new uint8_t*[height];
-	for (int i = 0; i < height; i++){
-		rePic[i] = new uint8_t[width];
-	}
-	uint8_t s;
-	for (int i = 0; i < height; i++)
-	{
-		for (int j = 0; j < width; j++)
-		{
-			PyArg_Parse(PyList_GetItem(PyList_GetItem(presult, i), j), "B", &s); 
-			rePic[i][j] = s;;
-		}
-	}
-	//Py_Finalize();
-	return rePic;
-}
-
-
-uint16_t **call_tensorflow_hbd(uint16_t *ppp, int height, int width, int stride,
-                               FRAME_TYPE frame_type) {
-	Py_SetPath(
-		L"/home/chenjs/a5/aom_cnn_7/aom/av1/encoder/:"
-		"/home/chenjs/.conda/envs/tf2/lib:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6/site-packages:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6/lib-dynload");
-
-	PyObject * pModule = NULL;
-	PyObject * pFuncI = NULL;
-	PyObject * pFuncB = NULL;
-	PyObject * pArgs = NULL;
-
-	// Initialize the python environment
-	Py_Initialize();
-
-	if (!Py_IsInitialized()) {
-		printf("Python init failed!\n");
-		return NULL;
-	}
-
-	pModule = PyImport_ImportModule("TEST");
-
-	if (!pModule) {
-		printf("don't load Pmodule\n");
-		Py_Finalize();
-		return NULL;
-	}
-	
-	// Get the function pointer that needs to be called
-	pFuncI = PyObject_GetAttrString(pModule, "entranceI");
-	if (!pFuncI) {
-		printf("don't get I function!");
-		Py_Finalize();
-		return NULL;
-	}
-
-	pFuncB = PyObject_GetAttrString(pModule, "entranceB");
-	if (!pFuncB) {
-		printf("don't get B function!");
-		Py_Finalize();
-		return NULL;
-	}
-	
-	PyObject* list = PyList_New(height); 
-	pArgs = PyTuple_New(1);             //A new tuple object of size 1   
-	PyObject** lists = new PyObject*[height];
-
-	//Read the data from y buffer into the list
-	for (int i = 0; i < height; i++)
-	{
-		lists[i] = PyList_New(0);
-		for (int j = 0; j < width; j++)
-		{
-			PyList_Append(
-				lists[i],
-				Py_BuildValue("i", *(ppp + j)));
-		}
-		PyList_SetItem(list, i, lists[i]);
-		ppp += stride;
-	}
-	PyTuple_SetItem(pArgs, 0, list);
-
-	PyObject *presult = NULL;
 
-	if (frame_type == KEY_FRAME){
-		presult = PyEval_CallObject(pFuncI, pArgs);  //Call the function in the python script
-	}
-	else{
-		presult = PyEval_CallObject(pFuncB, pArgs);
-	}
-
-	uint16_t **rePic = new uint16_t*[height];
-	for (int i = 0; i < height; i++){
-		rePic[i] = new uint16_t[width];
-	}
-	uint16_t s;
-	for (int i = 0; i < height; i++)
-	{
-		for (int j = 0; j < width; j++)
-		{
-			/*PyList_GetItem(PyList_GetItem(presult, i), j) get the object
-			  at position (i,j) in the tuple pointed to by presult*/
-			PyArg_Parse(PyList_GetItem(PyList_GetItem(presult, i), j), "H", &s); 
-			rePic[i][j] = s;
-		}
-	}
-	//Py_Finalize();
-	return rePic;
+// Entry points of the TEST module for intra [0] and inter [1] frames. The
+// interpreter and the module are set up on first use and kept for the life
+// of the process. TEST.py is looked up through PYTHONPATH.
+static PyObject *entrance_funcs[2];
+
+static int init_python(void) {
+  if (entrance_funcs[0] && entrance_funcs[1]) return 0;
+
+  // Initialize the python environment
+  if (!Py_IsInitialized()) Py_Initialize();
+  if (!Py_IsInitialized()) {
+    fprintf(stderr, "Python init failed!\n");
+    return -1;
+  }
+
+  PyObject *const module = PyImport_ImportModule("TEST");
+  if (!module) {
+    PyErr_Print();
+    return -1;
+  }
+  entrance_funcs[0] = PyObject_GetAttrString(module, "entranceI");
+  entrance_funcs[1] = PyObject_GetAttrString(module, "entranceB");
+  Py_DECREF(module);
+  if (!entrance_funcs[0] || !entrance_funcs[1]) {
+    PyErr_Print();
+    Py_CLEAR(entrance_funcs[0]);
+    Py_CLEAR(entrance_funcs[1]);
+    return -1;
+  }
+  return 0;
 }
 
-
-uint8_t **block_call_tensorflow(uint8_t *ppp, int cur_buf_height,
-                                int cur_buf_width, int stride,
-                                FRAME_TYPE frame_type) {
-	Py_SetPath(
-		L"/home/chenjs/a5/aom_cnn_7/aom/av1/encoder/:"
-		"/home/chenjs/.conda/envs/tf2/lib:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6/site-packages:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6/lib-dynload");
-
-	PyObject * pModule = NULL;
-	PyObject * pFuncI = NULL;
-	PyObject * pFuncB = NULL;
-	PyObject * pArgs = NULL;
-
-	Py_Initialize();
-
-	if (!Py_IsInitialized()) {
-		printf("Python init failed!\n");
-		return NULL;
-	}
-
-	pModule = PyImport_ImportModule("TEST");
-
-	if (!pModule) {
-		printf("don't load Pmodule\n");
-		Py_Finalize();
-		return NULL;
-	}
-
-	pFuncI = PyObject_GetAttrString(pModule, "entranceI");
-	if (!pFuncI) {
-		printf("don't get I function!");
-		Py_Finalize();
-		return NULL;
-	}
-
-	pFuncB = PyObject_GetAttrString(pModule, "entranceB");
-	if (!pFuncB) {
-		printf("don't get B function!");
-		Py_Finalize();
-		return NULL;
-	}
-	PyObject* list = PyList_New(cur_buf_height);
-	pArgs = PyTuple_New(1);                
-	PyObject** lists = new PyObject*[cur_buf_height];
-
-	for (int i = 0; i < cur_buf_height; i++)
-	{
-		lists[i] = PyList_New(0);
-		for (int j = 0; j < cur_buf_width; j++)
-		{
-			PyList_Append(lists[i], Py_BuildValue("i", *(ppp + j)));
-		}
-		PyList_SetItem(list, i, lists[i]);
-		ppp += stride;
-	}
-
-	PyTuple_SetItem(pArgs, 0, list);  
-
-	PyObject *presult = NULL;
-	if (frame_type == KEY_FRAME){
-		presult = PyEval_CallObject(pFuncI, pArgs);
-	}
-	else{
-		presult = PyEval_CallObject(pFuncB, pArgs);
-	}
-
-	uint8_t **rePic = new uint8_t*[cur_buf_height];
-	for (int i = 0; i < cur_buf_height; i++) {
-		rePic[i] = new uint8_t[cur_buf_width];
-	}
-	uint8_t s;
-	for (int i = 0; i < cur_buf_height; i++)
-	{
-		for (int j = 0; j < cur_buf_width; j++)
-		{
-			/*PyList_GetItem(PyList_GetItem(presult, i), j) get the object
-			  at position (i,j) in the tuple pointed to by presult*/
-			PyArg_Parse(PyList_GetItem(PyList_GetItem(presult, i), j), "B", &s);
-			rePic[i][j] = s;
-		}
-	}
-	//Py_Finalize();
-	return rePic;
-}
-
-uint16_t **block_call_tensorflow_hbd(uint16_t *ppp, int cur_buf_height,
-                                     int cur_buf_width, int stride,
-                                     FRAME_TYPE frame_type) {
-	Py_SetPath(
-		L"/home/chenjs/a5/aom_cnn_7/aom/av1/encoder/:"
-		"/home/chenjs/.conda/envs/tf2/lib:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6/site-packages:"
-		"/home/chenjs/.conda/envs/tf2/lib/python3.6/lib-dynload");
-
-	PyObject * pModule = NULL;
-	PyObject * pFuncI = NULL;
-	PyObject * pFuncB = NULL;
-	PyObject * pArgs = NULL;
-
-	Py_Initialize();
-
-	if (!Py_IsInitialized()) {
-		printf("Python init failed!\n");
-		return NULL;
-	}
-
-	pModule = PyImport_ImportModule("TEST");
-	//pModule = PyImport_ImportModule("TEST_qp52_B");
-	//pModule = PyImport_ImportModule("TEST_qp52_I");
-
-	if (!pModule) {
-		printf("don't load Pmodule\n");
-		Py_Finalize();
-		return NULL;
-	}
-
-	pFuncI = PyObject_GetAttrString(pModule, "entranceI");
-	if (!pFuncI) {
-		printf("don't get I function!");
-		Py_Finalize();
-		return NULL;
-	}
-
-	pFuncB = PyObject_GetAttrString(pModule, "entranceB");
-	if (!pFuncB) {
-		printf("don't get B function!");
-		Py_Finalize();
-		return NULL;
-	}
-	PyObject* list = PyList_New(cur_buf_height);
-	pArgs = PyTuple_New(1);                
-	PyObject** lists = new PyObject*[cur_buf_height];
-
-	for (int i = 0; i < cur_buf_height; i++)
-	{
-		lists[i] = PyList_New(0);
-		for (int j = 0; j < cur_buf_width; j++)
-		{
-			PyList_Append(lists[i], Py_BuildValue("i", *(ppp + j)));
-		}
-		PyList_SetItem(list, i, lists[i]);
-		ppp += stride;
-	}
-	PyTuple_SetItem(pArgs, 0, list);    
-	PyObject *presult = NULL;
-	if (frame_type == KEY_FRAME){
-		presult = PyEval_CallObject(pFuncI, pArgs);
-	}
-	else{
-		presult = PyEval_CallObject(pFuncB, pArgs);
-	}
-
-	uint16_t **rePic = new uint16_t*[cur_buf_height];
-	for (int i = 0; i < cur_buf_height; i++) {
-		rePic[i] = new uint16_t[cur_buf_width];
-	}
-	uint16_t s;
-	for (int i = 0; i < cur_buf_height; i++)
-	{
-		for (int j = 0; j < cur_buf_width; j++)
-		{
-			PyArg_Parse(PyList_GetItem(PyList_GetItem(presult, i), j), "H", &s);
-			rePic[i][j] = s;
-		}
-
-	}
-	//Py_Finalize();
-	return rePic;
+int call_tensorflow(const CnnPlaneView *view, int is_intra) {
+  if (init_python()) return -1;
+
+  const Py_ssize_t itemsize = view->highbd ? sizeof(uint16_t) : 1;
+  Py_ssize_t shape[2] = { view->height, view->width };
+  Py_ssize_t strides[2] = { view->stride * itemsize, itemsize };
+  Py_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  buffer.buf = view->highbd ? (void *)CONVERT_TO_SHORTPTR(view->data)
+                            : (void *)view->data;
+  buffer.len = shape[0] * shape[1] * itemsize;
+  buffer.itemsize = itemsize;
+  buffer.readonly = 0;
+  buffer.ndim = 2;
+  buffer.format = (char *)(view->highbd ? "H" : "B");
+  buffer.shape = shape;
+  buffer.strides = strides;
+
+  PyObject *const plane = PyMemoryView_FromBuffer(&buffer);
+  if (!plane) {
+    PyErr_Print();
+    return -1;
+  }
+  PyObject *const bit_depth = PyLong_FromLong(view->bit_depth);
+  PyObject *const result =
+      bit_depth ? PyObject_CallFunctionObjArgs(entrance_funcs[!is_intra],
+                                               plane, bit_depth, NULL)
+                : NULL;
+  Py_XDECREF(bit_depth);
+
+  // The memoryview borrows the frame buffer. Releasing it fails if the
+  // backend kept an export of it alive, which would leave a dangling
+  // reference to the frame.
+  PyObject *const released = PyObject_CallMethod(plane, "release", NULL);
+  Py_DECREF(plane);
+  if (!result || !released) {
+    PyErr_Print();
+    Py_XDECREF(result);
+    Py_XDECREF(released);
+    return -1;
+  }
+  Py_DECREF(result);
+  Py_DECREF(released);
+  return 0;
 }
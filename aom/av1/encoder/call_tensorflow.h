@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#ifndef AV1_ENCODER_CALL_TENSORFLOW_H_
+#define AV1_ENCODER_CALL_TENSORFLOW_H_
+
+#include "config/aom_config.h"
+
+#include "av1/common/cnn_restoration.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Restores the region described by view with the TensorFlow networks of
+// TEST.py (entranceI for intra frames, entranceB otherwise). The region is
+// passed to Python, along with the bit depth of its samples, as a writable
+// 2-D memoryview over the frame buffer, so no samples are copied and the
+// result is written back in place. The view is released before returning.
+// Returns 0 on success.
+int call_tensorflow(const CnnPlaneView *view, int is_intra);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // AV1_ENCODER_CALL_TENSORFLOW_H_
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+// For the sockets and shm_open() under -std=c99.
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "av1/encoder/cnn_remote.h"
+
+#include "aom_mem/aom_mem.h"
+#include "aom_ports/mem.h"
+
+struct CnnRemote {
+  int fd;
+  int num_models;
+  // The ring shared with the server, CNN_REMOTE_SLOTS slots of slot_size.
+  uint8_t *ring;
+  size_t slot_size;
+  int next_slot;
+  // The last request. Its slot holds the planes of the last frame, unless
+  // they were restored in place.
+  CnnRemoteRequest request;
+  int pending;
+  uint8_t *mask;
+  int mask_size;
+};
+
+#ifdef MSG_NOSIGNAL
+#define CNN_REMOTE_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define CNN_REMOTE_SEND_FLAGS 0
+#endif
+
+// Sends a request, and the file descriptor passed_fd along with it unless it
+// is negative. Returns 0 on success.
+static int send_request(int fd, const CnnRemoteRequest *request,
+                        int passed_fd) {
+  struct iovec iov = { (void *)request, sizeof(*request) };
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (passed_fd >= 0) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(int));
+  }
+  ssize_t sent;
+  do {
+    sent = sendmsg(fd, &msg, CNN_REMOTE_SEND_FLAGS);
+  } while (sent < 0 && errno == EINTR);
+  return sent != (ssize_t)sizeof(*request);
+}
+
+static int receive_reply(int fd, CnnRemoteReply *reply) {
+  size_t received = 0;
+  while (received < sizeof(*reply)) {
+    const ssize_t n = recv(fd, (uint8_t *)reply + received,
+                           sizeof(*reply) - received, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return 1;
+    received += n;
+  }
+  return reply->magic != CNN_REMOTE_MAGIC || reply->status != 0;
+}
+
+CnnRemote *av1_cnn_remote_connect(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) return NULL;
+  CnnRemote *const remote = (CnnRemote *)aom_calloc(1, sizeof(*remote));
+  if (remote == NULL) return NULL;
+  remote->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  CnnRemoteRequest request;
+  CnnRemoteReply reply;
+  memset(&request, 0, sizeof(request));
+  request.magic = CNN_REMOTE_MAGIC;
+  request.type = CNN_REMOTE_HELLO;
+  if (remote->fd < 0 ||
+      connect(remote->fd, (const struct sockaddr *)&addr, sizeof(addr)) ||
+      send_request(remote->fd, &request, -1) ||
+      receive_reply(remote->fd, &reply)) {
+    av1_cnn_remote_close(remote);
+    return NULL;
+  }
+  remote->num_models = reply.num_models;
+  return remote;
+}
+
+void av1_cnn_remote_close(CnnRemote *remote) {
+  if (remote == NULL) return;
+  if (remote->fd >= 0) close(remote->fd);
+  if (remote->ring != NULL)
+    munmap(remote->ring, remote->slot_size * CNN_REMOTE_SLOTS);
+  aom_free(remote->mask);
+  aom_free(remote);
+}
+
+int av1_cnn_remote_num_models(const CnnRemote *remote) {
+  return remote->num_models;
+}
+
+uint8_t *av1_cnn_remote_mask_buffer(CnnRemote *remote, int size) {
+  if (size > remote->mask_size) {
+    aom_free(remote->mask);
+    remote->mask_size = 0;
+    remote->mask = (uint8_t *)aom_malloc(size);
+    if (remote->mask == NULL) return NULL;
+    remote->mask_size = size;
+  }
+  return remote->mask;
+}
+
+// Returns the file descriptor of a new shared memory object of size bytes,
+// or -1. The object has no name left, so it goes away with the last
+// descriptor and mapping of it.
+static int create_shm(size_t size) {
+  static int counter;
+  char name[64];
+  int fd;
+  // The encoders on other threads of the process may take a name first.
+  do {
+    snprintf(name, sizeof(name), "/aom-cnn-%d-%d", (int)getpid(), counter++);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  } while (fd < 0 && errno == EEXIST);
+  if (fd < 0) return -1;
+  shm_unlink(name);
+  if (ftruncate(fd, (off_t)size)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Replaces the ring with one of slots of at least slot_size bytes, and hands
+// it to the server. Returns 0 on success.
+static int alloc_ring(CnnRemote *remote, size_t slot_size) {
+  if (remote->ring != NULL)
+    munmap(remote->ring, remote->slot_size * CNN_REMOTE_SLOTS);
+  remote->ring = NULL;
+  remote->slot_size = 0;
+  slot_size = (slot_size + 4095) & ~(size_t)4095;
+  const int fd = create_shm(slot_size * CNN_REMOTE_SLOTS);
+  if (fd < 0) return 1;
+  void *const ring = mmap(NULL, slot_size * CNN_REMOTE_SLOTS,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  CnnRemoteRequest request;
+  CnnRemoteReply reply;
+  memset(&request, 0, sizeof(request));
+  request.magic = CNN_REMOTE_MAGIC;
+  request.type = CNN_REMOTE_RING;
+  request.num_slots = CNN_REMOTE_SLOTS;
+  request.slot_size = slot_size;
+  const int failed = ring == MAP_FAILED ||
+                     send_request(remote->fd, &request, fd) ||
+                     receive_reply(remote->fd, &reply);
+  close(fd);
+  if (ring == MAP_FAILED) return 1;
+  remote->ring = (uint8_t *)ring;
+  remote->slot_size = slot_size;
+  return failed;
+}
+
+int av1_cnn_remote_get_frame_buffer(void *cb_priv, size_t min_size,
+                                    aom_codec_frame_buffer_t *fb) {
+  (void)cb_priv;
+  if (fb->data != NULL && fb->size >= min_size) return 0;
+  av1_cnn_remote_free_frame_buffer(fb);
+  const size_t size = (min_size + 4095) & ~(size_t)4095;
+  const int fd = create_shm(size);
+  if (fd < 0) return -1;
+  void *const data =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  fb->data = (uint8_t *)data;
+  fb->size = size;
+  // The descriptor goes to the server with every frame restored in place.
+  fb->priv = (void *)(intptr_t)fd;
+  return 0;
+}
+
+void av1_cnn_remote_free_frame_buffer(aom_codec_frame_buffer_t *fb) {
+  if (fb->data == NULL) return;
+  munmap(fb->data, fb->size);
+  close((int)(intptr_t)fb->priv);
+  fb->data = NULL;
+  fb->size = 0;
+  fb->priv = NULL;
+}
+
+// Copies a plane between the frame and its place in a slot, in the
+// direction to_frame says.
+static void copy_plane(const YV12_BUFFER_CONFIG *frame, int plane,
+                       uint8_t *slot_plane, int to_frame) {
+  const int is_uv = plane > 0;
+  const int highbd = (frame->flags & YV12_FLAG_HIGHBITDEPTH) != 0;
+  const int bytes_per_sample = highbd ? 2 : 1;
+  const int width = frame->crop_widths[is_uv];
+  uint8_t *row = highbd ? (uint8_t *)CONVERT_TO_SHORTPTR(frame->buffers[plane])
+                        : frame->buffers[plane];
+  for (int r = 0; r < frame->crop_heights[is_uv]; ++r) {
+    if (to_frame) {
+      memcpy(row, slot_plane, width * bytes_per_sample);
+    } else {
+      memcpy(slot_plane, row, width * bytes_per_sample);
+    }
+    row += frame->strides[is_uv] * bytes_per_sample;
+    slot_plane += width * bytes_per_sample;
+  }
+}
+
+int av1_cnn_remote_launch(CnnRemote *remote, const YV12_BUFFER_CONFIG *frame,
+                          const aom_codec_frame_buffer_t *fb,
+                          const CnnRemoteParams *params) {
+  CnnRemoteRequest *const request = &remote->request;
+  const int highbd = (frame->flags & YV12_FLAG_HIGHBITDEPTH) != 0;
+  const int bytes_per_sample = highbd ? 2 : 1;
+  const int sb_size = 1 << params->sb_size_log2;
+  // The frames aom_realloc_frame_buffer() put in fb do not own their buffer.
+  const int in_place = fb != NULL && fb->data != NULL &&
+                       frame->buffer_alloc_sz == 0 &&
+                       frame->buffer_alloc >= fb->data &&
+                       frame->buffer_alloc < fb->data + fb->size;
+  size_t in_size = 0;
+
+  memset(request, 0, sizeof(*request));
+  request->magic = CNN_REMOTE_MAGIC;
+  request->type = CNN_REMOTE_RESTORE;
+  request->in_place = in_place;
+  request->qp = params->qp;
+  request->depth = params->depth;
+  request->act_format = params->act_format;
+  request->highbd = highbd;
+  request->bit_depth = highbd ? params->bit_depth : 8;
+  request->sb_size_log2 = params->sb_size_log2;
+  request->sb_cols =
+      (frame->y_crop_width + sb_size - 1) >> params->sb_size_log2;
+  request->sb_rows =
+      (frame->y_crop_height + sb_size - 1) >> params->sb_size_log2;
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    CnnRemotePlane *const p = &request->planes[plane];
+    const int is_uv = plane > 0;
+    p->role = -1;
+    if (plane >= params->num_planes) continue;
+    p->role = is_uv ? (params->intra ? CNN_ROLE_CHROMA_INTRA
+                                     : CNN_ROLE_CHROMA_INTER)
+                    : (params->intra ? CNN_ROLE_INTRA : CNN_ROLE_INTER);
+    p->width = frame->crop_widths[is_uv];
+    p->height = frame->crop_heights[is_uv];
+    p->ss_x = is_uv ? frame->subsampling_x : 0;
+    p->ss_y = is_uv ? frame->subsampling_y : 0;
+    if (in_place) {
+      const uint8_t *const buf =
+          highbd ? (const uint8_t *)CONVERT_TO_SHORTPTR(frame->buffers[plane])
+                 : frame->buffers[plane];
+      p->stride = frame->strides[is_uv];
+      p->offset = buf - fb->data;
+    } else {
+      p->stride = p->width;
+      p->offset = in_size;
+      in_size += (size_t)p->width * p->height * bytes_per_sample;
+    }
+  }
+  request->mask_offset = in_size;
+  const size_t slot_size =
+      request->mask_offset + (size_t)request->sb_cols * request->sb_rows;
+
+  if (slot_size > remote->slot_size && alloc_ring(remote, slot_size)) return 1;
+  request->slot = remote->next_slot;
+  remote->next_slot = (remote->next_slot + 1) % CNN_REMOTE_SLOTS;
+  uint8_t *const slot = remote->ring + request->slot * remote->slot_size;
+  if (!in_place) {
+    for (int plane = 0; plane < params->num_planes; ++plane)
+      copy_plane(frame, plane, slot + request->planes[plane].offset, 0);
+  }
+  memcpy(slot + request->mask_offset, params->sb_mask,
+         (size_t)request->sb_cols * request->sb_rows);
+
+  if (send_request(remote->fd, request,
+                   in_place ? (int)(intptr_t)fb->priv : -1))
+    return 1;
+  remote->pending = 1;
+  return 0;
+}
+
+int av1_cnn_remote_wait(CnnRemote *remote, YV12_BUFFER_CONFIG *frame) {
+  const CnnRemoteRequest *const request = &remote->request;
+  CnnRemoteReply reply;
+  if (!remote->pending) return 1;
+  remote->pending = 0;
+  if (receive_reply(remote->fd, &reply)) return 1;
+  if (request->in_place) return 0;
+  const uint8_t *const slot = remote->ring + request->slot * remote->slot_size;
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    if (request->planes[plane].role < 0) continue;
+    const CnnRemotePlane *const p = &request->planes[plane];
+    copy_plane(frame, plane, (uint8_t *)slot + p->offset, 1);
+  }
+  return 0;
+}
+
+int av1_cnn_remote_undo_plane(CnnRemote *remote, YV12_BUFFER_CONFIG *frame,
+                              int plane) {
+  const CnnRemoteRequest *const last = &remote->request;
+  if (remote->ring == NULL) return 1;
+  if (last->planes[plane].role < 0) return 0;
+  // The server holds the input of the frame, see av1_cnn_restore_finish().
+  CnnRemoteRequest request;
+  CnnRemoteReply reply;
+  memset(&request, 0, sizeof(request));
+  request.magic = CNN_REMOTE_MAGIC;
+  request.type = CNN_REMOTE_UNDO;
+  request.plane = plane;
+  if (send_request(remote->fd, &request, -1) ||
+      receive_reply(remote->fd, &reply))
+    return 1;
+  if (!last->in_place) {
+    const uint8_t *const slot = remote->ring + last->slot * remote->slot_size;
+    copy_plane(frame, plane, (uint8_t *)slot + last->planes[plane].offset, 1);
+  }
+  return 0;
+}
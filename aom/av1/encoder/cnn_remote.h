@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#ifndef AV1_ENCODER_CNN_REMOTE_H_
+#define AV1_ENCODER_CNN_REMOTE_H_
+
+#include <stdint.h>
+
+#include "config/aom_config.h"
+
+#include "aom/aom_frame_buffer.h"
+#include "aom_scale/yv12config.h"
+#include "av1/common/cnn_restoration.h"
+#include "av1/common/blockd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// CNN restoration by a server process shared by several encoders, see
+// tools/cnn_inference_server.c. A client connects to the Unix domain socket
+// of the server and allocates its frame buffers in shared memory (see
+// av1_cnn_remote_get_frame_buffer()), which it passes along with the frames
+// to restore, so that the server restores them in place. The superblock
+// mask goes through a ring of shared memory slots, which also carry the
+// planes of the frames that are not in shared memory. Only the small
+// messages below go through the socket. The server restores the tiles of
+// all clients with one pool of threads and the models it loaded, which the
+// clients do not need to hold.
+
+#define CNN_REMOTE_MAGIC 0x334e4e43  // "CNN3"
+#define CNN_REMOTE_SLOTS 2
+
+typedef enum {
+  // Asks for the number of models the server holds.
+  CNN_REMOTE_HELLO,
+  // Comes with the file descriptor of a new ring, which replaces the old one.
+  CNN_REMOTE_RING,
+  // Restores a frame in place, in the frame buffer that comes with the
+  // request, or else in a slot of the ring.
+  CNN_REMOTE_RESTORE,
+  // Puts the input of a plane of the last restored frame back in place of
+  // its output.
+  CNN_REMOTE_UNDO,
+} CNN_REMOTE_MSG;
+
+// A plane within the frame buffer or the slot, with a stride in samples, of
+// 2 bytes each for high bitdepth frames.
+typedef struct CnnRemotePlane {
+  int32_t role;  // CNN_MODEL_ROLE, or -1 to leave the plane as it is.
+  int32_t width;
+  int32_t height;
+  int32_t stride;
+  int32_t ss_x;
+  int32_t ss_y;
+  uint64_t offset;
+} CnnRemotePlane;
+
+typedef struct CnnRemoteRequest {
+  uint32_t magic;
+  int32_t type;  // CNN_REMOTE_MSG
+  // CNN_REMOTE_RING
+  uint32_t num_slots;
+  uint64_t slot_size;
+  // CNN_REMOTE_RESTORE
+  uint32_t slot;
+  // Whether the planes are in the frame buffer that comes with the request
+  // rather than in the slot.
+  int32_t in_place;
+  int32_t qp;
+  int32_t depth;
+  int32_t act_format;  // CNN_ACT_FORMAT
+  int32_t highbd;
+  int32_t bit_depth;
+  int32_t sb_size_log2;
+  int32_t sb_cols;
+  int32_t sb_rows;
+  uint64_t mask_offset;
+  CnnRemotePlane planes[MAX_MB_PLANE];
+  // CNN_REMOTE_UNDO
+  int32_t plane;
+} CnnRemoteRequest;
+
+typedef struct CnnRemoteReply {
+  uint32_t magic;
+  int32_t status;  // 0 on success.
+  int32_t num_models;
+} CnnRemoteReply;
+
+// What the server needs to know about a frame besides its pixels.
+typedef struct CnnRemoteParams {
+  int qp;
+  int depth;
+  CNN_ACT_FORMAT act_format;
+  int intra;
+  // Number of planes to restore, from luma on.
+  int num_planes;
+  int bit_depth;
+  // Whether each superblock is restored, in raster order.
+  const uint8_t *sb_mask;
+  int sb_size_log2;
+} CnnRemoteParams;
+
+typedef struct CnnRemote CnnRemote;
+
+// Connects to the server listening at path. Returns NULL on failure.
+CnnRemote *av1_cnn_remote_connect(const char *path);
+void av1_cnn_remote_close(CnnRemote *remote);
+
+// Number of models the server holds.
+int av1_cnn_remote_num_models(const CnnRemote *remote);
+
+// Returns a buffer of at least size bytes to build the superblock mask of
+// the next frame in, or NULL if it cannot be allocated.
+uint8_t *av1_cnn_remote_mask_buffer(CnnRemote *remote, int size);
+
+// aom_get_frame_buffer_cb_fn_t that allocates frame buffers in shared
+// memory, which the server maps to restore the frames in them in place. The
+// buffer fb already holds is kept if it is large enough. cb_priv is not
+// used.
+int av1_cnn_remote_get_frame_buffer(void *cb_priv, size_t min_size,
+                                    aom_codec_frame_buffer_t *fb);
+// Frees a buffer of av1_cnn_remote_get_frame_buffer() and clears fb.
+void av1_cnn_remote_free_frame_buffer(aom_codec_frame_buffer_t *fb);
+
+// Asks the server to restore the planes of frame. If frame lies in fb, a
+// buffer of av1_cnn_remote_get_frame_buffer(), the server restores it in
+// place. Otherwise, or if fb is NULL, the planes are copied to the next slot
+// of the ring and back by av1_cnn_remote_wait(). Returns 0 on success.
+int av1_cnn_remote_launch(CnnRemote *remote, const YV12_BUFFER_CONFIG *frame,
+                          const aom_codec_frame_buffer_t *fb,
+                          const CnnRemoteParams *params);
+// Waits for the frame av1_cnn_remote_launch() started. Returns 0 on success.
+int av1_cnn_remote_wait(CnnRemote *remote, YV12_BUFFER_CONFIG *frame);
+// Puts the input of a plane of the last restored frame back in place of its
+// output. Returns 0 on success.
+int av1_cnn_remote_undo_plane(CnnRemote *remote, YV12_BUFFER_CONFIG *frame,
+                              int plane);
+
+// Starts a server restoring with models on num_threads threads, listening at
+// path. Returns NULL on failure. av1_cnn_server_stop() disconnects the
+// clients, failing the frames they wait for, and closes the socket.
+typedef struct CnnServer CnnServer;
+CnnServer *av1_cnn_server_start(const char *path,
+                                const CnnModelRegistry *models,
+                                int num_threads);
+void av1_cnn_server_stop(CnnServer *server);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif  // AV1_ENCODER_CNN_REMOTE_H_
@@ -0,0 +1,524 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+// For the sockets under -std=c99.
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "av1/encoder/cnn_remote.h"
+
+#include "aom_dsp/aom_dsp_common.h"
+#include "aom_mem/aom_mem.h"
+#include "aom_ports/mem.h"
+#include "av1/common/thread_common.h"
+
+typedef struct CnnServerFrame {
+  // Set up as av1_cnn_restore_tile() expects, with the job queue holding the
+  // tiles of the frame. Keeps the last frame of the client for reuse.
+  AV1CnnSync sync;
+  int jobs_done;
+  int failed;
+  pthread_cond_t done;
+  struct CnnServerFrame *next;
+} CnnServerFrame;
+
+// Number of frame buffers of a client kept mapped, as many as an encoder
+// has, see av1_cnn_remote_get_frame_buffer().
+#define CNN_SERVER_BUFFERS 16
+
+typedef struct CnnServerBuffer {
+  // The shared memory object, which cannot be reused while it is mapped.
+  dev_t dev;
+  ino_t ino;
+  uint8_t *data;
+  size_t size;
+  uint64_t last_used;
+} CnnServerBuffer;
+
+typedef struct CnnServerClient {
+  CnnServer *server;
+  int fd;
+  pthread_t thread;
+  int finished;
+  uint8_t *ring;
+  size_t slot_size;
+  uint32_t num_slots;
+  CnnServerBuffer buffers[CNN_SERVER_BUFFERS];
+  uint64_t buffer_clock;
+  CnnServerFrame frame;
+  // Whether frame holds the last frame restored, whose planes can still be
+  // put back.
+  int restored;
+  struct CnnServerClient *next;
+} CnnServerClient;
+
+struct CnnServer {
+  const CnnModelRegistry *models;
+  // Copies of models for each CNN_ACT_FORMAT, which the requests choose
+  // between. They share the parameters of models.
+  CnnModelRegistry *formats;
+  int listen_fd;
+  pthread_t accept_thread;
+  int accepting;
+  pthread_t *threads;
+  CnnWorkspace *workspaces;
+  int num_threads;
+
+  // Guards everything below, and the progress of the queued frames.
+  pthread_mutex_t mutex;
+  pthread_cond_t job_ready;
+  int stopping;
+  // Frames with tiles no thread took yet, oldest first.
+  CnnServerFrame *queue_head;
+  CnnServerFrame *queue_tail;
+  CnnServerClient *clients;
+};
+
+typedef struct CnnServerThread {
+  CnnServer *server;
+  CnnWorkspace *ws;
+} CnnServerThread;
+
+static void *restore_tiles(void *arg) {
+  CnnServer *const server = ((CnnServerThread *)arg)->server;
+  CnnWorkspace *const ws = ((CnnServerThread *)arg)->ws;
+  aom_free(arg);
+
+  pthread_mutex_lock(&server->mutex);
+  for (;;) {
+    while (!server->stopping && server->queue_head == NULL)
+      pthread_cond_wait(&server->job_ready, &server->mutex);
+    if (server->stopping) break;
+
+    CnnServerFrame *const frame = server->queue_head;
+    AV1CnnSync *const sync = &frame->sync;
+    const AV1CnnMTInfo *const job = sync->job_queue + sync->jobs_dequeued++;
+    if (sync->jobs_dequeued == sync->jobs_enqueued) {
+      server->queue_head = frame->next;
+      if (server->queue_head == NULL) server->queue_tail = NULL;
+    }
+    pthread_mutex_unlock(&server->mutex);
+    // The tiles write disjoint parts of the output and only read the input.
+    const int failed = av1_cnn_restore_tile(sync, job, ws) != 0;
+    pthread_mutex_lock(&server->mutex);
+
+    frame->failed |= failed;
+    if (++frame->jobs_done == sync->jobs_enqueued)
+      pthread_cond_signal(&frame->done);
+  }
+  pthread_mutex_unlock(&server->mutex);
+  return NULL;
+}
+
+// Receives a request, and the file descriptor sent along with it in *fd, or
+// -1. Returns 0 on success.
+static int receive_request(int socket_fd, CnnRemoteRequest *request,
+                           int *fd) {
+  size_t received = 0;
+  *fd = -1;
+  while (received < sizeof(*request)) {
+    struct iovec iov = { (uint8_t *)request + received,
+                         sizeof(*request) - received };
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    const ssize_t n = recvmsg(socket_fd, &msg, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        if (*fd >= 0) close(*fd);
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+    }
+    received += n;
+  }
+  if (received == sizeof(*request) && request->magic == CNN_REMOTE_MAGIC)
+    return 0;
+  if (*fd >= 0) close(*fd);
+  *fd = -1;
+  return 1;
+}
+
+static int send_reply(const CnnServerClient *client, int status) {
+  CnnRemoteReply reply;
+  memset(&reply, 0, sizeof(reply));
+  reply.magic = CNN_REMOTE_MAGIC;
+  reply.status = status;
+  reply.num_models = client->server->models->num_models;
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  return send(client->fd, &reply, sizeof(reply), flags) != sizeof(reply);
+}
+
+static int map_ring(CnnServerClient *client, const CnnRemoteRequest *request,
+                    int fd) {
+  client->restored = 0;
+  if (client->ring != NULL)
+    munmap(client->ring, client->slot_size * client->num_slots);
+  client->ring = NULL;
+  client->slot_size = 0;
+  client->num_slots = 0;
+  if (fd < 0 || request->num_slots == 0 ||
+      request->slot_size > SIZE_MAX / request->num_slots)
+    return 1;
+  void *const ring = mmap(NULL, request->slot_size * request->num_slots,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED) return 1;
+  client->ring = (uint8_t *)ring;
+  client->slot_size = request->slot_size;
+  client->num_slots = request->num_slots;
+  return 0;
+}
+
+// Returns the mapping of the frame buffer fd refers to, mapped unless it
+// already was, or NULL on failure. The mapping used least recently makes
+// room for it.
+static const CnnServerBuffer *map_buffer(CnnServerClient *client, int fd) {
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) || st.st_size <= 0) return NULL;
+  CnnServerBuffer *buffer = &client->buffers[0];
+  for (int i = 0; i < CNN_SERVER_BUFFERS; ++i) {
+    CnnServerBuffer *const b = &client->buffers[i];
+    if (b->data != NULL && b->dev == st.st_dev && b->ino == st.st_ino &&
+        b->size == (size_t)st.st_size) {
+      b->last_used = ++client->buffer_clock;
+      return b;
+    }
+    if (b->last_used < buffer->last_used) buffer = b;
+  }
+  if (buffer->data != NULL) munmap(buffer->data, buffer->size);
+  memset(buffer, 0, sizeof(*buffer));
+  void *const data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) return NULL;
+  buffer->dev = st.st_dev;
+  buffer->ino = st.st_ino;
+  buffer->data = (uint8_t *)data;
+  buffer->size = (size_t)st.st_size;
+  buffer->last_used = ++client->buffer_clock;
+  return buffer;
+}
+
+// Sets up client->frame to restore the planes of request in place, in the
+// frame buffer fd refers to or else in the slot of request. Returns 0 on
+// success.
+static int setup_frame(CnnServerClient *client,
+                       const CnnRemoteRequest *request, int fd) {
+  CnnServerFrame *const frame = &client->frame;
+  AV1CnnSync *const sync = &frame->sync;
+  const int bytes_per_sample = request->highbd ? 2 : 1;
+  const uint64_t mask_size = (uint64_t)request->sb_cols * request->sb_rows;
+
+  if (client->ring == NULL || request->slot >= client->num_slots ||
+      request->sb_size_log2 < MIN_SB_SIZE_LOG2 ||
+      request->sb_size_log2 > MAX_SB_SIZE_LOG2 || request->sb_cols <= 0 ||
+      request->sb_rows <= 0 || request->mask_offset > client->slot_size ||
+      mask_size > client->slot_size - request->mask_offset ||
+      request->planes[0].role < 0 || request->act_format < CNN_ACT_FLOAT ||
+      request->act_format > CNN_ACT_BF16 ||
+      (request->highbd && (request->bit_depth < 8 || request->bit_depth > 16)))
+    return 1;
+
+  uint8_t *const slot = client->ring + request->slot * client->slot_size;
+  uint8_t *base = slot;
+  size_t base_size = client->slot_size;
+  if (request->in_place) {
+    const CnnServerBuffer *const buffer = map_buffer(client, fd);
+    if (buffer == NULL) return 1;
+    base = buffer->data;
+    base_size = buffer->size;
+  }
+  AV1CnnPlane planes[MAX_MB_PLANE];
+  memset(planes, 0, sizeof(planes));
+  int num_planes = 0;
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    const CnnRemotePlane *const rp = &request->planes[plane];
+    AV1CnnPlane *const p = &planes[plane];
+    if (rp->role < 0) continue;
+    const int ss_x = plane ? rp->ss_x : 0, ss_y = plane ? rp->ss_y : 0;
+    const uint64_t size =
+        ((uint64_t)(rp->height - 1) * rp->stride + rp->width) *
+        bytes_per_sample;
+    if (rp->role > CNN_ROLE_CHROMA_INTER || rp->width <= 0 ||
+        rp->height <= 0 || rp->stride < rp->width || ss_x < 0 || ss_x > 1 ||
+        ss_y < 0 || ss_y > 1 ||
+        (((request->sb_cols << request->sb_size_log2) - 1) >> ss_x) <
+            rp->width - 1 ||
+        (((request->sb_rows << request->sb_size_log2) - 1) >> ss_y) <
+            rp->height - 1 ||
+        rp->offset > base_size || size > base_size - rp->offset)
+      return 1;
+    p->model = av1_cnn_registry_select(
+        &client->server->formats[request->act_format], request->qp,
+        (CNN_MODEL_ROLE)rp->role, request->depth);
+    if (p->model == NULL && plane == 0) return 1;
+    p->dst = base + rp->offset;
+    if (request->highbd) p->dst = CONVERT_TO_BYTEPTR(p->dst);
+    p->dst_stride = rp->stride;
+    p->width = rp->width;
+    p->height = rp->height;
+    p->ss_x = ss_x;
+    p->ss_y = ss_y;
+    num_planes = plane + 1;
+  }
+
+  // The tiles and the reuse of the last frame of the client are those of the
+  // codec. The tiles read their context from a copy of the input, which
+  // also serves to put planes back.
+  if (av1_cnn_restore_init_planes(sync, planes, num_planes, request->highbd,
+                                  request->bit_depth, request->sb_size_log2) ||
+      sync->sb_cols != request->sb_cols || sync->sb_rows != request->sb_rows)
+    return 1;
+  memcpy(sync->sb_mask, slot + request->mask_offset, (size_t)mask_size);
+  av1_cnn_restore_copy_rows(sync, 0, planes[0].height);
+  frame->jobs_done = 0;
+  frame->failed = 0;
+  frame->next = NULL;
+  return 0;
+}
+
+// Queues the tiles of client->frame for the threads and waits for them, then
+// keeps the frame for the next one of the client. Returns 0 on success.
+static int restore_frame(CnnServerClient *client) {
+  CnnServer *const server = client->server;
+  CnnServerFrame *const frame = &client->frame;
+
+  pthread_mutex_lock(&server->mutex);
+  if (server->queue_tail != NULL) {
+    server->queue_tail->next = frame;
+  } else {
+    server->queue_head = frame;
+  }
+  server->queue_tail = frame;
+  pthread_cond_broadcast(&server->job_ready);
+  while (!server->stopping && frame->jobs_done < frame->sync.jobs_enqueued)
+    pthread_cond_wait(&frame->done, &server->mutex);
+  const int failed =
+      frame->failed || frame->jobs_done < frame->sync.jobs_enqueued;
+  pthread_mutex_unlock(&server->mutex);
+  if (!failed) av1_cnn_restore_finish(&frame->sync);
+  return failed;
+}
+
+static void *serve_client(void *arg) {
+  CnnServerClient *const client = (CnnServerClient *)arg;
+  CnnRemoteRequest request;
+  int fd;
+
+  while (!receive_request(client->fd, &request, &fd)) {
+    int status = 1;
+    switch (request.type) {
+      case CNN_REMOTE_HELLO: status = 0; break;
+      case CNN_REMOTE_RING: status = map_ring(client, &request, fd); break;
+      case CNN_REMOTE_RESTORE:
+        status = setup_frame(client, &request, fd) || restore_frame(client);
+        client->restored = !status;
+        break;
+      case CNN_REMOTE_UNDO:
+        if (client->restored && request.plane >= 0 &&
+            request.plane < client->frame.sync.num_planes) {
+          av1_cnn_restore_undo_plane(&client->frame.sync, request.plane);
+          status = 0;
+        }
+        break;
+      default: break;
+    }
+    if (fd >= 0) close(fd);
+    if (send_reply(client, status)) break;
+  }
+
+  pthread_mutex_lock(&client->server->mutex);
+  client->finished = 1;
+  pthread_mutex_unlock(&client->server->mutex);
+  return NULL;
+}
+
+static void free_client(CnnServerClient *client) {
+  pthread_join(client->thread, NULL);
+  close(client->fd);
+  if (client->ring != NULL)
+    munmap(client->ring, client->slot_size * client->num_slots);
+  for (int i = 0; i < CNN_SERVER_BUFFERS; ++i) {
+    if (client->buffers[i].data != NULL)
+      munmap(client->buffers[i].data, client->buffers[i].size);
+  }
+  pthread_cond_destroy(&client->frame.done);
+  av1_cnn_restore_dealloc(&client->frame.sync);
+  aom_free(client);
+}
+
+static void *accept_clients(void *arg) {
+  CnnServer *const server = (CnnServer *)arg;
+
+  for (;;) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0 && errno == EINTR) continue;
+
+    pthread_mutex_lock(&server->mutex);
+    // Reap the clients that went away.
+    CnnServerClient **link = &server->clients;
+    while (*link != NULL) {
+      CnnServerClient *const client = *link;
+      if (client->finished) {
+        *link = client->next;
+        free_client(client);
+      } else {
+        link = &client->next;
+      }
+    }
+    if (fd < 0 || server->stopping) {
+      pthread_mutex_unlock(&server->mutex);
+      if (fd >= 0) close(fd);
+      if (server->stopping) break;
+      continue;
+    }
+
+    CnnServerClient *const client =
+        (CnnServerClient *)aom_calloc(1, sizeof(*client));
+    if (client != NULL) {
+      client->server = server;
+      client->fd = fd;
+      pthread_cond_init(&client->frame.done, NULL);
+      if (pthread_create(&client->thread, NULL, serve_client, client)) {
+        pthread_cond_destroy(&client->frame.done);
+        aom_free(client);
+      } else {
+        client->next = server->clients;
+        server->clients = client;
+        fd = -1;
+      }
+    }
+    pthread_mutex_unlock(&server->mutex);
+    if (fd >= 0) close(fd);
+  }
+  return NULL;
+}
+
+CnnServer *av1_cnn_server_start(const char *path,
+                                const CnnModelRegistry *models,
+                                int num_threads) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path) || num_threads < 1) return NULL;
+  CnnServer *const server = (CnnServer *)aom_calloc(1, sizeof(*server));
+  if (server == NULL) return NULL;
+  server->listen_fd = -1;
+  server->models = models;
+  server->formats = (CnnModelRegistry *)aom_malloc(
+      (CNN_ACT_BF16 + 1) * sizeof(*server->formats));
+  if (server->formats == NULL) {
+    aom_free(server);
+    return NULL;
+  }
+  for (int fmt = CNN_ACT_FLOAT; fmt <= CNN_ACT_BF16; ++fmt) {
+    server->formats[fmt] = *models;
+    av1_cnn_registry_set_act_format(&server->formats[fmt],
+                                    (CNN_ACT_FORMAT)fmt);
+  }
+  pthread_mutex_init(&server->mutex, NULL);
+  pthread_cond_init(&server->job_ready, NULL);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+  server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server->listen_fd < 0 ||
+      bind(server->listen_fd, (const struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(server->listen_fd, 16)) {
+    av1_cnn_server_stop(server);
+    return NULL;
+  }
+
+  server->threads =
+      (pthread_t *)aom_malloc(num_threads * sizeof(*server->threads));
+  server->workspaces =
+      (CnnWorkspace *)aom_calloc(num_threads, sizeof(*server->workspaces));
+  if (server->threads == NULL || server->workspaces == NULL) {
+    av1_cnn_server_stop(server);
+    return NULL;
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    CnnServerThread *const thread =
+        (CnnServerThread *)aom_malloc(sizeof(*thread));
+    if (thread != NULL) {
+      thread->server = server;
+      thread->ws = &server->workspaces[i];
+    }
+    if (thread == NULL ||
+        pthread_create(&server->threads[i], NULL, restore_tiles, thread)) {
+      aom_free(thread);
+      av1_cnn_server_stop(server);
+      return NULL;
+    }
+    server->num_threads++;
+  }
+  if (pthread_create(&server->accept_thread, NULL, accept_clients, server)) {
+    av1_cnn_server_stop(server);
+    return NULL;
+  }
+  server->accepting = 1;
+  return server;
+}
+
+void av1_cnn_server_stop(CnnServer *server) {
+  if (server == NULL) return;
+
+  pthread_mutex_lock(&server->mutex);
+  server->stopping = 1;
+  pthread_cond_broadcast(&server->job_ready);
+  for (CnnServerClient *client = server->clients; client != NULL;
+       client = client->next) {
+    pthread_cond_signal(&client->frame.done);
+    shutdown(client->fd, SHUT_RDWR);
+  }
+  pthread_mutex_unlock(&server->mutex);
+
+  // Wakes the accept thread up.
+  if (server->listen_fd >= 0) shutdown(server->listen_fd, SHUT_RDWR);
+  if (server->accepting) pthread_join(server->accept_thread, NULL);
+  // The tiles being restored read the rings of their clients.
+  for (int i = 0; i < server->num_threads; ++i) {
+    pthread_join(server->threads[i], NULL);
+    av1_cnn_workspace_free(&server->workspaces[i]);
+  }
+  while (server->clients != NULL) {
+    CnnServerClient *const client = server->clients;
+    server->clients = client->next;
+    free_client(client);
+  }
+  if (server->listen_fd >= 0) close(server->listen_fd);
+  pthread_cond_destroy(&server->job_ready);
+  pthread_mutex_destroy(&server->mutex);
+  aom_free(server->threads);
+  aom_free(server->workspaces);
+  aom_free(server->formats);
+  aom_free(server);
+}
@@ -27,7 +27,6 @@
 #include "av1/common/resize.h"
 #include "av1/common/tile_common.h"
 
-#include "av1/encoder/addition_handle_frame.h"
 #include "av1/encoder/aq_complexity.h"
 #include "av1/encoder/aq_cyclicrefresh.h"
 #include "av1/encoder/aq_variance.h"
@@ -50,10 +49,6 @@
 #include "av1/encoder/speed_features.h"
 #include "av1/encoder/temporal_filter.h"
 
-#include "opencv2/core/core.hpp"
-#include "opencv2/highgui/highgui.hpp"
-#include "opencv2/imgproc/imgproc.hpp"
-
 #include "aom_dsp/psnr.h"
 #if CONFIG_INTERNAL_STATS
 #include "aom_dsp/ssim.h"
@@ -72,7 +67,9 @@
 #if CONFIG_CNN_RESTORATION
 #include "av1/encoder/addition_handle_frame.h"
 #endif  // CONFIG_CNN_RESTORATION
-
+#if CONFIG_CNN_REMOTE
+#include "av1/encoder/cnn_remote.h"
+#endif  // CONFIG_CNN_REMOTE
 #define DEFAULT_EXPLICIT_ORDER_HINT_BITS 7
 
 // av1 uses 10,000,000 ticks/second as time stamp
@@ -515,6 +512,12 @@ static void dealloc_compressor_data(AV1_COMP *cpi) {
   aom_free(cm->tpl_mvs);
   cm->tpl_mvs = NULL;
 
+#if CONFIG_CNN_REMOTE
+  // The encoder sets no release callback for av1_free_ref_frame_buffers().
+  for (int i = 0; i < FRAME_BUFFERS; ++i)
+    av1_cnn_remote_free_frame_buffer(
+        &cm->buffer_pool->frame_bufs[i].raw_frame_buffer);
+#endif  // CONFIG_CNN_REMOTE
   av1_free_ref_frame_buffers(cm->buffer_pool);
   av1_free_txb_buf(cpi);
   av1_free_context_buffers(cm);
@@ -766,6 +769,16 @@ static void alloc_util_frame_buffers(AV1_COMP *cpi) {
                        "Failed to allocate scaled last source buffer");
 }
 
+#if CONFIG_CNN_RESTORATION
+// Sizes the CNN restoration buffers for the largest frames of the stream and
+// every loaded model, so that restoring a frame allocates nothing.
+static void reserve_cnn_restoration(AV1_COMP *cpi) {
+  const CnnBackend *const backend = cpi->cnn_backend;
+  if (!cpi->common.seq_params.enable_cnn_restoration) return;
+  if (backend != NULL && backend->reserve != NULL) backend->reserve(cpi);
+}
+#endif  // CONFIG_CNN_RESTORATION
+
 static void alloc_compressor_data(AV1_COMP *cpi) {
   AV1_COMMON *cm = &cpi->common;
   const int num_planes = av1_num_planes(cm);
@@ -786,6 +799,10 @@ static void alloc_compressor_data(AV1_COMP *cpi) {
   }
 
   av1_setup_pc_tree(&cpi->common, &cpi->td);
+
+#if CONFIG_CNN_RESTORATION
+  reserve_cnn_restoration(cpi);
+#endif  // CONFIG_CNN_RESTORATION
 }
 
 void av1_new_framerate(AV1_COMP *cpi, double framerate) {
@@ -2259,6 +2276,36 @@ static void realloc_segmentation_maps(AV1_COMP *cpi) {
                   aom_calloc(cm->mi_rows * cm->mi_cols, 1));
 }
 
+#if CONFIG_CNN_RESTORATION
+static int cnn_path_equal(const char *a, const char *b) {
+  if (a == NULL || b == NULL) return a == b;
+  return !strcmp(a, b);
+}
+
+// Loads the CNN models, or connects to the server holding them, and signals
+// in the sequence header whether frames may be restored with them. The
+// decoder needs the same models to follow.
+static void init_cnn_restoration(AV1_COMP *cpi) {
+  AV1_COMMON *const cm = &cpi->common;
+  struct aom_usec_timer timer;
+  aom_usec_timer_start(&timer);
+  addition_load_models(cpi);
+  aom_usec_timer_mark(&timer);
+  cpi->time_cnn_load += aom_usec_timer_elapsed(&timer);
+  // The new backend has its own speed.
+  av1_zero(cpi->cnn_time);
+  // The sequence header cannot change after the first key frame.
+  if (!cpi->seq_params_locked) {
+    // The networks see normalized samples, so they serve every bit depth.
+    // The decoder has to get the same frames though.
+    cm->seq_params.enable_cnn_restoration =
+        (cpi->cnn_backend->caps & CNN_BACKEND_BIT_EXACT) &&
+        addition_num_models(cpi) > 0;
+  }
+  reserve_cnn_restoration(cpi);
+}
+#endif  // CONFIG_CNN_RESTORATION
+
 void av1_change_config(struct AV1_COMP *cpi, const AV1EncoderConfig *oxcf) {
   AV1_COMMON *const cm = &cpi->common;
   const int num_planes = av1_num_planes(cm);
@@ -2306,10 +2353,26 @@ void av1_change_config(struct AV1_COMP *cpi, const AV1EncoderConfig *oxcf) {
         10;  // Default value (not signaled)
   }
 
+#if CONFIG_CNN_RESTORATION
+  const int cnn_models_changed =
+      !cnn_path_equal(cpi->oxcf.cnn_model_dir, oxcf->cnn_model_dir) ||
+      !cnn_path_equal(cpi->oxcf.cnn_server, oxcf->cnn_server) ||
+      cpi->oxcf.cnn_backend != oxcf->cnn_backend;
+#endif  // CONFIG_CNN_RESTORATION
+
   update_film_grain_parameters(cpi, oxcf);
 
   cpi->oxcf = *oxcf;
   cpi->common.options = oxcf->cfg;
+#if CONFIG_CNN_RESTORATION
+  if (cnn_models_changed) init_cnn_restoration(cpi);
+  if (!cpi->seq_params_locked) {
+    cm->seq_params.cnn_depth = oxcf->cnn_depth
+                                   ? (int)oxcf->cnn_depth
+                                   : av1_cnn_depth_for_speed(oxcf->speed);
+    cm->seq_params.cnn_bf16 = oxcf->cnn_bf16 != 0;
+  }
+#endif  // CONFIG_CNN_RESTORATION
   x->e_mbd.bd = (int)cm->bit_depth;
   x->e_mbd.global_motion = cm->global_motion;
 
@@ -2445,6 +2508,9 @@ AV1_COMP *av1_create_compressor(AV1EncoderConfig *oxcf,
   cpi->common.buffer_pool = pool;
 
   init_config(cpi, oxcf);
+#if CONFIG_CNN_RESTORATION
+  init_cnn_restoration(cpi);
+#endif  // CONFIG_CNN_RESTORATION
   av1_rc_init(&cpi->oxcf, oxcf->pass, &cpi->rc);
 
   cm->current_video_frame = 0;
@@ -2913,6 +2979,15 @@ void av1_remove_compressor(AV1_COMP *cpi) {
 
   dealloc_compressor_data(cpi);
 
+#if CONFIG_CNN_RESTORATION
+  for (t = 0; t < cpi->num_cnn_workers; ++t)
+    aom_get_worker_interface()->end(&cpi->cnn_workers[t]);
+  aom_free(cpi->cnn_workers);
+  av1_cnn_restore_dealloc(&cpi->cnn_sync);
+  aom_free_frame_buffer(&cpi->cnn_analysis_frame);
+  addition_free_models(cpi);
+#endif  // CONFIG_CNN_RESTORATION
+
   for (i = 0; i < sizeof(cpi->mbgraph_stats) / sizeof(cpi->mbgraph_stats[0]);
        ++i) {
     aom_free(cpi->mbgraph_stats[i].mb_stats);
@@ -3555,6 +3630,28 @@ static void update_reference_frames(AV1_COMP *cpi) {
 #endif  // DUMP_REF_FRAME_IMAGES
 }
 
+// Reallocates a frame buffer of the pool to the frame size. With the remote
+// CNN backend the buffers go to shared memory, where the inference server
+// restores the frames in place, and stay there.
+static int realloc_pool_frame_buffer(AV1_COMP *cpi, RefCntBuffer *buf) {
+  AV1_COMMON *const cm = &cpi->common;
+#if CONFIG_CNN_REMOTE
+  if (cpi->cnn_remote != NULL || buf->raw_frame_buffer.data != NULL) {
+    // The callback does not free what the frame allocated itself.
+    if (buf->buf.buffer_alloc_sz > 0) aom_free_frame_buffer(&buf->buf);
+    return aom_realloc_frame_buffer(
+        &buf->buf, cm->width, cm->height, cm->subsampling_x,
+        cm->subsampling_y, cm->use_highbitdepth, AOM_BORDER_IN_PIXELS,
+        cm->byte_alignment, &buf->raw_frame_buffer,
+        av1_cnn_remote_get_frame_buffer, NULL);
+  }
+#endif  // CONFIG_CNN_REMOTE
+  return aom_realloc_frame_buffer(&buf->buf, cm->width, cm->height,
+                                  cm->subsampling_x, cm->subsampling_y,
+                                  cm->use_highbitdepth, AOM_BORDER_IN_PIXELS,
+                                  cm->byte_alignment, NULL, NULL, NULL);
+}
+
 static INLINE void alloc_frame_mvs(AV1_COMMON *const cm, int buffer_idx) {
   assert(buffer_idx != INVALID_IDX);
   RefCntBuffer *const new_fb_ptr = &cm->buffer_pool->frame_bufs[buffer_idx];
@@ -3596,10 +3693,7 @@ static void scale_references(AV1_COMP *cpi) {
         new_fb_ptr = &pool->frame_bufs[new_fb];
         if (force_scaling || new_fb_ptr->buf.y_crop_width != cm->width ||
             new_fb_ptr->buf.y_crop_height != cm->height) {
-          if (aom_realloc_frame_buffer(
-                  &new_fb_ptr->buf, cm->width, cm->height, cm->subsampling_x,
-                  cm->subsampling_y, cm->use_highbitdepth, AOM_BORDER_IN_PIXELS,
-                  cm->byte_alignment, NULL, NULL, NULL))
+          if (realloc_pool_frame_buffer(cpi, new_fb_ptr))
             aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
                                "Failed to allocate frame buffer");
           av1_resize_and_extend_frame(ref, &new_fb_ptr->buf, (int)cm->bit_depth,
@@ -3759,6 +3853,10 @@ static void check_initial_width(AV1_COMP *cpi, int use_highbitdepth,
     alloc_raw_frame_buffers(cpi);
     init_ref_frame_bufs(cm);
     alloc_util_frame_buffers(cpi);
+#if CONFIG_CNN_RESTORATION
+    // The chroma planes the CNN restores depend on the subsampling.
+    reserve_cnn_restoration(cpi);
+#endif  // CONFIG_CNN_RESTORATION
 
     init_motion_estimation(cpi);  // TODO(agrange) This can be removed.
 
@@ -3824,10 +3922,8 @@ static void set_frame_size(AV1_COMP *cpi, int width, int height) {
   }
 
   // Reset the frame pointers to the current frame size.
-  if (aom_realloc_frame_buffer(get_frame_new_buffer(cm), cm->width, cm->height,
-                               cm->subsampling_x, cm->subsampling_y,
-                               cm->use_highbitdepth, AOM_BORDER_IN_PIXELS,
-                               cm->byte_alignment, NULL, NULL, NULL))
+  if (realloc_pool_frame_buffer(cpi,
+                                &cm->buffer_pool->frame_bufs[cm->new_fb_idx]))
     aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
                        "Failed to allocate frame buffer");
 
@@ -4094,7 +4190,8 @@ static void superres_post_encode(AV1_COMP *cpi) {
   }
 }
 
-static void loopfilter_frame(AV1_COMP *cpi, AV1_COMMON *cm) {
+// Picks and applies the in-loop filters of the planes from plane_start on.
+static void loopfilter_frame(AV1_COMP *cpi, AV1_COMMON *cm, int plane_start) {
   const int num_planes = av1_num_planes(cm);
   MACROBLOCKD *xd = &cpi->td.mb.e_mbd;
 
@@ -4119,22 +4216,26 @@ static void loopfilter_frame(AV1_COMP *cpi, AV1_COMMON *cm) {
 
     aom_usec_timer_start(&timer);
 
-    av1_pick_filter_level(cpi->source, cpi, cpi->sf.lpf_pick);//�����˲��ĵȼ�
+    av1_pick_filter_level(cpi->source, cpi, cpi->sf.lpf_pick, plane_start);//�����˲��ĵȼ�
 
     aom_usec_timer_mark(&timer);
     cpi->time_pick_lpf += aom_usec_timer_elapsed(&timer);
   }
 
-  if (lf->filter_level[0] || lf->filter_level[1]) {
+  if (plane_start > AOM_PLANE_Y
+          ? lf->filter_level_u || lf->filter_level_v
+          : lf->filter_level[0] || lf->filter_level[1]) {
 #if LOOP_FILTER_BITMASK
-    av1_loop_filter_frame(cm->frame_to_show, cm, xd, 0, num_planes, 0);
+    av1_loop_filter_frame(cm->frame_to_show, cm, xd, plane_start, num_planes,
+                          0);
 #else
     if (cpi->num_workers > 1)
-      av1_loop_filter_frame_mt(cm->frame_to_show, cm, xd, 0, num_planes, 0,
-                               cpi->workers, cpi->num_workers,
+      av1_loop_filter_frame_mt(cm->frame_to_show, cm, xd, plane_start,
+                               num_planes, 0, cpi->workers, cpi->num_workers,
                                &cpi->lf_row_sync);
     else
-      av1_loop_filter_frame(cm->frame_to_show, cm, xd, 0, num_planes, 0);
+      av1_loop_filter_frame(cm->frame_to_show, cm, xd, plane_start,
+                            num_planes, 0);
 #endif
   }
 
@@ -4149,7 +4250,7 @@ static void loopfilter_frame(AV1_COMP *cpi, AV1_COMMON *cm) {
   } else {
     // Find CDEF parameters
     av1_cdef_search(cm->frame_to_show, cpi->source, cm, xd,
-                    cpi->sf.fast_cdef_search);
+                    cpi->sf.fast_cdef_search, plane_start);
 
     // Apply the filter
     av1_cdef_frame(cm->frame_to_show, cm, xd);
@@ -4163,7 +4264,7 @@ static void loopfilter_frame(AV1_COMP *cpi, AV1_COMMON *cm) {
     cm->rst_info[2].frame_restoration_type = RESTORE_NONE;
   } else {
     av1_loop_restoration_save_boundary_lines(cm->frame_to_show, cm, 1);
-    av1_pick_filter_restoration(cpi->source, cpi);
+    av1_pick_filter_restoration(cpi->source, cpi, plane_start);
     if (cm->rst_info[0].frame_restoration_type != RESTORE_NONE ||
         cm->rst_info[1].frame_restoration_type != RESTORE_NONE ||
         cm->rst_info[2].frame_restoration_type != RESTORE_NONE) {
@@ -4178,6 +4279,155 @@ static void loopfilter_frame(AV1_COMP *cpi, AV1_COMMON *cm) {
   }
 }
 
+#if CONFIG_CNN_RESTORATION
+// Returns the luma pixels of the superblocks of the current frame the CNN
+// runs on.
+static int64_t cnn_active_pixels(const AV1_COMMON *cm) {
+  const int mib_size = cm->seq_params.mib_size;
+  int64_t pixels = 0;
+  for (int mi_row = 0; mi_row < cm->mi_rows; mi_row += mib_size) {
+    const int h = AOMMIN(mib_size, cm->mi_rows - mi_row) << MI_SIZE_LOG2;
+    for (int mi_col = 0; mi_col < cm->mi_cols; mi_col += mib_size) {
+      if (!av1_cnn_sb_active(cm, mi_row, mi_col)) continue;
+      pixels += (AOMMIN(mib_size, cm->mi_cols - mi_col) << MI_SIZE_LOG2) * h;
+    }
+  }
+  return pixels;
+}
+
+int av1_cnn_time_fits(const CnnTimeEstimate *estimate, int64_t active_pixels,
+                      unsigned int budget) {
+  if (budget == 0 || estimate->usec_per_pixel == 0 ||
+      estimate->frames_skipped >= CNN_TIME_PROBE_INTERVAL)
+    return 1;
+  return estimate->usec_per_pixel * active_pixels <= budget;
+}
+
+void av1_cnn_time_restored(CnnTimeEstimate *estimate, uint64_t usec,
+                           int64_t active_pixels) {
+  if (active_pixels <= 0) return;
+  const double usec_per_pixel = (double)usec / active_pixels;
+  if (estimate->frames_restored++ > 0) {
+    // After a run of skipped frames the average is stale, and the frame
+    // just restored tells more than it.
+    estimate->usec_per_pixel =
+        estimate->usec_per_pixel == 0 || estimate->frames_skipped > 0
+            ? usec_per_pixel
+            : 0.75 * estimate->usec_per_pixel + 0.25 * usec_per_pixel;
+  }
+  estimate->frames_skipped = 0;
+}
+
+void av1_cnn_time_skipped(CnnTimeEstimate *estimate) {
+  estimate->frames_skipped++;
+}
+
+// Returns 1 if the CNN restoration of the current frame is expected to fit
+// the time budget, going by the time it took per active pixel so far.
+static int cnn_fits_time_budget(const AV1_COMP *cpi) {
+  const unsigned int budget = cpi->oxcf.cnn_time_budget;
+  if (budget == 0) return 1;
+  return av1_cnn_time_fits(&cpi->cnn_time, cnn_active_pixels(&cpi->common),
+                           budget);
+}
+
+static uint64_t cnn_restoration_time(const AV1CnnSync *cnn_sync) {
+  return cnn_sync->time_prepare + cnn_sync->time_inference +
+         cnn_sync->time_write_back;
+}
+
+// Returns the squared error of the chroma planes of the current frame.
+static int64_t cnn_chroma_sse(const AV1_COMP *cpi) {
+  const YV12_BUFFER_CONFIG *const frame = cpi->common.frame_to_show;
+  if (cpi->common.use_highbitdepth) {
+    return aom_highbd_get_u_sse(cpi->source, frame) +
+           aom_highbd_get_v_sse(cpi->source, frame);
+  }
+  return aom_get_u_sse(cpi->source, frame) + aom_get_v_sse(cpi->source, frame);
+}
+
+// Restores the frame with the CNN. Sets *packed if the bitstream was packed
+// into dest while the CNN workers restored the frame.
+static int cnn_restoration_frame(AV1_COMP *cpi, AV1_COMMON *cm, uint8_t *dest,
+                                 size_t *size, int *packed) {
+  const uint64_t start_time = cnn_restoration_time(&cpi->cnn_sync);
+  *packed = 0;
+
+  // Signal that none of the normative in-loop filters are applied on top, so
+  // far. The chroma planes the CNN leaves get them afterwards.
+  cm->lf.filter_level[0] = 0;
+  cm->lf.filter_level[1] = 0;
+  cm->cdef_bits = 0;
+  cm->cdef_strengths[0] = 0;
+  cm->nb_cdef_strengths = 1;
+  cm->cdef_uv_strengths[0] = 0;
+  cm->rst_info[0].frame_restoration_type = RESTORE_NONE;
+  cm->rst_info[1].frame_restoration_type = RESTORE_NONE;
+  cm->rst_info[2].frame_restoration_type = RESTORE_NONE;
+
+  const int num_planes = av1_num_planes(cm);
+  // Backends that leave the chroma planes alone have no choice to make.
+  const int chroma = num_planes > 1 &&
+                     (cpi->cnn_backend->caps & CNN_BACKEND_CHROMA) != 0;
+  const int64_t chroma_sse = chroma ? cnn_chroma_sse(cpi) : 0;
+  int pack_error = 0;
+  // Packing reads no pixels, so it runs while the frame is restored. The
+  // chroma bit is only known afterwards: the bitstream is packed if the
+  // chroma planes of the last frame kept their restoration, and packed again
+  // if those of this one do not. Chroma planes that do not are filtered after
+  // the CNN, since CDEF takes its directions from the restored luma plane,
+  // and the bitstream can only be packed once their filters are picked.
+  cm->cnn_restore_chroma = chroma && cpi->cnn_last_restore_chroma;
+  if (addition_handle_blocks_launch(cpi, cm, cm->cur_frame->frame_type)) {
+    if (cm->cnn_restore_chroma) {
+      save_coding_context(cpi);
+      pack_error = av1_pack_bitstream(cpi, dest, size) != AOM_CODEC_OK;
+      *packed = 1;
+    }
+    addition_handle_blocks_join(cpi, cm);
+  }
+  // The chroma models are less reliable than the luma ones, so the chroma
+  // planes keep their restoration only if it brings them closer to the
+  // source.
+  const int restore_chroma = chroma && cnn_chroma_sse(cpi) < chroma_sse;
+  if (chroma && !restore_chroma) {
+    for (int plane = 1; plane < num_planes; ++plane)
+      addition_undo_plane(cpi, cm, plane);
+  }
+  if (*packed && restore_chroma != cm->cnn_restore_chroma) {
+    restore_coding_context(cpi);
+    *packed = 0;
+  }
+  cm->cnn_restore_chroma = restore_chroma;
+  cpi->cnn_last_restore_chroma = restore_chroma;
+  if (pack_error) return AOM_CODEC_ERROR;
+  if (num_planes > 1 && !restore_chroma)
+    loopfilter_frame(cpi, cm, AOM_PLANE_U);
+  av1_cnn_time_restored(&cpi->cnn_time,
+                        cnn_restoration_time(&cpi->cnn_sync) - start_time,
+                        cpi->cnn_mask_stats.active_pixels);
+  return AOM_CODEC_OK;
+}
+
+// Restores a copy of the filtered frame with a backend the decoder does not
+// match, which leaves the frame the stream predicts from alone. Only the
+// stage times of the backend come out of it.
+static void analyze_cnn_frame(AV1_COMP *cpi, AV1_COMMON *cm) {
+  YV12_BUFFER_CONFIG *const frame = cm->frame_to_show;
+  if (aom_realloc_frame_buffer(&cpi->cnn_analysis_frame, frame->y_crop_width,
+                               frame->y_crop_height, cm->subsampling_x,
+                               cm->subsampling_y, cm->use_highbitdepth,
+                               AOM_BORDER_IN_PIXELS, cm->byte_alignment, NULL,
+                               NULL, NULL))
+    aom_internal_error(&cm->error, AOM_CODEC_MEM_ERROR,
+                       "Failed to allocate CNN analysis frame buffer");
+  aom_yv12_copy_frame(frame, &cpi->cnn_analysis_frame, av1_num_planes(cm));
+  cm->frame_to_show = &cpi->cnn_analysis_frame;
+  addition_handle_blocks(cpi, cm, cm->cur_frame->frame_type);
+  cm->frame_to_show = frame;
+}
+#endif  // CONFIG_CNN_RESTORATION
+
 static int encode_without_recode_loop(AV1_COMP *cpi) {
   AV1_COMMON *const cm = &cpi->common;
   int q = 0, bottom_index = 0, top_index = 0;  // Dummy variables.
@@ -5044,16 +5294,31 @@ static int encode_frame_to_data_rate(AV1_COMP *cpi, size_t *size, uint8_t *dest,
   // TODO(zoeliu): For non-ref frames, loop filtering may need to be turned
   // off.
 
+  // Set when the bitstream is packed along with the CNN restoration.
+  int packed = 0;
+
   // Pick the loop filter level for the frame.
   if (!cm->allow_intrabc) {
-	  //loopfilter_frame(cpi, cm);
-    //addition_handle_frame(cm, cm->frame_type);
-    //addition_handle_blocks(cm, cm->frame_type);
-#if CONFIG_CNN_RESTORATION == 1
-    addition_handle_blocks(cm, cm->cur_frame->frame_type);
-#else
-    loopfilter_frame(cpi, cm);
-#endif
+#if CONFIG_CNN_RESTORATION
+    // The mask is final by now, av1_pack_bitstream() writes the same one.
+    cpi->refresh_frame_mask = av1_get_refresh_mask(cpi);
+    av1_zero(cpi->cnn_mask_stats);
+    cm->use_cnn_restoration = cnn_fits_time_budget(cpi);
+    if (!cm->use_cnn_restoration &&
+        av1_cnn_frame_allowed(cm, cpi->refresh_frame_mask))
+      av1_cnn_time_skipped(&cpi->cnn_time);
+    cm->cnn_restore_chroma = 0;
+    if (av1_cnn_frame_enabled(cm, cpi->refresh_frame_mask)) {
+      if (cnn_restoration_frame(cpi, cm, dest, size, &packed) != AOM_CODEC_OK)
+        return AOM_CODEC_ERROR;
+    } else
+#endif  // CONFIG_CNN_RESTORATION
+      loopfilter_frame(cpi, cm, AOM_PLANE_Y);
+#if CONFIG_CNN_RESTORATION
+    if (!(cpi->cnn_backend->caps & CNN_BACKEND_BIT_EXACT) &&
+        addition_num_models(cpi) > 0)
+      analyze_cnn_frame(cpi, cm);
+#endif  // CONFIG_CNN_RESTORATION
   } else {
 
     cm->lf.filter_level[0] = 0;
@@ -5076,7 +5341,7 @@ static int encode_frame_to_data_rate(AV1_COMP *cpi, size_t *size, uint8_t *dest,
 #endif
 
   // Build the bitstream
-  if (av1_pack_bitstream(cpi, dest, size) != AOM_CODEC_OK)
+  if (!packed && av1_pack_bitstream(cpi, dest, size) != AOM_CODEC_OK)
     return AOM_CODEC_ERROR;
 
   cpi->seq_params_locked = 1;
@@ -19,6 +19,9 @@
 #include "aom/aomcx.h"
 
 #include "av1/common/alloccommon.h"
+#if CONFIG_CNN_RESTORATION
+#include "av1/common/cnn_restoration.h"
+#endif  // CONFIG_CNN_RESTORATION
 #include "av1/common/entropymode.h"
 #include "av1/common/thread_common.h"
 #include "av1/common/onyxc_int.h"
@@ -283,6 +286,19 @@ typedef struct AV1EncoderConfig {
   aom_op_timing_info_t op_frame_timing[MAX_NUM_OPERATING_POINTS + 1];
   int film_grain_test_vector;
   const char *film_grain_table_filename;
+  // Directory of the CNN restoration model files, or NULL for the defaults.
+  const char *cnn_model_dir;
+  // Microseconds the CNN restoration of a frame may take, 0 for no limit.
+  unsigned int cnn_time_budget;
+  // Number of CNN layers to prefer, 0 to go by the speed setting.
+  unsigned int cnn_depth;
+  // Whether the CNN stores its activations as bfloat16.
+  unsigned int cnn_bf16;
+  // Socket of the CNN inference server to restore with, or NULL to restore
+  // in process.
+  const char *cnn_server;
+  // Backend to run the CNN restoration on.
+  aom_cnn_backend_t cnn_backend;
 
   uint8_t cdf_update_mode;
   aom_superblock_size_t superblock_size;
@@ -461,6 +477,26 @@ typedef struct TileBufferEnc {
   size_t size;
 } TileBufferEnc;
 
+#if CONFIG_CNN_RESTORATION
+// Frames the encoder falls back to the regular loop filters for in a row
+// before it runs the CNN again to see whether it got faster.
+#define CNN_TIME_PROBE_INTERVAL 16
+
+// What the CNN restoration of a frame is expected to take, which the frames
+// are checked against the time budget with.
+typedef struct CnnTimeEstimate {
+  // Moving average of the microseconds the CNN restoration took per active
+  // pixel, 0 until it is known.
+  double usec_per_pixel;
+  // Frames restored, the first of which is left out of the average: it
+  // pays for loading the models into the caches and touching the buffers.
+  int frames_restored;
+  // Frames that fell back to the regular loop filters since the last one
+  // restored.
+  int frames_skipped;
+} CnnTimeEstimate;
+#endif  // CONFIG_CNN_RESTORATION
+
 typedef struct AV1_COMP {
   QUANTS quants;
   ThreadData td;
@@ -580,6 +616,11 @@ typedef struct AV1_COMP {
   uint64_t time_compress_data;
   uint64_t time_pick_lpf;
   uint64_t time_encode_sb_row;
+#if CONFIG_CNN_RESTORATION
+  // The other CNN restoration stages are timed in cnn_sync.
+  uint64_t time_cnn_load;
+  CnnTimeEstimate cnn_time;
+#endif  // CONFIG_CNN_RESTORATION
 
 #if CONFIG_FP_MB_STATS
   int use_fp_mb_stats;
@@ -689,6 +730,30 @@ typedef struct AV1_COMP {
 
   AV1LfSync lf_row_sync;
   AV1LrSync lr_row_sync;
+#if CONFIG_CNN_RESTORATION
+  // Backend the frames are restored on, picked by oxcf.cnn_backend.
+  const struct CnnBackend *cnn_backend;
+  // All CNN restoration models, selected per frame by QP and frame type.
+  CnnModelRegistry cnn_models;
+#if CONFIG_CNN_REMOTE
+  // Connection to oxcf.cnn_server, which then restores the frames in place of
+  // cnn_models.
+  struct CnnRemote *cnn_remote;
+#endif  // CONFIG_CNN_REMOTE
+  AV1CnnSync cnn_sync;
+  // Share of the last frame the CNN ran on, all 0 if it did not run.
+  AV1CnnMaskStats cnn_mask_stats;
+  // Threads restoring the CNN tiles, the main thread being the last worker.
+  // They run while the main thread packs the bitstream.
+  AVxWorker *cnn_workers;
+  int num_cnn_workers;
+  // Whether the CNN kept the chroma planes of the last frame it restored.
+  // The next frame is packed with the same choice while it is restored.
+  int cnn_last_restore_chroma;
+  // Copy of the filtered frame that backends without CNN_BACKEND_BIT_EXACT
+  // restore instead of it.
+  YV12_BUFFER_CONFIG cnn_analysis_frame;
+#endif  // CONFIG_CNN_RESTORATION
   AV1LrStruct lr_ctxt;
 } AV1_COMP;
 
@@ -738,6 +803,19 @@ int av1_set_internal_size(AV1_COMP *cpi, AOM_SCALING horiz_mode,
 
 int av1_get_quantizer(struct AV1_COMP *cpi);
 
+#if CONFIG_CNN_RESTORATION
+// Returns 1 if the CNN restoration of a frame with active_pixels luma pixels
+// to restore is expected to take at most budget microseconds (0 for no
+// limit), or if it is time to measure it again.
+int av1_cnn_time_fits(const CnnTimeEstimate *estimate, int64_t active_pixels,
+                      unsigned int budget);
+// Records that a frame took usec microseconds to restore, or fell back to
+// the regular loop filters because it would not fit.
+void av1_cnn_time_restored(CnnTimeEstimate *estimate, uint64_t usec,
+                           int64_t active_pixels);
+void av1_cnn_time_skipped(CnnTimeEstimate *estimate);
+#endif  // CONFIG_CNN_RESTORATION
+
 int av1_convert_sect5obus_to_annexb(uint8_t *buffer, size_t *input_size);
 
 int64_t timebase_units_to_ticks(const aom_rational_t *timebase, int64_t n);
@@ -280,7 +280,8 @@ uint64_t compute_cdef_dist(uint16_t *dst, int dstride, uint16_t *src,
 }
 
 void av1_cdef_search(YV12_BUFFER_CONFIG *frame, const YV12_BUFFER_CONFIG *ref,
-                     AV1_COMMON *cm, MACROBLOCKD *xd, int fast) {
+                     AV1_COMMON *cm, MACROBLOCKD *xd, int fast,
+                     int plane_start) {
   int r, c;
   int fbr, fbc;
   uint16_t *src[3];
@@ -325,6 +326,7 @@ void av1_cdef_search(YV12_BUFFER_CONFIG *frame, const YV12_BUFFER_CONFIG *ref,
                        num_planes);
   mse[0] = aom_malloc(sizeof(**mse) * nvfb * nhfb);
   mse[1] = aom_malloc(sizeof(**mse) * nvfb * nhfb);
+  assert(plane_start <= AOM_PLANE_U && plane_start < num_planes);
   for (pli = 0; pli < num_planes; pli++) {
     uint8_t *ref_buffer;
     int ref_stride;
@@ -410,8 +412,12 @@ void av1_cdef_search(YV12_BUFFER_CONFIG *frame, const YV12_BUFFER_CONFIG *ref,
       cdef_count = sb_compute_cdef_list(cm, fbr * MI_SIZE_64X64,
                                         fbc * MI_SIZE_64X64, dlist, bs);
       for (pli = 0; pli < num_planes; pli++) {
+        // A plane before plane_start is only filtered once, at a strength
+        // other than 0, for the directions the chroma planes take from luma.
+        const int skip_plane = pli < plane_start;
+        if (skip_plane) memset(mse[0][sb_count], 0, sizeof(mse[0][sb_count]));
         for (i = 0; i < CDEF_INBUF_SIZE; i++) inbuf[i] = CDEF_VERY_LARGE;
-        for (gi = 0; gi < total_strengths; gi++) {
+        for (gi = skip_plane; gi < (skip_plane ? 2 : total_strengths); gi++) {
           int threshold;
           uint64_t curr_mse;
           int sec_strength;
@@ -437,6 +443,7 @@ void av1_cdef_search(YV12_BUFFER_CONFIG *frame, const YV12_BUFFER_CONFIG *ref,
                          dir, &dirinit, var, pli, dlist, cdef_count, threshold,
                          sec_strength + (sec_strength == 3), pri_damping,
                          sec_damping, coeff_shift);
+          if (skip_plane) continue;
           curr_mse = compute_cdef_dist(
               ref_coeff[pli] +
                   (fbr * MI_SIZE_64X64 << mi_high_l2[pli]) * stride[pli] +
@@ -481,6 +488,10 @@ void av1_cdef_search(YV12_BUFFER_CONFIG *frame, const YV12_BUFFER_CONFIG *ref,
     }
   }
   nb_strengths = 1 << nb_strength_bits;
+  // The luma mse is 0 at every strength, so the search above has left the
+  // luma strengths arbitrary.
+  if (plane_start > AOM_PLANE_Y)
+    memset(cm->cdef_strengths, 0, sizeof(cm->cdef_strengths));
 
   cm->cdef_bits = nb_strength_bits;
   cm->nb_cdef_strengths = nb_strengths;
@@ -21,8 +21,11 @@ extern "C" {
 struct yv12_buffer_config;
 struct AV1_COMP;
 int av1_get_max_filter_level(const AV1_COMP *cpi);
+// Picks the filter levels of the planes from plane_start on. Those of the
+// planes before it are set to 0.
 void av1_pick_filter_level(const struct yv12_buffer_config *sd,
-                           struct AV1_COMP *cpi, LPF_PICK_METHOD method);
+                           struct AV1_COMP *cpi, LPF_PICK_METHOD method,
+                           int plane_start);
 #ifdef __cplusplus
 }  // extern "C"
 #endif
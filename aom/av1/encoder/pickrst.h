@@ -20,7 +20,10 @@ extern "C" {
 struct yv12_buffer_config;
 struct AV1_COMP;
 
-void av1_pick_filter_restoration(const YV12_BUFFER_CONFIG *sd, AV1_COMP *cpi);
+// Picks the restoration of the planes from plane_start on. The planes before
+// it are left unrestored.
+void av1_pick_filter_restoration(const YV12_BUFFER_CONFIG *sd, AV1_COMP *cpi,
+                                 int plane_start);
 
 #ifdef __cplusplus
 }  // extern "C"
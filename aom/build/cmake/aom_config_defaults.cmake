@@ -86,6 +86,11 @@ set(DECODE_HEIGHT_LIMIT 0 CACHE NUMBER "Set limit for decode height.")
 set(DECODE_WIDTH_LIMIT 0 CACHE NUMBER "Set limit for decode width.")
 
 # AV1 experiment flags.
+set(CONFIG_CNN_RESTORATION 0 CACHE NUMBER "AV1 experiment flag.")
+set(CONFIG_CNN_TENSORFLOW 0
+    CACHE NUMBER "Embedded-Python TensorFlow CNN restoration backend.")
+set(CONFIG_CNN_REMOTE 0
+    CACHE NUMBER "CNN restoration by a local inference server process.")
 set(CONFIG_COLLECT_INTER_MODE_RD_STATS 1 CACHE NUMBER "AV1 experiment flag.")
 set(CONFIG_COLLECT_RD_STATS 0 CACHE NUMBER "AV1 experiment flag.")
 set(CONFIG_DIST_8X8 1 CACHE NUMBER "AV1 experiment flag.")
@@ -21,6 +21,18 @@ macro(fix_experiment_configs)
     change_config_and_warn(CONFIG_INSPECTION 1 CONFIG_ANALYZER)
   endif()
 
+  if(CONFIG_CNN_TENSORFLOW)
+    change_config_and_warn(CONFIG_CNN_RESTORATION 1 CONFIG_CNN_TENSORFLOW)
+  endif()
+
+  if(CONFIG_CNN_REMOTE)
+    if(WIN32 OR NOT CMAKE_USE_PTHREADS_INIT)
+      change_config_and_warn(CONFIG_CNN_REMOTE 0 "targets without pthreads")
+    else()
+      change_config_and_warn(CONFIG_CNN_RESTORATION 1 CONFIG_CNN_REMOTE)
+    endif()
+  endif()
+
   if(CONFIG_RD_DEBUG)
     change_config_and_warn(CONFIG_RD_DEBUG 0 CONFIG_JNT_COMP)
   endif()
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "third_party/googletest/src/googletest/include/gtest/gtest.h"
+
+#include "config/aom_config.h"
+#include "config/aom_version.h"
+
+#include "aom_dsp/aom_dsp_common.h"
+#include "aom_mem/aom_mem.h"
+#include "aom_ports/aom_timer.h"
+#include "aom_util/aom_thread.h"
+#include "av1/common/cnn_restoration.h"
+#include "test/acm_random.h"
+#include "test/codec_factory.h"
+#include "test/encode_test_driver.h"
+#include "test/util.h"
+#include "test/video_source.h"
+#include "test/y4m_video_source.h"
+
+using libaom_test::ACMRandom;
+
+namespace {
+
+const double kUsecsInMsec = 1000.0;
+const int kCnnPerfTestFrames = 10;
+// The depths of the networks in MODELS/.
+const int kCnnPerfTestDepths[] = { 15, 20, 25, 30 };
+const int kCnnPerfTestTileSizes[] = { 64, 128, 256 };
+const int kCnnPerfTestThreads[] = { 1, 2, 4 };
+// The reference clips the depths are compared on, and the quantizer they
+// are all coded at: the one bucket of MODELS/ with more than one depth.
+const char *const kCnnDepthTestClips[] = { "park_joy_90p_8_420.y4m",
+                                           "niklas_1280_720_30.y4m" };
+const int kCnnDepthTestQp = 52;
+
+enum CnnPerfPrecision {
+  kCnnFloat,
+  kCnnWinograd,
+  kCnnBf16,
+  kCnnInt8,
+  kCnnNumPrecisions
+};
+const char *const kCnnPrecisionNames[] = { "float", "winograd", "bf16",
+                                           "int8" };
+
+// Luma planes of the frames to restore, stored with a stride of width.
+struct CnnPerfInput {
+  std::string name;
+  int width;
+  int height;
+  std::vector<std::vector<uint8_t> > frames;
+};
+
+// The tiles a thread restores and the buffers it restores them with.
+struct CnnPerfJob {
+  const CnnModel *model;
+  const uint8_t *src;
+  uint8_t *dst;
+  int width;
+  int height;
+  const CnnRegion *regions;
+  int num_regions;
+  CnnWorkspace ws;
+};
+
+int RestoreTiles(void *arg1, void *arg2) {
+  CnnPerfJob *const job = static_cast<CnnPerfJob *>(arg1);
+  (void)arg2;
+  return !av1_cnn_restore_regions(job->model, job->src, job->width, job->dst,
+                                  job->width, job->width, job->height,
+                                  job->regions, job->num_regions, 0, 8,
+                                  &job->ws);
+}
+
+CnnPerfInput SyntheticInput(int width, int height) {
+  CnnPerfInput input;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  char name[64];
+  snprintf(name, sizeof(name), "synthetic_%dx%d", width, height);
+  input.name = name;
+  input.width = width;
+  input.height = height;
+  input.frames.resize(kCnnPerfTestFrames);
+  for (int f = 0; f < kCnnPerfTestFrames; ++f) {
+    std::vector<uint8_t> &frame = input.frames[f];
+    frame.resize(width * height);
+    for (int r = 0; r < height; ++r) {
+      for (int c = 0; c < width; ++c) {
+        frame[r * width + c] = clamp(
+            (r + f) % 256 + ((r / 16 + c / 16) & 1) * 32 + rnd(9) - 4, 0, 255);
+      }
+    }
+  }
+  return input;
+}
+
+void Y4mInput(const char *file_name, CnnPerfInput *input) {
+  libaom_test::Y4mVideoSource video(file_name, 0, kCnnPerfTestFrames);
+  ASSERT_NO_FATAL_FAILURE(video.Begin());
+  input->name = file_name;
+  for (; video.img() != NULL; video.Next()) {
+    const aom_image_t *const img = video.img();
+    ASSERT_EQ(img->fmt, AOM_IMG_FMT_I420);
+    input->width = img->d_w;
+    input->height = img->d_h;
+    std::vector<uint8_t> frame(img->d_w * img->d_h);
+    for (unsigned int r = 0; r < img->d_h; ++r) {
+      memcpy(&frame[r * img->d_w],
+             img->planes[AOM_PLANE_Y] + r * img->stride[AOM_PLANE_Y],
+             img->d_w);
+    }
+    input->frames.push_back(frame);
+  }
+}
+
+// Builds a model of the given depth with random weights, which run as fast
+// as trained ones, and readies it for the precision.
+void MakeModel(int depth, CnnPerfPrecision precision,
+               const CnnPerfInput &input, CnnModel *model) {
+  const size_t count = av1_cnn_model_param_count(depth);
+  ASSERT_GT(count, 0u);
+  memset(model, 0, sizeof(*model));
+  model->params = (float *)aom_memalign(32, count * sizeof(float));
+  ASSERT_TRUE(model->params != NULL);
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  for (size_t i = 0; i < count; ++i)
+    model->params[i] = (rnd.Rand16() / 65535.0f - 0.5f) * 0.1f;
+  av1_cnn_model_setup_layers(model, depth);
+  if (precision == kCnnInt8) {
+    float act_max[CNN_MAX_LAYERS] = { 0 };
+    ASSERT_EQ(0, av1_cnn_model_calibrate(model, &input.frames[0][0],
+                                         input.width, input.height,
+                                         input.width, act_max));
+    ASSERT_EQ(0, av1_cnn_model_quantize(model, act_max));
+    return;
+  }
+  if (precision != kCnnFloat) {
+    ASSERT_EQ(0, av1_cnn_model_set_conv_algo(model, CNN_CONV_WINOGRAD));
+  }
+  if (precision == kCnnBf16) model->act_format = CNN_ACT_BF16;
+}
+
+// Restores every frame of the input in tiles of tile_size, spread over
+// num_threads threads the way the encoder spreads them, and returns the
+// microseconds it took.
+void TimeRestoration(const CnnModel *model, const CnnPerfInput &input,
+                     int tile_size, int num_threads, int64_t *elapsed_us) {
+  std::vector<CnnRegion> tiles;
+  for (int y = 0; y < input.height; y += tile_size) {
+    for (int x = 0; x < input.width; x += tile_size) {
+      const CnnRegion tile = { x, y, AOMMIN(tile_size, input.width - x),
+                               AOMMIN(tile_size, input.height - y) };
+      tiles.push_back(tile);
+    }
+  }
+  const int num_tiles = static_cast<int>(tiles.size());
+  num_threads = AOMMIN(num_threads, num_tiles);
+
+  const AVxWorkerInterface *const winterface = aom_get_worker_interface();
+  std::vector<AVxWorker> workers(num_threads);
+  std::vector<CnnPerfJob> jobs(num_threads);
+  std::vector<uint8_t> dst(input.width * input.height);
+  for (int t = 0; t < num_threads; ++t) {
+    CnnPerfJob *const job = &jobs[t];
+    memset(job, 0, sizeof(*job));
+    job->model = model;
+    job->dst = &dst[0];
+    job->width = input.width;
+    job->height = input.height;
+    // Each thread takes a contiguous share of the tiles.
+    const int begin = t * num_tiles / num_threads;
+    job->regions = &tiles[begin];
+    job->num_regions = (t + 1) * num_tiles / num_threads - begin;
+    ASSERT_EQ(0, av1_cnn_workspace_reserve(
+                     &job->ws, model,
+                     av1_cnn_context_size(model, tile_size, input.width),
+                     av1_cnn_context_size(model, tile_size, input.height)));
+    winterface->init(&workers[t]);
+    workers[t].hook = RestoreTiles;
+    workers[t].data1 = job;
+    workers[t].data2 = NULL;
+    // The last job runs on the calling thread.
+    if (t < num_threads - 1) {
+      ASSERT_TRUE(winterface->reset(&workers[t]));
+    }
+  }
+
+  aom_usec_timer timer;
+  aom_usec_timer_start(&timer);
+  int failed = 0;
+  for (size_t f = 0; f < input.frames.size(); ++f) {
+    for (int t = 0; t < num_threads; ++t) {
+      jobs[t].src = &input.frames[f][0];
+      if (t < num_threads - 1) {
+        winterface->launch(&workers[t]);
+      } else {
+        winterface->execute(&workers[t]);
+      }
+    }
+    for (int t = 0; t < num_threads; ++t)
+      failed |= !winterface->sync(&workers[t]);
+  }
+  aom_usec_timer_mark(&timer);
+  *elapsed_us = aom_usec_timer_elapsed(&timer);
+
+  for (int t = 0; t < num_threads; ++t) {
+    winterface->end(&workers[t]);
+    av1_cnn_workspace_free(&jobs[t].ws);
+  }
+  ASSERT_FALSE(failed);
+}
+
+TEST(CnnPerfTest, PerfTest) {
+  std::vector<CnnPerfInput> inputs;
+  inputs.push_back(SyntheticInput(1280, 720));
+  inputs.push_back(CnnPerfInput());
+  ASSERT_NO_FATAL_FAILURE(Y4mInput("park_joy_90p_8_420.y4m", &inputs.back()));
+
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    const CnnPerfInput &input = inputs[i];
+    for (int d = 0; d < NELEMENTS(kCnnPerfTestDepths); ++d) {
+      for (int p = 0; p < kCnnNumPrecisions; ++p) {
+        const CnnPerfPrecision precision = static_cast<CnnPerfPrecision>(p);
+        CnnModel model;
+        ASSERT_NO_FATAL_FAILURE(
+            MakeModel(kCnnPerfTestDepths[d], precision, input, &model));
+        for (int s = 0; s < NELEMENTS(kCnnPerfTestTileSizes); ++s) {
+          for (int t = 0; t < NELEMENTS(kCnnPerfTestThreads); ++t) {
+            int64_t elapsed_us = 0;
+            ASSERT_NO_FATAL_FAILURE(TimeRestoration(
+                &model, input, kCnnPerfTestTileSizes[s],
+                kCnnPerfTestThreads[t], &elapsed_us));
+            const int frames = static_cast<int>(input.frames.size());
+            const double pixels =
+                static_cast<double>(input.width) * input.height * frames;
+
+            printf("{\n");
+            printf("\t\"type\" : \"cnn_perf_test\",\n");
+            printf("\t\"version\" : \"%s\",\n", VERSION_STRING_NOSP);
+            printf("\t\"input\" : \"%s\",\n", input.name.c_str());
+            printf("\t\"width\" : %d,\n", input.width);
+            printf("\t\"height\" : %d,\n", input.height);
+            printf("\t\"totalFrames\" : %d,\n", frames);
+            printf("\t\"depth\" : %d,\n", kCnnPerfTestDepths[d]);
+            printf("\t\"precision\" : \"%s\",\n",
+                   kCnnPrecisionNames[precision]);
+            printf("\t\"tileSize\" : %d,\n", kCnnPerfTestTileSizes[s]);
+            printf("\t\"threads\" : %d,\n", kCnnPerfTestThreads[t]);
+            printf("\t\"msPerFrame\" : %f,\n",
+                   elapsed_us / kUsecsInMsec / frames);
+            printf("\t\"megapixelsPerSecond\" : %f\n",
+                   elapsed_us ? pixels / elapsed_us : 0.0);
+            printf("}\n");
+          }
+        }
+        av1_cnn_model_free(&model);
+      }
+    }
+  }
+}
+
+#if CONFIG_AV1_ENCODER
+// Codes every clip of kCnnDepthTestClips all intra at kCnnDepthTestQp, once
+// with each depth the models of that QP bucket have, and reports what the
+// restoration costs and what the restored frames look like. Reads the
+// models converted from MODELS/ by cnn_model_converter from the cnn_models
+// directory of the test data.
+class CnnDepthTest
+    : public ::libaom_test::CodecTestWithParam<libaom_test::TestMode>,
+      public ::libaom_test::EncoderTest {
+ protected:
+  CnnDepthTest()
+      : EncoderTest(GET_PARAM(0)), encoding_mode_(GET_PARAM(1)), depth_(0) {}
+
+  virtual ~CnnDepthTest() {}
+
+  virtual void SetUp() {
+    InitializeConfig();
+    SetMode(encoding_mode_);
+    cfg_.g_lag_in_frames = 0;
+    cfg_.kf_max_dist = 0;
+    cfg_.rc_end_usage = AOM_Q;
+    cfg_.rc_min_quantizer = kCnnDepthTestQp;
+    cfg_.rc_max_quantizer = kCnnDepthTestQp;
+    init_flags_ = AOM_CODEC_USE_PSNR;
+  }
+
+  virtual void BeginPassHook(unsigned int /*pass*/) {
+    psnr_sum_ = 0;
+    frames_ = 0;
+    bytes_ = 0;
+    memset(&times_, 0, sizeof(times_));
+  }
+
+  virtual void PreEncodeFrameHook(::libaom_test::VideoSource *video,
+                                  ::libaom_test::Encoder *encoder) {
+    if (video->frame() == 0) {
+      encoder->Control(AOME_SET_CPUUSED, 8);
+      encoder->Control(AOME_SET_CQ_LEVEL, kCnnDepthTestQp);
+      encoder->Control(AV1E_SET_CNN_MODEL_DIR, model_dir_.c_str());
+      encoder->Control(AV1E_SET_CNN_DEPTH, depth_);
+    }
+    // The times of the frames coded so far.
+    encoder->Control(AV1E_GET_CNN_STAGE_TIMES, &times_);
+  }
+
+  virtual void FramePktHook(const aom_codec_cx_pkt_t *pkt) {
+    bytes_ += pkt->data.frame.sz;
+  }
+
+  virtual void PSNRPktHook(const aom_codec_cx_pkt_t *pkt) {
+    psnr_sum_ += pkt->data.psnr.psnr[1];
+    ++frames_;
+  }
+
+  virtual bool DoDecode() const { return false; }
+
+  libaom_test::TestMode encoding_mode_;
+  std::string model_dir_;
+  int depth_;
+  double psnr_sum_;
+  int frames_;
+  size_t bytes_;
+  aom_cnn_stage_times_t times_;
+};
+
+TEST_P(CnnDepthTest, DepthTest) {
+  model_dir_ = libaom_test::GetDataPath() + "/cnn_models";
+  CnnModelRegistry registry;
+  memset(&registry, 0, sizeof(registry));
+  ASSERT_EQ(0, av1_cnn_registry_load(&registry, model_dir_.c_str()))
+      << "Convert the checkpoints of MODELS/ into " << model_dir_;
+
+  std::vector<int> depths;
+  for (int d = 0; d < NELEMENTS(kCnnPerfTestDepths); ++d) {
+    // Depths the bucket lacks fall back to one of its own.
+    const CnnModel *const model = av1_cnn_registry_select(
+        &registry, kCnnDepthTestQp, CNN_ROLE_INTRA, kCnnPerfTestDepths[d]);
+    ASSERT_TRUE(model != NULL);
+    if (std::find(depths.begin(), depths.end(), model->num_layers) ==
+        depths.end())
+      depths.push_back(model->num_layers);
+  }
+  av1_cnn_registry_free(&registry);
+
+  for (size_t i = 0; i < NELEMENTS(kCnnDepthTestClips); ++i) {
+    for (size_t d = 0; d < depths.size(); ++d) {
+      depth_ = depths[d];
+      libaom_test::Y4mVideoSource video(kCnnDepthTestClips[i], 0,
+                                        kCnnPerfTestFrames);
+      ASSERT_NO_FATAL_FAILURE(RunLoop(&video));
+      ASSERT_GT(frames_, 1);
+      // The times are read before each frame, so the last one is left out.
+      const int timed_frames = frames_ - 1;
+      const int64_t restore_us =
+          times_.prepare_us + times_.inference_us + times_.write_back_us;
+
+      printf("{\n");
+      printf("\t\"type\" : \"cnn_depth_test\",\n");
+      printf("\t\"version\" : \"%s\",\n", VERSION_STRING_NOSP);
+      printf("\t\"input\" : \"%s\",\n", kCnnDepthTestClips[i]);
+      printf("\t\"totalFrames\" : %d,\n", frames_);
+      printf("\t\"qp\" : %d,\n", kCnnDepthTestQp);
+      printf("\t\"depth\" : %d,\n", depth_);
+      printf("\t\"msPerFrame\" : %f,\n",
+             restore_us / kUsecsInMsec / timed_frames);
+      printf("\t\"psnrY\" : %f,\n", psnr_sum_ / frames_);
+      printf("\t\"bytes\" : %d\n", static_cast<int>(bytes_));
+      printf("}\n");
+    }
+  }
+}
+
+AV1_INSTANTIATE_TEST_CASE(CnnDepthTest,
+                          ::testing::Values(::libaom_test::kOnePassGood));
+#endif  // CONFIG_AV1_ENCODER
+
+}  // namespace
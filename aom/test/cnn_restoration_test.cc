@@ -0,0 +1,1790 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "third_party/googletest/src/googletest/include/gtest/gtest.h"
+
+#include "config/aom_config.h"
+#include "config/av1_rtcd.h"
+
+#include "aom_dsp/aom_dsp_common.h"
+#include "aom_mem/aom_mem.h"
+#include "aom_ports/mem.h"
+#include "av1/common/cnn_restoration.h"
+#include "av1/common/thread_common.h"
+#if CONFIG_AV1_ENCODER
+#include "av1/encoder/encoder.h"
+#endif  // CONFIG_AV1_ENCODER
+#if CONFIG_CNN_REMOTE
+#include "av1/encoder/cnn_remote.h"
+#endif  // CONFIG_CNN_REMOTE
+#include "test/acm_random.h"
+#include "test/clear_system_state.h"
+#include "test/codec_factory.h"
+#include "test/encode_test_driver.h"
+#include "test/i420_video_source.h"
+#include "test/md5_helper.h"
+#include "test/util.h"
+#include "test/video_source.h"
+
+using libaom_test::ACMRandom;
+
+namespace {
+
+typedef void (*CnnConvolveFunc)(const float *input, int in_stride,
+                                int in_channels, float *output, int out_stride,
+                                int out_channels, int width, int height,
+                                const float *weights, const float *bias,
+                                int relu);
+
+// Function under test, input channels, output channels.
+typedef ::testing::tuple<CnnConvolveFunc, int, int> CnnConvolveParam;
+
+class CnnConvolveTest : public ::testing::TestWithParam<CnnConvolveParam> {
+ public:
+  virtual ~CnnConvolveTest() {}
+  virtual void SetUp() {
+    func_ = GET_PARAM(0);
+    in_channels_ = GET_PARAM(1);
+    out_channels_ = GET_PARAM(2);
+  }
+
+  virtual void TearDown() { libaom_test::ClearSystemState(); }
+
+ protected:
+  void RunCheckOutput(int width, int height, int relu);
+
+  CnnConvolveFunc func_;
+  int in_channels_;
+  int out_channels_;
+};
+
+static float RandomFloat(ACMRandom *rnd, float range) {
+  return (rnd->Rand16() / 65535.0f * 2.0f - 1.0f) * range;
+}
+
+// Builds a model of num_layers layers with weights and biases drawn from
+// [-range, range], running the direct convolutions on float activations.
+static void MakeRandomModel(int num_layers, float range, ACMRandom *rnd,
+                            CnnModel *model) {
+  const size_t count = av1_cnn_model_param_count(num_layers);
+  ASSERT_GT(count, 0u);
+  memset(model, 0, sizeof(*model));
+  model->params = (float *)aom_memalign(32, count * sizeof(float));
+  ASSERT_TRUE(model->params != NULL);
+  for (size_t i = 0; i < count; ++i) model->params[i] = RandomFloat(rnd, range);
+  av1_cnn_model_setup_layers(model, num_layers);
+}
+
+void CnnConvolveTest::RunCheckOutput(int width, int height, int relu) {
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  const int in_stride = (width + 2) * in_channels_;
+  const int out_stride = width * out_channels_;
+  std::vector<float> input(in_stride * (height + 2));
+  std::vector<float> weights(CNN_KERNEL_TAPS * in_channels_ * out_channels_);
+  std::vector<float> bias(out_channels_);
+  std::vector<float> ref_output(out_stride * height);
+  std::vector<float> output(out_stride * height);
+
+  for (size_t i = 0; i < input.size(); ++i) input[i] = RandomFloat(&rnd, 1.0f);
+  for (size_t i = 0; i < weights.size(); ++i)
+    weights[i] = RandomFloat(&rnd, 0.1f);
+  for (size_t i = 0; i < bias.size(); ++i) bias[i] = RandomFloat(&rnd, 0.1f);
+
+  const float *const in = &input[in_stride + in_channels_];
+  av1_cnn_convolve_3x3_c(in, in_stride, in_channels_, &ref_output[0],
+                         out_stride, out_channels_, width, height, &weights[0],
+                         &bias[0], relu);
+  func_(in, in_stride, in_channels_, &output[0], out_stride, out_channels_,
+        width, height, &weights[0], &bias[0], relu);
+
+  // The output is normative, so every implementation has to match the C one
+  // bit for bit.
+  for (size_t i = 0; i < output.size(); ++i) {
+    ASSERT_EQ(ref_output[i], output[i])
+        << "width " << width << " height " << height << " index " << i;
+  }
+}
+
+TEST_P(CnnConvolveTest, CheckOutput) {
+  const int sizes[][2] = { { 1, 1 }, { 5, 3 }, { 6, 2 }, { 13, 7 }, { 32, 4 } };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    RunCheckOutput(sizes[i][0], sizes[i][1], 0);
+    RunCheckOutput(sizes[i][0], sizes[i][1], 1);
+  }
+}
+
+using ::testing::make_tuple;
+
+#if HAVE_AVX2
+INSTANTIATE_TEST_CASE_P(
+    AVX2, CnnConvolveTest,
+    ::testing::Values(
+        make_tuple(&av1_cnn_convolve_3x3_avx2, 1, CNN_CHANNELS),
+        make_tuple(&av1_cnn_convolve_3x3_avx2, CNN_CHANNELS, CNN_CHANNELS),
+        make_tuple(&av1_cnn_convolve_3x3_avx2, CNN_CHANNELS, 1),
+        make_tuple(&av1_cnn_convolve_3x3_avx2, 3, 5)));
+#endif
+
+typedef void (*CnnConvolveInt8Func)(const uint8_t *input, int in_stride,
+                                    int in_channels, uint8_t *output,
+                                    int out_stride, int out_channels,
+                                    int width, int height,
+                                    const int8_t *weights, const int32_t *bias,
+                                    const float *scale);
+
+// Function under test, input channels, output channels.
+typedef ::testing::tuple<CnnConvolveInt8Func, int, int> CnnConvolveInt8Param;
+
+class CnnConvolveInt8Test
+    : public ::testing::TestWithParam<CnnConvolveInt8Param> {
+ public:
+  virtual ~CnnConvolveInt8Test() {}
+  virtual void SetUp() {
+    func_ = GET_PARAM(0);
+    in_channels_ = GET_PARAM(1);
+    out_channels_ = GET_PARAM(2);
+  }
+
+  virtual void TearDown() { libaom_test::ClearSystemState(); }
+
+ protected:
+  void RunCheckOutput(int width, int height);
+
+  CnnConvolveInt8Func func_;
+  int in_channels_;
+  int out_channels_;
+};
+
+void CnnConvolveInt8Test::RunCheckOutput(int width, int height) {
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  const int in_ch = (in_channels_ + 3) & ~3;
+  const int in_stride = (width + 2) * in_ch;
+  const int out_stride = width * out_channels_;
+  std::vector<uint8_t> input(in_stride * (height + 2));
+  std::vector<int8_t> weights(
+      av1_cnn_int8_weight_count(in_channels_, out_channels_));
+  std::vector<int32_t> bias(out_channels_);
+  std::vector<float> scale(out_channels_);
+  std::vector<uint8_t> ref_output(out_stride * height);
+  std::vector<uint8_t> output(out_stride * height);
+
+  for (size_t i = 0; i < input.size(); ++i) input[i] = rnd.Rand8();
+  // Extreme weights check that the pair sums do not saturate. The weights of
+  // the padding channels stay zero.
+  for (int tap = 0; tap < CNN_KERNEL_TAPS; ++tap) {
+    for (int i = 0; i < in_channels_; ++i) {
+      for (int o = 0; o < out_channels_; ++o) {
+        weights[av1_cnn_int8_weight_index(tap, i, o, in_channels_,
+                                          out_channels_)] =
+            rnd(2) ? CNN_INT8_WEIGHT_MAX
+                   : rnd(2 * CNN_INT8_WEIGHT_MAX + 1) - CNN_INT8_WEIGHT_MAX;
+      }
+    }
+  }
+  for (size_t i = 0; i < bias.size(); ++i) bias[i] = rnd(1 << 20) - (1 << 19);
+  for (size_t i = 0; i < scale.size(); ++i)
+    scale[i] = 1.0f / (1000 + rnd(100000));
+
+  const uint8_t *const in = &input[in_stride + in_ch];
+  av1_cnn_convolve_3x3_int8_c(in, in_stride, in_channels_, &ref_output[0],
+                              out_stride, out_channels_, width, height,
+                              &weights[0], &bias[0], &scale[0]);
+  func_(in, in_stride, in_channels_, &output[0], out_stride, out_channels_,
+        width, height, &weights[0], &bias[0], &scale[0]);
+
+  for (size_t i = 0; i < output.size(); ++i) {
+    ASSERT_EQ(ref_output[i], output[i])
+        << "width " << width << " height " << height << " index " << i;
+  }
+}
+
+TEST_P(CnnConvolveInt8Test, CheckOutput) {
+  const int sizes[][2] = { { 1, 1 }, { 5, 3 }, { 8, 2 }, { 13, 7 }, { 32, 4 } };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    RunCheckOutput(sizes[i][0], sizes[i][1]);
+}
+
+#if HAVE_AVX2
+INSTANTIATE_TEST_CASE_P(
+    AVX2, CnnConvolveInt8Test,
+    ::testing::Values(
+        make_tuple(&av1_cnn_convolve_3x3_int8_avx2, 1, CNN_CHANNELS),
+        make_tuple(&av1_cnn_convolve_3x3_int8_avx2, CNN_CHANNELS,
+                   CNN_CHANNELS),
+        make_tuple(&av1_cnn_convolve_3x3_int8_avx2, CNN_CHANNELS, 1),
+        make_tuple(&av1_cnn_convolve_3x3_int8_avx2, 12, 16)));
+#endif
+
+typedef void (*CnnWinogradFunc)(const float *input, int in_stride,
+                                int in_channels, float *output, int out_stride,
+                                int out_channels, int width, int height,
+                                const float *weights, const float *bias,
+                                int relu, float *scratch);
+
+class CnnWinogradTest : public ::testing::TestWithParam<CnnWinogradFunc> {
+ public:
+  virtual ~CnnWinogradTest() {}
+  virtual void SetUp() { func_ = GetParam(); }
+  virtual void TearDown() { libaom_test::ClearSystemState(); }
+
+ protected:
+  void RunCheckOutput(const CnnLayer *layer, int width, int height, int relu);
+
+  CnnWinogradFunc func_;
+};
+
+void CnnWinogradTest::RunCheckOutput(const CnnLayer *layer, int width,
+                                     int height, int relu) {
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  const int in_channels = layer->in_channels;
+  const int out_channels = layer->out_channels;
+  const int in_stride = (width + 2) * in_channels;
+  const int out_stride = width * out_channels;
+  std::vector<float> input(in_stride * (height + 2));
+  std::vector<float> ref_output(out_stride * height);
+  std::vector<float> wino_output(out_stride * height);
+  std::vector<float> output(out_stride * height);
+  std::vector<float> scratch(CNN_WINOGRAD_SCRATCH_SIZE);
+  for (size_t i = 0; i < input.size(); ++i) input[i] = RandomFloat(&rnd, 1.0f);
+
+  const float *const in = &input[in_stride + in_channels];
+  av1_cnn_convolve_3x3_c(in, in_stride, in_channels, &ref_output[0],
+                         out_stride, out_channels, width, height,
+                         layer->weights, layer->bias, relu);
+  av1_cnn_winograd_3x3_c(in, in_stride, in_channels, &wino_output[0],
+                         out_stride, out_channels, width, height,
+                         layer->wino_weights, layer->bias, relu, &scratch[0]);
+  func_(in, in_stride, in_channels, &output[0], out_stride, out_channels,
+        width, height, layer->wino_weights, layer->bias, relu, &scratch[0]);
+
+  // The transforms round differently from the direct convolution, but every
+  // implementation of them has to match the C one bit for bit.
+  for (size_t i = 0; i < output.size(); ++i) {
+    ASSERT_NEAR(ref_output[i], output[i], 1e-4f * in_channels)
+        << "width " << width << " height " << height << " index " << i;
+    ASSERT_EQ(wino_output[i], output[i])
+        << "width " << width << " height " << height << " index " << i;
+  }
+}
+
+TEST_P(CnnWinogradTest, CheckOutput) {
+  const int num_layers = 3;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.1f, &rnd, &model));
+  ASSERT_EQ(0, av1_cnn_model_set_conv_algo(&model, CNN_CONV_WINOGRAD));
+  ASSERT_TRUE(model.layers[0].wino_weights == NULL);
+  ASSERT_TRUE(model.layers[1].wino_weights != NULL);
+  ASSERT_TRUE(model.layers[2].wino_weights == NULL);
+
+  const int sizes[][2] = { { 1, 1 }, { 4, 4 }, { 5, 3 }, { 24, 8 }, { 29, 9 } };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    RunCheckOutput(&model.layers[1], sizes[i][0], sizes[i][1], 0);
+    RunCheckOutput(&model.layers[1], sizes[i][0], sizes[i][1], 1);
+  }
+  av1_cnn_model_free(&model);
+}
+
+INSTANTIATE_TEST_CASE_P(C, CnnWinogradTest,
+                        ::testing::Values(&av1_cnn_winograd_3x3_c));
+
+#if HAVE_AVX2
+INSTANTIATE_TEST_CASE_P(AVX2, CnnWinogradTest,
+                        ::testing::Values(&av1_cnn_winograd_3x3_avx2));
+#endif
+
+typedef void (*CnnLoadBf16Func)(const uint16_t *src, float *dst, int n);
+typedef void (*CnnStoreBf16Func)(const float *src, uint16_t *dst, int n);
+typedef ::testing::tuple<CnnLoadBf16Func, CnnStoreBf16Func> CnnBf16Param;
+
+class CnnBf16Test : public ::testing::TestWithParam<CnnBf16Param> {
+ public:
+  virtual ~CnnBf16Test() {}
+  virtual void SetUp() {
+    load_ = GET_PARAM(0);
+    store_ = GET_PARAM(1);
+  }
+  virtual void TearDown() { libaom_test::ClearSystemState(); }
+
+ protected:
+  CnnLoadBf16Func load_;
+  CnnStoreBf16Func store_;
+};
+
+// The conversions are exact bit manipulations, so every implementation must
+// match the C one exactly, including ties and the tails of odd lengths.
+TEST_P(CnnBf16Test, MatchesC) {
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  const int n = 75;
+  std::vector<float> src(n), ref(n), dst(n);
+  std::vector<uint16_t> ref_bf16(n), bf16(n);
+  for (int i = 0; i < n; ++i) src[i] = RandomFloat(&rnd, 4.0f);
+  // Halfway cases, which round to the even neighbour.
+  src[0] = 1.0f + 1.0f / 256;
+  src[1] = 1.0f + 3.0f / 256;
+  src[2] = -(1.0f + 1.0f / 256);
+
+  av1_cnn_store_bf16_c(&src[0], &ref_bf16[0], n);
+  store_(&src[0], &bf16[0], n);
+  for (int i = 0; i < n; ++i) ASSERT_EQ(ref_bf16[i], bf16[i]) << i;
+  av1_cnn_load_bf16_c(&ref_bf16[0], &ref[0], n);
+  load_(&ref_bf16[0], &dst[0], n);
+  for (int i = 0; i < n; ++i) {
+    ASSERT_EQ(ref[i], dst[i]) << i;
+    ASSERT_NEAR(src[i], dst[i], fabsf(src[i]) / 256) << i;
+  }
+  EXPECT_EQ(1.0f, dst[0]);
+  EXPECT_EQ(1.0f + 4.0f / 256, dst[1]);
+  EXPECT_EQ(-1.0f, dst[2]);
+}
+
+INSTANTIATE_TEST_CASE_P(C, CnnBf16Test,
+                        ::testing::Values(make_tuple(&av1_cnn_load_bf16_c,
+                                                     &av1_cnn_store_bf16_c)));
+
+#if HAVE_AVX2
+INSTANTIATE_TEST_CASE_P(
+    AVX2, CnnBf16Test,
+    ::testing::Values(make_tuple(&av1_cnn_load_bf16_avx2,
+                                 &av1_cnn_store_bf16_avx2)));
+#endif
+
+// A model whose weights and biases are all zero predicts a zero residual, so
+// restoring a plane with it must leave the plane untouched.
+TEST(CnnRestorationTest, ZeroModelIsIdentity) {
+  const int num_layers = 4;
+  const size_t count = av1_cnn_model_param_count(num_layers);
+  ASSERT_GT(count, 0u);
+
+  CnnModel model;
+  memset(&model, 0, sizeof(model));
+  model.params = (float *)aom_memalign(32, count * sizeof(float));
+  ASSERT_TRUE(model.params != NULL);
+  memset(model.params, 0, count * sizeof(float));
+  av1_cnn_model_setup_layers(&model, num_layers);
+
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  const int width = 37, height = 11, stride = 48;
+  std::vector<uint8_t> plane(stride * height);
+  for (size_t i = 0; i < plane.size(); ++i) plane[i] = rnd.Rand8();
+  const std::vector<uint8_t> ref_plane(plane);
+
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &plane[0], width, height, stride,
+                                     0, 8));
+  for (size_t i = 0; i < plane.size(); ++i) ASSERT_EQ(ref_plane[i], plane[i]);
+
+  av1_cnn_model_free(&model);
+}
+
+// Sets a model up the way av1_cnn_registry_add() does, with Winograd hidden
+// layers and bfloat16 activations.
+static void SetRegistryFormat(CnnModel *model) {
+  ASSERT_EQ(0, av1_cnn_model_set_conv_algo(model, CNN_CONV_WINOGRAD));
+  model->act_format = CNN_ACT_BF16;
+}
+
+// Restoring a plane tile by tile from an untouched copy must give exactly the
+// same result as restoring it whole, i.e. the tiles must not show seams.
+static void RunTilesMatchWholePlane(int registry_format) {
+  const int num_layers = 5;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+  if (registry_format) SetRegistryFormat(&model);
+
+  const int width = 45, height = 29, stride = 64;
+  std::vector<uint8_t> src(stride * height);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = rnd.Rand8();
+  std::vector<uint8_t> ref(src);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                     0, 8));
+
+  // The tiles are restored one at a time and then as a single batch, with
+  // one workspace for all batches.
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  const int tile_sizes[] = { 1, 7, 16, 64 };
+  for (size_t t = 0; t < sizeof(tile_sizes) / sizeof(tile_sizes[0]); ++t) {
+    const int size = tile_sizes[t];
+    std::vector<uint8_t> dst(src), batch_dst(src);
+    std::vector<CnnRegion> regions;
+    for (int y = 0; y < height; y += size) {
+      for (int x = 0; x < width; x += size) {
+        const CnnRegion region = { x, y, AOMMIN(size, width - x),
+                                   AOMMIN(size, height - y) };
+        ASSERT_EQ(0, av1_cnn_restore_region(
+                         &model, &src[0], stride, &dst[0], stride, width,
+                         height, region.x, region.y, region.width,
+                         region.height, 0, 8));
+        regions.push_back(region);
+      }
+    }
+    ASSERT_EQ(0, av1_cnn_restore_regions(
+                     &model, &src[0], stride, &batch_dst[0], stride, width,
+                     height, &regions[0], static_cast<int>(regions.size()), 0,
+                     8, &ws));
+    for (int r = 0; r < height; ++r) {
+      for (int c = 0; c < width; ++c) {
+        ASSERT_EQ(ref[r * stride + c], dst[r * stride + c])
+            << "tile size " << size << " at " << c << "x" << r;
+        ASSERT_EQ(ref[r * stride + c], batch_dst[r * stride + c])
+            << "tile size " << size << " at " << c << "x" << r;
+      }
+    }
+  }
+
+  av1_cnn_workspace_free(&ws);
+  av1_cnn_model_free(&model);
+}
+
+TEST(CnnRestorationTest, TilesMatchWholePlane) { RunTilesMatchWholePlane(0); }
+
+// The same with the Winograd blocks and the bfloat16 rounding of registry
+// models, which must not depend on where the tiles fall either.
+TEST(CnnRestorationTest, RegistryModelTilesMatchWholePlane) {
+  RunTilesMatchWholePlane(1);
+}
+
+// Regions wider than a strip are restored strip by strip, which must neither
+// show seams nor need more memory than a single strip.
+static void RunStripsMatchWholePlane(int registry_format) {
+  const int num_layers = 5;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+  if (registry_format) SetRegistryFormat(&model);
+
+  const int width = 601, height = 21;
+  std::vector<uint8_t> src(width * height);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = rnd.Rand8();
+  std::vector<uint8_t> ref(src), dst(src);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, width,
+                                     0, 8));
+
+  CnnWorkspace wide_ws, ws;
+  memset(&wide_ws, 0, sizeof(wide_ws));
+  memset(&ws, 0, sizeof(ws));
+  ASSERT_EQ(0, av1_cnn_workspace_reserve(&wide_ws, &model, 4 * width, height));
+  ASSERT_EQ(0, av1_cnn_workspace_reserve(&ws, &model, width, height));
+  EXPECT_EQ(wide_ws.act_size, ws.act_size);
+  const CnnWorkspace reserved = ws;
+  const CnnRegion region = { 0, 0, width, height };
+  ASSERT_EQ(0, av1_cnn_restore_regions(&model, &src[0], width, &dst[0], width,
+                                       width, height, &region, 1, 0, 8, &ws));
+  EXPECT_EQ(reserved.act_buf, ws.act_buf);
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      ASSERT_EQ(ref[r * width + c], dst[r * width + c])
+          << "at " << c << "x" << r;
+    }
+  }
+
+  av1_cnn_workspace_free(&wide_ws);
+  av1_cnn_workspace_free(&ws);
+  av1_cnn_model_free(&model);
+}
+
+TEST(CnnRestorationTest, StripsMatchWholePlane) { RunStripsMatchWholePlane(0); }
+
+TEST(CnnRestorationTest, RegistryModelStripsMatchWholePlane) {
+  RunStripsMatchWholePlane(1);
+}
+
+// Checks that a workspace reserved for a context size serves every batch of
+// regions within it without reallocating, and matches a fresh workspace.
+TEST(CnnRestorationTest, ReservedWorkspaceDoesNotGrow) {
+  const int num_layers = 5;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+  model.act_format = CNN_ACT_BF16;
+
+  const int width = 61, height = 43;
+  std::vector<uint8_t> src(width * height);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = rnd.Rand8();
+
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  ASSERT_EQ(0, av1_cnn_workspace_reserve(&ws, &model, width, height));
+  const CnnWorkspace reserved = ws;
+  const CnnRegion batches[][2] = { { { 0, 0, width, height }, { 0, 0, 0, 0 } },
+                                   { { 3, 5, 17, 9 }, { 30, 20, 31, 23 } },
+                                   { { 0, 0, 8, 8 }, { 40, 0, 21, 43 } } };
+  const int batch_sizes[] = { 1, 2, 2 };
+  for (int b = 0; b < 3; ++b) {
+    std::vector<uint8_t> ref(src);
+    std::vector<uint8_t> dst(src);
+    CnnWorkspace fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    ASSERT_EQ(0, av1_cnn_restore_regions(&model, &src[0], width, &ref[0],
+                                         width, width, height, batches[b],
+                                         batch_sizes[b], 0, 8, &fresh));
+    av1_cnn_workspace_free(&fresh);
+    ASSERT_EQ(0, av1_cnn_restore_regions(&model, &src[0], width, &dst[0],
+                                         width, width, height, batches[b],
+                                         batch_sizes[b], 0, 8, &ws));
+    EXPECT_EQ(ref, dst) << "batch " << b;
+    EXPECT_EQ(reserved.in_buf, ws.in_buf);
+    EXPECT_EQ(reserved.act_buf, ws.act_buf);
+    EXPECT_EQ(reserved.stage_buf, ws.stage_buf);
+    EXPECT_EQ(reserved.plans, ws.plans);
+  }
+  av1_cnn_workspace_free(&ws);
+  aom_free(model.params);
+}
+
+// Restores the tiles of a plane for several frames with one workspace and
+// checks that only the first frame plans them and that the planned frames
+// match a workspace planning from scratch.
+TEST(CnnRestorationTest, PlansAreReused) {
+  const int num_layers = 5;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+
+  const int width = 70, height = 50, tile_size = 32;
+  std::vector<CnnRegion> tiles;
+  for (int y = 0; y < height; y += tile_size) {
+    for (int x = 0; x < width; x += tile_size) {
+      const CnnRegion tile = { x, y, AOMMIN(tile_size, width - x),
+                               AOMMIN(tile_size, height - y) };
+      tiles.push_back(tile);
+    }
+  }
+  const int num_tiles = static_cast<int>(tiles.size());
+
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  for (int f = 0; f < 3; ++f) {
+    std::vector<uint8_t> src(width * height);
+    for (size_t i = 0; i < src.size(); ++i) src[i] = rnd.Rand8();
+    std::vector<uint8_t> ref(src);
+    std::vector<uint8_t> dst(src);
+    CnnWorkspace fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    ASSERT_EQ(0, av1_cnn_restore_regions(&model, &src[0], width, &ref[0],
+                                         width, width, height, &tiles[0],
+                                         num_tiles, 0, 8, &fresh));
+    av1_cnn_workspace_free(&fresh);
+    ASSERT_EQ(0, av1_cnn_restore_regions(&model, &src[0], width, &dst[0],
+                                         width, width, height, &tiles[0],
+                                         num_tiles, 0, 8, &ws));
+    EXPECT_EQ(ref, dst) << "frame " << f;
+    EXPECT_GT(ws.plans_built, 0);
+    EXPECT_LE(ws.plans_built, num_tiles) << "frame " << f;
+  }
+  av1_cnn_workspace_free(&ws);
+  aom_free(model.params);
+}
+
+// Restores tiles of a luma and a subsampled chroma plane with a random
+// superblock mask and checks that the active superblocks match the whole
+// plane restored and the others are left untouched.
+TEST(CnnRestorationTest, SparseTileRestoresActiveSuperblocks) {
+  const int num_layers = 4;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+
+  // The chroma plane follows the luma one in the copy of the frame.
+  const int width = 53, height = 37, sb_size_log2 = 3;
+  const int widths[2] = { width, (width + 1) >> 1 };
+  const int heights[2] = { height, (height + 1) >> 1 };
+  const size_t offsets[2] = { 0, (size_t)width * height };
+  std::vector<uint8_t> src(offsets[1] + widths[1] * heights[1]);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = rnd.Rand8();
+  std::vector<uint8_t> ref(src);
+  for (int plane = 0; plane < 2; ++plane) {
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[offsets[plane]],
+                                       widths[plane], heights[plane],
+                                       widths[plane], 0, 8));
+  }
+
+  const int sb_cols = (width + (1 << sb_size_log2) - 1) >> sb_size_log2;
+  const int sb_rows = (height + (1 << sb_size_log2) - 1) >> sb_size_log2;
+  std::vector<uint8_t> sb_mask(sb_cols * sb_rows);
+  for (size_t i = 0; i < sb_mask.size(); ++i) sb_mask[i] = rnd(3) != 0;
+  // Keep a fully active band of superblock rows.
+  for (int c = 0; c < sb_cols; ++c) sb_mask[sb_cols + c] = 1;
+
+  // The workspace is reused across tiles of all sizes.
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  const int tile_sizes[] = { 12, 24, 64 };
+  for (size_t t = 0; t < sizeof(tile_sizes) / sizeof(tile_sizes[0]); ++t) {
+    const int size = tile_sizes[t];
+    std::vector<uint8_t> dst(src);
+    AV1CnnSync cnn_sync;
+    memset(&cnn_sync, 0, sizeof(cnn_sync));
+    cnn_sync.src_buf = &src[0];
+    cnn_sync.num_planes = 2;
+    for (int plane = 0; plane < 2; ++plane) {
+      AV1CnnPlane *const p = &cnn_sync.planes[plane];
+      p->model = &model;
+      p->dst = &dst[offsets[plane]];
+      p->dst_stride = widths[plane];
+      p->width = widths[plane];
+      p->height = heights[plane];
+      p->ss_x = p->ss_y = plane;
+      p->buf_offset = offsets[plane];
+    }
+    cnn_sync.bit_depth = 8;
+    cnn_sync.sb_mask = &sb_mask[0];
+    cnn_sync.sb_size_log2 = sb_size_log2;
+    cnn_sync.sb_cols = sb_cols;
+    cnn_sync.sb_rows = sb_rows;
+    for (int plane = 0; plane < 2; ++plane) {
+      const int w = widths[plane], h = heights[plane];
+      for (int y = 0; y < h; y += size) {
+        for (int x = 0; x < w; x += size) {
+          const AV1CnnMTInfo job = { x, y, AOMMIN(size, w - x),
+                                     AOMMIN(size, h - y), plane };
+          ASSERT_EQ(0, av1_cnn_restore_tile(&cnn_sync, &job, &ws));
+        }
+      }
+      const int sb_log2 = sb_size_log2 - plane;
+      for (int r = 0; r < h; ++r) {
+        for (int c = 0; c < w; ++c) {
+          const size_t i = offsets[plane] + r * w + c;
+          const int active = sb_mask[(r >> sb_log2) * sb_cols + (c >> sb_log2)];
+          ASSERT_EQ(active ? ref[i] : src[i], dst[i])
+              << "plane " << plane << " tile size " << size << " at " << c
+              << "x" << r;
+        }
+      }
+    }
+  }
+
+  av1_cnn_workspace_free(&ws);
+  av1_cnn_model_free(&model);
+}
+
+// Restores the tiles of a plane with masks of scattered superblocks and checks
+// that no tile runs the model on more context than restoring it whole does,
+// and that the active superblocks still match the whole plane restored.
+TEST(CnnRestorationTest, SparseTileCostsNoMoreThanDenseTile) {
+  const int num_layers = 6;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+  ASSERT_NO_FATAL_FAILURE(SetRegistryFormat(&model));
+
+  const int width = 256, height = 192, sb_size_log2 = 5, tile_size = 128;
+  std::vector<uint8_t> src(width * height);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = rnd.Rand8();
+  std::vector<uint8_t> ref(src);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, width, 0,
+                                     8));
+
+  const int sb_cols = width >> sb_size_log2, sb_rows = height >> sb_size_log2;
+  std::vector<uint8_t> sb_mask(sb_cols * sb_rows);
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  for (int m = 0; m < 5; ++m) {
+    for (int r = 0; r < sb_rows; ++r) {
+      for (int c = 0; c < sb_cols; ++c) {
+        uint8_t *const active = &sb_mask[r * sb_cols + c];
+        switch (m) {
+          case 0: *active = r == 2 && c == 3; break;
+          case 1: *active = (r + c) & 1; break;
+          case 2: *active = r % 3 == 0 && c % 3 == 0; break;
+          case 3: *active = c % 2 == 0; break;
+          default: *active = rnd(3) == 0; break;
+        }
+      }
+    }
+    std::vector<uint8_t> dst(src);
+    AV1CnnSync cnn_sync;
+    memset(&cnn_sync, 0, sizeof(cnn_sync));
+    cnn_sync.src_buf = &src[0];
+    cnn_sync.num_planes = 1;
+    AV1CnnPlane *const p = &cnn_sync.planes[0];
+    p->model = &model;
+    p->dst = &dst[0];
+    p->dst_stride = width;
+    p->width = width;
+    p->height = height;
+    cnn_sync.bit_depth = 8;
+    cnn_sync.sb_mask = &sb_mask[0];
+    cnn_sync.sb_size_log2 = sb_size_log2;
+    cnn_sync.sb_cols = sb_cols;
+    cnn_sync.sb_rows = sb_rows;
+    for (int y = 0; y < height; y += tile_size) {
+      for (int x = 0; x < width; x += tile_size) {
+        const AV1CnnMTInfo job = { x, y, AOMMIN(tile_size, width - x),
+                                   AOMMIN(tile_size, height - y), 0 };
+        const CnnRegion tile = { job.x, job.y, job.width, job.height };
+        const int64_t area = ws.context_area;
+        ASSERT_EQ(0, av1_cnn_restore_tile(&cnn_sync, &job, &ws));
+        EXPECT_LE(ws.context_area - area,
+                  av1_cnn_regions_context_area(&model, &tile, 1, width,
+                                               height))
+            << "mask " << m << " tile at " << x << "x" << y;
+      }
+    }
+    for (int r = 0; r < height; ++r) {
+      for (int c = 0; c < width; ++c) {
+        const int i = r * width + c;
+        const int active =
+            sb_mask[(r >> sb_size_log2) * sb_cols + (c >> sb_size_log2)];
+        ASSERT_EQ(active ? ref[i] : src[i], dst[i])
+            << "mask " << m << " at " << c << "x" << r;
+      }
+    }
+  }
+
+  av1_cnn_workspace_free(&ws);
+  av1_cnn_model_free(&model);
+}
+
+// Restores a plane, then the same plane with a few pixels changed, reusing
+// the output of the first one where the change is out of sight of the model.
+static void RunReuseMatchesFullRestore(int registry_format) {
+  const int num_layers = 8;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+  if (registry_format) SetRegistryFormat(&model);
+
+  const int width = 96, height = 64, sb_size_log2 = 4;
+  const int sb_cols = width >> sb_size_log2, sb_rows = height >> sb_size_log2;
+  std::vector<uint8_t> frame(width * height);
+  for (size_t i = 0; i < frame.size(); ++i) frame[i] = rnd.Rand8();
+  std::vector<uint8_t> changed(frame);
+  changed[50 * width + 70] ^= 0x55;
+  const std::vector<uint8_t> changed_src(changed);
+  std::vector<uint8_t> ref(changed);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, width,
+                                     0, 8));
+
+  std::vector<uint8_t> src_buf(frame.size()), prev_src(frame.size());
+  std::vector<uint8_t> prev_dst(frame.size());
+  std::vector<uint8_t> sb_mask(sb_cols * sb_rows, 1);
+  std::vector<uint8_t> prev_sb_mask(sb_mask.size());
+  AV1CnnSync cnn_sync;
+  memset(&cnn_sync, 0, sizeof(cnn_sync));
+  cnn_sync.src_buf = &src_buf[0];
+  cnn_sync.num_planes = 1;
+  cnn_sync.planes[0].model = &model;
+  cnn_sync.planes[0].dst_stride = width;
+  cnn_sync.planes[0].width = width;
+  cnn_sync.planes[0].height = height;
+  cnn_sync.bit_depth = 8;
+  cnn_sync.sb_mask = &sb_mask[0];
+  cnn_sync.sb_size_log2 = sb_size_log2;
+  cnn_sync.sb_cols = sb_cols;
+  cnn_sync.sb_rows = sb_rows;
+  cnn_sync.prev_src = &prev_src[0];
+  cnn_sync.prev_dst = &prev_dst[0];
+  cnn_sync.prev_sb_mask = &prev_sb_mask[0];
+
+  CnnWorkspace ws;
+  memset(&ws, 0, sizeof(ws));
+  const AV1CnnMTInfo job = { 0, 0, width, height, 0 };
+  cnn_sync.planes[0].dst = &frame[0];
+  av1_cnn_restore_copy_rows(&cnn_sync, 0, height);
+  ASSERT_EQ(0, av1_cnn_restore_tile(&cnn_sync, &job, &ws));
+  av1_cnn_restore_finish(&cnn_sync);
+
+  // Mark the output of the first frame in a superblock far from the change,
+  // to tell that it is reused.
+  const int marked = 4 * width + 4;
+  prev_dst[marked] ^= 1;
+
+  cnn_sync.planes[0].dst = &changed[0];
+  av1_cnn_restore_copy_rows(&cnn_sync, 0, height);
+  ASSERT_EQ(0, av1_cnn_restore_tile(&cnn_sync, &job, &ws));
+  prev_dst[marked] ^= 1;
+  EXPECT_EQ(prev_dst[marked] ^ 1, changed[marked]);
+  changed[marked] ^= 1;
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      ASSERT_EQ(ref[r * width + c], changed[r * width + c])
+          << "at " << c << "x" << r;
+    }
+  }
+  av1_cnn_restore_finish(&cnn_sync);
+
+  // The same input with the other activation storage, as after a new
+  // sequence header, reuses nothing.
+  model.act_format =
+      model.act_format == CNN_ACT_BF16 ? CNN_ACT_FLOAT : CNN_ACT_BF16;
+  std::vector<uint8_t> other_ref(changed_src);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &other_ref[0], width, height,
+                                     width, 0, 8));
+  ASSERT_NE(ref, other_ref);
+  std::vector<uint8_t> other(changed_src);
+  cnn_sync.planes[0].dst = &other[0];
+  av1_cnn_restore_copy_rows(&cnn_sync, 0, height);
+  ASSERT_EQ(0, av1_cnn_restore_tile(&cnn_sync, &job, &ws));
+  ASSERT_EQ(other_ref, other);
+
+  av1_cnn_workspace_free(&ws);
+  av1_cnn_model_free(&model);
+}
+
+TEST(CnnRestorationTest, ReuseMatchesFullRestore) {
+  RunReuseMatchesFullRestore(0);
+}
+
+// The same with the Winograd blocks and the bfloat16 rounding of registry
+// models.
+TEST(CnnRestorationTest, RegistryModelReuseMatchesFullRestore) {
+  RunReuseMatchesFullRestore(1);
+}
+
+// Quantizes a random model calibrated on a smooth test plane and checks that
+// the int8 inference stays close to the float one, and that it is seamless
+// across tiles too.
+TEST(CnnRestorationTest, QuantizedModelMatchesFloat) {
+  const int num_layers = 8;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+
+  const int width = 96, height = 64, stride = 96;
+  std::vector<uint8_t> src(stride * height);
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      src[r * stride + c] = clamp(64 + r + c + rnd(16), 0, 255);
+    }
+  }
+  std::vector<uint8_t> ref(src);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                     0, 8));
+
+  float act_max[CNN_MAX_LAYERS] = { 0 };
+  ASSERT_EQ(0, av1_cnn_model_calibrate(&model, &src[0], width, height, stride,
+                                       act_max));
+  for (int l = 0; l < num_layers - 1; ++l) EXPECT_GT(act_max[l], 0.0f);
+  ASSERT_EQ(0, av1_cnn_model_quantize(&model, act_max));
+  ASSERT_TRUE(model.quantized);
+
+  std::vector<uint8_t> dst(src);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &dst[0], width, height, stride,
+                                     0, 8));
+  int64_t sse = 0;
+  for (size_t i = 0; i < dst.size(); ++i) {
+    const int diff = dst[i] - ref[i];
+    sse += diff * diff;
+  }
+  const double psnr =
+      sse ? 10.0 * log10(255.0 * 255.0 * dst.size() / sse) : 100.0;
+  EXPECT_GT(psnr, 40.0);
+
+  std::vector<uint8_t> tiles(src);
+  const int size = 16;
+  for (int y = 0; y < height; y += size) {
+    for (int x = 0; x < width; x += size) {
+      ASSERT_EQ(0, av1_cnn_restore_region(&model, &src[0], stride, &tiles[0],
+                                          stride, width, height, x, y, size,
+                                          size, 0, 8));
+    }
+  }
+  for (size_t i = 0; i < dst.size(); ++i) ASSERT_EQ(dst[i], tiles[i]);
+
+  av1_cnn_model_free(&model);
+}
+
+// Restores a 10-bit version of an 8-bit plane, with the float model and then
+// with its quantized version, and checks that the result is the 8-bit one
+// scaled to 10 bits, up to rounding.
+TEST(CnnRestorationTest, HighBitdepthMatchesEightBit) {
+  const int num_layers = 6;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+
+  const int width = 48, height = 40, stride = 64;
+  const int bit_depth = 10;
+  const int peak = (1 << bit_depth) - 1;
+  std::vector<uint8_t> src(stride * height);
+  std::vector<uint16_t> src16(stride * height);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = clamp(128 + (int)(i % stride) - (int)(i / stride) + rnd(32), 0,
+                   255);
+    src16[i] = (src[i] * peak + 127) / 255;
+  }
+
+  for (int quantized = 0; quantized <= 1; ++quantized) {
+    if (quantized) {
+      float act_max[CNN_MAX_LAYERS] = { 0 };
+      ASSERT_EQ(0, av1_cnn_model_calibrate(&model, &src[0], width, height,
+                                           stride, act_max));
+      ASSERT_EQ(0, av1_cnn_model_quantize(&model, act_max));
+    }
+    std::vector<uint8_t> ref(src);
+    std::vector<uint16_t> dst(src16);
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                       0, 8));
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, CONVERT_TO_BYTEPTR(&dst[0]),
+                                       width, height, stride, 1, bit_depth));
+    for (int r = 0; r < height; ++r) {
+      for (int c = 0; c < width; ++c) {
+        const int i = r * stride + c;
+        ASSERT_NEAR(ref[i] * peak / 255.0, dst[i], 3.0)
+            << "quantized " << quantized << " at " << c << "x" << r;
+      }
+    }
+  }
+
+  av1_cnn_model_free(&model);
+}
+
+// Restores a plane with the hidden layers run as Winograd convolutions and
+// checks that they only round differently from the direct ones.
+TEST(CnnRestorationTest, WinogradMatchesDirect) {
+  const int num_layers = 8;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+
+  const int width = 45, height = 29, stride = 64;
+  std::vector<uint8_t> ref(stride * height);
+  for (size_t i = 0; i < ref.size(); ++i) ref[i] = rnd.Rand8();
+  std::vector<uint8_t> dst(ref);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                     0, 8));
+  ASSERT_EQ(0, av1_cnn_model_set_conv_algo(&model, CNN_CONV_WINOGRAD));
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &dst[0], width, height, stride,
+                                     0, 8));
+  for (size_t i = 0; i < dst.size(); ++i) ASSERT_NEAR(ref[i], dst[i], 1);
+
+  av1_cnn_model_free(&model);
+}
+
+// Restores a plane with the C kernels the reference CNN backend of the
+// encoder runs and with the optimized ones, which must give the same output.
+TEST(CnnRestorationTest, ReferenceMatchesOptimized) {
+  const int num_layers = 8;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModel model;
+  ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, &model));
+  ASSERT_EQ(0, av1_cnn_model_set_conv_algo(&model, CNN_CONV_WINOGRAD));
+  model.act_format = CNN_ACT_BF16;
+
+  const int width = 45, height = 29, stride = 64;
+  std::vector<uint8_t> ref(stride * height);
+  for (size_t i = 0; i < ref.size(); ++i) ref[i] = rnd.Rand8();
+  std::vector<uint8_t> dst(ref);
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &dst[0], width, height, stride,
+                                     0, 8));
+  model.reference = 1;
+  ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                     0, 8));
+  for (size_t i = 0; i < dst.size(); ++i) ASSERT_EQ(ref[i], dst[i]) << i;
+
+  av1_cnn_model_free(&model);
+}
+
+// Returns the PSNR of a against b.
+static double PlanePsnr(const std::vector<uint8_t> &a,
+                        const std::vector<uint8_t> &b) {
+  int64_t sse = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    const int diff = a[i] - b[i];
+    sse += diff * diff;
+  }
+  return sse ? 10.0 * log10(255.0 * 255.0 * a.size() / sse) : 100.0;
+}
+
+// The checkpoints shipped in MODELS/, with the MD5s of the restoration of
+// MakeNoisyPlane() by the C kernels. The reference outputs were generated
+// with av1_cnn_restore_plane(), first on the direct convolutions and float
+// activations the models are loaded with, then in the format of the codec,
+// see SetRegistryFormat().
+static const struct {
+  const char *name;
+  const char *md5;
+  const char *registry_md5;
+} kCnnModels[] = {
+  { "qp27/VDSR15_qp27_I_set2K/VDSR15_qp27_I_set2K_394",
+    "0d0e06732c5be7ffc63767e2fb0064fc", "c419dbd686af45b4b3d46008ae749007" },
+  { "qp32/VDSR15_qp32_B_set2319_noclip_v2/VDSR15_qp32_B_set2319_noclip_v2_300",
+    "a7d0bca77b185c92d227b23ea3612e4d", "29fdd472b095b95b0d2c56b2ba89fce0" },
+  { "qp32/VDSR15_qp32_I_set2K+2193/VDSR15_qp32_I_set2K+2193_473",
+    "002345c384f90d77c6d24a7f6ebb4f05", "03d9ce1dc1014665608afd97481a385c" },
+  { "qp37/VDSR20_qp37_B_set2038_noclip_v2/VDSR20_qp37_B_set2038_noclip_v2_356",
+    "f67eb1736c62673636a5c6e67b4f1de0", "cfd674d6710455458ee8a94645fd8d3e" },
+  { "qp37/VDSR20_qp37_I_set2K+2299/VDSR20_qp37_I_set2K+2299_593",
+    "767973ec5df3448c4fa70964aa701664", "283c8493db89c3c9145237f6c01f6741" },
+  { "qp42/VDSR25_qp42_B_set2161_noclip/VDSR25_qp42_B_set2161_noclip_151",
+    "9912a0096d0dfb1cd648efa67e501627", "9912a0096d0dfb1cd648efa67e501627" },
+  { "qp42/VDSR25_qp42_I_2K+2193_av1/VDSR25_qp42_I_2K+2193_av1_372",
+    "a2446fa996ed2935efba8d9d4364d589", "ded6453efc6f6c53175b284e6b66a39c" },
+  { "qp47/VDSR25_qp47_B_set2184_noclip_v2/VDSR25_qp47_B_set2184_noclip_v2_419",
+    "330d0840332b86a1ce4aac7b7c220b8b", "d6f544574b57e7053c69e5bfcd71106c" },
+  { "qp47/VDSR25_qp47_I_set2K+2034_v2/VDSR25_qp47_I_set2K+2034_v2_582",
+    "61f20ede6dae7662bf4e6f4ce08ecbad", "ed13a9a288ce47179c9995c562ab108a" },
+  { "qp52/VDSR25_qp52_B_set2299_noclip/VDSR25_qp52_B_set2299_noclip_252",
+    "511cfb22ac863647663f680f66e19f1d", "094c3e5396fa36e28bf61dd3d227f26e" },
+  { "qp52/VDSR25_qp52_I_set2K+2299_true/VDSR25_qp52_I_set2K+2299_true_364",
+    "f40dc0a2ee2f42f9152a7cb3b616b5a1", "dd0a29a5e04ef8cc24ee5cd3ff3e3f94" },
+  { "qp52/VDSR30_qp52_B_set2299_noclip_v3/VDSR30_qp52_B_set2299_noclip_v3_416",
+    "dbc3c625c5793a269a2654a3b4db6dfc", "bbec6b8fbc814d18ecb74418ac08519e" },
+  { "qp52/VDSR30_qp52_I_set2K+2299_av1/VDSR30_qp52_I_set2K+2299_av1_394",
+    "64b1ca8dfd004f515e931e395c68456d", "218286dff3c17d5f8ee6998c6aef3bea" },
+};
+static const int kNumCnnModels =
+    (int)(sizeof(kCnnModels) / sizeof(kCnnModels[0]));
+
+// Loads a model of kCnnModels from the MODELS directory of the test data.
+static void LoadCnnModel(CnnModel *model, int index) {
+  const std::string path = libaom_test::GetDataPath() + "/MODELS/" +
+                           kCnnModels[index].name + ".ckpt.data-00000-of-00001";
+  ASSERT_EQ(0, av1_cnn_model_load(model, path.c_str()))
+      << "Copy MODELS/ into the test data directory to load " << path;
+}
+
+// Fills a width x height plane with a gradient and a checkerboard, and a copy
+// of it with some noise on top.
+static void MakeNoisyPlane(int width, int height, std::vector<uint8_t> *clean,
+                           std::vector<uint8_t> *noisy) {
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  clean->resize(width * height);
+  noisy->resize(width * height);
+  for (int r = 0; r < height; ++r) {
+    for (int c = 0; c < width; ++c) {
+      const int i = r * width + c;
+      (*clean)[i] = 48 + 3 * r + 2 * c + ((r / 8 + c / 8) & 1) * 40;
+      (*noisy)[i] = clamp((*clean)[i] + rnd(9) - 4, 0, 255);
+    }
+  }
+}
+
+// Restores a noisy plane with each model of MODELS/ storing its activations
+// as floats and as bfloat16, and checks that the PSNR against the clean plane
+// barely moves.
+TEST(CnnRestorationTest, Bf16MatchesFloatForEachModel) {
+  const int width = 48, height = 32, stride = 48;
+  std::vector<uint8_t> clean, noisy;
+  MakeNoisyPlane(width, height, &clean, &noisy);
+
+  for (int i = 0; i < kNumCnnModels; ++i) {
+    CnnModel model;
+    ASSERT_NO_FATAL_FAILURE(LoadCnnModel(&model, i));
+    const char *const name = kCnnModels[i].name;
+    ASSERT_EQ(0, av1_cnn_model_set_conv_algo(&model, CNN_CONV_WINOGRAD));
+    std::vector<uint8_t> ref(noisy), dst(noisy);
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                       0, 8));
+    model.act_format = CNN_ACT_BF16;
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, &dst[0], width, height, stride,
+                                       0, 8));
+    for (size_t j = 0; j < dst.size(); ++j)
+      ASSERT_NEAR(ref[j], dst[j], 1) << name;
+    EXPECT_NEAR(PlanePsnr(ref, clean), PlanePsnr(dst, clean), 0.05) << name;
+    av1_cnn_model_free(&model);
+  }
+}
+
+// Restores a noisy plane with each model of MODELS/, as loaded and in the
+// format of the codec, and checks the output of the C kernels against the
+// stored reference, and the optimized kernels against the C ones, which they
+// must match exactly.
+TEST(CnnRestorationTest, ModelsMatchReferenceOutputs) {
+  const int width = 48, height = 32, stride = 48;
+  std::vector<uint8_t> clean, noisy;
+  MakeNoisyPlane(width, height, &clean, &noisy);
+
+  for (int i = 0; i < kNumCnnModels; ++i) {
+    CnnModel model;
+    ASSERT_NO_FATAL_FAILURE(LoadCnnModel(&model, i));
+    const char *const name = kCnnModels[i].name;
+    for (int registry_format = 0; registry_format <= 1; ++registry_format) {
+      if (registry_format) SetRegistryFormat(&model);
+      std::vector<uint8_t> ref(noisy), dst(noisy);
+      model.reference = 1;
+      ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height,
+                                         stride, 0, 8));
+      libaom_test::MD5 md5;
+      md5.Add(&ref[0], ref.size());
+      EXPECT_STREQ(registry_format ? kCnnModels[i].registry_md5
+                                   : kCnnModels[i].md5,
+                   md5.Get())
+          << name << " registry format " << registry_format;
+      model.reference = 0;
+      ASSERT_EQ(0, av1_cnn_restore_plane(&model, &dst[0], width, height,
+                                         stride, 0, 8));
+      for (size_t j = 0; j < dst.size(); ++j) {
+        ASSERT_EQ(ref[j], dst[j])
+            << name << " registry format " << registry_format << " at " << j;
+      }
+    }
+    av1_cnn_model_free(&model);
+  }
+}
+
+// Quantizes each model of MODELS/, calibrated on one noisy plane, restores
+// another with the float and the int8 parameters, and checks that the int8
+// inference loses less than 0.3 dB of PSNR against the clean plane. The
+// largest loss of the checkpoints is 0.25 dB.
+TEST(CnnRestorationTest, QuantizedMatchesFloatForEachModel) {
+  std::vector<uint8_t> calib_clean, calib;
+  MakeNoisyPlane(64, 40, &calib_clean, &calib);
+  const int width = 48, height = 32, stride = 48;
+  std::vector<uint8_t> clean, noisy;
+  MakeNoisyPlane(width, height, &clean, &noisy);
+
+  for (int i = 0; i < kNumCnnModels; ++i) {
+    CnnModel model;
+    ASSERT_NO_FATAL_FAILURE(LoadCnnModel(&model, i));
+    const char *const name = kCnnModels[i].name;
+    std::vector<uint8_t> ref(noisy), dst(noisy);
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, &ref[0], width, height, stride,
+                                       0, 8));
+    float act_max[CNN_MAX_LAYERS] = { 0 };
+    ASSERT_EQ(0,
+              av1_cnn_model_calibrate(&model, &calib[0], 64, 40, 64, act_max));
+    ASSERT_EQ(0, av1_cnn_model_quantize(&model, act_max));
+    ASSERT_EQ(0, av1_cnn_restore_plane(&model, &dst[0], width, height, stride,
+                                       0, 8));
+    EXPECT_GT(PlanePsnr(dst, clean), PlanePsnr(ref, clean) - 0.3) << name;
+    av1_cnn_model_free(&model);
+  }
+}
+
+// Builds a 4:2:0 frame of one superblock covered by a single inter block and
+// checks which predictions leave the superblock to the reference frame the
+// CNN has restored already: only whole-pel copies without residual.
+TEST(CnnRestorationTest, SuperblockMask) {
+  AV1_COMMON *const cm = (AV1_COMMON *)aom_calloc(1, sizeof(*cm));
+  ASSERT_TRUE(cm != NULL);
+  cm->seq_params.mib_size = 16;
+  cm->subsampling_x = cm->subsampling_y = 1;
+  cm->mi_rows = cm->mi_cols = cm->mi_stride = 16;
+  for (int i = 0; i < INTER_REFS_PER_FRAME; ++i)
+    av1_setup_scale_factors_for_frame(&cm->frame_refs[i].sf, 128, 128, 128,
+                                      128);
+  MB_MODE_INFO copy;
+  memset(&copy, 0, sizeof(copy));
+  copy.sb_type = BLOCK_64X64;
+  copy.mode = NEWMV;
+  copy.ref_frame[0] = LAST_FRAME;
+  copy.ref_frame[1] = NONE_FRAME;
+  copy.motion_mode = SIMPLE_TRANSLATION;
+  copy.skip = 1;
+  copy.mv[0].as_mv.row = 16;
+  copy.mv[0].as_mv.col = -32;
+  MB_MODE_INFO mbmi = copy;
+  std::vector<MB_MODE_INFO *> grid(16 * 16, &mbmi);
+  cm->mi_grid_visible = &grid[0];
+  EXPECT_EQ(0, av1_cnn_sb_active(cm, 0, 0));
+
+  // Whole pixels in luma, half pixels in chroma.
+  mbmi.mv[0].as_mv.row = 8;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  cm->seq_params.monochrome = 1;
+  EXPECT_EQ(0, av1_cnn_sb_active(cm, 0, 0));
+  cm->seq_params.monochrome = 0;
+  mbmi = copy;
+  mbmi.mv[0].as_mv.col = 4;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.skip = 0;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.ref_frame[1] = ALTREF_FRAME;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.ref_frame[1] = INTRA_FRAME;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.motion_mode = OBMC_CAUSAL;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.motion_mode = WARPED_CAUSAL;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.mode = GLOBALMV;
+  cm->global_motion[LAST_FRAME].wmtype = ROTZOOM;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  cm->global_motion[LAST_FRAME].wmtype = IDENTITY;
+  mbmi = copy;
+  av1_setup_scale_factors_for_frame(&cm->frame_refs[0].sf, 256, 256, 128,
+                                    128);
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+  mbmi.ref_frame[0] = GOLDEN_FRAME;
+  EXPECT_EQ(0, av1_cnn_sb_active(cm, 0, 0));
+  mbmi = copy;
+  mbmi.ref_frame[0] = INTRA_FRAME;
+  mbmi.mode = DC_PRED;
+  EXPECT_EQ(1, av1_cnn_sb_active(cm, 0, 0));
+
+  aom_free(cm);
+}
+
+TEST(CnnRestorationTest, ParamCount) {
+  EXPECT_EQ(0u, av1_cnn_model_param_count(1));
+  EXPECT_EQ(0u, av1_cnn_model_param_count(CNN_MAX_LAYERS + 1));
+  // Size of the VDSR25 checkpoints shipped in MODELS/.
+  EXPECT_EQ(850561u, av1_cnn_model_param_count(25));
+}
+
+// Writes a two layer model file with every parameter set to its index in the
+// file and checks that it loads with the parameters in place.
+TEST(CnnRestorationTest, LoadModelFile) {
+  CnnModelFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CNN_MODEL_MAGIC;
+  hdr.version = CNN_MODEL_VERSION;
+  hdr.num_layers = 2;
+  hdr.kernel_size = CNN_KERNEL_SIZE;
+  hdr.out_block = CNN_OUT_BLOCK;
+  hdr.qp = 37;
+  hdr.role = CNN_ROLE_INTER;
+  const int in_channels[2] = { 1, CNN_CHANNELS };
+  const int out_channels[2] = { CNN_CHANNELS, 1 };
+  uint32_t offset = CNN_MODEL_ALIGN * 16;
+  ASSERT_LE(sizeof(hdr), offset);
+  for (int l = 0; l < 2; ++l) {
+    hdr.layers[l].in_channels = in_channels[l];
+    hdr.layers[l].out_channels = out_channels[l];
+    hdr.layers[l].bias_offset = offset;
+    offset += CNN_MODEL_ALIGN * 4;
+    hdr.layers[l].weights_offset = offset;
+    offset += CNN_MODEL_ALIGN * 64;
+  }
+  hdr.file_size = offset;
+
+  std::vector<float> data(offset / sizeof(float));
+  for (size_t i = 0; i < data.size(); ++i) data[i] = (float)i;
+  memcpy(&data[0], &hdr, sizeof(hdr));
+
+  libaom_test::TempOutFile file;
+  ASSERT_TRUE(file.file() != NULL);
+  ASSERT_EQ(1u, fwrite(&data[0], offset, 1, file.file()));
+  ASSERT_EQ(0, fflush(file.file()));
+
+  CnnModel model;
+  ASSERT_EQ(0, av1_cnn_model_load(&model, file.file_name().c_str()));
+  EXPECT_EQ(2, model.num_layers);
+  EXPECT_EQ(37, model.qp);
+  EXPECT_EQ(CNN_ROLE_INTER, model.role);
+  for (int l = 0; l < 2; ++l) {
+    EXPECT_EQ(in_channels[l], model.layers[l].in_channels);
+    EXPECT_EQ(out_channels[l], model.layers[l].out_channels);
+    EXPECT_EQ(hdr.layers[l].bias_offset / sizeof(float),
+              model.layers[l].bias[0]);
+    EXPECT_EQ(hdr.layers[l].weights_offset / sizeof(float) + 1,
+              model.layers[l].weights[1]);
+  }
+  av1_cnn_model_free(&model);
+
+  // A truncated file must be rejected.
+  hdr.file_size += sizeof(float);
+  ASSERT_EQ(0, fseek(file.file(), 0, SEEK_SET));
+  ASSERT_EQ(1u, fwrite(&hdr, sizeof(hdr), 1, file.file()));
+  ASSERT_EQ(0, fflush(file.file()));
+  EXPECT_NE(0, av1_cnn_model_load(&model, file.file_name().c_str()));
+}
+
+// Writes a quantized model file and checks that it loads only while its int8
+// weights stay within +/-CNN_INT8_WEIGHT_MAX, which the optimized kernels
+// rely on.
+TEST(CnnRestorationTest, LoadQuantizedModelFile) {
+  CnnModelFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CNN_MODEL_MAGIC;
+  hdr.version = CNN_MODEL_VERSION;
+  hdr.num_layers = 2;
+  hdr.kernel_size = CNN_KERNEL_SIZE;
+  hdr.out_block = CNN_OUT_BLOCK;
+  hdr.qp = -1;
+  const int in_channels[2] = { 1, CNN_CHANNELS };
+  const int out_channels[2] = { CNN_CHANNELS, 1 };
+  uint32_t offset = CNN_MODEL_ALIGN * 16;
+  ASSERT_LE(sizeof(hdr), offset);
+  for (int l = 0; l < 2; ++l) {
+    hdr.layers[l].in_channels = in_channels[l];
+    hdr.layers[l].out_channels = out_channels[l];
+    hdr.layers[l].bias_offset = offset;
+    offset += CNN_MODEL_ALIGN * 4;
+    hdr.layers[l].weights_offset = offset;
+    offset += CNN_MODEL_ALIGN * 64;
+  }
+  CnnModelFileQuantLayer qlayers[2];
+  memset(qlayers, 0, sizeof(qlayers));
+  hdr.quant_offset = offset;
+  offset += CNN_MODEL_ALIGN;
+  for (int l = 0; l < 2; ++l) {
+    qlayers[l].bias_offset = offset;
+    offset += CNN_MODEL_ALIGN * 4;
+    qlayers[l].scale_offset = offset;
+    offset += CNN_MODEL_ALIGN * 4;
+    qlayers[l].weights_offset = offset;
+    offset += CNN_MODEL_ALIGN * 64;
+  }
+  hdr.file_size = offset;
+
+  std::vector<uint8_t> data(offset);
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  for (int l = 0; l < 2; ++l) {
+    const size_t count =
+        av1_cnn_int8_weight_count(in_channels[l], out_channels[l]);
+    ASSERT_LE(count, CNN_MODEL_ALIGN * 64u);
+    int8_t *const weights = (int8_t *)&data[qlayers[l].weights_offset];
+    for (size_t i = 0; i < count; ++i) {
+      weights[i] = (int8_t)(rnd(2 * CNN_INT8_WEIGHT_MAX + 1) -
+                            CNN_INT8_WEIGHT_MAX);
+    }
+  }
+  memcpy(&data[0], &hdr, sizeof(hdr));
+  memcpy(&data[hdr.quant_offset], qlayers, sizeof(qlayers));
+
+  libaom_test::TempOutFile file;
+  ASSERT_TRUE(file.file() != NULL);
+  ASSERT_EQ(1u, fwrite(&data[0], offset, 1, file.file()));
+  ASSERT_EQ(0, fflush(file.file()));
+  CnnModel model;
+  ASSERT_EQ(0, av1_cnn_model_load(&model, file.file_name().c_str()));
+  EXPECT_EQ(1, model.quantized);
+  av1_cnn_model_free(&model);
+
+  const int8_t too_large[2] = { CNN_INT8_WEIGHT_MAX + 1,
+                                -CNN_INT8_WEIGHT_MAX - 1 };
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(0, fseek(file.file(), qlayers[1].weights_offset + 5, SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&too_large[i], 1, 1, file.file()));
+    ASSERT_EQ(0, fflush(file.file()));
+    EXPECT_NE(0, av1_cnn_model_load(&model, file.file_name().c_str()));
+  }
+}
+
+TEST(CnnRestorationTest, RegistrySelect) {
+  CnnModelRegistry registry;
+  memset(&registry, 0, sizeof(registry));
+  EXPECT_TRUE(av1_cnn_registry_select(&registry, 40, CNN_ROLE_INTRA, 0) ==
+              NULL);
+
+  const int qps[] = { 27, 37, 52, 32, 52 };
+  const CNN_MODEL_ROLE roles[] = { CNN_ROLE_INTRA, CNN_ROLE_INTRA,
+                                   CNN_ROLE_INTRA, CNN_ROLE_INTER,
+                                   CNN_ROLE_INTER };
+  for (int i = 0; i < 5; ++i) {
+    registry.models[i].qp = qps[i];
+    registry.models[i].role = roles[i];
+  }
+  registry.num_models = 5;
+
+  EXPECT_EQ(&registry.models[0],
+            av1_cnn_registry_select(&registry, 0, CNN_ROLE_INTRA, 0));
+  EXPECT_EQ(&registry.models[1],
+            av1_cnn_registry_select(&registry, 40, CNN_ROLE_INTRA, 0));
+  EXPECT_EQ(&registry.models[2],
+            av1_cnn_registry_select(&registry, 63, CNN_ROLE_INTRA, 0));
+  EXPECT_EQ(&registry.models[3],
+            av1_cnn_registry_select(&registry, 40, CNN_ROLE_INTER, 0));
+  EXPECT_EQ(&registry.models[4],
+            av1_cnn_registry_select(&registry, 50, CNN_ROLE_INTER, 0));
+
+  // Without a model of the requested role the nearest other one is used.
+  registry.num_models = 3;
+  EXPECT_EQ(&registry.models[1],
+            av1_cnn_registry_select(&registry, 36, CNN_ROLE_INTER, 0));
+
+  // The planes do not take the models of the others, but the chroma planes
+  // take a chroma model of the other frame type.
+  registry.num_models = 5;
+  EXPECT_TRUE(av1_cnn_registry_select(&registry, 40, CNN_ROLE_CHROMA_INTRA,
+                                      0) == NULL);
+  EXPECT_TRUE(av1_cnn_registry_select(&registry, 50, CNN_ROLE_CHROMA_INTER,
+                                      0) == NULL);
+  registry.models[5].qp = 32;
+  registry.models[5].role = CNN_ROLE_CHROMA_INTRA;
+  registry.num_models = 6;
+  EXPECT_EQ(&registry.models[5],
+            av1_cnn_registry_select(&registry, 50, CNN_ROLE_CHROMA_INTRA, 0));
+  EXPECT_EQ(&registry.models[5],
+            av1_cnn_registry_select(&registry, 50, CNN_ROLE_CHROMA_INTER, 0));
+  EXPECT_EQ(&registry.models[2],
+            av1_cnn_registry_select(&registry, 50, CNN_ROLE_INTRA, 0));
+
+  // The depth picks between the models of the nearest QP bucket only.
+  registry.models[2].num_layers = 25;
+  registry.models[3] = registry.models[2];
+  registry.models[3].num_layers = 30;
+  registry.models[4] = registry.models[2];
+  registry.models[4].num_layers = 15;
+  registry.num_models = 5;
+  EXPECT_EQ(&registry.models[3],
+            av1_cnn_registry_select(&registry, 52, CNN_ROLE_INTRA, 0));
+  EXPECT_EQ(&registry.models[2],
+            av1_cnn_registry_select(&registry, 52, CNN_ROLE_INTRA, 25));
+  EXPECT_EQ(&registry.models[4],
+            av1_cnn_registry_select(&registry, 50, CNN_ROLE_INTRA, 17));
+  EXPECT_EQ(&registry.models[3],
+            av1_cnn_registry_select(&registry, 63, CNN_ROLE_INTRA, 32));
+  EXPECT_EQ(&registry.models[1],
+            av1_cnn_registry_select(&registry, 37, CNN_ROLE_INTRA, 15));
+}
+
+#if CONFIG_AV1_ENCODER
+// Feeds the time estimate of the encoder a cold first frame, then frames too
+// slow for the budget, and checks that it skips the CNN for a while only and
+// returns to it once it is fast enough again.
+TEST(CnnRestorationTest, TimeBudgetReturnsToCnn) {
+  const int64_t pixels = 1000;
+  const unsigned int budget = 1000;
+  CnnTimeEstimate estimate;
+  memset(&estimate, 0, sizeof(estimate));
+
+  // The first frame is slow for reasons of its own and tells nothing.
+  EXPECT_TRUE(av1_cnn_time_fits(&estimate, pixels, budget));
+  av1_cnn_time_restored(&estimate, 10 * budget, pixels);
+  EXPECT_TRUE(av1_cnn_time_fits(&estimate, pixels, budget));
+  av1_cnn_time_restored(&estimate, 2 * budget, pixels);
+  EXPECT_FALSE(av1_cnn_time_fits(&estimate, pixels, budget));
+  // Frames with fewer pixels to restore still fit.
+  EXPECT_TRUE(av1_cnn_time_fits(&estimate, pixels / 2, budget));
+
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < CNN_TIME_PROBE_INTERVAL; ++i) {
+      ASSERT_FALSE(av1_cnn_time_fits(&estimate, pixels, budget)) << i;
+      av1_cnn_time_skipped(&estimate);
+    }
+    // The CNN runs again, and in the first round turns out as slow as
+    // before.
+    ASSERT_TRUE(av1_cnn_time_fits(&estimate, pixels, budget));
+    av1_cnn_time_restored(&estimate, round ? budget / 2 : 2 * budget, pixels);
+  }
+  for (int i = 0; i < 2 * CNN_TIME_PROBE_INTERVAL; ++i) {
+    ASSERT_TRUE(av1_cnn_time_fits(&estimate, pixels, budget)) << i;
+    av1_cnn_time_restored(&estimate, budget / 2, pixels);
+  }
+
+  // No budget, no limit.
+  estimate.usec_per_pixel = 1e6;
+  EXPECT_TRUE(av1_cnn_time_fits(&estimate, pixels, 0));
+}
+#endif  // CONFIG_AV1_ENCODER
+
+#if CONFIG_CNN_REMOTE
+// Restores a 4:2:0 frame of each of two clients on an inference server
+// listening on a local socket, both in flight at once, and checks every
+// plane against restoring it whole in process with the model the server
+// picks for it. The first client restores its frame in place in shared
+// memory, the second through the ring. The frames are wider than a tile, and
+// a second frame of one client differs from its first in a small block only,
+// so that the server restores the rest from the frame before.
+TEST(CnnRestorationTest, RemoteMatchesLocal) {
+  const int num_layers = 3;
+  ACMRandom rnd(ACMRandom::DeterministicSeed());
+  CnnModelRegistry registry;
+  memset(&registry, 0, sizeof(registry));
+  const CNN_MODEL_ROLE roles[2] = { CNN_ROLE_INTRA, CNN_ROLE_CHROMA_INTRA };
+  for (int i = 0; i < 2; ++i) {
+    CnnModel *const model = &registry.models[i];
+    ASSERT_NO_FATAL_FAILURE(MakeRandomModel(num_layers, 0.05f, &rnd, model));
+    SetRegistryFormat(model);
+    model->qp = 40;
+    model->role = roles[i];
+    registry.num_models++;
+  }
+
+  libaom_test::TempOutFile file;
+  const std::string path = file.file_name() + ".sock";
+  CnnServer *const server = av1_cnn_server_start(path.c_str(), &registry, 3);
+  ASSERT_TRUE(server != NULL);
+  CnnRemote *remotes[2] = { av1_cnn_remote_connect(path.c_str()),
+                            av1_cnn_remote_connect(path.c_str()) };
+  ASSERT_TRUE(remotes[0] != NULL);
+  ASSERT_TRUE(remotes[1] != NULL);
+  EXPECT_EQ(2, av1_cnn_remote_num_models(remotes[0]));
+
+  // Two tiles of the restoration threads across, see CNN_TILE_SIZE.
+  const int tile_size = 512;
+  const int width = tile_size + 88, height = 70;
+  const uint8_t mask[20] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+                             1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+  CnnRemoteParams params;
+  params.qp = 40;
+  params.depth = 0;
+  params.act_format = CNN_ACT_BF16;
+  params.intra = 1;
+  params.num_planes = MAX_MB_PLANE;
+  params.bit_depth = 8;
+  params.sb_mask = mask;
+  params.sb_size_log2 = 6;
+  YV12_BUFFER_CONFIG frames[2];
+  aom_codec_frame_buffer_t fbs[2];
+  std::vector<uint8_t> srcs[2][MAX_MB_PLANE], refs[2][MAX_MB_PLANE];
+  for (int i = 0; i < 2; ++i) {
+    memset(&frames[i], 0, sizeof(frames[i]));
+    memset(&fbs[i], 0, sizeof(fbs[i]));
+    ASSERT_EQ(0, aom_realloc_frame_buffer(
+                     &frames[i], width, height, 1, 1, 0, 32, 32, &fbs[i],
+                     i == 0 ? av1_cnn_remote_get_frame_buffer : NULL, NULL));
+    for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+      const int is_uv = plane > 0;
+      const int w = frames[i].crop_widths[is_uv];
+      const int h = frames[i].crop_heights[is_uv];
+      std::vector<uint8_t> &src = srcs[i][plane];
+      src.resize(w * h);
+      for (int r = 0; r < h; ++r) {
+        for (int c = 0; c < w; ++c) {
+          src[r * w + c] = rnd.Rand8();
+          frames[i].buffers[plane][r * frames[i].strides[is_uv] + c] =
+              src[r * w + c];
+        }
+      }
+      refs[i][plane] = src;
+      ASSERT_EQ(0, av1_cnn_restore_plane(&registry.models[is_uv],
+                                         &refs[i][plane][0], w, h, w, 0, 8));
+    }
+    ASSERT_EQ(0,
+              av1_cnn_remote_launch(remotes[i], &frames[i], &fbs[i], &params));
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(0, av1_cnn_remote_wait(remotes[i], &frames[i]));
+    for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+      const int is_uv = plane > 0;
+      const int w = frames[i].crop_widths[is_uv];
+      for (int r = 0; r < frames[i].crop_heights[is_uv]; ++r) {
+        for (int c = 0; c < w; ++c) {
+          ASSERT_EQ(refs[i][plane][r * w + c],
+                    frames[i].buffers[plane][r * frames[i].strides[is_uv] + c])
+              << "client " << i << " plane " << plane << " at " << c << "x"
+              << r;
+        }
+      }
+    }
+  }
+
+  // The next frame of the first client changes a block across the tile
+  // boundary of every plane.
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    const int is_uv = plane > 0;
+    const int w = frames[0].crop_widths[is_uv];
+    const int h = frames[0].crop_heights[is_uv];
+    std::vector<uint8_t> &src = srcs[0][plane];
+    for (int r = h / 4; r < h / 2; ++r) {
+      for (int c = (tile_size >> is_uv) - 8; c < (tile_size >> is_uv) + 8; ++c)
+        src[r * w + c] = rnd.Rand8();
+    }
+    for (int r = 0; r < h; ++r) {
+      memcpy(frames[0].buffers[plane] + r * frames[0].strides[is_uv],
+             &src[r * w], w);
+    }
+    refs[0][plane] = src;
+    ASSERT_EQ(0, av1_cnn_restore_plane(&registry.models[is_uv],
+                                       &refs[0][plane][0], w, h, w, 0, 8));
+  }
+  ASSERT_EQ(0, av1_cnn_remote_launch(remotes[0], &frames[0], &fbs[0], &params));
+  ASSERT_EQ(0, av1_cnn_remote_wait(remotes[0], &frames[0]));
+  for (int plane = 0; plane < MAX_MB_PLANE; ++plane) {
+    const int is_uv = plane > 0;
+    const int w = frames[0].crop_widths[is_uv];
+    for (int r = 0; r < frames[0].crop_heights[is_uv]; ++r) {
+      for (int c = 0; c < w; ++c) {
+        ASSERT_EQ(refs[0][plane][r * w + c],
+                  frames[0].buffers[plane][r * frames[0].strides[is_uv] + c])
+            << "next frame plane " << plane << " at " << c << "x" << r;
+      }
+    }
+  }
+
+  // A plane put back holds its input again, which restores to the same
+  // output once more.
+  for (int i = 0; i < 2; ++i) {
+    const int uv_width = frames[i].uv_crop_width;
+    ASSERT_EQ(0, av1_cnn_remote_undo_plane(remotes[i], &frames[i], 1));
+    for (int r = 0; r < frames[i].uv_crop_height; ++r) {
+      for (int c = 0; c < uv_width; ++c) {
+        ASSERT_EQ(srcs[i][1][r * uv_width + c],
+                  frames[i].u_buffer[r * frames[i].uv_stride + c])
+            << "client " << i << " put back at " << c << "x" << r;
+      }
+    }
+    ASSERT_EQ(0,
+              av1_cnn_remote_launch(remotes[i], &frames[i], &fbs[i], &params));
+    ASSERT_EQ(0, av1_cnn_remote_wait(remotes[i], &frames[i]));
+    for (int r = 0; r < frames[i].uv_crop_height; ++r) {
+      for (int c = 0; c < uv_width; ++c) {
+        ASSERT_EQ(refs[i][1][r * uv_width + c],
+                  frames[i].u_buffer[r * frames[i].uv_stride + c])
+            << "client " << i << " restored again at " << c << "x" << r;
+      }
+    }
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    av1_cnn_remote_close(remotes[i]);
+    aom_free_frame_buffer(&frames[i]);
+    av1_cnn_remote_free_frame_buffer(&fbs[i]);
+  }
+  av1_cnn_server_stop(server);
+  remove(path.c_str());
+  av1_cnn_registry_free(&registry);
+}
+#endif  // CONFIG_CNN_REMOTE
+
+#if CONFIG_AV1_ENCODER && CONFIG_AV1_DECODER
+// Writes model as a float model file the way tools/cnn_model_converter does.
+static void WriteModelFile(const CnnModel *model, int qp, CNN_MODEL_ROLE role,
+                           const std::string &path) {
+  CnnModelFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CNN_MODEL_MAGIC;
+  hdr.version = CNN_MODEL_VERSION;
+  hdr.num_layers = model->num_layers;
+  hdr.kernel_size = CNN_KERNEL_SIZE;
+  hdr.out_block = CNN_OUT_BLOCK;
+  hdr.qp = qp;
+  hdr.role = role;
+  uint32_t offset = ALIGN_POWER_OF_TWO(sizeof(hdr), 6);
+  for (int l = 0; l < model->num_layers; ++l) {
+    const CnnLayer *const layer = &model->layers[l];
+    hdr.layers[l].in_channels = layer->in_channels;
+    hdr.layers[l].out_channels = layer->out_channels;
+    hdr.layers[l].bias_offset = offset;
+    offset += ALIGN_POWER_OF_TWO(layer->out_channels * sizeof(float), 6);
+    hdr.layers[l].weights_offset = offset;
+    offset += ALIGN_POWER_OF_TWO(CNN_KERNEL_TAPS * layer->in_channels *
+                                     layer->out_channels * sizeof(float),
+                                 6);
+  }
+  hdr.file_size = offset;
+
+  std::vector<uint8_t> data(offset);
+  memcpy(&data[0], &hdr, sizeof(hdr));
+  for (int l = 0; l < model->num_layers; ++l) {
+    const CnnLayer *const layer = &model->layers[l];
+    memcpy(&data[hdr.layers[l].bias_offset], layer->bias,
+           layer->out_channels * sizeof(float));
+    memcpy(&data[hdr.layers[l].weights_offset], layer->weights,
+           CNN_KERNEL_TAPS * layer->in_channels * layer->out_channels *
+               sizeof(float));
+  }
+  FILE *const file = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(file != NULL) << path;
+  EXPECT_EQ(1u, fwrite(&data[0], data.size(), 1, file));
+  ASSERT_EQ(0, fclose(file));
+}
+
+// Codes a short clip with a directory of random models and checks that the
+// decoder restores every frame exactly like the encoder did, with the frame
+// and row multithreading of the decoder as well as of the encoder.
+class CnnEncodeDecodeTest
+    : public ::libaom_test::CodecTestWith3Params<libaom_test::TestMode, int,
+                                                 int>,
+      public ::libaom_test::EncoderTest {
+ protected:
+  CnnEncodeDecodeTest()
+      : EncoderTest(GET_PARAM(0)), encoding_mode_(GET_PARAM(1)),
+        threads_(GET_PARAM(2)), row_mt_(GET_PARAM(3)), cnn_ran_(false) {}
+
+  virtual ~CnnEncodeDecodeTest() {}
+
+  virtual void SetUp() {
+    InitializeConfig();
+    SetMode(encoding_mode_);
+    cfg_.g_threads = threads_;
+    cfg_.g_lag_in_frames = 3;
+    cfg_.rc_end_usage = AOM_Q;
+    cfg_.rc_min_quantizer = 40;
+    cfg_.rc_max_quantizer = 40;
+
+    libaom_test::TempOutFile file;
+    model_dir_ = file.file_name() + "_models";
+#if defined(_WIN32)
+    ASSERT_EQ(0, _mkdir(model_dir_.c_str()));
+#else
+    ASSERT_EQ(0, mkdir(model_dir_.c_str(), 0700));
+#endif
+    const CNN_MODEL_ROLE roles[] = { CNN_ROLE_INTRA, CNN_ROLE_INTER,
+                                     CNN_ROLE_CHROMA_INTRA };
+    ACMRandom rnd(ACMRandom::DeterministicSeed());
+    for (size_t i = 0; i < NELEMENTS(roles); ++i) {
+      CnnModel model;
+      ASSERT_NO_FATAL_FAILURE(MakeRandomModel(3, 0.05f, &rnd, &model));
+      char name[32];
+      snprintf(name, sizeof(name), "/random_%d.bin", roles[i]);
+      model_files_.push_back(model_dir_ + name);
+      WriteModelFile(&model, 40, roles[i], model_files_.back());
+      av1_cnn_model_free(&model);
+      ASSERT_FALSE(HasFatalFailure());
+    }
+  }
+
+  virtual void TearDown() {
+    for (size_t i = 0; i < model_files_.size(); ++i)
+      remove(model_files_[i].c_str());
+#if defined(_WIN32)
+    _rmdir(model_dir_.c_str());
+#else
+    rmdir(model_dir_.c_str());
+#endif
+    libaom_test::ClearSystemState();
+  }
+
+  virtual void InitDecoderHook(aom_codec_dec_cfg_t *cfg) {
+    cfg->threads = threads_;
+  }
+
+  virtual void PreEncodeFrameHook(::libaom_test::VideoSource *video,
+                                  ::libaom_test::Encoder *encoder) {
+    if (video->frame() == 0) {
+      encoder->Control(AOME_SET_CPUUSED, 8);
+      encoder->Control(AOME_SET_CQ_LEVEL, 40);
+      // Two tile columns for the encoder threads to share.
+      encoder->Control(AV1E_SET_TILE_COLUMNS, 1);
+      encoder->Control(AV1E_SET_CNN_MODEL_DIR, model_dir_.c_str());
+    } else {
+      // The superblocks the last frame coded was restored on.
+      aom_cnn_mask_stats_t stats;
+      encoder->Control(AV1E_GET_CNN_MASK_STATS, &stats);
+      if (stats.active_sb_count > 0) cnn_ran_ = true;
+    }
+  }
+
+  virtual void PreDecodeFrameHook(::libaom_test::VideoSource * /*video*/,
+                                  ::libaom_test::Decoder *decoder) {
+    decoder->Control(AV1D_SET_ROW_MT, row_mt_);
+    decoder->Control(AV1D_SET_CNN_MODEL_DIR, model_dir_.c_str());
+  }
+
+  libaom_test::TestMode encoding_mode_;
+  int threads_;
+  int row_mt_;
+  std::string model_dir_;
+  std::vector<std::string> model_files_;
+  bool cnn_ran_;
+};
+
+TEST_P(CnnEncodeDecodeTest, DecoderMatchesEncoder) {
+  libaom_test::I420VideoSource video("hantro_collage_w352h288.yuv", 352, 288,
+                                     30, 1, 0, 3);
+  ASSERT_NO_FATAL_FAILURE(RunLoop(&video));
+  // The models must have run, or the test compares nothing of the CNN.
+  EXPECT_TRUE(cnn_ran_);
+}
+
+AV1_INSTANTIATE_TEST_CASE(CnnEncodeDecodeTest,
+                          ::testing::Values(::libaom_test::kOnePassGood),
+                          ::testing::Values(1, 4), ::testing::Values(0, 1));
+#endif  // CONFIG_AV1_ENCODER && CONFIG_AV1_DECODER
+
+}  // namespace
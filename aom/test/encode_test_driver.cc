@@ -177,6 +177,7 @@ void EncoderTest::MismatchHook(const aom_image_t *img_enc,
 void EncoderTest::RunLoop(VideoSource *video) {
   aom_codec_dec_cfg_t dec_cfg = aom_codec_dec_cfg_t();
   dec_cfg.allow_lowbitdepth = 1;
+  InitDecoderHook(&dec_cfg);
 
   stats_.Reset();
 
@@ -242,6 +243,7 @@ void EncoderTest::RunLoop(VideoSource *video) {
           case AOM_CODEC_CX_FRAME_PKT:
             has_cxdata = true;
             if (decoder.get() != NULL && DoDecode()) {
+              PreDecodeFrameHook(video, decoder.get());
               aom_codec_err_t res_dec;
               if (DoDecodeInvisible()) {
                 res_dec = decoder->DecodeFrame(
@@ -77,6 +77,7 @@ list(APPEND AOM_UNIT_TEST_ENCODER_SOURCES
 
 list(APPEND AOM_DECODE_PERF_TEST_SOURCES "${AOM_ROOT}/test/decode_perf_test.cc")
 list(APPEND AOM_ENCODE_PERF_TEST_SOURCES "${AOM_ROOT}/test/encode_perf_test.cc")
+list(APPEND AOM_CNN_PERF_TEST_SOURCES "${AOM_ROOT}/test/cnn_perf_test.cc")
 list(APPEND AOM_UNIT_TEST_WEBM_SOURCES "${AOM_ROOT}/test/webm_video_source.h")
 list(APPEND AOM_TEST_INTRA_PRED_SPEED_SOURCES "${AOM_CONFIG_DIR}/usage_exit.c"
             "${AOM_ROOT}/test/test_intra_pred_speed.cc")
@@ -103,6 +104,11 @@ if(NOT BUILD_SHARED_LIBS)
                 "${AOM_ROOT}/test/accounting_test.cc")
   endif()
 
+  if(CONFIG_CNN_RESTORATION)
+    list(APPEND AOM_UNIT_TEST_COMMON_SOURCES
+                "${AOM_ROOT}/test/cnn_restoration_test.cc")
+  endif()
+
   if(CONFIG_AV1_DECODER AND CONFIG_AV1_ENCODER)
     list(APPEND AOM_UNIT_TEST_COMMON_SOURCES
                 "${AOM_ROOT}/test/av1_ext_tile_test.cc"
@@ -289,6 +295,12 @@ function(setup_aom_test_targets)
       target_sources(test_libaom PRIVATE ${AOM_ENCODE_PERF_TEST_SOURCES})
     endif()
 
+    # The CNN is exercised through internal functions.
+    if(ENABLE_CNN_PERF_TESTS AND CONFIG_CNN_RESTORATION
+       AND NOT BUILD_SHARED_LIBS)
+      target_sources(test_libaom PRIVATE ${AOM_CNN_PERF_TEST_SOURCES})
+    endif()
+
     if(NOT BUILD_SHARED_LIBS)
       add_executable(test_intra_pred_speed ${AOM_TEST_INTRA_PRED_SPEED_SOURCES}
                      $<TARGET_OBJECTS:aom_common_app_util>)
@@ -401,6 +413,8 @@ function(setup_aom_test_targets)
             "${var}" MATCHES "_ENCODE_PERF_TEST_")
         OR (CONFIG_AV1_DECODER AND ENABLE_DECODE_PERF_TESTS AND
             "${var}" MATCHES "_DECODE_PERF_TEST_")
+        OR (CONFIG_CNN_RESTORATION AND ENABLE_CNN_PERF_TESTS AND
+            "${var}" MATCHES "_CNN_PERF_TEST_")
         OR (CONFIG_AV1_ENCODER AND "${var}" MATCHES "_TEST_ENCODER_")
         OR (CONFIG_AV1_DECODER AND  "${var}" MATCHES "_TEST_DECODER_"))
       list(APPEND aom_test_source_vars ${var})
@@ -42,5 +42,11 @@ expand_test_file_paths("AOM_TEST_FILE" "${AOM_TEST_DATA_URL}" "url")
 
 check_file("${filepath}" "${AOM_TEST_CHECKSUM}" "needs_download")
 if(needs_download)
-  download_test_file("${url}" "${AOM_TEST_CHECKSUM}" "${filepath}")
+  # Files the source tree ships, like the CNN checkpoints, are copied from it.
+  set(source_path "${AOM_ROOT}/../${AOM_TEST_FILE}")
+  if(EXISTS "${source_path}")
+    copy_test_file("${source_path}" "${AOM_TEST_CHECKSUM}" "${filepath}")
+  else()
+    download_test_file("${url}" "${AOM_TEST_CHECKSUM}" "${filepath}")
+  endif()
 endif()
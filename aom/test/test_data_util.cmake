@@ -497,6 +497,24 @@ if(CONFIG_AV1_DECODER)
               "av1-1-b8-02-allintra.ivf.md5")
 endif()
 
+if(CONFIG_CNN_RESTORATION)
+  # The checkpoints of MODELS/, which ship with the source tree next to aom/.
+  list(APPEND AOM_TEST_DATA_FILE_NAMES
+              "MODELS/qp27/VDSR15_qp27_I_set2K/VDSR15_qp27_I_set2K_394.ckpt.data-00000-of-00001"
+              "MODELS/qp32/VDSR15_qp32_B_set2319_noclip_v2/VDSR15_qp32_B_set2319_noclip_v2_300.ckpt.data-00000-of-00001"
+              "MODELS/qp32/VDSR15_qp32_I_set2K+2193/VDSR15_qp32_I_set2K+2193_473.ckpt.data-00000-of-00001"
+              "MODELS/qp37/VDSR20_qp37_B_set2038_noclip_v2/VDSR20_qp37_B_set2038_noclip_v2_356.ckpt.data-00000-of-00001"
+              "MODELS/qp37/VDSR20_qp37_I_set2K+2299/VDSR20_qp37_I_set2K+2299_593.ckpt.data-00000-of-00001"
+              "MODELS/qp42/VDSR25_qp42_B_set2161_noclip/VDSR25_qp42_B_set2161_noclip_151.ckpt.data-00000-of-00001"
+              "MODELS/qp42/VDSR25_qp42_I_2K+2193_av1/VDSR25_qp42_I_2K+2193_av1_372.ckpt.data-00000-of-00001"
+              "MODELS/qp47/VDSR25_qp47_B_set2184_noclip_v2/VDSR25_qp47_B_set2184_noclip_v2_419.ckpt.data-00000-of-00001"
+              "MODELS/qp47/VDSR25_qp47_I_set2K+2034_v2/VDSR25_qp47_I_set2K+2034_v2_582.ckpt.data-00000-of-00001"
+              "MODELS/qp52/VDSR25_qp52_B_set2299_noclip/VDSR25_qp52_B_set2299_noclip_252.ckpt.data-00000-of-00001"
+              "MODELS/qp52/VDSR25_qp52_I_set2K+2299_true/VDSR25_qp52_I_set2K+2299_true_364.ckpt.data-00000-of-00001"
+              "MODELS/qp52/VDSR30_qp52_B_set2299_noclip_v3/VDSR30_qp52_B_set2299_noclip_v3_416.ckpt.data-00000-of-00001"
+              "MODELS/qp52/VDSR30_qp52_I_set2K+2299_av1/VDSR30_qp52_I_set2K+2299_av1_394.ckpt.data-00000-of-00001")
+endif()
+
 if(ENABLE_ENCODE_PERF_TESTS AND CONFIG_AV1_ENCODER)
   list(APPEND AOM_TEST_DATA_FILE_NAMES "desktop_640_360_30.yuv"
               "kirland_640_480_30.yuv" "macmarcomoving_640_480_30.yuv"
@@ -570,6 +588,17 @@ function(check_file local_path expected_checksum out_needs_update)
   message("${local_path} up to date.")
 endfunction()
 
+# Copies $source_path, a file of the source tree, to $local_path and confirms
+# that $file_checksum matches.
+function(copy_test_file source_path file_checksum local_path)
+  message("Copying ${source_path} ...")
+  configure_file("${source_path}" "${local_path}" COPYONLY)
+  file(SHA1 "${local_path}" file_checksum_copied)
+  if(NOT "${file_checksum_copied}" STREQUAL "${file_checksum}")
+    message(FATAL_ERROR "Checksum mismatch for ${source_path}.")
+  endif()
+endfunction()
+
 # Downloads data from $file_url, confirms that $file_checksum matches, and
 # writes it to $local_path.
 function(download_test_file file_url file_checksum local_path)
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+// For sigwait() and pthread_sigmask() under -std=c99.
+#define _POSIX_C_SOURCE 200809L
+
+// This tool restores frames with the CNN for encoders running on the same
+// machine, which pass --cnn-server=<socket> to use it instead of loading the
+// models and running the network themselves (see av1/encoder/cnn_remote.h).
+// The tiles of all encoders share the threads of the server, so that several
+// encodes of one machine keep its cores busy without each of them holding
+// the models and a set of threads sized for the whole machine.
+//
+// Command line:
+//   ./cnn_inference_server --socket=<path> [--model-dir=<dir>]
+//       [--threads=<n>]
+//
+// The server runs until it is interrupted. The decoders of the streams still
+// restore with their own models, which have to be the same.
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "config/aom_config.h"
+
+#include "av1/common/cnn_restoration.h"
+#include "av1/encoder/cnn_remote.h"
+#include "common/args.h"
+#include "common/tools_common.h"
+
+static const char *exec_name;
+
+void usage_exit(void) {
+  fprintf(stderr,
+          "Usage: %s --socket=<path> [--model-dir=<dir>] [--threads=<n>]\n",
+          exec_name);
+  exit(EXIT_FAILURE);
+}
+
+static const arg_def_t help =
+    ARG_DEF(NULL, "help", 0, "Show usage options and exit");
+static const arg_def_t socket_arg =
+    ARG_DEF("s", "socket", 1, "Unix domain socket to listen at");
+static const arg_def_t model_dir_arg = ARG_DEF(
+    NULL, "model-dir", 1, "Directory of CNN model files (default: built-in)");
+static const arg_def_t threads_arg =
+    ARG_DEF("t", "threads", 1, "Number of threads (default: all cores)");
+
+typedef struct {
+  const char *socket;
+  const char *model_dir;
+  int threads;
+} server_args_t;
+
+static void parse_args(server_args_t *args, char **argv) {
+  struct arg arg;
+  static const arg_def_t *main_args[] = { &help, &socket_arg, &model_dir_arg,
+                                          &threads_arg, NULL };
+  for (; *argv; argv++) {
+    if (arg_match(&arg, &help, argv)) {
+      fprintf(stdout, "\nOptions:\n");
+      arg_show_usage(stdout, main_args);
+      exit(0);
+    } else if (arg_match(&arg, &socket_arg, argv)) {
+      args->socket = arg.val;
+    } else if (arg_match(&arg, &model_dir_arg, argv)) {
+      args->model_dir = arg.val;
+    } else if (arg_match(&arg, &threads_arg, argv)) {
+      args->threads = arg_parse_int(&arg);
+    } else {
+      fprintf(stdout, "Unknown arg: %s\n\nUsage:\n", *argv);
+      arg_show_usage(stdout, main_args);
+      exit(0);
+    }
+  }
+  if (!args->socket) usage_exit();
+}
+
+int main(int argc, char *argv[]) {
+  server_args_t args = { NULL, NULL, 0 };
+  exec_name = argv[0];
+  (void)argc;
+  parse_args(&args, argv + 1);
+  if (args.threads <= 0) args.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (args.threads <= 0) args.threads = 1;
+
+  static CnnModelRegistry models;
+  if (av1_cnn_registry_load(&models, args.model_dir) ||
+      models.num_models == 0) {
+    die("Failed to load CNN models from %s",
+        args.model_dir ? args.model_dir : "the default paths");
+  }
+
+  // The threads of the server inherit the blocked signals, which leaves them
+  // to sigwait() below.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  CnnServer *const server =
+      av1_cnn_server_start(args.socket, &models, args.threads);
+  if (server == NULL) die("Failed to listen at %s", args.socket);
+  fprintf(stderr, "Serving %d CNN models on %d threads at %s\n",
+          models.num_models, args.threads, args.socket);
+
+  int sig;
+  do {
+    if (sigwait(&signals, &sig)) sig = SIGTERM;
+  } while (sig == SIGPIPE);
+
+  av1_cnn_server_stop(server);
+  unlink(args.socket);
+  av1_cnn_registry_free(&models);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2019, Alliance for Open Media. All rights reserved
+ *
+ * This source code is subject to the terms of the BSD 2 Clause License and
+ * the Alliance for Open Media Patent License 1.0. If the BSD 2 Clause License
+ * was not distributed with this source code in the LICENSE file, you can
+ * obtain it at www.aomedia.org/license/software. If the Alliance for Open
+ * Media Patent License 1.0 was not distributed with this source code in the
+ * PATENTS file, you can obtain it at www.aomedia.org/license/patent.
+ */
+
+// This tool converts the TensorFlow checkpoints of the CNN restoration
+// networks into the flat binary model files the encoder maps at run time
+// (see CnnModelFileHeader in av1/common/cnn_restoration.h).
+//
+// Command line:
+//   ./cnn_model_converter [--qp=<qp>] [--role=<I|B|CI|CB>]
+//       [--calibrate=<input.y4m> [--calibrate-frames=<n>]]
+//       --input=<model.ckpt.data-00000-of-00001> --output=<model.bin>
+//
+// When --qp or --role are not given they are taken from the checkpoint path,
+// which follows the MODELS/qp52/VDSR25_qp52_B_*/ naming. The path cannot name
+// the chroma roles CI and CB, which have to be passed.
+//
+// With --calibrate the float network is run over the planes of the
+// given 8-bit clip to find the range of the activations of each layer, and
+// the file also carries the int8 parameters derived from them, which the
+// codec then runs instead of the float ones. The clip should be
+// reconstructed (decoded) video at the quantizer the model is meant for.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config/aom_config.h"
+
+#include "av1/common/cnn_restoration.h"
+#include "common/args.h"
+#include "common/tools_common.h"
+#include "common/y4minput.h"
+
+static const char *exec_name;
+
+void usage_exit(void) {
+  fprintf(stderr,
+          "Usage: %s [--qp=<qp>] [--role=<I|B|CI|CB>] [--calibrate=<y4m>] "
+          "--input=<checkpoint data> --output=<model file>\n",
+          exec_name);
+  exit(EXIT_FAILURE);
+}
+
+static const arg_def_t help =
+    ARG_DEF(NULL, "help", 0, "Show usage options and exit");
+static const arg_def_t input_arg =
+    ARG_DEF("i", "input", 1, "Checkpoint data shard (*.ckpt.data-*)");
+static const arg_def_t output_arg =
+    ARG_DEF("o", "output", 1, "Output model file");
+static const arg_def_t qp_arg =
+    ARG_DEF(NULL, "qp", 1, "QP bucket the model was trained for");
+static const arg_def_t role_arg =
+    ARG_DEF(NULL, "role", 1,
+            "Role: I (intra) or B (inter) luma, CI or CB for chroma");
+static const arg_def_t calibrate_arg = ARG_DEF(
+    NULL, "calibrate", 1, "Quantize to int8, calibrated on this y4m clip");
+static const arg_def_t calibrate_frames_arg =
+    ARG_DEF(NULL, "calibrate-frames", 1,
+            "Number of frames to calibrate on (default: all)");
+
+// Indexed by CNN_MODEL_ROLE.
+static const char *const role_names[] = { "I", "B", "CI", "CB" };
+
+typedef struct {
+  const char *input;
+  const char *output;
+  int qp;
+  int role;
+  const char *calibrate;
+  int calibrate_frames;
+} converter_args_t;
+
+static void parse_args(converter_args_t *args, char **argv) {
+  struct arg arg;
+  static const arg_def_t *main_args[] = { &help,
+                                          &input_arg,
+                                          &output_arg,
+                                          &qp_arg,
+                                          &role_arg,
+                                          &calibrate_arg,
+                                          &calibrate_frames_arg,
+                                          NULL };
+  for (; *argv; argv++) {
+    if (arg_match(&arg, &help, argv)) {
+      fprintf(stdout, "\nOptions:\n");
+      arg_show_usage(stdout, main_args);
+      exit(0);
+    } else if (arg_match(&arg, &input_arg, argv)) {
+      args->input = arg.val;
+    } else if (arg_match(&arg, &output_arg, argv)) {
+      args->output = arg.val;
+    } else if (arg_match(&arg, &qp_arg, argv)) {
+      args->qp = arg_parse_int(&arg);
+    } else if (arg_match(&arg, &role_arg, argv)) {
+      args->role = -1;
+      for (int role = 0; role < 4; ++role) {
+        if (!strcmp(arg.val, role_names[role])) args->role = role;
+      }
+      if (args->role < 0) die("Invalid role: %s", arg.val);
+    } else if (arg_match(&arg, &calibrate_arg, argv)) {
+      args->calibrate = arg.val;
+    } else if (arg_match(&arg, &calibrate_frames_arg, argv)) {
+      args->calibrate_frames = arg_parse_int(&arg);
+    } else {
+      fprintf(stdout, "Unknown arg: %s\n\nUsage:\n", *argv);
+      arg_show_usage(stdout, main_args);
+      exit(0);
+    }
+  }
+  if (!args->input || !args->output) usage_exit();
+}
+
+// Returns the number following the last "_qp" in path, or -1.
+static int qp_from_path(const char *path) {
+  const char *p = path;
+  const char *last = NULL;
+  while ((p = strstr(p, "_qp")) != NULL) last = p++;
+  return last ? atoi(last + 3) : -1;
+}
+
+// Returns the role named by the last "_I_" or "_B_" in path, or -1.
+static int role_from_path(const char *path) {
+  const char *const intra = strstr(path, "_I_");
+  const char *const inter = strstr(path, "_B_");
+  if (intra && (!inter || intra > inter)) return CNN_ROLE_INTRA;
+  if (inter) return CNN_ROLE_INTER;
+  return -1;
+}
+
+static uint32_t align_offset(uint32_t offset) {
+  return (offset + CNN_MODEL_ALIGN - 1) & ~(uint32_t)(CNN_MODEL_ALIGN - 1);
+}
+
+static void write_at(FILE *f, uint32_t offset, const void *data, size_t size) {
+  if (fseek(f, offset, SEEK_SET) != 0 || fwrite(data, 1, size, f) != size)
+    die("Failed to write model file.");
+}
+
+// Quantizes the model with the activation ranges seen on the planes the
+// model is meant for (luma, or both chroma planes) of up to max_frames frames
+// of the clip at path.
+static void calibrate_model(CnnModel *model, const char *path, int chroma,
+                            int max_frames) {
+  FILE *const f = fopen(path, "rb");
+  if (!f) die("Failed to open calibration clip: %s", path);
+  y4m_input y4m;
+  memset(&y4m, 0, sizeof(y4m));
+  if (y4m_input_open(&y4m, f, NULL, 0, 0) < 0)
+    die("Failed to parse calibration clip: %s", path);
+  if (y4m.bit_depth != 8) die("Calibration clip must be 8-bit.");
+
+  float act_max[CNN_MAX_LAYERS] = { 0 };
+  aom_image_t img;
+  int frames = 0;
+  while ((max_frames <= 0 || frames < max_frames) &&
+         y4m_input_fetch_frame(&y4m, f, &img) > 0) {
+    for (int plane = chroma ? AOM_PLANE_U : AOM_PLANE_Y;
+         plane <= (chroma ? AOM_PLANE_V : AOM_PLANE_Y); ++plane) {
+      const int ss_x = plane ? img.x_chroma_shift : 0;
+      const int ss_y = plane ? img.y_chroma_shift : 0;
+      if (av1_cnn_model_calibrate(model, img.planes[plane],
+                                  (img.d_w + ss_x) >> ss_x,
+                                  (img.d_h + ss_y) >> ss_y, img.stride[plane],
+                                  act_max))
+        die("Failed to allocate calibration buffers.");
+    }
+    ++frames;
+  }
+  y4m_input_close(&y4m);
+  fclose(f);
+  if (frames == 0) die("No frames in calibration clip: %s", path);
+  if (av1_cnn_model_quantize(model, act_max))
+    die("Failed to quantize the model.");
+}
+
+int main(int argc, char *argv[]) {
+  converter_args_t args = { NULL, NULL, -1, -1, NULL, 0 };
+  exec_name = argv[0];
+  (void)argc;
+  parse_args(&args, argv + 1);
+  const int quantize = args.calibrate != NULL;
+  if (args.qp < 0) args.qp = qp_from_path(args.input);
+  if (args.role < 0) args.role = role_from_path(args.input);
+  if (args.role < 0) die("Unable to tell the frame role, pass --role.");
+
+  CnnModel model;
+  if (av1_cnn_model_load_ckpt(&model, args.input))
+    die("Failed to load checkpoint %s", args.input);
+  if (quantize) {
+    calibrate_model(&model, args.calibrate, args.role >> 1,
+                    args.calibrate_frames);
+  }
+
+  CnnModelFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CNN_MODEL_MAGIC;
+  hdr.version = CNN_MODEL_VERSION;
+  hdr.num_layers = model.num_layers;
+  hdr.kernel_size = CNN_KERNEL_SIZE;
+  hdr.out_block = CNN_OUT_BLOCK;
+  hdr.qp = args.qp;
+  hdr.role = args.role;
+
+  uint32_t offset = align_offset(sizeof(hdr));
+  for (int l = 0; l < model.num_layers; ++l) {
+    const CnnLayer *const layer = &model.layers[l];
+    CnnModelFileLayer *const dst = &hdr.layers[l];
+    dst->in_channels = layer->in_channels;
+    dst->out_channels = layer->out_channels;
+    dst->bias_offset = offset;
+    offset = align_offset(offset + layer->out_channels * sizeof(float));
+    dst->weights_offset = offset;
+    offset = align_offset(offset + CNN_KERNEL_TAPS * layer->in_channels *
+                                       layer->out_channels * sizeof(float));
+  }
+  CnnModelFileQuantLayer qlayers[CNN_MAX_LAYERS];
+  if (quantize) {
+    hdr.quant_offset = offset;
+    offset = align_offset(offset + model.num_layers * sizeof(*qlayers));
+    for (int l = 0; l < model.num_layers; ++l) {
+      const CnnLayer *const layer = &model.layers[l];
+      CnnModelFileQuantLayer *const dst = &qlayers[l];
+      dst->weights_offset = offset;
+      offset = align_offset(offset + av1_cnn_int8_weight_count(
+                                         layer->in_channels,
+                                         layer->out_channels));
+      dst->bias_offset = offset;
+      offset = align_offset(offset + layer->out_channels * sizeof(int32_t));
+      dst->scale_offset = offset;
+      offset = align_offset(offset + layer->out_channels * sizeof(float));
+      dst->reserved = 0;
+    }
+  }
+  hdr.file_size = offset;
+
+  FILE *const f = fopen(args.output, "wb");
+  if (!f) die("Failed to open output file: %s", args.output);
+  // Zero-fill the whole file first so the alignment padding is defined.
+  const uint8_t zero = 0;
+  write_at(f, offset - 1, &zero, 1);
+  write_at(f, 0, &hdr, sizeof(hdr));
+  for (int l = 0; l < model.num_layers; ++l) {
+    const CnnLayer *const layer = &model.layers[l];
+    write_at(f, hdr.layers[l].bias_offset, layer->bias,
+             layer->out_channels * sizeof(float));
+    write_at(f, hdr.layers[l].weights_offset, layer->weights,
+             CNN_KERNEL_TAPS * layer->in_channels * layer->out_channels *
+                 sizeof(float));
+    if (!quantize) continue;
+    write_at(f, qlayers[l].weights_offset, layer->qweights,
+             av1_cnn_int8_weight_count(layer->in_channels,
+                                       layer->out_channels));
+    write_at(f, qlayers[l].bias_offset, layer->qbias,
+             layer->out_channels * sizeof(int32_t));
+    write_at(f, qlayers[l].scale_offset, layer->qscale,
+             layer->out_channels * sizeof(float));
+  }
+  if (quantize) {
+    write_at(f, hdr.quant_offset, qlayers,
+             model.num_layers * sizeof(*qlayers));
+  }
+  fclose(f);
+
+  printf("%s: VDSR%d, qp %d, role %s, %s, %u bytes\n", args.output,
+         model.num_layers, args.qp, role_names[args.role],
+         quantize ? "int8" : "float", hdr.file_size);
+  av1_cnn_model_free(&model);
+  return EXIT_SUCCESS;
+}